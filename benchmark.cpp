@@ -3,25 +3,59 @@ Copyright 2020. Siwei Wang.
 
 Unit and performance tests for Trie.
 */
+#include <sys/wait.h>
+#include <unistd.h>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <random>
 #include <set>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
+#include "compressed_trie.h"
+#include "dawg.h"
+#include "dictionary.h"
+#include "durable_trie.h"
+#include "front_coded.h"
+#include "hat_trie.h"
+#include "lsm_trie.h"
+#include "paged_trie.h"
+#include "range_filter.h"
+#include "shared_trie.h"
+#include "successor.h"
 #include "trie.h"
+#include "trie_handle.h"
+#include "trie_image.h"
 
 using std::cout;
 using std::endl;
+using std::equal;
 using std::function;
 using std::ifstream;
 using std::is_same;
 using std::mismatch;
+using std::out_of_range;
 using std::runtime_error;
 using std::set;
 using std::string;
+using std::stringstream;
 using std::vector;
 using std::chrono::duration_cast;
 using std::chrono::high_resolution_clock;
@@ -33,9 +67,32 @@ bool is_prefix(const string& prf, const string& word);
 
 vector<string> read_words(const string& perf_word_list, size_t num_perf_words);
 
+size_t heap_bytes();
+
 void print_duration(time_point<high_resolution_clock, nanoseconds> start,
                     time_point<high_resolution_clock, nanoseconds> finish);
 
+// Counts the bytes taken from the heap through it.
+class CountingResource : public std::pmr::memory_resource {
+ public:
+  size_t in_use = 0;
+  size_t allocations = 0;
+
+ private:
+  void* do_allocate(size_t bytes, size_t align) override {
+    in_use += bytes;
+    ++allocations;
+    return std::pmr::new_delete_resource()->allocate(bytes, align);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t align) override {
+    in_use -= bytes;
+    std::pmr::new_delete_resource()->deallocate(p, bytes, align);
+  }
+  bool do_is_equal(const memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
 namespace Unit_Test {
 bool Empty_Test();
 bool Find_Test();
@@ -45,6 +102,31 @@ bool Iteration_Test();
 bool Copy_Test();
 bool Comparison_Test();
 bool Arithmetic_Test();
+bool Dawg_Test();
+bool Dictionary_Test();
+bool FrontCoded_Test();
+bool HatTrie_Test();
+bool CompressedTrie_Test();
+bool RangeFilter_Test();
+bool BloomFilter_Test();
+bool HashIndex_Test();
+bool Serialization_Test();
+bool TrieImage_Test();
+bool SharedTrie_Test();
+bool DurableTrie_Test();
+bool Checkpoint_Test();
+bool PagedTrie_Test();
+bool LsmTrie_Test();
+bool TrieHandle_Test();
+bool Reclaim_Test();
+bool Split_Test();
+bool EraseRange_Test();
+bool Compact_Test();
+bool ImageLayout_Test();
+bool Pool_Test();
+bool Path_Test();
+bool Resource_Test();
+bool Budget_Test();
 }  // namespace Unit_Test
 
 namespace Perf_Test {
@@ -67,6 +149,74 @@ void Erase_Test(Trie words, string prefix);
 // Iteration speed test.
 template <typename Container>
 void Iterate_Test(const Container& words);
+
+// DAWG minimization test.
+void Dawg_Test(const Trie& words);
+
+// Dictionary encoding test.
+void Dictionary_Test(const Trie& words, const vector<string>& word_list);
+
+// Front coded storage test.
+void FrontCoded_Test(const Trie& words, const vector<string>& word_list);
+
+// High entropy key test.
+void HatTrie_Test(size_t num_keys);
+
+// Order-preserving key compression test.
+void CompressedTrie_Test(const vector<string>& word_list, size_t num_keys);
+
+// Range filter test.
+void RangeFilter_Test(const Trie& words, const vector<string>& word_list);
+
+// Negative lookup filter test.
+void BloomFilter_Test(Trie words, const vector<string>& word_list);
+
+// Exact match index test.
+void HashIndex_Test(const Trie& words, const vector<string>& word_list);
+
+// Binary save and load test.
+void Serialization_Test(const Trie& words);
+
+// Memory mapped image test.
+void TrieImage_Test(const Trie& words, const vector<string>& word_list);
+
+// Shared memory test with forked readers.
+void SharedTrie_Test(const Trie& words, const vector<string>& word_list,
+                     size_t num_readers);
+
+// Write-ahead log and recovery test.
+void DurableTrie_Test(const vector<string>& word_list);
+
+// Disk resident paged trie test with a small buffer pool.
+void PagedTrie_Test(const Trie& words, const vector<string>& word_list);
+
+// Log structured merge ingestion test.
+void LsmTrie_Test(const Trie& words, const vector<string>& word_list);
+
+// Hot swap of a rebuilt trie under reader threads.
+void TrieHandle_Test(const Trie& words, const vector<string>& word_list,
+                     size_t num_readers);
+
+// Moving prefix and key ranges between tries.
+void Split_Test(Trie words);
+
+// Range deletion against erasing each key.
+void EraseRange_Test(const Trie& words, const string& lo, const string& hi);
+
+// Lookup and iteration before and after compacting a churned trie.
+void Compact_Test(const vector<string>& word_list);
+
+// Lookups in pre-order and van Emde Boas images against the pointer trie.
+void ImageLayout_Test(size_t num_keys);
+
+// Heap bytes per key of the node pool, and moving subtrees within it.
+void Pool_Test(const vector<string>& word_list);
+
+// Small scratch tries per query on the global heap and on memory resources.
+void Resource_Test(const vector<string>& word_list, size_t keys_per_query);
+
+// Memory breakdown, reserved inserts, and inserts up to a memory limit.
+void Budget_Test(const vector<string>& word_list);
 }  // namespace Perf_Test
 
 int main() {
@@ -74,7 +224,20 @@ int main() {
       Unit_Test::Empty_Test,      Unit_Test::Find_Test,
       Unit_Test::Insert_Test,     Unit_Test::Erase_Test,
       Unit_Test::Iteration_Test,  Unit_Test::Copy_Test,
-      Unit_Test::Comparison_Test, Unit_Test::Arithmetic_Test};
+      Unit_Test::Comparison_Test, Unit_Test::Arithmetic_Test,
+      Unit_Test::Dawg_Test,       Unit_Test::Dictionary_Test,
+      Unit_Test::FrontCoded_Test, Unit_Test::HatTrie_Test,
+      Unit_Test::CompressedTrie_Test, Unit_Test::RangeFilter_Test,
+      Unit_Test::BloomFilter_Test,    Unit_Test::HashIndex_Test,
+      Unit_Test::Serialization_Test,  Unit_Test::TrieImage_Test,
+      Unit_Test::SharedTrie_Test,     Unit_Test::DurableTrie_Test,
+      Unit_Test::Checkpoint_Test,     Unit_Test::PagedTrie_Test,
+      Unit_Test::LsmTrie_Test,        Unit_Test::TrieHandle_Test,
+      Unit_Test::Reclaim_Test,        Unit_Test::Split_Test,
+      Unit_Test::EraseRange_Test,     Unit_Test::Compact_Test,
+      Unit_Test::ImageLayout_Test,    Unit_Test::Pool_Test,
+      Unit_Test::Path_Test,           Unit_Test::Resource_Test,
+      Unit_Test::Budget_Test};
 
   cout << "--- EXECUTING UNIT TESTS ---\n";
   __uint16_t passed = 0;
@@ -120,6 +283,88 @@ int main() {
   // Iteration perf
   Perf_Test::Iterate_Test(word_set);
   Perf_Test::Iterate_Test(word_trie);
+  cout << '\n';
+
+  // Minimization perf
+  Perf_Test::Dawg_Test(word_trie);
+  Perf_Test::Dictionary_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Cold storage perf
+  Perf_Test::FrontCoded_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Burst trie perf
+  Perf_Test::HatTrie_Test(200000);
+  cout << '\n';
+
+  // Key compression perf
+  Perf_Test::CompressedTrie_Test(master_list, 200000);
+  cout << '\n';
+
+  // Range filter perf
+  Perf_Test::RangeFilter_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Negative lookup perf
+  Perf_Test::BloomFilter_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Exact match index perf
+  Perf_Test::HashIndex_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Persistence perf
+  Perf_Test::Serialization_Test(word_trie);
+  Perf_Test::TrieImage_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Shared memory perf
+  Perf_Test::SharedTrie_Test(word_trie, master_list, 4);
+  cout << '\n';
+
+  // Durability perf
+  Perf_Test::DurableTrie_Test(master_list);
+  cout << '\n';
+
+  // Out of core perf
+  Perf_Test::PagedTrie_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Write heavy ingestion perf
+  Perf_Test::LsmTrie_Test(word_trie, master_list);
+  cout << '\n';
+
+  // Hot swap perf
+  Perf_Test::TrieHandle_Test(word_trie, master_list, 4);
+  cout << '\n';
+
+  // Shard rebalancing perf
+  Perf_Test::Split_Test(word_trie);
+  cout << '\n';
+
+  // Range deletion perf
+  Perf_Test::EraseRange_Test(word_trie, "ma", "pr");
+  cout << '\n';
+
+  // Relayout perf
+  Perf_Test::Compact_Test(master_list);
+  cout << '\n';
+
+  // Image layout perf
+  Perf_Test::ImageLayout_Test(1000000);
+  cout << '\n';
+
+  // Node pool perf
+  Perf_Test::Pool_Test(master_list);
+  cout << '\n';
+
+  // Memory resource perf
+  Perf_Test::Resource_Test(master_list, 32);
+  cout << '\n';
+
+  // Memory budget perf
+  Perf_Test::Budget_Test(master_list);
 
   cout << "--- FINISHED PERFORMANCE TEST ---\n" << endl;
 
@@ -156,6 +401,15 @@ vector<string> read_words(const string& perf_word_list, size_t num_perf_words) {
   return master_list;
 }
 
+size_t heap_bytes() {
+#ifdef __GLIBC__
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
 void print_duration(time_point<high_resolution_clock, nanoseconds> start,
                     time_point<high_resolution_clock, nanoseconds> finish) {
   cout << "Duration: " << duration_cast<time_unit>(finish - start).count()
@@ -199,6 +453,14 @@ bool Unit_Test::Find_Test() {
   auto missing_prf_iter = tr.find("conk");
   if (missing_prf_iter != tr.end()) return false;
 
+  // Nodes where keys only branch hold no key, so exact finds of them miss.
+  if (tr.find("co") != tr.end() || tr.find("conta") != tr.end() ||
+      tr.find("ma") != tr.end() || tr.find("") != tr.end())
+    return false;
+  auto branch_prf_iter = tr.find("conta", Trie::PREFIX_FLAG);
+  if (branch_prf_iter == tr.end() || *branch_prf_iter != "contain")
+    return false;
+
   return true;
 }
 
@@ -306,6 +568,22 @@ bool Unit_Test::Iteration_Test() {
   if (tr.begin("cops") != tr.end()) return false;
   if (*tr.end("cops") != "corn") return false;
 
+  // Ranges end at the first key above every string with the prefix, also
+  // when the prefix ends inside the last label of a node or diverges from a
+  // label after its first character.
+  const Trie edges{"pre", "prefix", "prezzo", "zebra"};
+  const set<string> keys(edges.begin(), edges.end());
+  for (const string prefix : {"prez", "prezb", "prezz", "prezzo", "prezzz",
+                              "pre", "prf", "p", "a", "zebras", "zz"}) {
+    string bound = prefix;
+    const auto expected =
+        prefix_successor(bound) ? keys.lower_bound(bound) : keys.end();
+    const auto finish = edges.end(prefix);
+    if (expected == keys.end() ? finish != edges.end()
+                               : finish == edges.end() || *finish != *expected)
+      return false;
+  }
+
   return true;
 }
 
@@ -366,141 +644,2648 @@ bool Unit_Test::Arithmetic_Test() {
   return true;
 }
 
-template <class Container>
-Container Perf_Test::get_words(const vector<string>& word_list) {
-  // Make announcement.
-  if (is_same<Container, set<string>>::value) {
-    cout << "Set insertion...\n";
-  } else if (is_same<Container, Trie>::value) {
-    cout << "Trie insertion...\n";
-  } else {
-    throw runtime_error("Container must be either set<string> or Trie.");
+bool Unit_Test::Dawg_Test() {
+  cout << "Dawg test";
+
+  const Trie tr{"mahogany", "mahjong",     "compute", "computer", "matrix",
+                "math",     "contaminate", "corn",    "corner",   "material",
+                "mat",      "maternal",    "contain", "walking",  "talking"};
+  const Dawg dg(tr);
+
+  if (dg.size() != tr.size()) return false;
+  if (!equal(tr.begin(), tr.end(), dg.begin(), dg.end())) return false;
+
+  // Membership is preserved.
+  for (const auto& key : tr) {
+    if (!dg.contains(key)) return false;
   }
+  if (dg.contains("ma") || dg.contains("cornered") || dg.contains(""))
+    return false;
 
-  // Time insertion with range constructor.
-  auto start = high_resolution_clock::now();
-  Container words(word_list.begin(), word_list.end());
-  auto finish = high_resolution_clock::now();
-  print_duration(start, finish);
-  return words;
+  // Ranks match positions in alphabetical order, even for absent keys.
+  if (dg.rank("compute") != 0 || dg.rank("corn") != 4) return false;
+  if (dg.rank("mat") != 8 || dg.rank("matz") != 13) return false;
+  if (dg.rank("a") != 0 || dg.rank("zebra") != 15) return false;
+  bool found = false;
+  if (dg.rank("math", found) != 11 || !found) return false;
+  if (dg.rank("mate", found) != 9 || found) return false;
+  if (dg.rank("corners", found) != 6 || found) return false;
+
+  // The "alking" suffix of walking and talking is shared.
+  return dg.stats().dawg_nodes < dg.stats().trie_nodes;
 }
 
-void Perf_Test::Count_Test(const set<string>& words) {
-  cout << "Set count...\n";
+bool Unit_Test::Dictionary_Test() {
+  cout << "Dictionary test";
 
-  auto start = high_resolution_clock::now();
-  // Get starting iterators on each character.
-  vector<set<string>::iterator> bounds;
-  for (char c = 'a'; c <= 'z'; ++c) {
-    bounds.push_back(lower_bound(words.begin(), words.end(), string(1, c)));
-  }
-  bounds.push_back(words.end());
-  cout << "\tPrinting subset sizes: ";
-  for (size_t i = 0; i < bounds.size() - 1; ++i) {
-    cout << distance(bounds[i], bounds[i + 1]) << ' ';
+  const Trie tr{"mahogany", "mahjong",     "compute", "computer", "matrix",
+                "math",     "contaminate", "corn",    "corner",   "material",
+                "mat",      "maternal",    "contain"};
+  const Dictionary dict(tr);
+  if (dict.size() != tr.size()) return false;
+
+  // Ids are dense alphabetical ranks in both directions.
+  Dictionary::id_type id = 0;
+  for (const auto& key : tr) {
+    if (dict.id_of(key) != id || dict.key_of(id) != key) return false;
+    ++id;
   }
-  auto finish = high_resolution_clock::now();
 
-  cout << endl;
-  print_duration(start, finish);
+  // Batch conversion round trips.
+  const vector<string> column{"math", "corn", "math", "compute"};
+  const auto ids = dict.encode(column);
+  if (ids != vector<Dictionary::id_type>{11, 4, 11, 0}) return false;
+  if (dict.decode(ids) != column) return false;
+
+  // Range predicates translate to id ranges.
+  if (dict.lower_bound("mat") != 8 || dict.lower_bound("mau") != 13)
+    return false;
+
+  // Missing keys and ids are rejected.
+  if (dict.contains("ma")) return false;
+  try {
+    dict.id_of("ma");
+    return false;
+  } catch (const out_of_range&) {
+  }
+  try {
+    dict.key_of(13);
+    return false;
+  } catch (const out_of_range&) {
+  }
+  return true;
 }
 
-void Perf_Test::Count_Test(const Trie& words) {
-  cout << "Trie count...\n";
+bool Unit_Test::FrontCoded_Test() {
+  cout << "Front coded test";
 
-  auto start = high_resolution_clock::now();
-  cout << "\tPrinting subset sizes: ";
+  // Enough keys to span several blocks.
+  Trie tr{"mahogany", "mahjong",     "compute", "computer", "matrix",
+          "math",     "contaminate", "corn",    "corner",   "material",
+          "mat",      "maternal",    "contain"};
   for (char c = 'a'; c <= 'z'; ++c) {
-    cout << words.size(string(1, c)) << ' ';
+    tr.insert(string("re") + c);
+    tr.insert(string("pre") + c + c);
   }
-  auto finish = high_resolution_clock::now();
+  const FrontCoded fc(tr, FrontCoded::MIN_BLOCK_SIZE);
 
-  cout << endl;
-  print_duration(start, finish);
+  if (fc.size() != tr.size()) return false;
+  if (!equal(tr.begin(), tr.end(), fc.begin(), fc.end())) return false;
+  if (fc.to_trie() != tr) return false;
+
+  for (const auto& key : tr) {
+    auto iter = fc.find(key);
+    if (iter == fc.end() || *iter != key) return false;
+  }
+  if (fc.find("ma") != fc.end() || fc.find("zzz") != fc.end()) return false;
+  if (fc.find("") != fc.end()) return false;
+
+  // Prefix ranges agree with the trie.
+  for (const string prefix : {"ma", "mate", "pre", "prez", "re", ""}) {
+    if (!equal(tr.begin(prefix), tr.end(prefix), fc.begin(prefix),
+               fc.end(prefix)))
+      return false;
+  }
+  if (fc.begin("cops") != fc.end("cops") || *fc.end("cops") != "corn")
+    return false;
+
+  try {
+    FrontCoded bad(tr, FrontCoded::MAX_BLOCK_SIZE + 1);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  return true;
 }
 
-void Perf_Test::Find_Test(const set<string>& words, string prefix) {
-  cout << "Set find...\n";
+bool Unit_Test::HatTrie_Test() {
+  cout << "HAT-trie test";
 
-  auto t0 = high_resolution_clock::now();
+  const vector<string> words{"compute", "computer", "contain",  "contaminate",
+                             "corn",    "corner",   "mahjong",  "mahogany",
+                             "mat",     "material", "maternal", "math",
+                             "matrix",  "",         "c"};
+  // A tiny burst threshold forces several levels of radix nodes.
+  HatTrie tr(2);
+  for (const auto& key : words) {
+    auto iter = tr.insert(key);
+    if (iter == tr.end() || *iter != key) return false;
+  }
+  const Trie expected(words.begin(), words.end());
 
-  auto start = lower_bound(words.begin(), words.end(), prefix);
-  auto finish = start;
-  while (finish != words.end() && is_prefix(prefix, *finish)) {
-    ++finish;
+  if (tr.size() != expected.size()) return false;
+  if (!equal(expected.begin(), expected.end(), tr.begin(), tr.end()))
+    return false;
+  for (const string prefix : {"co", "ma", "mate", "c", "con"}) {
+    if (tr.size(prefix) != expected.size(prefix)) return false;
+    if (!equal(expected.begin(prefix), expected.end(prefix), tr.begin(prefix),
+               tr.end(prefix)))
+      return false;
   }
+  if (!tr.empty("cops") || tr.begin("cops") != tr.end()) return false;
+  if (*tr.end("cops") != "corn") return false;
 
-  auto t1 = high_resolution_clock::now();
-  cout << "Prefix " << prefix << " starts at " << *start << " and ends at "
-       << *finish << endl;
-  print_duration(t0, t1);
+  // Iterators from exact finds resolve their position when incremented.
+  auto iter = tr.find("mat");
+  if (iter == tr.end() || *++iter != "material") return false;
+  if (tr.find("mate") != tr.end()) return false;
+  if (*tr.find("mate", HatTrie::PREFIX_FLAG) != "material") return false;
+
+  HatTrie copied(tr);
+  copied.erase("mat");
+  copied.erase("con", HatTrie::PREFIX_FLAG);
+  if (copied.size() != 12 || tr.size() != 15) return false;
+  if (copied.find("mat") || copied.find("contain")) return false;
+  if (copied.size("co") != 4 || copied.size("ma") != 6) return false;
+
+  copied.erase("", HatTrie::PREFIX_FLAG);
+  if (!copied.empty() || copied.begin() != copied.end()) return false;
+
+  // One large bucket grows its slots and keeps its order through erases.
+  std::mt19937_64 gen(0);
+  HatTrie big(4096);
+  set<string> model;
+  for (size_t i = 0; i < 3000; ++i) {
+    const string key = std::to_string(gen() % 2000);
+    if (gen() % 4 == 0) {
+      big.erase(key);
+      model.erase(key);
+    } else {
+      big.insert(key);
+      model.insert(key);
+    }
+  }
+  big.erase("1", HatTrie::PREFIX_FLAG);
+  for (auto it = model.begin(); it != model.end();)
+    it = it->front() == '1' ? model.erase(it) : std::next(it);
+  const auto twos = std::count_if(model.begin(), model.end(), [](auto& key) {
+    return key.front() == '2';
+  });
+  if (big.size() != model.size() || big.size("2") != size_t(twos) ||
+      !equal(model.begin(), model.end(), big.begin(), big.end()))
+    return false;
+  if (*big.lower_bound("55") != *model.lower_bound("55")) return false;
+
+  // Ordered traversals only read, so they may share a const trie.
+  const HatTrie& shared = big;
+  std::atomic<bool> agreed(true);
+  vector<std::thread> readers;
+  for (int t = 0; t < 4; ++t) {
+    readers.emplace_back([&]() {
+      if (!equal(model.begin(), model.end(), shared.begin(), shared.end()))
+        agreed = false;
+    });
+  }
+  for (auto& reader : readers) reader.join();
+  return agreed;
 }
 
-void Perf_Test::Find_Test(const Trie& words, string prefix) {
-  cout << "Trie find...\n";
+bool Unit_Test::CompressedTrie_Test() {
+  cout << "Compressed trie test";
+
+  const vector<string> words{
+      "http://www.example.com/index.html", "http://www.example.com/about.html",
+      "http://www.example.org/index.html", "https://www.example.com/",
+      "https://www.example.com/index.html", "https://mail.example.com/",
+      "http://www.test.com/", "ftp://files.example.com/pub", "http", "h",
+      ""};
+  const KeyEncoder enc(words, 32);
+
+  // Encoding preserves order and round trips for every pair of keys.
+  for (const auto& lhs : words) {
+    if (enc.decode(enc.encode(lhs)) != lhs) return false;
+    for (const auto& rhs : words) {
+      if ((lhs < rhs) != (enc.encode(lhs) < enc.encode(rhs))) return false;
+    }
+  }
+  // Including keys made of bytes the sample never saw.
+  const string unseen{'\0', '\xff', 'z', '\x7f'};
+  if (enc.decode(enc.encode(unseen)) != unseen) return false;
+  if (!(enc.encode(unseen) < enc.encode("ftp://"))) return false;
 
-  auto t0 = high_resolution_clock::now();
+  CompressedTrie tr(words, 32);
+  for (const auto& key : words) {
+    auto iter = tr.insert(key);
+    if (!iter || *iter != key) return false;
+  }
+  const Trie expected(words.begin(), words.end());
+  if (tr.size() != expected.size()) return false;
+  if (!equal(expected.begin(), expected.end(), tr.begin(), tr.end()))
+    return false;
+  for (const string prefix : {"http://www.example.", "https", "http", "f",
+                              "http://www.test.com/", "h"}) {
+    if (tr.size(prefix) != expected.size(prefix)) return false;
+    if (!equal(expected.begin(prefix), expected.end(prefix), tr.begin(prefix),
+               tr.end(prefix)))
+      return false;
+    if (*tr.find(prefix, CompressedTrie::PREFIX_FLAG) !=
+        *expected.find(prefix, Trie::PREFIX_FLAG))
+      return false;
+  }
+  if (!tr.empty("gopher") || tr.begin("gopher") || tr.end("gopher"))
+    return false;
+  if (tr.find("http://www.example.com/") || !tr.find("http")) return false;
 
-  auto start = words.begin(prefix);
-  auto finish = words.end(prefix);
+  tr.erase("http://www.example.", CompressedTrie::PREFIX_FLAG);
+  tr.erase("h");
+  if (tr.size() != expected.size() - 4 || tr.size("http") != 5) return false;
+  tr.clear();
+  return tr.empty() && tr.begin() == tr.end();
+}
 
-  auto t1 = high_resolution_clock::now();
-  cout << "Prefix " << prefix << " starts at " << *start << " and ends at "
-       << *finish << endl;
-  print_duration(t0, t1);
+bool Unit_Test::RangeFilter_Test() {
+  cout << "Range filter test";
+
+  const Trie tr{"mahogany", "mahjong", "compute",  "computer", "matrix",
+                "math",     "corn",    "corner",   "material", "mat",
+                "maternal", "contain", "contaminate"};
+  const vector<string> bounds{"",      "c",     "co",    "com",  "comq",
+                              "cops",  "corn",  "corna", "d",    "ma",
+                              "mah",   "mat",   "mate",  "math", "mats",
+                              "matz",  "mb",    "zzz",   "comp", "computes"};
+  // Every level dense and none give the same guarantees.
+  for (const size_t ratio : {size_t{0}, size_t{1000}}) {
+    for (const auto& bits : vector<std::pair<size_t, size_t>>{
+             {0, 0}, {3, 0}, {8, 0}, {64, 0}, {0, 8}, {5, 7}}) {
+      const RangeFilter filter =
+          build_filter(tr, bits.first, bits.second, ratio);
+      if (filter.size() != tr.size()) return false;
+      if ((filter.num_dense_levels() == 0) != (ratio > 0)) return false;
+      // No false negatives.
+      for (const auto& key : tr) {
+        if (!filter.may_contain(key)) return false;
+      }
+      for (const auto& lo : bounds) {
+        for (const auto& hi : bounds) {
+          const auto first = tr.lower_bound(lo);
+          const bool present =
+              lo < hi && first && *Trie::iterator(first) < hi;
+          if (present && !filter.may_contain_range(lo, hi)) return false;
+        }
+      }
+    }
+
+    // With long suffixes, the filter is exact for these short keys.
+    const RangeFilter exact =
+        build_filter(tr, RangeFilter::MAX_SUFFIX_BITS, 0, ratio);
+    for (const auto& key : bounds) {
+      if (exact.may_contain(key) != static_cast<bool>(tr.find(key)))
+        return false;
+    }
+    if (exact.may_contain_range("cops", "corm") ||
+        exact.may_contain_range("mats", "mb") ||
+        !exact.may_contain_range("cops", "corna"))
+      return false;
+    // Hash bits reject keys that extend a truncated key.
+    if (!build_filter(tr, 8, 0, ratio).may_contain("matrixes") ||
+        build_filter(tr, 0, 32, ratio).may_contain("matrixes"))
+      return false;
+  }
+
+  // A larger trie gets dense upper levels above sparse ones, and ranges that
+  // cross from one to the other.
+  std::mt19937 gen(5);
+  Trie random_keys;
+  for (size_t i = 0; i < 3000; ++i) {
+    string key;
+    for (size_t len = gen() % 9; len > 0; --len) key += "abcdefgh"[gen() % 8];
+    random_keys.insert(key);
+  }
+  const RangeFilter mixed = build_filter(random_keys, 4, 4, 1);
+  if (mixed.num_dense_levels() == 0 || mixed.num_dense_levels() > 3)
+    return false;
+  for (const auto& key : random_keys) {
+    if (!mixed.may_contain(key)) return false;
+  }
+  for (size_t i = 0; i < 3000; ++i) {
+    string lo;
+    for (size_t len = gen() % 6; len > 0; --len) lo += "abcdefghi"[gen() % 9];
+    string hi = lo + "c";
+    if (!lo.empty() && gen() % 2 == 0) ++hi[gen() % lo.length()];
+    const auto first = random_keys.lower_bound(lo);
+    if (first && *Trie::iterator(first) < hi &&
+        !mixed.may_contain_range(lo, hi))
+      return false;
+  }
+
+  if (build_filter(Trie(), 8).may_contain_range("", "zzz")) return false;
+  try {
+    build_filter(tr, RangeFilter::MAX_SUFFIX_BITS, 1);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  return true;
 }
 
-void Perf_Test::Erase_Test(set<string> words, string prefix) {
-  cout << "Set deletion...\n";
+bool Unit_Test::BloomFilter_Test() {
+  cout << "Bloom filter test";
+
+  const vector<string> words{"mahogany", "mahjong",  "compute",  "computer",
+                             "matrix",   "math",     "corn",     "corner",
+                             "material", "mat",      "maternal", "contain",
+                             "contaminate"};
+  const vector<string> probes{"",     "c",     "co",    "comp", "computers",
+                              "corn", "mat",   "mate",  "maz",  "matrices",
+                              "zzz",  "mahjo", "mahjongg"};
+  const Trie plain(words.begin(), words.end());
+  Trie tr(words.begin(), words.end());
+  tr.enable_filter(10, 3);
+  if (!tr.has_filter()) return false;
+
+  // Results never change, whatever the filter says.
+  const auto agrees = [&probes](const Trie& lhs, const Trie& rhs) {
+    for (const auto& key : probes) {
+      if (static_cast<bool>(lhs.find(key)) != static_cast<bool>(rhs.find(key)))
+        return false;
+      if (lhs.empty(key) != rhs.empty(key) || lhs.size(key) != rhs.size(key))
+        return false;
+      auto lhs_iter = lhs.find(key, Trie::PREFIX_FLAG);
+      auto rhs_iter = rhs.find(key, Trie::PREFIX_FLAG);
+      if (static_cast<bool>(lhs_iter) != static_cast<bool>(rhs_iter) ||
+          (lhs_iter && *lhs_iter != *rhs_iter))
+        return false;
+    }
+    return true;
+  };
+  if (!agrees(tr, plain)) return false;
+  auto stats = tr.filter_stats();
+  if (stats.lookups == 0 || stats.negatives == 0) return false;
+  if (stats.negatives + stats.false_positives > stats.lookups) return false;
+
+  // Const lookups from several threads only read the filter, and every one
+  // of them is counted.
+  const size_t before = tr.filter_stats().lookups;
+  vector<std::thread> readers;
+  for (size_t t = 0; t < 4; ++t) {
+    readers.emplace_back([&tr, &probes]() {
+      for (size_t round = 0; round < 1000; ++round) {
+        for (const auto& key : probes) tr.find(key);
+      }
+    });
+  }
+  for (auto& reader : readers) reader.join();
+  if (tr.filter_stats().lookups != before + 4 * 1000 * probes.size() ||
+      tr.filter_stats().rebuilds != 0)
+    return false;
 
-  auto t0 = high_resolution_clock::now();
+  // The prefix erase rebuilds the filter itself, and erased keys stay
+  // correct.
+  Trie copied(tr);
+  Trie expected(plain);
+  copied.erase("ma", Trie::PREFIX_FLAG);
+  if (copied.filter_stats().rebuilds != 1) return false;
+  expected.erase("ma", Trie::PREFIX_FLAG);
+  copied.erase("corn");
+  expected.erase("corn");
+  if (!agrees(copied, expected)) return false;
+  if (copied.filter_stats().rebuilds != 1) return false;
+  copied.insert("mat");
+  expected.insert("mat");
+  if (!agrees(copied, expected)) return false;
+
+  copied.clear();
+  if (copied.find("mat") || !copied.empty("mat")) return false;
+  tr.disable_filter();
+  return !tr.has_filter() && tr.filter_stats().lookups == 0 &&
+         agrees(tr, plain);
+}
 
-  // Find the first item that's a prefix using lower bound.
-  auto start = lower_bound(words.begin(), words.end(), prefix);
-  // Find where it stops being a prefix.
-  auto finish = start;
-  while (finish != words.end() && is_prefix(prefix, *finish)) {
-    ++finish;
+bool Unit_Test::HashIndex_Test() {
+  cout << "Hash index test";
+
+  const vector<string> words{"mahogany", "mahjong",  "compute",  "computer",
+                             "matrix",   "math",     "corn",     "corner",
+                             "material", "mat",      "maternal", "contain",
+                             "contaminate"};
+  Trie expected(words.begin(), words.end());
+  Trie tr;
+  tr.enable_index();
+  for (const auto& key : words) {
+    auto iter = tr.insert(key);
+    if (!iter || *iter != key) return false;
   }
-  words.erase(start, finish);
+  if (!tr.has_index() || tr != expected || tr.size() != expected.size())
+    return false;
 
-  auto t1 = high_resolution_clock::now();
+  // Iterators from the index traverse the tree.
+  auto iter = tr.find("mat");
+  if (!iter || *++iter != "material") return false;
+  if (tr.find("ma") || tr.find("co") || tr.find("") || tr.find("mats"))
+    return false;
 
-  cout << "Erased all words with prefix " << prefix << endl;
-  print_duration(t0, t1);
+  // Node merges and prefix erases keep the index in sync.
+  Trie copied(tr);
+  for (Trie* t : {&tr, &copied, &expected}) {
+    t->erase("mat");
+    t->erase("corn");
+    t->erase("cont", Trie::PREFIX_FLAG);
+    t->insert("mats");
+  }
+  for (const Trie* t : {&tr, &copied}) {
+    if (*t != expected || t->size() != expected.size()) return false;
+    for (const auto& key : words) {
+      if (static_cast<bool>(t->find(key)) !=
+          static_cast<bool>(expected.find(key)))
+        return false;
+    }
+    if (!t->find("mats") || *t->find("corner") != "corner") return false;
+  }
+
+  tr.clear();
+  if (tr.size() != 0 || tr.find("mats")) return false;
+  tr.insert("mats");
+  copied.disable_index();
+  if (tr.size() != 1 || !tr.find("mats") || copied.has_index() ||
+      !copied.find("mats") || tr.index_memory_usage() == 0)
+    return false;
+
+  // Keys share one arena, whose erased bytes are dropped once they make up
+  // half of it, without losing the keys that stay.
+  HashIndex<uint32_t> table;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    table.insert("key number " + std::to_string(i), i);
+  }
+  table.insert("key number 7", 7000);
+  const size_t full = table.memory_usage();
+  for (uint32_t i = 0; i < 1000; ++i) {
+    if (i % 10 != 0) table.erase("key number " + std::to_string(i));
+  }
+  if (table.size() != 100 || table.memory_usage() >= full) return false;
+  for (uint32_t i = 0; i < 1000; ++i) {
+    const uint32_t* value = table.find("key number " + std::to_string(i));
+    if ((value != nullptr) != (i % 10 == 0) || (value && *value != i))
+      return false;
+  }
+  table.clear();
+  return table.size() == 0 && !table.find("key number 0");
 }
 
-void Perf_Test::Erase_Test(Trie words, string prefix) {
-  cout << "Trie deletion...\n";
+bool Unit_Test::Serialization_Test() {
+  cout << "Serialization test";
+
+  const vector<string> words{"",         "mahogany", "mahjong",  "compute",
+                             "computer", "matrix",   "math",     "corn",
+                             "corner",   "material", "mat",      "maternal",
+                             "contain",  "contaminate"};
+  const Trie expected(words.begin(), words.end());
+  stringstream buffer;
+  expected.save(buffer);
+  const string saved = buffer.str();
+
+  // The loaded trie replaces any previous keys and keeps working.
+  Trie tr{"zebra", "mathematics"};
+  tr.load(buffer);
+  if (tr != expected || tr.size() != words.size() || *tr.begin() != "")
+    return false;
+  if (!equal(tr.begin(), tr.end(), expected.begin(), expected.end()))
+    return false;
+  tr.erase("mat");
+  tr.insert("mats");
+  if (!tr.find("mats") || tr.find("mat") || !tr.find("material"))
+    return false;
 
-  auto t0 = high_resolution_clock::now();
-  words.erase(prefix, Trie::PREFIX_FLAG);
-  auto t1 = high_resolution_clock::now();
+  // Empty tries round trip, and an enabled index is rebuilt.
+  Trie empty;
+  stringstream empty_buffer;
+  empty.save(empty_buffer);
+  tr.enable_index();
+  tr.load(empty_buffer);
+  if (!tr.empty() || tr.size() != 0 || tr.find("mats")) return false;
+  stringstream again(saved);
+  tr.load(again);
+  if (tr != expected || tr.size() != words.size() || !tr.find("corner"))
+    return false;
 
-  cout << "Erased all words with prefix " << prefix << endl;
-  print_duration(t0, t1);
+  // A chain far deeper than the call stack could recurse through loads, and
+  // every key along it is found.
+  const size_t depth = 200000;
+  string chain = saved.substr(0, 5) + '\x03';
+  for (size_t i = 1; i < depth; ++i) chain += "\x01" "a\x03";
+  chain += "\x01" "a\x01";
+  stringstream deep(chain);
+  Trie chained;
+  chained.load(deep);
+  if (!chained.find(string(depth, 'a')) ||
+      !chained.find(string(depth / 2, 'a')) ||
+      chained.find(string(depth + 1, 'a')) || !chained.find(""))
+    return false;
+
+  // Malformed input throws and leaves the trie unchanged.
+  const vector<string> corrupt{"", "TREE", saved.substr(0, saved.length() - 1),
+                               saved.substr(0, 4) + '\x7F'};
+  for (const auto& bytes : corrupt) {
+    stringstream bad(bytes);
+    try {
+      tr.load(bad);
+      return false;
+    } catch (const runtime_error&) {
+    }
+    if (tr != expected) return false;
+  }
+  return true;
 }
 
-template <class Container>
-void Perf_Test::Iterate_Test(const Container& words) {
-  if (is_same<Container, set<string>>::value) {
-    cout << "Set iteration...\n";
-  } else if (is_same<Container, Trie>::value) {
-    cout << "Trie iteration...\n";
-  } else {
-    throw runtime_error("Container must be either set<string> or Trie.");
+bool Unit_Test::TrieImage_Test() {
+  cout << "Trie image test";
+
+  Trie tr{"",     "mahogany", "mahjong", "compute",  "computer",
+          "math", "corn",     "corner",  "material", "mat",
+          "maternal", "contain", "contaminate", "\xFF"};
+  const TrieImage image(tr);
+  if (image.size() != tr.size() || image.empty()) return false;
+  if (!equal(tr.begin(), tr.end(), image.begin(), image.end())) return false;
+  for (const auto& key : tr) {
+    auto iter = image.find(key);
+    if (!image.contains(key) || iter == image.end() || *iter != key)
+      return false;
+  }
+  for (const string key : {"ma", "co", "mats", "corners", "m", "\xFE"}) {
+    if (image.contains(key) || image.find(key) != image.end()) return false;
   }
 
-  size_t counter = 0;
-  auto t0 = high_resolution_clock::now();
-  for (const auto& key : words) {
-    /*
-    Work-around for compiler flags not using the key variable.
+  // Prefix counts and ranges agree with the trie.
+  const set<string> keys(tr.begin(), tr.end());
+  for (const string prefix : {"", "ma", "mate", "mah", "co", "cont", "corn",
+                              "cops", "z", "\xFF", "matrix"}) {
+    if (image.size(prefix) != tr.size(prefix) ||
+        image.empty(prefix) != tr.empty(prefix))
+      return false;
+    if (tr.empty(prefix) ? image.begin(prefix) != image.end(prefix)
+                         : !equal(tr.begin(prefix), tr.end(prefix),
+                                  image.begin(prefix), image.end(prefix)))
+      return false;
+    const auto bound = keys.lower_bound(prefix);
+    const auto iter = image.lower_bound(prefix);
+    if ((bound == keys.end()) != (iter == image.end()) ||
+        (iter != image.end() && *iter != *bound))
+      return false;
+  }
+
+  // Written images map back, and borrowed bytes serve the same queries.
+  const string path = "trie_image_test.img";
+  image.write(path);
+  const TrieImage mapped = TrieImage::open(path);
+  std::remove(path.c_str());
+  const TrieImage borrowed(image.data(), image.bytes());
+  if (!equal(mapped.begin(), mapped.end(), image.begin(), image.end()) ||
+      borrowed.size("ma") != image.size("ma"))
+    return false;
+
+  const TrieImage empty_image{Trie()};
+  if (!empty_image.empty() || empty_image.begin() != empty_image.end() ||
+      empty_image.contains(""))
+    return false;
+
+  // Building from sorted keys gives the same image up to the record order.
+  TrieImage::Builder builder;
+  for (const auto& key : keys) builder.add(key);
+  try {
+    builder.add("mat");
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  const TrieImage built = builder.finish();
+  if (built.bytes() != image.bytes() ||
+      !equal(tr.begin(), tr.end(), built.begin(), built.end()))
+    return false;
+  for (const string prefix : {"", "ma", "mate", "co", "cops", "\xFF"}) {
+    if (built.size(prefix) != tr.size(prefix) ||
+        built.contains(prefix) != bool(tr.find(prefix)))
+      return false;
+  }
+  if (!TrieImage::Builder().finish().empty()) return false;
+  try {
+    const string bad(image.data(), image.bytes() - 1);
+    TrieImage truncated(bad.data(), bad.length());
+    return false;
+  } catch (const runtime_error&) {
+  }
+
+  // Overwriting any word after the header with an offset past the end, into
+  // the header, or back to the root makes queries throw or answer, but never
+  // read outside the image or loop forever.
+  uint32_t rt = 0;
+  std::memcpy(&rt, image.data() + 12, sizeof(rt));
+  for (size_t pos = TrieImage::HEADER_SIZE; pos + 4 <= image.bytes();
+       pos += 4) {
+    for (const uint32_t val :
+         {uint32_t{0xFFFFFFF0}, uint32_t{4}, rt,
+          static_cast<uint32_t>(image.bytes() - 4)}) {
+      string bad(image.data(), image.bytes());
+      std::memcpy(&bad[pos], &val, sizeof(val));
+      try {
+        const TrieImage corrupt(bad.data(), bad.length());
+        for (const auto& key : tr) corrupt.contains(key);
+        corrupt.size("ma");
+        corrupt.lower_bound("cop");
+        for (auto iter = corrupt.begin(); iter != corrupt.end(); ++iter) {
+        }
+      } catch (const runtime_error&) {
+      }
+    }
+  }
+  return true;
+}
+
+bool Unit_Test::SharedTrie_Test() {
+  cout << "Shared trie test";
+
+  const string name = "/trie_unit_test_" + std::to_string(getpid());
+  const Trie first{"mahogany", "mahjong", "mat", "math", "matrix", "corn"};
+  const Trie second{"compute", "computer", "contain", "corn"};
+  if (SharedTrie::publish(name, first) != 1) return false;
+  SharedTrie reader(name);
+  if (reader.generation() != 1 || reader.image().size() != first.size() ||
+      !equal(first.begin(), first.end(), reader.image().begin(),
+             reader.image().end()))
+    return false;
+
+  // Another process attaches to the same segment.
+  const pid_t child = fork();
+  if (child == 0) {
+    bool ok = false;
+    try {
+      const SharedTrie forked(name);
+      ok = forked.image().contains("math") && forked.image().size("ma") == 5;
+    } catch (...) {
+    }
+    _exit(ok ? 0 : 1);
+  }
+  int status = 0;
+  if (child < 0 || waitpid(child, &status, 0) != child ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    return false;
+
+  // Readers keep their generation until they refresh.
+  if (SharedTrie::publish(name, second) != 2) return false;
+  if (!reader.image().contains("mahjong") || reader.generation() != 1)
+    return false;
+  if (!reader.refresh() || reader.refresh() || reader.generation() != 2)
+    return false;
+  if (reader.image().contains("mahjong") || !reader.image().contains("contain"))
+    return false;
+
+  SharedTrie::remove(name);
+  SharedTrie::remove(name);
+  if (!reader.image().contains("corn")) return false;
+  try {
+    SharedTrie gone(name);
+    return false;
+  } catch (const runtime_error&) {
+  }
+  try {
+    SharedTrie::publish("no_slash", first);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  return true;
+}
+
+bool Unit_Test::DurableTrie_Test() {
+  cout << "Durable trie test";
+
+  const string dir = "durable_unit_test.d";
+  std::filesystem::remove_all(dir);
+  Trie expected;
+  {
+    DurableTrie tr(dir, 4);
+    for (const string key : {"mahogany", "mahjong", "mat", "math", "matrix",
+                             "corn", "corner", "contain", ""}) {
+      tr.insert(key);
+      expected.insert(key);
+    }
+    tr.erase("corn");
+    tr.erase("mah", Trie::PREFIX_FLAG);
+    expected.erase("corn");
+    expected.erase("mah", Trie::PREFIX_FLAG);
+    if (tr.trie() != expected) return false;
+  }
+
+  // Reopening replays every record.
+  {
+    DurableTrie tr(dir, 4);
+    if (tr.recovered() != 11 || tr.trie() != expected) return false;
+  }
+
+  // A torn record is cut off, and later records follow the last whole one.
+  {
+    std::ofstream torn(dir + "/wal", std::ios::binary | std::ios::app);
+    torn << "I\x08mathem";
+  }
+  {
+    DurableTrie tr(dir, 4);
+    if (tr.recovered() != 11 || tr.trie() != expected) return false;
+    tr.insert("mats");
+    expected.insert("mats");
+  }
+
+  // A checkpoint empties the log, and later records are replayed on top.
+  {
+    DurableTrie tr(dir);
+    if (tr.recovered() != 12 || tr.trie() != expected) return false;
+    tr.checkpoint();
+    tr.erase("ma", Trie::PREFIX_FLAG);
+    expected.erase("ma", Trie::PREFIX_FLAG);
+  }
+  {
+    DurableTrie tr(dir, 1, 32);
+    if (tr.recovered() != 1 || tr.trie() != expected) return false;
+    // Tiny logs checkpoint on their own.
+    for (char c = 'a'; c <= 'z'; ++c) {
+      tr.insert(string("re") + c);
+      expected.insert(string("re") + c);
+    }
+  }
+  {
+    DurableTrie tr(dir);
+    if (tr.recovered() > 4 || tr.trie() != expected) return false;
+    // Later checkpoints write only what changed.
+    tr.checkpoint();
+    tr.insert("containers");
+    expected.insert("containers");
+    tr.checkpoint();
+    std::ostringstream whole;
+    tr.trie().save(whole);
+    if (tr.last_checkpoint_bytes() == 0 ||
+        tr.last_checkpoint_bytes() * 2 >= whole.str().length())
+      return false;
+  }
+  {
+    DurableTrie tr(dir);
+    if (tr.recovered() != 0 || tr.trie() != expected) return false;
+  }
+  std::filesystem::remove_all(dir);
+
+  try {
+    DurableTrie bad(dir, 0);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  std::filesystem::remove_all(dir);
+  return true;
+}
+
+bool Unit_Test::Checkpoint_Test() {
+  cout << "Incremental checkpoint test";
+
+  Trie tr{"mahogany", "mahjong", "mat", "math", "matrix", "corn", "corner",
+          "contain", "compute", "computer"};
+  // A file starts with a byte that no record uses, since offset 0 is invalid.
+  std::stringstream file;
+  file << '#';
+  uint64_t offset = 1;
+  const uint64_t first = tr.save_changes(file, offset);
+  const uint64_t full = offset;
+  if (offset != file.str().length()) return false;
+
+  // Nothing changed, so nothing is written.
+  if (tr.save_changes(file, offset) != first || offset != full) return false;
+
+  // Only the changed path is appended.
+  Trie expected(tr);
+  for (Trie* t : {&tr, &expected}) {
+    t->insert("maths");
+    t->erase("corn");
+  }
+  const uint64_t second = tr.save_changes(file, offset);
+  if (offset != file.str().length() || offset - full >= full) return false;
+
+  // Both checkpoints load from the same file.
+  Trie loaded;
+  loaded.load_checkpoint(file.str(), second);
+  if (loaded != expected) return false;
+  loaded.load_checkpoint(file.str(), first);
+  if (loaded.find("maths") || !loaded.find("corn")) return false;
+
+  // A loaded trie extends the file with its own changes.
+  loaded.erase("ma", Trie::PREFIX_FLAG);
+  const uint64_t third = loaded.save_changes(file, offset);
+  Trie reloaded;
+  reloaded.load_checkpoint(file.str(), third);
+  if (reloaded != loaded || reloaded.size() != 5) return false;
+
+  // Forgetting the file writes everything again.
+  tr.forget_checkpoint();
+  const uint64_t before = offset;
+  tr.save_changes(file, offset);
+  if (offset - before < full - 1) return false;
+
+  for (const uint64_t bad : {uint64_t{0}, offset, offset + 1}) {
+    try {
+      reloaded.load_checkpoint(file.str(), bad);
+      return false;
+    } catch (const runtime_error&) {
+    }
+  }
+
+  // Records that are children of two nodes would double the tree at every
+  // level, so they are rejected.
+  string shared = "#\x01";
+  char prev = 1;
+  for (size_t level = 0; level < 16; ++level) {
+    const auto at = static_cast<char>(shared.length());
+    shared += string("\x05\x01" "a") + prev + "\x01" "b" + prev;
+    prev = at;
+  }
+  try {
+    reloaded.load_checkpoint(shared, static_cast<uint64_t>(prev));
+    return false;
+  } catch (const runtime_error&) {
+  }
+  return reloaded == loaded;
+}
+
+bool Unit_Test::PagedTrie_Test() {
+  cout << "Paged trie test";
+
+  const string path = "paged_unit_test.db";
+  std::remove(path.c_str());
+  Trie tr{"",     "mahogany", "mahjong", "compute",  "computer",
+          "math", "corn",     "corner",  "material", "mat",
+          "maternal", "contain", "contaminate", "\xFF"};
+  // Enough keys to fill many pages, and labels longer than MAX_LABEL.
+  std::mt19937 gen(7);
+  for (size_t i = 0; i < 5000; ++i) {
+    string key;
+    for (size_t len = gen() % 10; len > 0; --len) key += "acgt"[gen() % 4];
+    if (i % 500 == 0) key += string(PagedTrie::MAX_LABEL * 2 + i % 7, 'n');
+    tr.insert(key);
+  }
+  {
+    // The smallest buffer pool evicts pages all the time.
+    PagedTrie paged(path, 0);
+    for (const auto& key : tr) {
+      if (!paged.insert(key) || paged.insert(key)) return false;
+    }
+    if (paged.size() != tr.size() || paged.page_writes() == 0) return false;
+  }
+
+  // Reopening reads the same keys back from the file.
+  PagedTrie paged(path, 16 * PagedTrie::PAGE_SIZE);
+  std::remove(path.c_str());
+  if (paged.size() != tr.size() || paged.empty()) return false;
+  if (!equal(tr.begin(), tr.end(), paged.begin(), paged.end())) return false;
+  for (const string key : {"mahogany", "", "acgtnn", "\xFF", "ma", "corners",
+                           "m", "\xFE", "acgtacgtacgtacgt"}) {
+    const auto iter = paged.find(key);
+    if (paged.contains(key) != tr.find(key) ||
+        (iter != paged.end()) != paged.contains(key) ||
+        (iter != paged.end() && *iter != key))
+      return false;
+  }
+
+  // Prefix counts and ranges agree with the trie.
+  const set<string> keys(tr.begin(), tr.end());
+  for (const string prefix : {"", "ma", "mate", "co", "cops", "z", "\xFF",
+                              "a", "ac", "cag", "ttt", "gnn", "tnnnnnn"}) {
+    if (paged.size(prefix) != tr.size(prefix) ||
+        paged.empty(prefix) != tr.empty(prefix))
+      return false;
+    if (tr.empty(prefix) ? paged.begin(prefix) != paged.end(prefix)
+                         : !equal(tr.begin(prefix), tr.end(prefix),
+                                  paged.begin(prefix), paged.end(prefix)))
+      return false;
+    const auto bound = keys.lower_bound(prefix);
+    const auto iter = paged.lower_bound(prefix);
+    if ((bound == keys.end()) != (iter == paged.end()) ||
+        (iter != paged.end() && *iter != *bound))
+      return false;
+  }
+
+  // Files of other kinds are rejected.
+  {
+    std::ofstream bad(path, std::ios::binary);
+    bad << "not a paged trie";
+  }
+  try {
+    PagedTrie other(path);
+    std::remove(path.c_str());
+    return false;
+  } catch (const runtime_error&) {
+  }
+  std::remove(path.c_str());
+  return true;
+}
+
+bool Unit_Test::LsmTrie_Test() {
+  cout << "LSM trie test";
+
+  // Tiny memtables flush and merge runs all the time.
+  LsmTrie lsm(8, 2);
+  set<string> expected;
+  std::mt19937 gen(11);
+  for (size_t i = 0; i < 3000; ++i) {
+    string key;
+    for (size_t len = gen() % 6; len > 0; --len) key += "abc"[gen() % 3];
+    if (gen() % 3 == 0) {
+      lsm.erase(key);
+      expected.erase(key);
+    } else {
+      lsm.insert(key);
+      expected.insert(key);
+    }
+    if (lsm.read_amplification() > 4 * 2 + 2) return false;
+    if (i % 100 == 0 &&
+        !equal(expected.begin(), expected.end(), lsm.begin(), lsm.end()))
+      return false;
+  }
+  if (lsm.compactions() == 0) return false;
+
+  const auto check = [&lsm, &expected]() {
+    if (!equal(expected.begin(), expected.end(), lsm.begin(), lsm.end()))
+      return false;
+    for (const string key : {"", "a", "ab", "abc", "cab", "ccccc", "d"}) {
+      if (lsm.contains(key) != (expected.count(key) == 1)) return false;
+    }
+    // Prefix ranges skip keys whose newest entry is a tombstone.
+    for (const string prefix : {"", "a", "ba", "cc", "abca", "d"}) {
+      vector<string> with_prefix;
+      for (const auto& key : expected) {
+        if (is_prefix(prefix, key)) with_prefix.push_back(key);
+      }
+      if (!equal(with_prefix.begin(), with_prefix.end(), lsm.begin(prefix),
+                 lsm.end()))
+        return false;
+    }
+    return true;
+  };
+  if (!check()) return false;
+
+  // Compaction leaves one run without tombstones and the same keys.
+  lsm.compact();
+  if (lsm.num_runs() > 1 || !check()) return false;
+  for (const auto& key : vector<string>(expected.begin(), expected.end())) {
+    lsm.erase(key);
+    expected.erase(key);
+  }
+  lsm.compact();
+  if (lsm.num_runs() != 0 || lsm.begin() != lsm.end() || !check())
+    return false;
+
+  try {
+    LsmTrie bad(0);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  return true;
+}
+
+bool Unit_Test::TrieHandle_Test() {
+  cout << "Trie handle test";
+
+  TrieHandle handle(
+      std::make_unique<Trie>(Trie{"mahogany", "mahjong", "mat", "math"}));
+  TrieHandle::Reader reader(handle);
+  {
+    const auto outer = reader.pin();
+    if (!outer->find("mat") || handle.version() != 0) return false;
+    handle.publish(std::make_unique<Trie>(Trie{"compute", "corn"}));
+    {
+      // A nested pin sees the new tree.
+      const auto inner = reader.pin();
+      if (inner->find("mat") || !inner->find("corn")) return false;
+    }
+    // The outer pin keeps the old tree alive.
+    std::this_thread::sleep_for(10 * TrieHandle::RECLAIM_POLL);
+    if (!outer->find("mahjong") || (*outer).size("ma") != 4 ||
+        handle.version() != 1 || handle.pending() != 1 ||
+        handle.reclaimed() != 0)
+      return false;
+  }
+  const auto drain = [&handle](size_t count) {
+    for (size_t i = 0; i < 1000 && handle.reclaimed() < count; ++i) {
+      std::this_thread::sleep_for(TrieHandle::RECLAIM_POLL);
+    }
+    return handle.reclaimed() == count && handle.pending() == 0;
+  };
+  if (!drain(1)) return false;
+
+  // Rebuild from a saved tree, and keep the current one if that fails.
+  const string path = "handle_unit_test.bin";
+  {
+    std::ofstream fout(path, std::ios::binary);
+    Trie{"alpha", "beta", "gamma"}.save(fout);
+  }
+  handle.rebuild(path);
+  handle.wait();
+  std::remove(path.c_str());
+  if (handle.version() != 2 || reader.pin()->size() != 3) return false;
+  handle.rebuild(path);
+  try {
+    handle.wait();
+    return false;
+  } catch (const runtime_error&) {
+  }
+  if (handle.version() != 2 || !reader.pin()->find("gamma")) return false;
+
+  // Readers always see a whole tree while trees are swapped under them.
+  const size_t num_publishes = 200;
+  handle.publish(std::make_unique<Trie>(Trie{"base", "tree"}));
+  std::atomic<bool> done(false);
+  std::atomic<size_t> failures(0);
+  vector<std::thread> threads;
+  for (size_t i = 0; i < 4; ++i) {
+    threads.emplace_back([&handle, &done, &failures]() {
+      TrieHandle::Reader local(handle);
+      while (!done.load()) {
+        const auto guard = local.pin();
+        if (!guard->find("base") || guard->size("tree") != 1) ++failures;
+      }
+    });
+  }
+  for (size_t i = 0; i < num_publishes; ++i) {
+    handle.publish(std::make_unique<Trie>(
+        Trie{"base", "tree" + std::to_string(i)}));
+  }
+  done.store(true);
+  for (auto& thread : threads) thread.join();
+  if (failures.load() != 0 || handle.version() != 3 + num_publishes ||
+      !drain(3 + num_publishes))
+    return false;
+
+  // Every slot is taken.
+  vector<std::unique_ptr<TrieHandle::Reader>> readers;
+  try {
+    while (readers.size() < TrieHandle::MAX_READERS) {
+      readers.push_back(std::make_unique<TrieHandle::Reader>(handle));
+    }
+    return false;
+  } catch (const runtime_error&) {
+  }
+  try {
+    TrieHandle bad(nullptr);
+    return false;
+  } catch (const std::invalid_argument&) {
+  }
+  return true;
+}
+
+bool Unit_Test::Reclaim_Test() {
+  cout << "Reclaim test";
+
+  // The subtree under "pr" is the node pr with 3 children.
+  Trie tr{"pra", "prb", "prc", "mat", "math"};
+  tr.erase("pr", Trie::PREFIX_FLAG);
+  if (tr.pending_reclaim() != 1 || tr.size() != 2 || !tr.empty("pr"))
+    return false;
+  if (tr.reclaim() != 4 || tr.pending_reclaim() != 0 || tr.reclaim() != 0)
+    return false;
+
+  // Large subtrees are freed a bounded number of nodes at a time.
+  for (size_t i = 0; i < 1000; ++i) tr.insert("key" + std::to_string(i));
+  tr.erase("key", Trie::PREFIX_FLAG);
+  if (tr.size() != 2 || tr.reclaim(2) != 2 || tr.pending_reclaim() == 0)
+    return false;
+  for (size_t i = 0; i < 1000 && tr.pending_reclaim() > 0; ++i) {
+    tr.insert("new" + std::to_string(i));
+    if (!tr.find("new" + std::to_string(i))) return false;
+  }
+  // Each insert freed RECLAIM_STEP nodes.
+  if (tr.pending_reclaim() != 0 || tr.size("new") * Trie::RECLAIM_STEP > 2000)
+    return false;
+
+  // Clear leaves every node to reclaim, and the trie is reusable at once.
+  tr.clear();
+  if (!tr.empty() || tr.pending_reclaim() == 0) return false;
+  tr.insert("mat");
+  if (tr.size() != 1 || !tr.find("mat")) return false;
+  tr.reclaim();
+  return tr.pending_reclaim() == 0 && tr.size() == 1;
+}
+
+bool Unit_Test::Split_Test() {
+  cout << "Split test";
+
+  const Trie original{"mahogany", "mahjong", "mat",     "math",
+                      "matrix",   "corn",    "corner",  "contain",
+                      "compute",  "computer", "contaminate", ""};
+  Trie tr(original);
+
+  // The extracted keys keep their whole strings, and merge back.
+  Trie extracted = tr.extract_prefix("mat");
+  if (extracted != Trie{"mat", "math", "matrix"} || !tr.empty("mat") ||
+      tr.size() != 9)
+    return false;
+  if (!tr.extract_prefix("x").empty() || tr.size() != 9) return false;
+  tr.merge_disjoint(std::move(extracted));
+  if (tr != original || !extracted.empty()) return false;
+  extracted = tr.extract_prefix("");
+  if (!tr.empty() || extracted != original) return false;
+  tr.merge_disjoint(std::move(extracted));
+  if (tr != original) return false;
+
+  // Every bound splits the keys into those less than it and the rest.
+  for (const string key : {"", "a", "co", "con", "contain", "contaminatf",
+                           "corn", "mahjong", "mat", "matha", "z"}) {
+    Trie upper = tr.split_at(key);
+    for (const auto& lower_key : tr) {
+      if (lower_key >= key) return false;
+    }
+    for (const auto& upper_key : upper) {
+      if (upper_key < key) return false;
+    }
+    if (tr.size() + upper.size() != original.size()) return false;
+    tr.merge_disjoint(std::move(upper));
+    if (tr != original) return false;
+  }
+
+  // Random moves between two tries keep the same keys as two sets.
+  std::mt19937 gen(7);
+  const auto random_key = [&gen]() {
+    string key;
+    for (size_t len = gen() % 6; len > 0; --len) key += "abc"[gen() % 3];
+    return key;
+  };
+  Trie first;
+  Trie second;
+  set<string> first_set;
+  set<string> second_set;
+  for (size_t i = 0; i < 300; ++i) {
+    const string key = random_key();
+    first.insert(key);
+    first_set.insert(key);
+  }
+  for (size_t i = 0; i < 200; ++i) {
+    const string key = random_key();
+    if (i % 2 == 0) {
+      second.merge_disjoint(first.split_at(key));
+      second_set.insert(first_set.lower_bound(key), first_set.end());
+      first_set.erase(first_set.lower_bound(key), first_set.end());
+    } else {
+      Trie moved = second.extract_prefix(key);
+      for (auto iter = second_set.lower_bound(key);
+           iter != second_set.end() && is_prefix(key, *iter);) {
+        first_set.insert(*iter);
+        iter = second_set.erase(iter);
+      }
+      first.merge_disjoint(std::move(moved));
+    }
+    if (!equal(first_set.begin(), first_set.end(), first.begin(),
+               first.end()) ||
+        !equal(second_set.begin(), second_set.end(), second.begin(),
+               second.end()))
+      return false;
+  }
+
+  // A trie holding moved nodes writes all of them to its own checkpoint.
+  std::stringstream file;
+  file << '#';
+  uint64_t offset = 1;
+  tr.save_changes(file, offset);
+  Trie moved = tr.extract_prefix("co");
+  std::stringstream other_file;
+  other_file << '#';
+  uint64_t other_offset = 1;
+  const uint64_t moved_root = moved.save_changes(other_file, other_offset);
+  Trie loaded;
+  loaded.load_checkpoint(other_file.str(), moved_root);
+  return loaded == moved && loaded.size() == 6;
+}
+
+bool Unit_Test::EraseRange_Test() {
+  cout << "Erase range test";
+
+  Trie tr{"mahogany", "mahjong",     "compute", "computer", "matrix",
+          "math",     "contaminate", "corn",    "corner",   "material",
+          "mat",      "maternal",    "contain", ""};
+  // Empty and inverted ranges erase nothing.
+  tr.erase_range("mat", "mat");
+  tr.erase_range("z", "a");
+  if (tr.size() != 14) return false;
+
+  // Both bounds are inclusive of lo and exclusive of hi, stored or not.
+  tr.erase_range("mat", "matrix");
+  if (tr != Trie{"mahogany", "mahjong", "compute", "computer", "matrix",
+                 "contaminate", "corn", "corner", "contain", ""})
+    return false;
+  tr.erase_range("com", "corn");
+  if (tr != Trie{"mahogany", "mahjong", "matrix", "corn", "corner", ""})
+    return false;
+  tr.erase_range("", "corner");
+  if (tr != Trie{"mahogany", "mahjong", "matrix", "corner"}) return false;
+
+  // Random ranges, with and without an index and a filter, match std::set.
+  std::mt19937 gen(5);
+  const auto random_key = [&gen]() {
+    string key;
+    for (size_t len = gen() % 7; len > 0; --len) key += "abcd"[gen() % 4];
+    return key;
+  };
+  for (size_t trial = 0; trial < 30; ++trial) {
+    Trie random_trie;
+    if (trial % 3 == 1) random_trie.enable_index();
+    if (trial % 3 == 2) random_trie.enable_filter(10, 2);
+    set<string> expected;
+    for (size_t i = 0; i < 400; ++i) {
+      const string key = random_key();
+      random_trie.insert(key);
+      expected.insert(key);
+    }
+    for (size_t i = 0; i < 5; ++i) {
+      const string lo = random_key();
+      const string hi = random_key();
+      random_trie.erase_range(lo, hi);
+      if (lo < hi)
+        expected.erase(expected.lower_bound(lo), expected.lower_bound(hi));
+      if (!equal(expected.begin(), expected.end(), random_trie.begin(),
+                 random_trie.end()) ||
+          random_trie.size() != expected.size())
+        return false;
+      for (size_t j = 0; j < 20; ++j) {
+        const string key = random_key();
+        if (static_cast<bool>(random_trie.find(key)) !=
+            (expected.count(key) == 1))
+          return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool Unit_Test::Compact_Test() {
+  cout << "Compact test";
+
+  Trie tr{"mahogany", "mahjong",     "compute", "computer", "matrix",
+          "math",     "contaminate", "corn",    "corner",   "material",
+          "mat",      "maternal",    "contain", ""};
+  tr.enable_index();
+  tr.erase("corn");
+  tr.erase("con", Trie::PREFIX_FLAG);
+  const Trie expected(tr);
+
+  // Offsets of saved nodes survive, so nothing is written again.
+  std::stringstream file;
+  file << '#';
+  uint64_t offset = 1;
+  const uint64_t first = tr.save_changes(file, offset);
+  const uint64_t full = offset;
+
+  tr.compact();
+  if (tr != expected || tr.pending_reclaim() != 0 || !tr.has_index())
+    return false;
+  if (!tr.find("mahjong") || tr.find("corn") || tr.size("ma") != 7 ||
+      tr.size() != 11)
+    return false;
+  if (tr.save_changes(file, offset) != first || offset != full) return false;
+
+  // The rebuilt trie takes updates and checkpoints as before.
+  tr.insert("corn");
+  tr.erase("mat", Trie::PREFIX_FLAG);
+  const uint64_t second = tr.save_changes(file, offset);
+  Trie loaded;
+  loaded.load_checkpoint(file.str(), second);
+  if (loaded != tr || loaded.size() != 7) return false;
+
+  Trie empty;
+  empty.compact();
+  return empty.empty() && empty.size() == 0;
+}
+
+bool Unit_Test::ImageLayout_Test() {
+  cout << "Image layout test";
+
+  // Random keys over a small alphabet make a deep tree, whose van Emde Boas
+  // order differs from pre-order.
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<size_t> len_dist(1, 24);
+  Trie tr{"", "a", "acgt", "acgtacgt"};
+  for (size_t i = 0; i < 3000; ++i) {
+    string key(len_dist(gen), ' ');
+    for (auto& c : key) c = "acgt"[gen() % 4];
+    tr.insert(key);
+  }
+  const TrieImage pre(tr);
+  const TrieImage veb(tr, TrieImage::VAN_EMDE_BOAS);
+  if (veb.bytes() != pre.bytes() ||
+      std::equal(pre.data(), pre.data() + pre.bytes(), veb.data()))
+    return false;
+  if (!equal(tr.begin(), tr.end(), veb.begin(), veb.end())) return false;
+  for (const auto& key : tr) {
+    if (!veb.contains(key) || *veb.find(key) != key) return false;
+  }
+  for (size_t i = 0; i < 1000; ++i) {
+    string probe(len_dist(gen) / 3, ' ');
+    for (auto& c : probe) c = "acgtu"[gen() % 5];
+    if (veb.contains(probe) != tr.find(probe) ||
+        veb.size(probe) != tr.size(probe) ||
+        (veb.lower_bound(probe) == veb.end()) !=
+            (pre.lower_bound(probe) == pre.end()))
+      return false;
+    if (!tr.empty(probe) && !equal(tr.begin(probe), tr.end(probe),
+                                   veb.begin(probe), veb.end(probe)))
+      return false;
+  }
+
+  // Trees of one or two levels have only one order.
+  for (const Trie& small : {Trie(), Trie{"a", "b", "c"}}) {
+    const TrieImage small_pre(small);
+    const TrieImage small_veb(small, TrieImage::VAN_EMDE_BOAS);
+    if (!std::equal(small_pre.data(), small_pre.data() + small_pre.bytes(),
+                    small_veb.data(), small_veb.data() + small_veb.bytes()))
+      return false;
+  }
+  return true;
+}
+
+bool Unit_Test::Pool_Test() {
+  cout << "Pool test";
+
+  // Nodes freed by erase are reused by later inserts.
+  Trie tr{"mahogany", "mahjong", "compute", "computer", "matrix",
+          "math",     "corn",    "corner",  "material", "mat"};
+  const Trie expected(tr);
+  for (size_t round = 0; round < 3; ++round) {
+    tr.erase("ma", Trie::PREFIX_FLAG);
+    tr.erase("corner");
+    tr.reclaim();
+    tr.insert("corner");
+    for (const auto& key : expected) {
+      if (is_prefix("ma", key)) tr.insert(key);
+    }
+  }
+  if (tr != expected) return false;
+
+  // Indices only identify nodes within one pool.
+  const Trie twin(expected);
+  if (twin.find("math") == tr.find("math") || twin.end() != tr.end())
+    return false;
+
+  {
+    // Extracted tries share the pool, and free their nodes into it.
+    Trie extracted = tr.extract_prefix("ma");
+    if (extracted.size() != 6 || tr.size() != 4 || tr.find("mat"))
+      return false;
+    Trie copy(extracted);
+    copy.insert("maze");
+    if (!copy.find("maze") || extracted.find("maze")) return false;
+    Trie more = tr.split_at("corn");
+    tr.merge_disjoint(std::move(more));
+  }
+  if (tr.size() != 4 || !tr.find("corner") || tr.find("matrix")) return false;
+
+  // Merging across pools copies the nodes, so other may go first.
+  {
+    Trie other{"mat", "math", "matrix", "material", "mahjong", "mahogany"};
+    tr.merge_disjoint(std::move(other));
+  }
+  tr.insert("");
+  tr.erase("");
+  if (tr != expected || !tr.find("mahjong")) return false;
+  auto part = tr.extract_prefix("com");
+  Trie joined;
+  joined.merge_disjoint(std::move(part));
+  joined.merge_disjoint(std::move(tr));
+  tr.compact();
+  return joined == expected && tr.empty() && joined.size() == 10;
+}
+
+bool Unit_Test::Path_Test() {
+  cout << "Iterator path test";
+
+  Trie tr{"mahogany", "mahjong", "compute", "computer", "matrix",
+          "math",     "corn",    "corner",  "material", "mat"};
+  // Keys found by exact match and by insert find their path on increment.
+  auto iter = tr.find("mat");
+  if (!iter || *iter != "mat" || *++iter != "material") return false;
+  iter = tr.insert("corm");
+  if (*iter != "corm" || *++iter != "corn") return false;
+  tr.enable_index();
+  iter = tr.find("computer");
+  if (*iter++ != "computer" || *iter != "corm") return false;
+  if (iter != tr.find("corm") || ++tr.find("matrix") != tr.end())
+    return false;
+  tr.disable_index();
+
+  // Missing prefixes have no first key, but still end at the next key.
+  if (tr.begin("cot") || *tr.end("cot") != "mahjong" ||
+      *tr.lower_bound("mai") != "mat" || tr.lower_bound("n") != tr.end())
+    return false;
+
+  // Erasing joins the remaining child into its parent, and changes only the
+  // path to it after a checkpoint.
+  std::stringstream file;
+  file << '#';
+  uint64_t offset = 1;
+  tr.save_changes(file, offset);
+  tr.erase("corm");
+  tr.erase("mahogany");
+  tr.erase("mat", Trie::PREFIX_FLAG);
+  const uint64_t changed = tr.save_changes(file, offset);
+  Trie loaded;
+  loaded.load_checkpoint(file.str(), changed);
+  const Trie expected{"mahjong", "compute", "computer", "corn", "corner"};
+  return tr == expected && loaded == expected &&
+         *tr.find("c", Trie::PREFIX_FLAG) == "compute";
+}
+
+bool Unit_Test::Resource_Test() {
+  cout << "Memory resource test";
+
+  CountingResource counting;
+  const Trie expected{"mahogany", "mahjong", "compute", "computer",
+                      "matrix",   "math",    "corn",    "corner",
+                      string(40, 'x')};
+  {
+    Trie tr(&counting);
+    for (const auto& key : expected) tr.insert(key);
+    if (tr.resource() != &counting || tr != expected || counting.in_use == 0)
+      return false;
+
+    // Copies take the default resource unless given one.
+    const size_t used = counting.in_use;
+    Trie copy(tr);
+    if (copy.resource() != std::pmr::get_default_resource() ||
+        counting.in_use != used)
+      return false;
+    Trie same(tr, &counting);
+    if (same != tr || counting.in_use <= used) return false;
+
+    // Assignment and merging copy nodes into the resource of the target.
+    same = copy;
+    copy = same;
+    if (same.resource() != &counting || copy.resource() == &counting ||
+        same != expected)
+      return false;
+    Trie part = copy.extract_prefix("co");
+    tr.erase("co", Trie::PREFIX_FLAG);
+    tr.merge_disjoint(std::move(part));
+    Trie moved(std::move(tr));
+    if (moved.resource() != &counting || tr.resource() != &counting ||
+        moved != expected)
+      return false;
+  }
+  // Every node and label went back to the resource.
+  if (counting.in_use != 0) return false;
+
+  // A scratch trie on a stack buffer never reaches the upstream resource.
+  const size_t allocations = counting.allocations;
+  char buffer[1 << 14];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer),
+                                            &counting);
+  Trie scratch(&arena);
+  for (const auto& key : expected) scratch.insert(key);
+  scratch.erase("ma", Trie::PREFIX_FLAG);
+  scratch.reclaim();
+  scratch.insert("matrix");
+  return counting.allocations == allocations && scratch.size() == 6 &&
+         scratch.find("matrix") && *scratch.begin("x") == string(40, 'x');
+}
+
+bool Unit_Test::Budget_Test() {
+  cout << "Memory budget test";
+
+  CountingResource counting;
+  Trie tr(&counting);
+  // The pool itself is the only allocation outside the count.
+  const size_t bookkeeping = counting.in_use - tr.memory_usage().total;
+
+  // Reserved node slots are used before the pool grows.
+  if (!tr.reserve(100, 1000)) return false;
+  const size_t reserved = tr.memory_usage().total;
+  for (size_t i = 0; i < 100; ++i) tr.insert(std::to_string(i * 7919));
+  const string long_key(40, 'x');
+  tr.insert(long_key);
+  const auto usage = tr.memory_usage();
+  if (usage.total != counting.in_use - bookkeeping ||
+      usage.nodes + usage.children + usage.labels + usage.overhead !=
+          usage.total ||
+      usage.labels <= long_key.length() || usage.total <= reserved)
+    return false;
+
+  // Under a limit, inserts that need memory fail and change nothing.
+  tr.enable_index();
+  const Trie before(tr);
+  tr.set_memory_limit(tr.memory_usage().total);
+  if (tr.insert(string(40, 'y')) || tr.insert("7919a") || tr.find("7919a") ||
+      tr.size() != before.size() || tr != before || !tr.insert("7919"))
+    return false;
+  if (tr.reserve(1000, 0) || tr.memory_usage().total != usage.total)
+    return false;
+
+  // Erasing makes room, and the limit survives rebuilding the pool.
+  tr.erase(long_key);
+  if (!tr.insert(string(40, 'y'))) return false;
+  tr.compact();
+  if (tr.memory_limit() != usage.total) return false;
+  tr.set_memory_limit(0);
+  return tr.insert(string(40, 'z')) && tr.size() == 102;
+}
+
+template <class Container>
+Container Perf_Test::get_words(const vector<string>& word_list) {
+  // Make announcement.
+  if (is_same<Container, set<string>>::value) {
+    cout << "Set insertion...\n";
+  } else if (is_same<Container, Trie>::value) {
+    cout << "Trie insertion...\n";
+  } else {
+    throw runtime_error("Container must be either set<string> or Trie.");
+  }
+
+  // Time insertion with range constructor.
+  auto start = high_resolution_clock::now();
+  Container words(word_list.begin(), word_list.end());
+  auto finish = high_resolution_clock::now();
+  print_duration(start, finish);
+  return words;
+}
+
+void Perf_Test::Count_Test(const set<string>& words) {
+  cout << "Set count...\n";
+
+  auto start = high_resolution_clock::now();
+  // Get starting iterators on each character.
+  vector<set<string>::iterator> bounds;
+  for (char c = 'a'; c <= 'z'; ++c) {
+    bounds.push_back(lower_bound(words.begin(), words.end(), string(1, c)));
+  }
+  bounds.push_back(words.end());
+  cout << "\tPrinting subset sizes: ";
+  for (size_t i = 0; i < bounds.size() - 1; ++i) {
+    cout << distance(bounds[i], bounds[i + 1]) << ' ';
+  }
+  auto finish = high_resolution_clock::now();
+
+  cout << endl;
+  print_duration(start, finish);
+}
+
+void Perf_Test::Count_Test(const Trie& words) {
+  cout << "Trie count...\n";
+
+  auto start = high_resolution_clock::now();
+  cout << "\tPrinting subset sizes: ";
+  for (char c = 'a'; c <= 'z'; ++c) {
+    cout << words.size(string(1, c)) << ' ';
+  }
+  auto finish = high_resolution_clock::now();
+
+  cout << endl;
+  print_duration(start, finish);
+}
+
+void Perf_Test::Find_Test(const set<string>& words, string prefix) {
+  cout << "Set find...\n";
+
+  auto t0 = high_resolution_clock::now();
+
+  auto start = lower_bound(words.begin(), words.end(), prefix);
+  auto finish = start;
+  while (finish != words.end() && is_prefix(prefix, *finish)) {
+    ++finish;
+  }
+
+  auto t1 = high_resolution_clock::now();
+  cout << "Prefix " << prefix << " starts at " << *start << " and ends at "
+       << *finish << endl;
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Find_Test(const Trie& words, string prefix) {
+  cout << "Trie find...\n";
+
+  auto t0 = high_resolution_clock::now();
+
+  auto start = words.begin(prefix);
+  auto finish = words.end(prefix);
+
+  auto t1 = high_resolution_clock::now();
+  cout << "Prefix " << prefix << " starts at " << *start << " and ends at "
+       << *finish << endl;
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Erase_Test(set<string> words, string prefix) {
+  cout << "Set deletion...\n";
+
+  auto t0 = high_resolution_clock::now();
+
+  // Find the first item that's a prefix using lower bound.
+  auto start = lower_bound(words.begin(), words.end(), prefix);
+  // Find where it stops being a prefix.
+  auto finish = start;
+  while (finish != words.end() && is_prefix(prefix, *finish)) {
+    ++finish;
+  }
+  words.erase(start, finish);
+
+  auto t1 = high_resolution_clock::now();
+
+  cout << "Erased all words with prefix " << prefix << endl;
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Erase_Test(Trie words, string prefix) {
+  cout << "Trie deletion...\n";
+
+  auto t0 = high_resolution_clock::now();
+  words.erase(prefix, Trie::PREFIX_FLAG);
+  auto t1 = high_resolution_clock::now();
+
+  cout << "Erased all words with prefix " << prefix << endl;
+  print_duration(t0, t1);
+
+  // The erased nodes are freed afterwards, a few per update or all at once.
+  cout << "Trie reclamation of erased nodes...\n";
+  t0 = high_resolution_clock::now();
+  const size_t freed = words.reclaim();
+  t1 = high_resolution_clock::now();
+  cout << "Freed " << freed << " nodes.\n";
+  print_duration(t0, t1);
+}
+
+template <class Container>
+void Perf_Test::Iterate_Test(const Container& words) {
+  if (is_same<Container, set<string>>::value) {
+    cout << "Set iteration...\n";
+  } else if (is_same<Container, Trie>::value) {
+    cout << "Trie iteration...\n";
+  } else if (is_same<Container, FrontCoded>::value) {
+    cout << "Front coded iteration...\n";
+  } else if (is_same<Container, HatTrie>::value) {
+    cout << "HAT-trie iteration...\n";
+  } else if (is_same<Container, TrieImage>::value) {
+    cout << "Trie image iteration...\n";
+  } else if (is_same<Container, PagedTrie>::value) {
+    cout << "Paged trie iteration...\n";
+  } else if (is_same<Container, LsmTrie>::value) {
+    cout << "LSM trie iteration...\n";
+  } else {
+    throw runtime_error("Container must be a set<string> or a trie.");
+  }
+
+  size_t counter = 0;
+  auto t0 = high_resolution_clock::now();
+  for (const auto& key : words) {
+    /*
+    Work-around for compiler flags not using the key variable.
     Branch prediction should optimize out this call.
     */
     if (!key.empty()) ++counter;
   }
   auto t1 = high_resolution_clock::now();
-  cout << "Finished iterating over " << counter << " keys.\n";
+  cout << "Finished iterating over " << counter << " keys.\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Dawg_Test(const Trie& words) {
+  cout << "Trie minimization...\n";
+
+  auto t0 = high_resolution_clock::now();
+  const Dawg dg(words);
+  auto t1 = high_resolution_clock::now();
+
+  cout << dg.stats();
+  print_duration(t0, t1);
+
+  cout << "Dawg iteration...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : dg) {
+    if (!key.empty()) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Finished iterating over " << counter << " keys.\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Dictionary_Test(const Trie& words,
+                                const vector<string>& word_list) {
+  cout << "Dictionary construction...\n";
+  auto t0 = high_resolution_clock::now();
+  const Dictionary dict(words);
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Dictionary encoding...\n";
+  t0 = high_resolution_clock::now();
+  const auto ids = dict.encode(word_list);
+  t1 = high_resolution_clock::now();
+  cout << "Encoded " << ids.size() << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Dictionary decoding...\n";
+  t0 = high_resolution_clock::now();
+  const auto keys = dict.decode(ids);
+  t1 = high_resolution_clock::now();
+  cout << "Decoded " << keys.size() << " keys.\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::FrontCoded_Test(const Trie& words,
+                                const vector<string>& word_list) {
+  cout << "Front coding...\n";
+  auto t0 = high_resolution_clock::now();
+  const FrontCoded fc(words);
+  auto t1 = high_resolution_clock::now();
+  cout << "Front coded " << fc.size() << " keys into " << fc.memory_usage()
+       << " bytes.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie exact find...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (words.find(key) != words.end()) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Front coded exact find...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (fc.find(key) != fc.end()) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Front coded find...\n";
+  t0 = high_resolution_clock::now();
+  auto start = fc.begin("re");
+  auto finish = fc.end("re");
+  t1 = high_resolution_clock::now();
+  cout << "Prefix re starts at " << *start << " and ends at " << *finish
+       << endl;
+  print_duration(t0, t1);
+
+  Perf_Test::Iterate_Test(fc);
+}
+
+void Perf_Test::HatTrie_Test(size_t num_keys) {
+  // Random hexadecimal keys in the shape of UUIDs.
+  std::mt19937_64 gen(0);
+  vector<string> keys;
+  keys.reserve(num_keys);
+  const char hex[] = "0123456789abcdef";
+  for (size_t i = 0; i < num_keys; ++i) {
+    string key(32, '0');
+    for (auto& c : key) c = hex[gen() % 16];
+    keys.push_back(key);
+  }
+  cout << "Generated " << keys.size() << " random hexadecimal keys.\n";
+
+  cout << "Trie insertion...\n";
+  auto t0 = high_resolution_clock::now();
+  const Trie tr(keys.begin(), keys.end());
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "HAT-trie insertion...\n";
+  t0 = high_resolution_clock::now();
+  const HatTrie hat(keys.begin(), keys.end());
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie exact find...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : keys) {
+    if (tr.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "HAT-trie exact find...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : keys) {
+    if (hat.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  Perf_Test::Iterate_Test(tr);
+  Perf_Test::Iterate_Test(hat);
+}
+
+void Perf_Test::CompressedTrie_Test(const vector<string>& word_list,
+                                   size_t num_keys) {
+  // Synthetic URLs assembled from dictionary words.
+  std::mt19937_64 gen(0);
+  const string schemes[] = {"http://www.", "https://www.", "https://"};
+  const string domains[] = {".com/", ".org/", ".net/"};
+  vector<string> keys;
+  keys.reserve(num_keys);
+  for (size_t i = 0; i < num_keys; ++i) {
+    string key = schemes[gen() % 3] + word_list[gen() % word_list.size()] +
+                 domains[gen() % 3] + word_list[gen() % word_list.size()] +
+                 '/' + word_list[gen() % word_list.size()] + ".html";
+    keys.push_back(key);
+  }
+  cout << "Generated " << keys.size() << " URL keys.\n";
+
+  cout << "Learning key encoder...\n";
+  auto t0 = high_resolution_clock::now();
+  const vector<string> sample(keys.begin(), keys.begin() + 4096);
+  CompressedTrie compressed(sample);
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  size_t raw_bytes = 0, encoded_bytes = 0;
+  for (const auto& key : keys) {
+    raw_bytes += key.length();
+    encoded_bytes += compressed.key_encoder().encode(key).length();
+  }
+  cout << "Average key length " << raw_bytes / keys.size() << " bytes, "
+       << encoded_bytes / keys.size() << " bytes encoded with "
+       << compressed.key_encoder().dictionary_size() << " intervals.\n";
+
+  cout << "Trie insertion...\n";
+  t0 = high_resolution_clock::now();
+  const Trie tr(keys.begin(), keys.end());
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Compressed trie insertion...\n";
+  t0 = high_resolution_clock::now();
+  for (const auto& key : keys) compressed.insert(key);
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie exact find...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : keys) {
+    if (tr.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Compressed trie exact find...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : keys) {
+    if (compressed.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Compressed trie count...\n";
+  t0 = high_resolution_clock::now();
+  const size_t secure = compressed.size("https://");
+  t1 = high_resolution_clock::now();
+  cout << "Counted " << secure << " https keys, trie counted "
+       << tr.size("https://") << ".\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::RangeFilter_Test(const Trie& words,
+                                 const vector<string>& word_list) {
+  // Absent keys that extend stored keys, and empty random ranges.
+  vector<string> absent;
+  for (const auto& key : word_list) {
+    if (!words.find(key + "q")) absent.push_back(key + "q");
+  }
+  std::mt19937_64 gen(0);
+  vector<string> empty_ranges;
+  while (empty_ranges.size() < absent.size()) {
+    string lo(5, 'a');
+    for (auto& c : lo) c = static_cast<char>('a' + gen() % 26);
+    string hi = lo;
+    ++hi.back();
+    const auto next = words.lower_bound(lo);
+    if (!next || *Trie::iterator(next) >= hi) empty_ranges.push_back(lo);
+  }
+
+  for (const auto& bits : vector<std::pair<size_t, size_t>>{
+           {8, 0}, {0, 8}, {4, 4}}) {
+    cout << "Range filter with " << bits.first << " real and " << bits.second
+         << " hash suffix bits...\n";
+    auto t0 = high_resolution_clock::now();
+    const RangeFilter filter = build_filter(words, bits.first, bits.second);
+    auto t1 = high_resolution_clock::now();
+    cout << "Filtered " << filter.size() << " keys with "
+         << filter.bits_per_key() << " bits per key.\n";
+    print_duration(t0, t1);
+
+    size_t positives = 0;
+    t0 = high_resolution_clock::now();
+    for (const auto& key : absent) {
+      if (filter.may_contain(key)) ++positives;
+    }
+    t1 = high_resolution_clock::now();
+    cout << "Point false positives " << positives << " out of "
+         << absent.size() << ".\n";
+    print_duration(t0, t1);
+
+    positives = 0;
+    t0 = high_resolution_clock::now();
+    for (const auto& lo : empty_ranges) {
+      string hi = lo;
+      ++hi.back();
+      if (filter.may_contain_range(lo, hi)) ++positives;
+    }
+    t1 = high_resolution_clock::now();
+    cout << "Range false positives " << positives << " out of "
+         << empty_ranges.size() << ".\n";
+    print_duration(t0, t1);
+  }
+}
+
+void Perf_Test::BloomFilter_Test(Trie words, const vector<string>& word_list) {
+  // Mostly misses, as in production.
+  vector<string> probes;
+  for (size_t i = 0; i < word_list.size(); ++i) {
+    probes.push_back(i % 10 == 0 ? word_list[i] : word_list[i] + "q");
+  }
+
+  cout << "Trie find without filter...\n";
+  size_t counter = 0;
+  auto t0 = high_resolution_clock::now();
+  for (const auto& key : probes) {
+    if (words.find(key)) ++counter;
+  }
+  auto t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Building filter...\n";
+  t0 = high_resolution_clock::now();
+  words.enable_filter();
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie find with filter...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : probes) {
+    if (words.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+  cout << words.filter_stats();
+}
+
+void Perf_Test::HashIndex_Test(const Trie& words,
+                               const vector<string>& word_list) {
+  cout << "Trie insertion with index...\n";
+  auto t0 = high_resolution_clock::now();
+  Trie indexed;
+  indexed.enable_index();
+  for (const auto& key : word_list) indexed.insert(key);
+  auto t1 = high_resolution_clock::now();
+  cout << "Index uses " << indexed.index_memory_usage() << " bytes.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie exact find without index...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (words.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie exact find with index...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (indexed.find(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Serialization_Test(const Trie& words) {
+  cout << "Trie save...\n";
+  stringstream buffer;
+  auto t0 = high_resolution_clock::now();
+  words.save(buffer);
+  auto t1 = high_resolution_clock::now();
+  cout << "Saved " << buffer.str().length() << " bytes.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie load...\n";
+  Trie loaded;
+  t0 = high_resolution_clock::now();
+  loaded.load(buffer);
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+  if (loaded != words) throw runtime_error("Loaded trie differs.");
+}
+
+void Perf_Test::TrieImage_Test(const Trie& words,
+                               const vector<string>& word_list) {
+  const string image_path = "words.img";
+  const string trie_path = "words.trie";
+  cout << "Trie image construction...\n";
+  auto t0 = high_resolution_clock::now();
+  {
+    const TrieImage image(words);
+    image.write(image_path);
+    std::ofstream fout(trie_path, std::ios::binary);
+    words.save(fout);
+  }
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie image open...\n";
+  t0 = high_resolution_clock::now();
+  const TrieImage image = TrieImage::open(image_path);
+  t1 = high_resolution_clock::now();
+  cout << "Mapped " << image.bytes() << " bytes.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie load from file...\n";
+  t0 = high_resolution_clock::now();
+  Trie loaded;
+  ifstream fin(trie_path, std::ios::binary);
+  loaded.load(fin);
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie rebuild from words.txt...\n";
+  t0 = high_resolution_clock::now();
+  const auto rebuilt_list = read_words("words.txt", word_list.size());
+  const Trie rebuilt(rebuilt_list.begin(), rebuilt_list.end());
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+  std::remove(image_path.c_str());
+  std::remove(trie_path.c_str());
+
+  cout << "Trie image exact find...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (image.contains(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  Perf_Test::Iterate_Test(image);
+  if (image.size() != loaded.size() || loaded != rebuilt)
+    throw runtime_error("Trie image differs.");
+}
+
+void Perf_Test::SharedTrie_Test(const Trie& words,
+                                const vector<string>& word_list,
+                                size_t num_readers) {
+  const string name = "/trie_perf_test_" + std::to_string(getpid());
+  cout << "Shared trie publish...\n";
+  auto t0 = high_resolution_clock::now();
+  SharedTrie::publish(name, words);
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Shared trie attach...\n";
+  t0 = high_resolution_clock::now();
+  const SharedTrie reader(name);
+  t1 = high_resolution_clock::now();
+  cout << "Attached " << reader.image().bytes() << " bytes.\n";
+  print_duration(t0, t1);
+
+  // Every reader looks up every key in its own process.
+  cout << "Shared trie exact find in " << num_readers << " processes...\n";
+  t0 = high_resolution_clock::now();
+  vector<pid_t> children;
+  for (size_t i = 0; i < num_readers; ++i) {
+    const pid_t child = fork();
+    if (child == 0) {
+      size_t counter = 0;
+      const SharedTrie forked(name);
+      for (const auto& key : word_list) {
+        if (forked.image().contains(key)) ++counter;
+      }
+      _exit(counter == word_list.size() ? 0 : 1);
+    }
+    children.push_back(child);
+  }
+  size_t succeeded = 0;
+  for (const pid_t child : children) {
+    int status = 0;
+    if (child > 0 && waitpid(child, &status, 0) == child &&
+        WIFEXITED(status) && WEXITSTATUS(status) == 0)
+      ++succeeded;
+  }
+  t1 = high_resolution_clock::now();
+  cout << succeeded << " readers found every key.\n";
+  print_duration(t0, t1);
+  SharedTrie::remove(name);
+}
+
+void Perf_Test::DurableTrie_Test(const vector<string>& word_list) {
+  const string dir = "durable_perf_test.d";
+  std::filesystem::remove_all(dir);
+  // Keep every record in the log, to time a full replay.
+  const size_t no_checkpoint = std::numeric_limits<size_t>::max();
+
+  const size_t num_synced = std::min<size_t>(word_list.size(), 2000);
+  cout << "Durable insertion of " << num_synced
+       << " keys, flushing every key...\n";
+  auto t0 = high_resolution_clock::now();
+  {
+    DurableTrie tr(dir, 1, no_checkpoint);
+    for (size_t i = 0; i < num_synced; ++i) tr.insert(word_list[i]);
+  }
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+  std::filesystem::remove_all(dir);
+
+  cout << "Durable insertion with group commit...\n";
+  t0 = high_resolution_clock::now();
+  {
+    DurableTrie tr(dir, DurableTrie::DEFAULT_GROUP_COMMIT, no_checkpoint);
+    for (const auto& key : word_list) tr.insert(key);
+  }
+  t1 = high_resolution_clock::now();
+  const auto micros = duration_cast<time_unit>(t1 - t0).count();
+  cout << "Logged " << word_list.size() * 1000000 / (micros > 0 ? micros : 1)
+       << " inserts per second.\n";
+  print_duration(t0, t1);
+
+  cout << "Recovery from the log...\n";
+  t0 = high_resolution_clock::now();
+  {
+    DurableTrie tr(dir, DurableTrie::DEFAULT_GROUP_COMMIT, no_checkpoint);
+    t1 = high_resolution_clock::now();
+    cout << "Replayed " << tr.recovered() << " records.\n";
+    print_duration(t0, t1);
+
+    cout << "Full checkpoint...\n";
+    t0 = high_resolution_clock::now();
+    tr.checkpoint();
+    t1 = high_resolution_clock::now();
+    cout << "Wrote " << tr.last_checkpoint_bytes() << " bytes.\n";
+    print_duration(t0, t1);
+  }
+
+  cout << "Recovery from the checkpoint...\n";
+  t0 = high_resolution_clock::now();
+  DurableTrie tr(dir);
+  t1 = high_resolution_clock::now();
+  cout << "Recovered " << tr.trie().size() << " keys.\n";
+  print_duration(t0, t1);
+
+  // Checkpoints after a few updates only write the changed paths.
+  cout << "Incremental checkpoint after 1000 updates...\n";
+  for (size_t i = 0; i < 1000 && i < word_list.size(); ++i) {
+    tr.insert(word_list[i * (word_list.size() / 1000)] + "ish");
+  }
+  t0 = high_resolution_clock::now();
+  tr.checkpoint();
+  t1 = high_resolution_clock::now();
+  cout << "Wrote " << tr.last_checkpoint_bytes() << " bytes.\n";
+  print_duration(t0, t1);
+  std::filesystem::remove_all(dir);
+}
+
+
+void Perf_Test::PagedTrie_Test(const Trie& words,
+                               const vector<string>& word_list) {
+  const string path = "paged_perf_test.db";
+  std::remove(path.c_str());
+  // A budget far below the size of the file, so most lookups go to disk.
+  const size_t small_budget = size_t{1} << 20;
+
+  cout << "Paged trie insertion with a 1 MiB buffer pool...\n";
+  auto t0 = high_resolution_clock::now();
+  {
+    PagedTrie paged(path, small_budget);
+    for (const auto& key : word_list) paged.insert(key);
+    paged.flush();
+    cout << "Wrote " << paged.pages() * PagedTrie::PAGE_SIZE << " bytes in "
+         << paged.page_writes() << " page writes.\n";
+  }
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  for (const size_t budget : {small_budget, PagedTrie::DEFAULT_BUDGET}) {
+    const PagedTrie paged(path, budget);
+    cout << "Paged trie exact find with a " << (budget >> 20)
+         << " MiB buffer pool...\n";
+    size_t counter = 0;
+    t0 = high_resolution_clock::now();
+    for (const auto& key : word_list) {
+      if (paged.contains(key)) ++counter;
+    }
+    t1 = high_resolution_clock::now();
+    cout << "Found " << counter << " keys with " << paged.page_reads()
+         << " page reads.\n";
+    print_duration(t0, t1);
+    if (paged.size("re") != words.size("re"))
+      throw runtime_error("Paged trie differs.");
+  }
+
+  const PagedTrie paged(path, small_budget);
+  Perf_Test::Iterate_Test(paged);
+  std::remove(path.c_str());
+  if (!equal(words.begin(), words.end(), paged.begin(), paged.end()))
+    throw runtime_error("Paged trie differs.");
+}
+
+void Perf_Test::LsmTrie_Test(const Trie& words,
+                             const vector<string>& word_list) {
+  // Small memtables, so that runs are merged in the background many times.
+  const size_t memtable_limit = 1 << 14;
+  cout << "LSM trie insertion with " << memtable_limit
+       << " updates per memtable...\n";
+  auto t0 = high_resolution_clock::now();
+  LsmTrie lsm(memtable_limit);
+  for (const auto& key : word_list) lsm.insert(key);
+  auto t1 = high_resolution_clock::now();
+  cout << "Read amplification " << lsm.read_amplification() << " after "
+       << lsm.compactions() << " compactions.\n";
+  print_duration(t0, t1);
+
+  cout << "LSM trie exact find...\n";
+  size_t counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (lsm.contains(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "LSM trie prefix iteration...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (auto iter = lsm.begin("re"); iter != lsm.end(); ++iter) ++counter;
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys with prefix re.\n";
+  print_duration(t0, t1);
+
+  cout << "LSM trie full compaction...\n";
+  t0 = high_resolution_clock::now();
+  lsm.compact();
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "LSM trie exact find after compaction...\n";
+  counter = 0;
+  t0 = high_resolution_clock::now();
+  for (const auto& key : word_list) {
+    if (lsm.contains(key)) ++counter;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter << " keys.\n";
+  print_duration(t0, t1);
+
+  Perf_Test::Iterate_Test(lsm);
+  if (!equal(words.begin(), words.end(), lsm.begin(), lsm.end()))
+    throw runtime_error("LSM trie differs.");
+}
+
+void Perf_Test::TrieHandle_Test(const Trie& words,
+                                const vector<string>& word_list,
+                                size_t num_readers) {
+  const string path = "handle_perf_test.bin";
+  {
+    std::ofstream fout(path, std::ios::binary);
+    words.save(fout);
+  }
+  TrieHandle handle(std::make_unique<Trie>(words));
+
+  // Each reader pins once per lookup, while the tree is rebuilt and swapped.
+  cout << "Trie handle exact find in " << num_readers
+       << " threads during a rebuild...\n";
+  std::atomic<size_t> counter(0);
+  auto t0 = high_resolution_clock::now();
+  vector<std::thread> threads;
+  for (size_t i = 0; i < num_readers; ++i) {
+    threads.emplace_back([&handle, &word_list, &counter]() {
+      TrieHandle::Reader reader(handle);
+      size_t found = 0;
+      for (const auto& key : word_list) {
+        if (reader.pin()->find(key)) ++found;
+      }
+      counter += found;
+    });
+  }
+  handle.rebuild(path);
+  handle.wait();
+  auto t1 = high_resolution_clock::now();
+  cout << "Rebuilt and published version " << handle.version() << ".\n";
+  print_duration(t0, t1);
+  for (auto& thread : threads) thread.join();
+  t1 = high_resolution_clock::now();
+  cout << "Found " << counter.load() << " keys.\n";
+  print_duration(t0, t1);
+  std::remove(path.c_str());
+
+  // The caller only swaps a pointer, and the old tree is freed elsewhere.
+  auto copy = std::make_unique<Trie>(words);
+  while (handle.pending() != 0) {
+    std::this_thread::sleep_for(TrieHandle::RECLAIM_POLL);
+  }
+  const size_t before = handle.reclaimed();
+  cout << "Trie handle publish...\n";
+  t0 = high_resolution_clock::now();
+  handle.publish(std::move(copy));
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie handle background reclamation...\n";
+  while (handle.reclaimed() == before) {
+    std::this_thread::sleep_for(TrieHandle::RECLAIM_POLL);
+  }
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Split_Test(Trie words) {
+  const Trie original(words);
+  cout << "Trie extract prefix...\n";
+  auto t0 = high_resolution_clock::now();
+  Trie extracted = words.extract_prefix("re");
+  auto t1 = high_resolution_clock::now();
+  cout << "Moved " << extracted.size() << " keys with prefix re.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie merge back...\n";
+  t0 = high_resolution_clock::now();
+  words.merge_disjoint(std::move(extracted));
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie split at m...\n";
+  t0 = high_resolution_clock::now();
+  Trie upper = words.split_at("m");
+  t1 = high_resolution_clock::now();
+  cout << "Moved " << upper.size() << " keys.\n";
+  print_duration(t0, t1);
+
+  cout << "Trie merge back...\n";
+  t0 = high_resolution_clock::now();
+  words.merge_disjoint(std::move(upper));
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+  if (words != original) throw runtime_error("Split and merge differ.");
+
+  // Moving the same range key by key, for comparison.
+  cout << "Key by key move of keys from m...\n";
+  t0 = high_resolution_clock::now();
+  Trie copied;
+  for (auto iter = words.find("m", Trie::PREFIX_FLAG); iter != words.end();
+       ++iter) {
+    copied.insert(*iter);
+  }
+  for (const auto& key : copied) words.erase(key);
+  t1 = high_resolution_clock::now();
+  cout << "Moved " << copied.size() << " keys.\n";
+  print_duration(t0, t1);
+}
+
+void Perf_Test::EraseRange_Test(const Trie& words, const string& lo,
+                                const string& hi) {
+  Trie ranged(words);
+  cout << "Trie range deletion from " << lo << " to " << hi << "...\n";
+  auto t0 = high_resolution_clock::now();
+  ranged.erase_range(lo, hi);
+  auto t1 = high_resolution_clock::now();
+  cout << "Erased " << words.size() - ranged.size() << " keys.\n";
+  print_duration(t0, t1);
+
+  // The same keys, found by iteration and erased one at a time.
+  Trie each(words);
+  cout << "Trie deletion of each key from " << lo << " to " << hi << "...\n";
+  t0 = high_resolution_clock::now();
+  vector<string> doomed;
+  for (auto iter = each.find(lo, Trie::PREFIX_FLAG);
+       iter != each.end() && *iter < hi; ++iter) {
+    doomed.push_back(*iter);
+  }
+  for (const auto& key : doomed) each.erase(key);
+  t1 = high_resolution_clock::now();
+  cout << "Erased " << doomed.size() << " keys.\n";
+  print_duration(t0, t1);
+  if (ranged != each) throw runtime_error("Range deletion differs.");
+}
+
+void Perf_Test::Compact_Test(const vector<string>& word_list) {
+  // Insert in random order, then erase and insert half of the keys a few
+  // times, so that nodes end up scattered across the heap.
+  cout << "Trie churn...\n";
+  auto t0 = high_resolution_clock::now();
+  vector<string> shuffled(word_list);
+  std::mt19937 gen(3);
+  std::shuffle(shuffled.begin(), shuffled.end(), gen);
+  Trie words(shuffled.begin(), shuffled.end());
+  const size_t half = shuffled.size() / 2;
+  for (size_t round = 0; round < 3; ++round) {
+    std::shuffle(shuffled.begin(), shuffled.end(), gen);
+    for (size_t i = 0; i < half; ++i) words.erase(shuffled[i]);
+    std::shuffle(shuffled.begin(), shuffled.begin() + half, gen);
+    for (size_t i = 0; i < half; ++i) words.insert(shuffled[i]);
+  }
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  const auto find_all = [&words, &word_list]() {
+    cout << "Trie exact find...\n";
+    size_t counter = 0;
+    const auto start = high_resolution_clock::now();
+    for (const auto& key : word_list) {
+      if (words.find(key)) ++counter;
+    }
+    const auto finish = high_resolution_clock::now();
+    cout << "Found " << counter << " keys.\n";
+    print_duration(start, finish);
+  };
+  find_all();
+  Perf_Test::Iterate_Test(words);
+
+  cout << "Trie compaction...\n";
+  t0 = high_resolution_clock::now();
+  const size_t freed = words.compact();
+  t1 = high_resolution_clock::now();
+  cout << "Freed " << freed << " heap bytes.\n";
+  print_duration(t0, t1);
+  find_all();
+  Perf_Test::Iterate_Test(words);
+}
+
+void Perf_Test::ImageLayout_Test(size_t num_keys) {
+  // Random DNA reads branch four ways, so the tree is deep and its images
+  // outgrow the last level cache.
+  cout << "Generating " << num_keys << " random reads...\n";
+  std::mt19937 gen(11);
+  vector<string> reads(num_keys, string(32, ' '));
+  for (auto& read : reads) {
+    for (auto& c : read) c = "acgt"[gen() % 4];
+  }
+  vector<string> prefixes(num_keys / 4);
+  for (auto& prefix : prefixes) prefix = reads[gen() % num_keys].substr(0, 12);
+
+  cout << "Trie insertion...\n";
+  auto t0 = high_resolution_clock::now();
+  const Trie words(reads.begin(), reads.end());
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+  std::shuffle(reads.begin(), reads.end(), gen);
+
+  // Times exact finds of every read, and prefix begin iterators.
+  const auto lookups = [&reads, &prefixes](const auto& container,
+                                           const auto& contains) {
+    cout << "Exact find...\n";
+    size_t counter = 0;
+    auto start = high_resolution_clock::now();
+    for (const auto& key : reads) {
+      if (contains(container, key)) ++counter;
+    }
+    auto finish = high_resolution_clock::now();
+    cout << "Found " << counter << " keys.\n";
+    print_duration(start, finish);
+
+    cout << "Prefix begin...\n";
+    size_t length = 0;
+    start = high_resolution_clock::now();
+    for (const auto& prefix : prefixes) {
+      length += (*container.begin(prefix)).length();
+    }
+    finish = high_resolution_clock::now();
+    cout << "Read " << length << " key bytes.\n";
+    print_duration(start, finish);
+  };
+  cout << "Pointer trie:\n";
+  lookups(words, [](const Trie& tr, const string& key) {
+    return static_cast<bool>(tr.find(key));
+  });
+
+  for (const auto layout : {TrieImage::PREORDER, TrieImage::VAN_EMDE_BOAS}) {
+    cout << (layout == TrieImage::PREORDER ? "Pre-order" : "Van Emde Boas")
+         << " image construction...\n";
+    t0 = high_resolution_clock::now();
+    const TrieImage image(words, layout);
+    t1 = high_resolution_clock::now();
+    cout << "Built " << image.bytes() << " bytes.\n";
+    print_duration(t0, t1);
+    lookups(image, [](const TrieImage& img, const string& key) {
+      return img.contains(key);
+    });
+  }
+}
+
+void Perf_Test::Pool_Test(const vector<string>& word_list) {
+  cout << "Trie construction...\n";
+  const size_t before = heap_bytes();
+  auto t0 = high_resolution_clock::now();
+  Trie words(word_list.begin(), word_list.end());
+  auto t1 = high_resolution_clock::now();
+  const size_t used = heap_bytes() - before;
+  cout << "Heap bytes: " << used << ", per key: "
+       << static_cast<double>(used) / static_cast<double>(words.size())
+       << '\n';
+  print_duration(t0, t1);
+
+  // Within a pool, moving a prefix out and back in touches no other node.
+  cout << "Trie extract and merge within the pool...\n";
+  t0 = high_resolution_clock::now();
+  for (size_t i = 0; i < 100; ++i) {
+    words.merge_disjoint(words.extract_prefix("s"));
+  }
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  // Another pool's nodes are copied in, after being copied out.
+  cout << "Trie extract, copy and merge across pools...\n";
+  t0 = high_resolution_clock::now();
+  for (size_t i = 0; i < 100; ++i) {
+    const Trie part = words.extract_prefix("s");
+    words.merge_disjoint(Trie(part));
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Keys: " << words.size() << '\n';
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Resource_Test(const vector<string>& word_list,
+                              size_t keys_per_query) {
+  // Each query builds a trie of a few keys, searches it, and drops it.
+  const size_t num_queries = word_list.size() / keys_per_query;
+  const auto query = [&](std::pmr::memory_resource* mem, size_t q) {
+    const auto first = word_list.begin() +
+                       static_cast<std::ptrdiff_t>(q * keys_per_query);
+    Trie scratch(mem);
+    for (size_t i = 0; i < keys_per_query; ++i) {
+      scratch.insert(first[static_cast<std::ptrdiff_t>(i)]);
+    }
+    return static_cast<bool>(scratch.find(*first));
+  };
+  size_t found = 0;
+
+  cout << "Scratch tries on the global heap...\n";
+  auto t0 = high_resolution_clock::now();
+  for (size_t q = 0; q < num_queries; ++q) {
+    found += query(std::pmr::new_delete_resource(), q);
+  }
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  // A fresh arena per query is released all at once.
+  cout << "Scratch tries on a stack buffer...\n";
+  t0 = high_resolution_clock::now();
+  for (size_t q = 0; q < num_queries; ++q) {
+    char buffer[1 << 14];
+    std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer));
+    found += query(&arena, q);
+  }
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Scratch tries on a pool resource...\n";
+  std::pmr::unsynchronized_pool_resource pooled;
+  t0 = high_resolution_clock::now();
+  for (size_t q = 0; q < num_queries; ++q) {
+    found += query(&pooled, q);
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Found: " << found << " of " << 3 * num_queries << '\n';
+  print_duration(t0, t1);
+}
+
+void Perf_Test::Budget_Test(const vector<string>& word_list) {
+  size_t total_bytes = 0;
+  for (const auto& word : word_list) total_bytes += word.length();
+
+  cout << "Trie insertion...\n";
+  auto t0 = high_resolution_clock::now();
+  Trie words(word_list.begin(), word_list.end());
+  auto t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie insertion after reserve...\n";
+  t0 = high_resolution_clock::now();
+  Trie reserved;
+  reserved.reserve(word_list.size(), total_bytes);
+  for (const auto& word : word_list) reserved.insert(word);
+  t1 = high_resolution_clock::now();
+  print_duration(t0, t1);
+
+  cout << "Trie memory usage...\n";
+  const size_t before = heap_bytes();
+  t0 = high_resolution_clock::now();
+  const auto usage = words.memory_usage();
+  t1 = high_resolution_clock::now();
+  cout << usage << "Reserved total: " << reserved.memory_usage().total
+       << ", heap bytes of a copy: ";
+  {
+    const Trie copy(words);
+    cout << heap_bytes() - before << '\n';
+  }
+  print_duration(t0, t1);
+
+  // Inserts stop at the first key that does not fit, at no cost to others.
+  cout << "Trie insertion up to half the memory...\n";
+  Trie capped;
+  capped.set_memory_limit(usage.total / 2);
+  t0 = high_resolution_clock::now();
+  size_t refused = 0;
+  for (const auto& word : word_list) {
+    if (!capped.insert(word)) ++refused;
+  }
+  t1 = high_resolution_clock::now();
+  cout << "Keys: " << capped.size() << ", refused: " << refused
+       << ", total: " << capped.memory_usage().total << '\n';
   print_duration(t0, t1);
 }
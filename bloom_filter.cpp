@@ -0,0 +1,70 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for BloomFilter.
+*/
+#include "bloom_filter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+using std::string;
+
+namespace {
+/**
+ * @brief Derive a second hash for double hashing within a block.
+ * @param hash The hash of a key.
+ * @return A well mixed odd value.
+ */
+uint64_t rehash(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDULL;
+  hash ^= hash >> 33;
+  return hash | 1;
+}
+}  // namespace
+
+BloomFilter::BloomFilter(size_t capacity, size_t bits_per_key)
+    : bits(), num_hashes(0) {
+  const size_t num_blocks =
+      std::max<size_t>(1, (capacity * bits_per_key + 511) / 512);
+  bits.assign(num_blocks * BLOCK_WORDS, 0);
+  // bits_per_key * ln(2) hashes minimize the false positive rate.
+  num_hashes = std::min<size_t>(
+      16, std::max<size_t>(1, static_cast<size_t>(std::lround(
+                                  static_cast<double>(bits_per_key) * 0.69))));
+}
+
+size_t BloomFilter::block_of(uint64_t hash) const {
+  const size_t num_blocks = bits.size() / BLOCK_WORDS;
+  return static_cast<size_t>(((hash >> 32) * num_blocks) >> 32) * BLOCK_WORDS;
+}
+
+void BloomFilter::insert(const string& key) {
+  const uint64_t hash = std::hash<string>()(key);
+  uint64_t* block = bits.data() + block_of(hash);
+  const uint64_t step = rehash(hash);
+  uint64_t pos = hash;
+  for (size_t i = 0; i < num_hashes; ++i, pos += step) {
+    block[(pos >> 6) % BLOCK_WORDS] |= uint64_t{1} << (pos % 64);
+  }
+}
+
+bool BloomFilter::may_contain(const string& key) const {
+  const uint64_t hash = std::hash<string>()(key);
+  const uint64_t* block = bits.data() + block_of(hash);
+  const uint64_t step = rehash(hash);
+  uint64_t pos = hash;
+  for (size_t i = 0; i < num_hashes; ++i, pos += step) {
+    if (!(block[(pos >> 6) % BLOCK_WORDS] & (uint64_t{1} << (pos % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void BloomFilter::clear() { std::fill(bits.begin(), bits.end(), 0); }
+
+size_t BloomFilter::memory_usage() const {
+  return bits.size() * sizeof(uint64_t);
+}
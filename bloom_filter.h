@@ -0,0 +1,62 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for BloomFilter.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A blocked Bloom filter over strings. Every key sets all of its bits in
+ * a single 512 bit block, so a query touches one cache line. Keys cannot be
+ * removed, so the filter must be rebuilt to forget erased keys.
+ */
+class BloomFilter {
+ private:
+  static constexpr size_t BLOCK_WORDS = 8;
+  std::vector<uint64_t> bits;
+  size_t num_hashes;
+
+  /**
+   * @brief Get the block of a hash.
+   * @param hash The hash of a key.
+   * @return The offset of the first word of the block.
+   */
+  size_t block_of(uint64_t hash) const;
+
+ public:
+  /**
+   * @brief Construct an empty filter.
+   * @param capacity The number of keys the filter is sized for.
+   * @param bits_per_key The number of bits per key, which sets the false
+   * positive rate at capacity. Must be positive.
+   */
+  BloomFilter(size_t capacity, size_t bits_per_key);
+
+  /**
+   * @brief Add a key.
+   * @param key The key to add.
+   */
+  void insert(const std::string& key);
+
+  /**
+   * @brief Check for a key.
+   * @param key The key to check for.
+   * @return False if key was definitely never added. True if it may have been.
+   */
+  bool may_contain(const std::string& key) const;
+
+  /**
+   * @brief Forget every key.
+   */
+  void clear();
+
+  /**
+   * @brief Get the space used.
+   * @return The number of bytes used by the bits.
+   */
+  size_t memory_usage() const;
+};
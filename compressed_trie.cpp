@@ -0,0 +1,122 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for CompressedTrie.
+*/
+#include "compressed_trie.h"
+
+#include <utility>
+
+#include "successor.h"
+using std::string;
+using std::vector;
+
+CompressedTrie::CompressedTrie(const vector<string>& sample, size_t max_grams)
+    : encoder(sample, max_grams), tree() {}
+
+void CompressedTrie::prefix_range(const string& prefix, Trie::iterator& first,
+                                  Trie::iterator& last) const {
+  first = tree.lower_bound(encoder.encode(prefix));
+  string upper = prefix;
+  last = prefix_successor(upper) ? tree.lower_bound(encoder.encode(upper))
+                                 : tree.end();
+}
+
+bool CompressedTrie::empty(const string& prefix) const {
+  auto first = tree.end(), last = tree.end();
+  prefix_range(prefix, first, last);
+  return first == last;
+}
+
+size_t CompressedTrie::size(const string& prefix) const {
+  if (prefix.empty()) return tree.size();
+  auto first = tree.end(), last = tree.end();
+  prefix_range(prefix, first, last);
+  size_t count = 0;
+  for (; first != last; ++first) ++count;
+  return count;
+}
+
+const KeyEncoder& CompressedTrie::key_encoder() const { return encoder; }
+
+const Trie& CompressedTrie::encoded() const { return tree; }
+
+CompressedTrie::iterator CompressedTrie::begin() const {
+  return iterator(&encoder, tree.begin());
+}
+
+CompressedTrie::iterator CompressedTrie::end() const {
+  return iterator(&encoder, tree.end());
+}
+
+CompressedTrie::iterator CompressedTrie::begin(const string& prefix) const {
+  auto first = tree.end(), last = tree.end();
+  prefix_range(prefix, first, last);
+  return first == last ? end() : iterator(&encoder, first);
+}
+
+CompressedTrie::iterator CompressedTrie::end(const string& prefix) const {
+  auto first = tree.end(), last = tree.end();
+  prefix_range(prefix, first, last);
+  return first == last ? end() : iterator(&encoder, last);
+}
+
+CompressedTrie::iterator CompressedTrie::find(const string& key,
+                                              bool is_prefix) const {
+  if (is_prefix) return begin(key);
+  return iterator(&encoder, tree.find(encoder.encode(key)));
+}
+
+CompressedTrie::iterator CompressedTrie::lower_bound(const string& key) const {
+  return iterator(&encoder, tree.lower_bound(encoder.encode(key)));
+}
+
+CompressedTrie::iterator CompressedTrie::insert(const string& key) {
+  return iterator(&encoder, tree.insert(encoder.encode(key)));
+}
+
+void CompressedTrie::erase(const string& key, bool is_prefix) {
+  if (!is_prefix) {
+    tree.erase(encoder.encode(key));
+    return;
+  }
+  // Encoded keys with the prefix need not share an encoded prefix, so erase
+  // the range one key at a time.
+  auto first = tree.end(), last = tree.end();
+  prefix_range(key, first, last);
+  vector<string> codes;
+  for (; first != last; ++first) codes.push_back(*first);
+  for (const string& code : codes) tree.erase(code);
+}
+
+void CompressedTrie::clear() { tree.clear(); }
+
+CompressedTrie::iterator::iterator(const KeyEncoder* enc, Trie::iterator p)
+    : encoder(enc), pos(std::move(p)) {}
+
+CompressedTrie::iterator& CompressedTrie::iterator::operator++() {
+  ++pos;
+  return *this;
+}
+
+CompressedTrie::iterator CompressedTrie::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+string CompressedTrie::iterator::operator*() { return encoder->decode(*pos); }
+
+CompressedTrie::iterator::operator bool() const {
+  return static_cast<bool>(pos);
+}
+
+bool operator==(const CompressedTrie::iterator& lhs,
+                const CompressedTrie::iterator& rhs) {
+  return lhs.pos == rhs.pos;
+}
+
+bool operator!=(const CompressedTrie::iterator& lhs,
+                const CompressedTrie::iterator& rhs) {
+  return lhs.pos != rhs.pos;
+}
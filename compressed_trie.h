@@ -0,0 +1,223 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for CompressedTrie.
+*/
+#pragma once
+#include <cstddef>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "key_encoder.h"
+#include "trie.h"
+
+/**
+ * @brief A Trie whose keys are compressed by an order-preserving KeyEncoder
+ * before they are stored. Edge labels and comparisons operate on the shorter
+ * codes, and keys are decoded on iteration. Since encoding preserves order,
+ * every operation returns the same keys, in the same order, as a Trie holding
+ * the uncompressed keys.
+ *
+ * Prefixes are not preserved by encoding, so the keys with prefix P are found
+ * as the encoded range [encode(P), encode(S)), where S is the smallest string
+ * greater than every string with prefix P.
+ */
+class CompressedTrie {
+ private:
+  KeyEncoder encoder;
+  Trie tree;
+
+  /**
+   * @brief Get the encoded range of keys with the given prefix.
+   * @param prefix The prefix to search for.
+   * @param first Set to the first key with prefix.
+   * @param last Set to one past the last key with prefix.
+   */
+  void prefix_range(const std::string& prefix, Trie::iterator& first,
+                    Trie::iterator& last) const;
+
+ public:
+  /**
+   * Used to mark a parameter as passing in a prefix and not a full key.
+   */
+  static constexpr bool PREFIX_FLAG = true;
+
+  /**
+   * @brief Construct an empty trie with a dictionary learnt from sample.
+   * @param sample Keys representative of the keys that will be inserted.
+   * @param max_grams Upper bound on the number of learnt byte sequences.
+   */
+  explicit CompressedTrie(const std::vector<std::string>& sample,
+                          size_t max_grams = 128);
+
+  /* --- CONTAINER SIZE --- */
+
+  /**
+   * @brief Check if the trie is empty.
+   * @param prefix The prefix on which to check for emptiness.
+   * @return Whether or not the trie is empty starting at given prefix.
+   */
+  bool empty(const std::string& prefix = "") const;
+
+  /**
+   * @brief Get the size of the trie under the prefix.
+   * @param prefix The prefix on which to check for size.
+   * @return The number of words stored in the trie with given prefix.
+   */
+  size_t size(const std::string& prefix = "") const;
+
+  /**
+   * @brief Get the key compressor.
+   * @return The encoder used for every stored key.
+   */
+  const KeyEncoder& key_encoder() const;
+
+  /**
+   * @brief Get the underlying trie of compressed keys.
+   * @return The trie of encoded keys.
+   */
+  const Trie& encoded() const;
+
+  /* --- ITERATION --- */
+
+  /**
+   * @brief Supports const forward iteration over the decoded keys.
+   */
+  class iterator {
+    friend class CompressedTrie;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    const KeyEncoder* encoder;
+    Trie::iterator pos;
+
+    /**
+     * @brief Constructor.
+     * @param enc The encoder used to decode keys.
+     * @param p The position in the trie of encoded keys.
+     */
+    iterator(const KeyEncoder* enc, Trie::iterator p);
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The decoded string referred to by this.
+     */
+    std::string operator*();
+
+    /**
+     * @brief Implicit conversion to bool.
+     * @return Whether or not the iterator points at a key.
+     */
+    operator bool() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const CompressedTrie::iterator& lhs,
+                           const CompressedTrie::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const CompressedTrie::iterator& lhs,
+                           const CompressedTrie::iterator& rhs);
+  };
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the beginning of the trie.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the end of the trie.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Prefix ranged begin iterator. Like Trie, returns a null iterator if
+   * none of the keys have the given prefix.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the start of the range with given prefix.
+   */
+  iterator begin(const std::string& prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator. Like Trie, returns a null iterator if
+   * none of the keys have the given prefix.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to one past the end of the range with given prefix.
+   */
+  iterator end(const std::string& prefix) const;
+
+  /* --- SEARCHING --- */
+
+  /**
+   * @brief Searches for key in trie.
+   * @param key The key used to search the trie.
+   * @param is_prefix Flags whether or not to treat the key as a prefix.
+   * @return An iterator to it if it exists. Otherwise, returns a null iterator.
+   * If is_prefix is true, returns an iterator to the first key that matches the
+   * prefix.
+   */
+  iterator find(const std::string& key, bool is_prefix = !PREFIX_FLAG) const;
+
+  /**
+   * @brief Searches for the first key that is not less than key.
+   * @param key The bound to search for, which need not be in the trie.
+   * @return An iterator to the first key not less than key, or a null iterator.
+   */
+  iterator lower_bound(const std::string& key) const;
+
+  /* --- INSERTION --- */
+
+  /**
+   * @brief Inserts key into trie. Idempotent if key already in trie.
+   * @param key The key to insert into the trie.
+   * @return An iterator to the key (whether inserted or not).
+   */
+  iterator insert(const std::string& key);
+
+  /* --- DELETION --- */
+
+  /**
+   * @brief Erases key from trie. If prefix flag is set, erases all keys that
+   * have the key as prefix from the trie. Idempotent if key (or prefix) is not
+   * in trie.
+   * @param key The key to erase from the trie.
+   * @param is_prefix Flag for treating key as a prefix.
+   */
+  void erase(const std::string& key, bool is_prefix = !PREFIX_FLAG);
+
+  /**
+   * @brief Erases all keys from trie. Idempotent on empty tries.
+   */
+  void clear();
+};
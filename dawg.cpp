@@ -0,0 +1,231 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for Dawg.
+*/
+#include "dawg.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+using std::numeric_limits;
+using std::ostream;
+using std::runtime_error;
+using std::string;
+using std::unordered_map;
+using std::vector;
+
+namespace {
+/**
+ * @brief Append the bytes of a 32-bit value to a signature.
+ * @param sig The signature to append to.
+ * @param val The value to append.
+ */
+void append_u32(string& sig, uint32_t val) {
+  for (int shift = 0; shift < 32; shift += 8) {
+    sig.push_back(static_cast<char>((val >> shift) & 0xFF));
+  }
+}
+}  // namespace
+
+uint32_t Dawg::minimize(const Trie& tree, Trie::Ref rt,
+                        unordered_map<string, uint32_t>& signatures,
+                        unordered_map<string, uint32_t>& pool) {
+  const Trie::Node& trie_node = tree.at(rt);
+  ++summary.trie_nodes;
+  summary.trie_bytes += sizeof(Trie::Node);
+
+  // Minimize every child first and record the edges that rt would own.
+  vector<Edge> out;
+  out.reserve(trie_node.children.size());
+  for (const auto& trie_edge : trie_node.children) {
+    const string label(trie_edge.label);
+    // Edge in the child vector, and heap allocated label if any.
+    summary.trie_bytes += sizeof(Trie::Edge);
+    if (label.length() > 15) summary.trie_bytes += label.length() + 1;
+
+    const uint32_t target = minimize(tree, trie_edge.child, signatures, pool);
+    auto pool_iter = pool.find(label);
+    if (pool_iter == pool.end()) {
+      pool_iter =
+          pool.emplace(label, static_cast<uint32_t>(labels.length())).first;
+      labels += label;
+    }
+    out.push_back(
+        Edge{pool_iter->second, static_cast<uint32_t>(label.length()), target});
+  }
+
+  // Two subtrees are equivalent iff is_end, labels and child ids all match.
+  string sig(1, trie_node.is_end() ? '1' : '0');
+  for (const Edge& e : out) {
+    append_u32(sig, e.label_offset);
+    append_u32(sig, e.label_length);
+    append_u32(sig, e.target);
+  }
+  const auto sig_iter = signatures.find(sig);
+  if (sig_iter != signatures.end()) return sig_iter->second;
+
+  if (nodes.size() == numeric_limits<uint32_t>::max())
+    throw runtime_error("Dawg has too many nodes.");
+  const auto id = static_cast<uint32_t>(nodes.size());
+  const bool is_end = trie_node.is_end();
+  Node node{static_cast<uint32_t>(edges.size()), is_end ? 1U : 0U,
+            static_cast<uint16_t>(out.size()), is_end};
+  for (const Edge& e : out) {
+    node.count += nodes[e.target].count;
+    edges.push_back(e);
+  }
+  nodes.push_back(node);
+  signatures.emplace(std::move(sig), id);
+  return id;
+}
+
+Dawg::Dawg(const Trie& tree) : root(0), summary{0, 0, 0, 0, 0} {
+  unordered_map<string, uint32_t> signatures;
+  unordered_map<string, uint32_t> pool;
+  root = minimize(tree, tree.root, signatures, pool);
+
+  nodes.shrink_to_fit();
+  edges.shrink_to_fit();
+  labels.shrink_to_fit();
+  summary.dawg_nodes = nodes.size();
+  summary.dawg_edges = edges.size();
+  summary.dawg_bytes = sizeof(Dawg) + nodes.size() * sizeof(Node) +
+                       edges.size() * sizeof(Edge) + labels.capacity();
+}
+
+size_t Dawg::common_length(const Edge& e, const string& key,
+                           size_t pos) const {
+  const size_t limit = std::min<size_t>(e.label_length, key.length() - pos);
+  size_t i = 0;
+  while (i < limit && labels[e.label_offset + i] == key[pos + i]) ++i;
+  return i;
+}
+
+bool Dawg::contains(const string& key) const {
+  uint32_t cur = root;
+  size_t pos = 0;
+  while (pos < key.length()) {
+    const Node& node = nodes[cur];
+    bool descended = false;
+    for (uint32_t i = 0; i < node.num_edges; ++i) {
+      const Edge& e = edges[node.first_edge + i];
+      // Children never share a first character, so only one can match.
+      if (labels[e.label_offset] != key[pos]) continue;
+      if (common_length(e, key, pos) != e.label_length) return false;
+      pos += e.label_length;
+      cur = e.target;
+      descended = true;
+      break;
+    }
+    if (!descended) return false;
+  }
+  return nodes[cur].is_end;
+}
+
+size_t Dawg::size() const { return nodes[root].count; }
+
+size_t Dawg::rank(const string& key) const {
+  bool found = false;
+  return rank(key, found);
+}
+
+size_t Dawg::rank(const string& key, bool& found) const {
+  size_t acc = 0;
+  uint32_t cur = root;
+  size_t pos = 0;
+  found = false;
+  while (pos < key.length()) {
+    const Node& node = nodes[cur];
+    // The key at this node is a proper prefix of key, so it is smaller.
+    if (node.is_end) ++acc;
+    bool descended = false;
+    for (uint32_t i = 0; i < node.num_edges; ++i) {
+      const Edge& e = edges[node.first_edge + i];
+      const size_t common = common_length(e, key, pos);
+      if (common == e.label_length) {
+        pos += e.label_length;
+        cur = e.target;
+        descended = true;
+        break;
+      }
+      // Everything under this edge and its right siblings is greater.
+      if (pos + common == key.length()) return acc;
+      const auto lhs =
+          static_cast<unsigned char>(labels[e.label_offset + common]);
+      const auto rhs = static_cast<unsigned char>(key[pos + common]);
+      if (lhs > rhs) return acc;
+      // Everything under this edge is smaller.
+      acc += nodes[e.target].count;
+    }
+    if (!descended) return acc;
+  }
+  found = nodes[cur].is_end;
+  return acc;
+}
+
+const Dawg::Stats& Dawg::stats() const { return summary; }
+
+Dawg::iterator::iterator(const Dawg* g) : graph(g), path(), key() {
+  if (!graph) return;
+  path.emplace_back(graph->root, 0);
+  if (!graph->nodes[graph->root].is_end) advance();
+}
+
+void Dawg::iterator::advance() {
+  while (!path.empty()) {
+    auto& frame = path.back();
+    const Node& node = graph->nodes[frame.first];
+    if (frame.second < node.num_edges) {
+      // Descend along the next unexplored edge.
+      const Edge& e = graph->edges[node.first_edge + frame.second];
+      ++frame.second;
+      key.append(graph->labels, e.label_offset, e.label_length);
+      path.emplace_back(e.target, 0);
+      if (graph->nodes[e.target].is_end) return;
+    } else {
+      // Every edge has been explored, so move back up.
+      path.pop_back();
+      if (path.empty()) break;
+      const Node& par = graph->nodes[path.back().first];
+      const Edge& e = graph->edges[par.first_edge + path.back().second - 1];
+      key.resize(key.length() - e.label_length);
+    }
+  }
+  graph = nullptr;
+}
+
+Dawg::iterator& Dawg::iterator::operator++() {
+  advance();
+  return *this;
+}
+
+Dawg::iterator Dawg::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& Dawg::iterator::operator*() const { return key; }
+
+Dawg::iterator Dawg::begin() const { return iterator(this); }
+
+Dawg::iterator Dawg::end() const { return iterator(); }
+
+bool operator==(const Dawg::iterator& lhs, const Dawg::iterator& rhs) {
+  // End iterators have no graph. Otherwise the current keys must match.
+  if (!lhs.graph || !rhs.graph) return lhs.graph == rhs.graph;
+  return lhs.graph == rhs.graph && lhs.key == rhs.key;
+}
+
+bool operator!=(const Dawg::iterator& lhs, const Dawg::iterator& rhs) {
+  return !(lhs == rhs);
+}
+
+ostream& operator<<(ostream& os, const Dawg::Stats& stats) {
+  os << "Trie nodes: " << stats.trie_nodes << " (" << stats.trie_bytes
+     << " bytes)\n";
+  os << "DAWG nodes: " << stats.dawg_nodes << ", edges: " << stats.dawg_edges
+     << " (" << stats.dawg_bytes << " bytes)\n";
+  return os;
+}
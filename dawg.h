@@ -0,0 +1,223 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for Dawg.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "trie.h"
+
+/**
+ * @brief A directed acyclic word graph (minimal acyclic automaton) built from
+ * a Trie. Equivalent subtrees of the radix tree (same is_end and same labelled
+ * edges to equivalent children) are hash-consed into a single node, so common
+ * suffixes such as "ing" or "ness" are stored once. The structure is frozen.
+ *
+ * Every node records the number of keys reachable from it, which allows keys
+ * to be ranked in O(|key|) even though nodes are shared.
+ */
+class Dawg {
+ private:
+  /**
+   * @brief A labelled edge. The label is a slice of the shared label pool.
+   */
+  struct Edge {
+    uint32_t label_offset;
+    uint32_t label_length;
+    uint32_t target;
+  };
+
+  /**
+   * @brief A node owns the contiguous range of edges starting at first_edge.
+   */
+  struct Node {
+    uint32_t first_edge;
+    uint32_t count;
+    uint16_t num_edges;
+    bool is_end;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<Edge> edges;
+  std::string labels;
+  uint32_t root;
+
+  // Dictionary encoding walks the counted nodes directly.
+  friend class Dictionary;
+
+  /**
+   * @brief Compare a label with the key starting at pos.
+   * @param e The edge whose label is compared.
+   * @param key The key being searched for.
+   * @param pos The offset into key at which the comparison starts.
+   * @return The number of leading characters the label and key share.
+   */
+  size_t common_length(const Edge& e, const std::string& key,
+                       size_t pos) const;
+
+  /**
+   * @brief Recursively hash-cons the subtree at rt. Children are minimized
+   * before their parent, so a node's signature can refer to child ids.
+   * @param tree The trie that rt belongs to.
+   * @param rt The trie node to minimize.
+   * @param signatures Maps node signatures to existing node ids.
+   * @param pool Maps edge labels to offsets into labels.
+   * @return The id of the node equivalent to rt.
+   */
+  uint32_t minimize(const Trie& tree, Trie::Ref rt,
+                    std::unordered_map<std::string, uint32_t>& signatures,
+                    std::unordered_map<std::string, uint32_t>& pool);
+
+ public:
+  /**
+   * @brief Statistics comparing the DAWG with the trie it was built from.
+   */
+  struct Stats {
+    size_t trie_nodes;
+    size_t trie_bytes;
+    size_t dawg_nodes;
+    size_t dawg_edges;
+    size_t dawg_bytes;
+  };
+
+  /**
+   * @brief Minimize tree into a DAWG.
+   * @param tree The trie to minimize. It is not modified.
+   */
+  explicit Dawg(const Trie& tree);
+
+  /**
+   * @brief Check for membership.
+   * @param key The key to search for.
+   * @return Whether or not key was in the original trie.
+   */
+  bool contains(const std::string& key) const;
+
+  /**
+   * @brief Get the number of keys stored.
+   * @return The number of keys in the original trie.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Rank a key. The key need not be stored.
+   * @param key The key to rank.
+   * @return The number of stored keys that are strictly less than key.
+   */
+  size_t rank(const std::string& key) const;
+
+  /**
+   * @brief Rank a key, and check whether it is stored, in one descent.
+   * @param key The key to rank.
+   * @param found Set to whether or not key is stored.
+   * @return The number of stored keys that are strictly less than key.
+   */
+  size_t rank(const std::string& key, bool& found) const;
+
+  /**
+   * @brief Get the size reduction obtained by minimization.
+   * @return Node and byte counts of the original trie and of this.
+   */
+  const Stats& stats() const;
+
+  /**
+   * @brief Supports const forward iteration in alphabetical order. Since nodes
+   * are shared, the iterator carries the path from the root explicitly.
+   */
+  class iterator {
+    friend class Dawg;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    const Dawg* graph;
+    // Each frame holds a node and the index of the next edge to explore.
+    std::vector<std::pair<uint32_t, uint32_t>> path;
+    std::string key;
+
+    /**
+     * @brief Constructor, the end iterator by default.
+     * @param g The graph to iterate over, or null for the end iterator.
+     */
+    explicit iterator(const Dawg* g = nullptr);
+
+    /**
+     * @brief Advance to the next node with is_end along the path.
+     */
+    void advance();
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The key referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const Dawg::iterator& lhs,
+                           const Dawg::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const Dawg::iterator& lhs,
+                           const Dawg::iterator& rhs);
+  };
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the smallest key.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the largest key.
+   */
+  iterator end() const;
+
+ private:
+  Stats summary;
+};
+
+/**
+ * @brief Outputs the node and memory reduction of a DAWG.
+ * @param os The output stream.
+ * @param stats The statistics to write.
+ * @return std::ostream& os
+ */
+std::ostream& operator<<(std::ostream& os, const Dawg::Stats& stats);
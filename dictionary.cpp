@@ -0,0 +1,77 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for Dictionary.
+*/
+#include "dictionary.h"
+
+#include <stdexcept>
+using std::out_of_range;
+using std::string;
+using std::vector;
+
+Dictionary::Dictionary(const Trie& tree) : graph(tree) {}
+
+size_t Dictionary::size() const { return graph.size(); }
+
+size_t Dictionary::memory_usage() const { return graph.stats().dawg_bytes; }
+
+bool Dictionary::contains(const string& key) const {
+  return graph.contains(key);
+}
+
+Dictionary::id_type Dictionary::id_of(const string& key) const {
+  bool found = false;
+  const auto id = static_cast<id_type>(graph.rank(key, found));
+  if (!found) throw out_of_range("Dictionary::id_of on missing key " + key);
+  return id;
+}
+
+string Dictionary::key_of(id_type id) const {
+  if (id >= size()) throw out_of_range("Dictionary::key_of on invalid id");
+  string key;
+  uint32_t cur = graph.root;
+  // Number of keys under cur that still precede the target.
+  id_type remaining = id;
+  while (true) {
+    const Dawg::Node& node = graph.nodes[cur];
+    if (node.is_end) {
+      if (remaining == 0) return key;
+      --remaining;
+    }
+    // Skip over every child whose keys all precede the target.
+    for (uint32_t i = 0; i < node.num_edges; ++i) {
+      const Dawg::Edge& e = graph.edges[node.first_edge + i];
+      const uint32_t count = graph.nodes[e.target].count;
+      if (remaining < count) {
+        key.append(graph.labels, e.label_offset, e.label_length);
+        cur = e.target;
+        break;
+      }
+      remaining -= count;
+    }
+  }
+}
+
+Dictionary::id_type Dictionary::lower_bound(const string& key) const {
+  return static_cast<id_type>(graph.rank(key));
+}
+
+vector<Dictionary::id_type> Dictionary::encode(
+    const vector<string>& keys) const {
+  vector<id_type> ids;
+  ids.reserve(keys.size());
+  for (const string& key : keys) {
+    ids.push_back(id_of(key));
+  }
+  return ids;
+}
+
+vector<string> Dictionary::decode(const vector<id_type>& ids) const {
+  vector<string> keys;
+  keys.reserve(ids.size());
+  for (const id_type id : ids) {
+    keys.push_back(key_of(id));
+  }
+  return keys;
+}
@@ -0,0 +1,90 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for Dictionary.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "dawg.h"
+#include "trie.h"
+
+/**
+ * @brief A frozen, order-preserving dictionary encoding. Every key of the
+ * source Trie is mapped to a dense id equal to its alphabetical rank, so
+ * comparisons between ids agree with comparisons between keys. Both directions
+ * take O(|key|) steps on the counted, minimized graph of the keys.
+ */
+class Dictionary {
+ public:
+  using id_type = uint32_t;
+
+ private:
+  Dawg graph;
+
+ public:
+  /**
+   * @brief Build the dictionary from the keys of a trie.
+   * @param tree The trie to encode. It is not modified.
+   */
+  explicit Dictionary(const Trie& tree);
+
+  /**
+   * @brief Get the number of keys (and hence ids).
+   * @return The number of keys in the dictionary.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get the memory footprint.
+   * @return The number of bytes used by the encoding.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Check for membership.
+   * @param key The key to search for.
+   * @return Whether or not key has an id.
+   */
+  bool contains(const std::string& key) const;
+
+  /**
+   * @brief Get the id of a key. Throws std::out_of_range if key is missing.
+   * @param key The key to encode.
+   * @return The alphabetical rank of key.
+   */
+  id_type id_of(const std::string& key) const;
+
+  /**
+   * @brief Get the key with the given id. Throws std::out_of_range if id is
+   * not less than size().
+   * @param id The id to decode.
+   * @return The key whose alphabetical rank is id.
+   */
+  std::string key_of(id_type id) const;
+
+  /**
+   * @brief Translate a string bound into an id bound. Keys in [lo, hi) are
+   * exactly the keys with ids in [lower_bound(lo), lower_bound(hi)).
+   * @param key The bound, which need not be stored.
+   * @return The number of stored keys strictly less than key.
+   */
+  id_type lower_bound(const std::string& key) const;
+
+  /**
+   * @brief Encode a batch of keys. Throws std::out_of_range on missing keys.
+   * @param keys The keys to encode.
+   * @return The ids of keys, in the same order.
+   */
+  std::vector<id_type> encode(const std::vector<std::string>& keys) const;
+
+  /**
+   * @brief Decode a batch of ids. Throws std::out_of_range on invalid ids.
+   * @param ids The ids to decode.
+   * @return The keys of ids, in the same order.
+   */
+  std::vector<std::string> decode(const std::vector<id_type>& ids) const;
+};
@@ -0,0 +1,304 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for DurableTrie.
+*/
+#include "durable_trie.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "varint.h"
+using std::ifstream;
+using std::invalid_argument;
+using std::ofstream;
+using std::runtime_error;
+using std::string;
+
+namespace {
+// Record types, followed by a varint key length, the key, and a checksum.
+constexpr char INSERT_RECORD = 'I';
+constexpr char ERASE_RECORD = 'E';
+constexpr char PREFIX_RECORD = 'P';
+constexpr size_t CHECKSUM_BYTES = 4;
+const char LOG_FILE[] = "wal";
+// The root file holds its magic bytes, the generation of the data file, the
+// offset of the root record, the committed length of the data file, and the
+// length of its last full rewrite.
+const char ROOT_FILE[] = "checkpoint";
+const char ROOT_TEMP[] = "checkpoint.tmp";
+const char ROOT_MAGIC[8] = "TRIEROT";
+constexpr size_t ROOT_FIELDS = 4;
+// Data files are named after their generation and start with magic bytes.
+const char DATA_MAGIC[8] = "TRIECKP";
+
+/**
+ * @brief Get the name of a data file.
+ * @param gen The generation of the data file.
+ * @return The name of the data file.
+ */
+string data_file(uint64_t gen) { return "checkpoint." + std::to_string(gen); }
+
+/**
+ * @brief FNV-1a hash of a run of bytes, which detects torn records.
+ * @param data The first byte.
+ * @param len The number of bytes.
+ * @return The 32 bit hash.
+ */
+uint32_t checksum(const char* data, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * @brief Read a varint without running past the end of the input.
+ * @param in The input.
+ * @param pos The offset to read at, advanced past the varint.
+ * @param val Set to the value read.
+ * @return Whether or not a whole varint was read.
+ */
+bool read_varint(const string& in, size_t& pos, size_t& val) {
+  val = 0;
+  for (unsigned shift = 0; shift < 64 && pos < in.length(); shift += 7) {
+    const auto byte = static_cast<unsigned char>(in[pos++]);
+    val |= static_cast<size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Write every byte to a file descriptor.
+ * @param fd The file descriptor.
+ * @param data The bytes to write.
+ */
+void write_all(int fd, const string& data) {
+  size_t done = 0;
+  while (done < data.length()) {
+    const ssize_t n = ::write(fd, data.data() + done, data.length() - done);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) throw runtime_error("Cannot write the trie log.");
+    done += static_cast<size_t>(n);
+  }
+}
+
+/**
+ * @brief Flush a file or directory to disk.
+ * @param file The path of the file or directory.
+ */
+void sync_path(const string& file) {
+  const int fd = ::open(file.c_str(), O_RDONLY);
+  if (fd < 0) throw runtime_error("Cannot open " + file + ".");
+  const int res = fsync(fd);
+  close(fd);
+  if (res != 0) throw runtime_error("Cannot sync " + file + ".");
+}
+}  // namespace
+
+DurableTrie::DurableTrie(const string& dir_in, size_t group_commit_in,
+                         size_t checkpoint_bytes_in)
+    : tree(),
+      dir(dir_in),
+      log_fd(-1),
+      group_commit(group_commit_in),
+      checkpoint_bytes(checkpoint_bytes_in),
+      pending(),
+      num_pending(0),
+      log_bytes(0),
+      num_recovered(0),
+      data_gen(0),
+      data_bytes(0),
+      full_bytes(0),
+      last_written(0) {
+  if (group_commit == 0)
+    throw invalid_argument("DurableTrie group commit must be positive.");
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST)
+    throw runtime_error("Cannot create " + dir + ".");
+  recover();
+  log_fd = ::open(path(LOG_FILE).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+  if (log_fd < 0) throw runtime_error("Cannot open " + path(LOG_FILE) + ".");
+}
+
+DurableTrie::~DurableTrie() {
+  // Destructors must not throw, and unflushed records may be lost anyway.
+  try {
+    sync();
+  } catch (const runtime_error&) {
+  }
+  close(log_fd);
+}
+
+string DurableTrie::path(const string& file) const { return dir + "/" + file; }
+
+void DurableTrie::recover() {
+  ifstream root_in(path(ROOT_FILE), std::ios::binary);
+  if (root_in) {
+    char magic[sizeof(ROOT_MAGIC)];
+    uint64_t fields[ROOT_FIELDS];
+    root_in.read(magic, sizeof(magic));
+    root_in.read(reinterpret_cast<char*>(fields), sizeof(fields));
+    if (!root_in || std::memcmp(magic, ROOT_MAGIC, sizeof(magic)) != 0)
+      throw runtime_error("Corrupt " + path(ROOT_FILE) + ".");
+    data_gen = fields[0];
+    data_bytes = fields[2];
+    full_bytes = fields[3];
+
+    // Bytes past the committed length are from an unfinished checkpoint.
+    ifstream data_in(path(data_file(data_gen)), std::ios::binary);
+    string data((std::istreambuf_iterator<char>(data_in)),
+                std::istreambuf_iterator<char>());
+    if (data.length() < data_bytes)
+      throw runtime_error("Truncated " + path(data_file(data_gen)) + ".");
+    data.resize(data_bytes);
+    tree.load_checkpoint(data, fields[1]);
+  }
+
+  ifstream fin(path(LOG_FILE), std::ios::binary);
+  const string data((std::istreambuf_iterator<char>(fin)),
+                    std::istreambuf_iterator<char>());
+  // Replay whole records, stopping at the first torn or corrupt one.
+  size_t pos = 0;
+  string key;
+  while (pos < data.length()) {
+    const size_t start = pos;
+    const char type = data[pos++];
+    size_t len = 0;
+    if (!read_varint(data, pos, len) || len > data.length() - pos ||
+        CHECKSUM_BYTES > data.length() - pos - len)
+      break;
+    key.assign(data, pos, len);
+    pos += len;
+    uint32_t stored = 0;
+    for (size_t i = 0; i < CHECKSUM_BYTES; ++i) {
+      stored |= static_cast<uint32_t>(static_cast<unsigned char>(data[pos++]))
+                << (8 * i);
+    }
+    if (stored != checksum(data.data() + start, pos - CHECKSUM_BYTES - start))
+      break;
+
+    if (type == INSERT_RECORD) {
+      tree.insert(key);
+    } else if (type == ERASE_RECORD) {
+      tree.erase(key);
+    } else if (type == PREFIX_RECORD) {
+      tree.erase(key, Trie::PREFIX_FLAG);
+    } else {
+      break;
+    }
+    ++num_recovered;
+    log_bytes = pos;
+  }
+
+  // Cut off the torn tail so that new records follow the last whole one.
+  if (log_bytes < data.length() &&
+      truncate(path(LOG_FILE).c_str(), static_cast<off_t>(log_bytes)) != 0)
+    throw runtime_error("Cannot truncate " + path(LOG_FILE) + ".");
+}
+
+void DurableTrie::log(char type, const string& key) {
+  const size_t start = pending.length();
+  pending.push_back(type);
+  put_varint(pending, key.length());
+  pending += key;
+  const uint32_t sum =
+      checksum(pending.data() + start, pending.length() - start);
+  for (size_t i = 0; i < CHECKSUM_BYTES; ++i) {
+    pending.push_back(static_cast<char>(sum >> (8 * i)));
+  }
+  log_bytes += pending.length() - start;
+
+  if (++num_pending >= group_commit) sync();
+  if (log_bytes >= checkpoint_bytes) checkpoint();
+}
+
+const Trie& DurableTrie::trie() const { return tree; }
+
+void DurableTrie::insert(const string& key) {
+  tree.insert(key);
+  log(INSERT_RECORD, key);
+}
+
+void DurableTrie::erase(const string& key, bool is_prefix) {
+  tree.erase(key, is_prefix);
+  log(is_prefix ? PREFIX_RECORD : ERASE_RECORD, key);
+}
+
+void DurableTrie::sync() {
+  if (pending.empty()) return;
+  write_all(log_fd, pending);
+  if (fdatasync(log_fd) != 0) throw runtime_error("Cannot sync the trie log.");
+  pending.clear();
+  num_pending = 0;
+}
+
+void DurableTrie::checkpoint() {
+  sync();
+  // Rewrite everything into a new data file once garbage piles up.
+  const bool full = data_gen == 0 || data_bytes > COMPACT_RATIO * full_bytes;
+  const uint64_t gen = full ? data_gen + 1 : data_gen;
+  const string data_path = path(data_file(gen));
+  uint64_t offset = full ? sizeof(DATA_MAGIC) : data_bytes;
+  uint64_t root = 0;
+  try {
+    if (full) {
+      tree.forget_checkpoint();
+    } else if (truncate(data_path.c_str(), static_cast<off_t>(data_bytes))) {
+      // Drop what a failed checkpoint may have left past the committed length.
+      throw runtime_error("Cannot truncate " + data_path + ".");
+    }
+    ofstream fout(data_path, std::ios::binary |
+                                 (full ? std::ios::trunc : std::ios::app));
+    if (full) fout.write(DATA_MAGIC, sizeof(DATA_MAGIC));
+    root = tree.save_changes(fout, offset);
+    if (!fout.flush()) throw runtime_error("Cannot write " + data_path + ".");
+    fout.close();
+    sync_path(data_path);
+
+    // The rename commits the checkpoint atomically, once its data is on disk.
+    const uint64_t fields[ROOT_FIELDS] = {gen, root, offset,
+                                          full ? offset : full_bytes};
+    ofstream root_out(path(ROOT_TEMP), std::ios::binary | std::ios::trunc);
+    root_out.write(ROOT_MAGIC, sizeof(ROOT_MAGIC));
+    root_out.write(reinterpret_cast<const char*>(fields), sizeof(fields));
+    if (!root_out.flush())
+      throw runtime_error("Cannot write " + path(ROOT_TEMP) + ".");
+    root_out.close();
+    sync_path(path(ROOT_TEMP));
+    if (rename(path(ROOT_TEMP).c_str(), path(ROOT_FILE).c_str()) != 0)
+      throw runtime_error("Cannot replace " + path(ROOT_FILE) + ".");
+    sync_path(dir);
+  } catch (...) {
+    // Offsets saved in the nodes may refer to uncommitted bytes.
+    tree.forget_checkpoint();
+    throw;
+  }
+
+  if (full && data_gen != 0) unlink(path(data_file(data_gen)).c_str());
+  if (full) full_bytes = offset;
+  last_written = offset - (full ? 0 : data_bytes);
+  data_gen = gen;
+  data_bytes = offset;
+
+  // A crash before the log is emptied only replays it again.
+  if (ftruncate(log_fd, 0) != 0 || fdatasync(log_fd) != 0)
+    throw runtime_error("Cannot truncate " + path(LOG_FILE) + ".");
+  log_bytes = 0;
+}
+
+size_t DurableTrie::last_checkpoint_bytes() const {
+  return static_cast<size_t>(last_written);
+}
+
+size_t DurableTrie::recovered() const { return num_recovered; }
@@ -0,0 +1,140 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for DurableTrie.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "trie.h"
+
+/**
+ * @brief A Trie whose updates survive crashes. Each insert, erase, and prefix
+ * erase appends a checksummed record to a write-ahead log in a directory, and
+ * the log is flushed to disk once every group_commit records (group commit),
+ * or on sync. Once the log outgrows checkpoint_bytes, a checkpoint is taken
+ * and the log is emptied.
+ *
+ * Checkpoints are incremental. They append the records of the nodes changed
+ * since the previous checkpoint to a data file (see Trie::save_changes), which
+ * refer to unchanged subtrees by offset, and then atomically replace a small
+ * root file naming the data file, the root record, and the committed length.
+ * Checkpoint I/O is thus proportional to the number of changed nodes. Once
+ * the data file grows to COMPACT_RATIO times the size of its last full
+ * rewrite, the next checkpoint rewrites the whole trie into a new data file.
+ *
+ * Opening a directory recovers the trie by loading the checkpoint and then
+ * replaying the log. A record torn by a crash ends the replay and is cut off.
+ * Replaying records that a checkpoint already holds is harmless, since every
+ * record sets the membership of its keys regardless of their prior state.
+ *
+ * Updates since the last flush, at most group_commit - 1 of them, may be lost
+ * in a crash. Only one DurableTrie may use a directory at a time.
+ */
+class DurableTrie {
+ private:
+  Trie tree;
+  std::string dir;
+  int log_fd;
+  size_t group_commit;
+  size_t checkpoint_bytes;
+  // Records not yet written to the log, and their number.
+  std::string pending;
+  size_t num_pending;
+  size_t log_bytes;
+  size_t num_recovered;
+  // The current data file, its committed length, the length of its last full
+  // rewrite, and the bytes appended by the last checkpoint.
+  uint64_t data_gen;
+  uint64_t data_bytes;
+  uint64_t full_bytes;
+  uint64_t last_written;
+
+  /**
+   * @brief Load the checkpoint, replay the log, and cut off any torn tail.
+   */
+  void recover();
+
+  /**
+   * @brief Append a record for an update, applied to the trie by the caller.
+   * @param type The kind of update.
+   * @param key The key or prefix of the update.
+   */
+  void log(char type, const std::string& key);
+
+  /**
+   * @brief Get the path of a file in the directory.
+   * @param file The name of the file.
+   * @return The path of the file.
+   */
+  std::string path(const std::string& file) const;
+
+ public:
+  static constexpr size_t DEFAULT_GROUP_COMMIT = 64;
+  static constexpr uint64_t COMPACT_RATIO = 2;
+  static constexpr size_t DEFAULT_CHECKPOINT_BYTES = size_t{64} << 20;
+
+  /**
+   * @brief Open or create a durable trie, recovering its keys. Throws
+   * std::runtime_error if the directory or its files cannot be used.
+   * @param dir_in The directory holding the checkpoint and the log. Created
+   * if missing.
+   * @param group_commit_in The number of records per flush. Must be positive.
+   * @param checkpoint_bytes_in The log size that triggers a checkpoint.
+   */
+  explicit DurableTrie(const std::string& dir_in,
+                       size_t group_commit_in = DEFAULT_GROUP_COMMIT,
+                       size_t checkpoint_bytes_in = DEFAULT_CHECKPOINT_BYTES);
+
+  DurableTrie(const DurableTrie&) = delete;
+  DurableTrie& operator=(const DurableTrie&) = delete;
+
+  /**
+   * @brief Destructor, flushes the log.
+   */
+  ~DurableTrie();
+
+  /**
+   * @brief Get the trie for searching and iteration.
+   * @return The recovered trie with every update applied.
+   */
+  const Trie& trie() const;
+
+  /**
+   * @brief Inserts key and logs it. Idempotent if key is already stored.
+   * @param key The key to insert.
+   */
+  void insert(const std::string& key);
+
+  /**
+   * @brief Erases key, or every key with the prefix key if is_prefix is set,
+   * and logs it. Idempotent if nothing matches.
+   * @param key The key or prefix to erase.
+   * @param is_prefix Flag for treating key as a prefix.
+   */
+  void erase(const std::string& key, bool is_prefix = !Trie::PREFIX_FLAG);
+
+  /**
+   * @brief Write and flush every logged update, making all of them durable.
+   */
+  void sync();
+
+  /**
+   * @brief Save the changes since the last checkpoint and empty the log.
+   */
+  void checkpoint();
+
+  /**
+   * @brief Get the size of the last checkpoint.
+   * @return The number of bytes appended by the last checkpoint.
+   */
+  size_t last_checkpoint_bytes() const;
+
+  /**
+   * @brief Get the number of log records replayed when opening.
+   * @return The number of records recovered from the log.
+   */
+  size_t recovered() const;
+};
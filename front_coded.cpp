@@ -0,0 +1,142 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for FrontCoded.
+*/
+#include "front_coded.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+#include "successor.h"
+#include "varint.h"
+using std::invalid_argument;
+using std::numeric_limits;
+using std::runtime_error;
+using std::string;
+
+FrontCoded::FrontCoded(const Trie& tree, size_t block_size_in)
+    : block_size(block_size_in),
+      num_keys(0),
+      data(),
+      blocks(),
+      index(encode(tree)) {}
+
+Trie FrontCoded::encode(const Trie& tree) {
+  if (block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE)
+    throw invalid_argument("FrontCoded block size must be from 16 to 64.");
+
+  Trie first_keys;
+  string prev;
+  for (const string& key : tree) {
+    size_t common = 0;
+    if (num_keys % block_size == 0) {
+      // Every block starts with a full key so it can be decoded on its own.
+      if (data.size() > numeric_limits<uint32_t>::max())
+        throw runtime_error("FrontCoded data is too large.");
+      blocks.push_back(static_cast<uint32_t>(data.size()));
+      first_keys.insert(key);
+    } else {
+      const size_t limit = std::min(prev.length(), key.length());
+      while (common < limit && prev[common] == key[common]) ++common;
+    }
+    put_varint(data, common);
+    put_varint(data, key.length() - common);
+    data.append(key, common, string::npos);
+    prev = key;
+    ++num_keys;
+  }
+  data.shrink_to_fit();
+  blocks.shrink_to_fit();
+  return first_keys;
+}
+
+size_t FrontCoded::decode(size_t pos, string& key) const {
+  const size_t common = get_varint(data.data(), pos);
+  const size_t suffix = get_varint(data.data(), pos);
+  key.resize(common);
+  key.append(data, pos, suffix);
+  return pos + suffix;
+}
+
+size_t FrontCoded::block_of(const string& key) const {
+  // Number of blocks whose first key is less than key.
+  const size_t rank = index.lower_bound(key);
+  if (rank < blocks.size()) {
+    string first;
+    decode(blocks[rank], first);
+    if (first == key) return rank;
+  }
+  return rank == 0 ? 0 : rank - 1;
+}
+
+Trie FrontCoded::to_trie() const { return Trie(begin(), end()); }
+
+size_t FrontCoded::size() const { return num_keys; }
+
+size_t FrontCoded::memory_usage() const {
+  return sizeof(FrontCoded) + data.capacity() +
+         blocks.capacity() * sizeof(uint32_t) + index.memory_usage();
+}
+
+FrontCoded::iterator::iterator(const FrontCoded* k, size_t p)
+    : keys(k), pos(p), next(p), key() {
+  if (pos < keys->data.size()) next = keys->decode(pos, key);
+}
+
+FrontCoded::iterator& FrontCoded::iterator::operator++() {
+  pos = next;
+  if (pos < keys->data.size()) next = keys->decode(pos, key);
+  return *this;
+}
+
+FrontCoded::iterator FrontCoded::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& FrontCoded::iterator::operator*() const { return key; }
+
+FrontCoded::iterator FrontCoded::begin() const { return iterator(this, 0); }
+
+FrontCoded::iterator FrontCoded::end() const {
+  return iterator(this, data.size());
+}
+
+FrontCoded::iterator FrontCoded::begin(const string& prefix) const {
+  // Every key with the given prefix is at least the prefix itself.
+  return lower_bound(prefix);
+}
+
+FrontCoded::iterator FrontCoded::end(const string& prefix) const {
+  string bound = prefix;
+  return prefix_successor(bound) ? lower_bound(bound) : end();
+}
+
+FrontCoded::iterator FrontCoded::find(const string& key) const {
+  auto iter = lower_bound(key);
+  return iter != end() && *iter == key ? iter : end();
+}
+
+FrontCoded::iterator FrontCoded::lower_bound(const string& key) const {
+  if (blocks.empty()) return end();
+  const size_t block = block_of(key);
+  iterator iter(this, blocks[block]);
+  // Scan the block. Past its last entry, the next block's first key is larger.
+  for (size_t i = 0; i < block_size && iter != end(); ++i, ++iter) {
+    if (*iter >= key) break;
+  }
+  return iter;
+}
+
+bool operator==(const FrontCoded::iterator& lhs,
+                const FrontCoded::iterator& rhs) {
+  return lhs.keys == rhs.keys && lhs.pos == rhs.pos;
+}
+
+bool operator!=(const FrontCoded::iterator& lhs,
+                const FrontCoded::iterator& rhs) {
+  return !(lhs == rhs);
+}
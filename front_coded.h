@@ -0,0 +1,194 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for FrontCoded.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "dictionary.h"
+#include "trie.h"
+
+/**
+ * @brief A compact, frozen set of keys for rarely queried data. Keys are kept
+ * in alphabetical order in blocks of 16 to 64 entries. Within a block, each key
+ * is front coded as the length of the prefix it shares with the previous key
+ * followed by the remaining suffix. The first key of every block is stored in
+ * full and indexed by a small radix tree, so a lookup decodes a single block.
+ */
+class FrontCoded {
+ public:
+  static constexpr size_t MIN_BLOCK_SIZE = 16;
+  static constexpr size_t MAX_BLOCK_SIZE = 64;
+
+ private:
+  size_t block_size;
+  size_t num_keys;
+  // Entries of every block, back to back.
+  std::string data;
+  // Offset into data of the first entry of each block.
+  std::vector<uint32_t> blocks;
+  // Ranks the first key of each block.
+  Dictionary index;
+
+  /**
+   * @brief Front code the keys of tree into data and blocks.
+   * @param tree The trie to encode.
+   * @return A trie containing the first key of every block.
+   */
+  Trie encode(const Trie& tree);
+
+  /**
+   * @brief Decode a single entry.
+   * @param pos The offset of the entry in data.
+   * @param key The previous key, which is overwritten by the decoded key.
+   * @return The offset of the following entry.
+   */
+  size_t decode(size_t pos, std::string& key) const;
+
+  /**
+   * @brief Find the block that would contain key.
+   * @param key The key to search for.
+   * @return The last block whose first key is not greater than key, or 0 if
+   * every first key is greater than key.
+   */
+  size_t block_of(const std::string& key) const;
+
+ public:
+  /**
+   * @brief Encode the keys of a trie in linear time.
+   * @param tree The trie to encode. It is not modified.
+   * @param block_size_in The number of keys per block, from MIN_BLOCK_SIZE to
+   * MAX_BLOCK_SIZE. Throws std::invalid_argument otherwise.
+   */
+  explicit FrontCoded(const Trie& tree, size_t block_size_in = 32);
+
+  /**
+   * @brief Decode every key back into a live trie in linear time.
+   * @return A trie containing the same keys as this.
+   */
+  Trie to_trie() const;
+
+  /**
+   * @brief Get the number of keys stored.
+   * @return The number of keys.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get the memory footprint.
+   * @return The number of bytes used by the blocks and the index.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Supports const forward iteration in alphabetical order.
+   */
+  class iterator {
+    friend class FrontCoded;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    const FrontCoded* keys;
+    // Offsets of the current and the following entry.
+    size_t pos;
+    size_t next;
+    std::string key;
+
+    /**
+     * @brief Constructor, decodes the entry at p.
+     * @param k The set being iterated over.
+     * @param p The offset of an entry, or data.size() for the end iterator.
+     */
+    iterator(const FrontCoded* k, size_t p);
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The key referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const FrontCoded::iterator& lhs,
+                           const FrontCoded::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const FrontCoded::iterator& lhs,
+                           const FrontCoded::iterator& rhs);
+  };
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the smallest key.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the largest key.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the first key with the given prefix. Unlike the Trie,
+   * this is end(prefix) rather than a null iterator if there is no such key, so
+   * the range is always valid.
+   */
+  iterator begin(const std::string& prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to the first key after every key with the given prefix.
+   */
+  iterator end(const std::string& prefix) const;
+
+  /**
+   * @brief Searches for key.
+   * @param key The key to search for.
+   * @return An iterator to key if it exists. Otherwise, end().
+   */
+  iterator find(const std::string& key) const;
+
+  /**
+   * @brief Find the first key that is not less than key.
+   * @param key The bound to search for, which need not be stored.
+   * @return An iterator to the first key not less than key, or end().
+   */
+  iterator lower_bound(const std::string& key) const;
+};
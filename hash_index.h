@@ -0,0 +1,264 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for HashIndex.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "varint.h"
+
+/**
+ * @brief An open addressing hash table from string keys to values, with linear
+ * probing and backward shift deletion (so there are no tombstones). Keys are
+ * stored back to back in one arena, each as a varint length and its bytes, and
+ * a slot holds only 32 bits of the hash of its key, the offset of the key in
+ * the arena, and the value. Most mismatches are rejected by the hash without
+ * reading the arena. Erased keys leave holes in the arena, which is compacted
+ * once they make up half of it. The arena is at most 4 GiB.
+ */
+template <typename Value>
+class HashIndex {
+ private:
+  /**
+   * @brief A slot is empty if its offset is EMPTY.
+   */
+  struct Slot {
+    uint32_t hash;
+    uint32_t offset;
+    Value value;
+  };
+
+  static constexpr size_t MIN_SLOTS = 16;
+  static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+  std::vector<Slot> slots;
+  std::string arena;
+  size_t count;
+  // Bytes of the arena held by erased keys.
+  size_t dead;
+
+  /**
+   * @brief Hash a key.
+   * @param key The key to hash.
+   * @return The low 32 bits of its std::hash.
+   */
+  static uint32_t hash_of(std::string_view key);
+
+  /**
+   * @brief Get a key stored in the arena.
+   * @param offset The offset of the key.
+   * @return The bytes of the key.
+   */
+  std::string_view key_at(uint32_t offset) const;
+
+  /**
+   * @brief Get the number of arena bytes taken by a key.
+   * @param offset The offset of the key.
+   * @return The size of its length and its bytes.
+   */
+  size_t stored_size(uint32_t offset) const;
+
+  /**
+   * @brief Find the slot of key, or the empty slot where it would go.
+   * @param key The key to search for.
+   * @param hash The hash of key.
+   * @return The index of the slot.
+   */
+  size_t probe(std::string_view key, uint32_t hash) const;
+
+  /**
+   * @brief Move every entry into a table with the given number of slots.
+   * @param num_slots The new number of slots, a power of two.
+   */
+  void rehash(size_t num_slots);
+
+  /**
+   * @brief Copy the keys of every entry into a fresh arena, dropping the
+   * bytes of erased keys.
+   */
+  void compact_keys();
+
+ public:
+  HashIndex();
+
+  /**
+   * @brief Look up a key.
+   * @param key The key to search for.
+   * @return A pointer to the value of key, or nullptr if key is missing.
+   */
+  const Value* find(const std::string& key) const;
+
+  /**
+   * @brief Insert a key, or replace its value. Throws std::length_error if the
+   * keys no longer fit in the arena.
+   * @param key The key to insert.
+   * @param value The value to associate with key.
+   */
+  void insert(const std::string& key, Value value);
+
+  /**
+   * @brief Erase a key. Idempotent.
+   * @param key The key to erase.
+   */
+  void erase(const std::string& key);
+
+  /**
+   * @brief Erase every key.
+   */
+  void clear();
+
+  /**
+   * @brief Get the number of keys.
+   * @return The number of keys stored.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get the space used by the slots and the arena.
+   * @return The number of bytes allocated.
+   */
+  size_t memory_usage() const;
+};
+
+// TEMPLATED IMPLEMENTATIONS
+
+template <typename Value>
+HashIndex<Value>::HashIndex()
+    : slots(MIN_SLOTS, Slot{0, EMPTY, Value()}), arena(), count(0), dead(0) {}
+
+template <typename Value>
+uint32_t HashIndex<Value>::hash_of(std::string_view key) {
+  return static_cast<uint32_t>(std::hash<std::string_view>()(key));
+}
+
+template <typename Value>
+std::string_view HashIndex<Value>::key_at(uint32_t offset) const {
+  size_t pos = offset;
+  const size_t len = get_varint(arena.data(), pos);
+  return std::string_view(arena.data() + pos, len);
+}
+
+template <typename Value>
+size_t HashIndex<Value>::stored_size(uint32_t offset) const {
+  size_t pos = offset;
+  const size_t len = get_varint(arena.data(), pos);
+  return pos - offset + len;
+}
+
+template <typename Value>
+size_t HashIndex<Value>::probe(std::string_view key, uint32_t hash) const {
+  const size_t mask = slots.size() - 1;
+  size_t pos = hash & mask;
+  while (slots[pos].offset != EMPTY &&
+         (slots[pos].hash != hash || key_at(slots[pos].offset) != key)) {
+    pos = (pos + 1) & mask;
+  }
+  return pos;
+}
+
+template <typename Value>
+void HashIndex<Value>::rehash(size_t num_slots) {
+  std::vector<Slot> old(num_slots, Slot{0, EMPTY, Value()});
+  old.swap(slots);
+  const size_t mask = slots.size() - 1;
+  for (auto& slot : old) {
+    if (slot.offset == EMPTY) continue;
+    size_t pos = slot.hash & mask;
+    while (slots[pos].offset != EMPTY) pos = (pos + 1) & mask;
+    slots[pos] = std::move(slot);
+  }
+}
+
+template <typename Value>
+void HashIndex<Value>::compact_keys() {
+  std::string fresh;
+  fresh.reserve(arena.size() - dead);
+  for (auto& slot : slots) {
+    if (slot.offset == EMPTY) continue;
+    const std::string_view key = key_at(slot.offset);
+    slot.offset = static_cast<uint32_t>(fresh.size());
+    put_varint(fresh, key.size());
+    fresh.append(key);
+  }
+  arena.swap(fresh);
+  dead = 0;
+}
+
+template <typename Value>
+const Value* HashIndex<Value>::find(const std::string& key) const {
+  const size_t pos = probe(key, hash_of(key));
+  return slots[pos].offset != EMPTY ? &slots[pos].value : nullptr;
+}
+
+template <typename Value>
+void HashIndex<Value>::insert(const std::string& key, Value value) {
+  const uint32_t hash = hash_of(key);
+  size_t pos = probe(key, hash);
+  if (slots[pos].offset == EMPTY) {
+    // Offsets stay below EMPTY, dropping the holes of erased keys first.
+    const size_t needed = key.size() + 10;
+    if (arena.size() + needed >= EMPTY && dead > 0) compact_keys();
+    if (arena.size() + needed >= EMPTY)
+      throw std::length_error("HashIndex keys exceed 4 GiB.");
+    // Keep the load factor at most 3/4.
+    if ((count + 1) * 4 > slots.size() * 3) {
+      rehash(slots.size() * 2);
+      pos = probe(key, hash);
+    }
+    slots[pos].hash = hash;
+    slots[pos].offset = static_cast<uint32_t>(arena.size());
+    put_varint(arena, key.size());
+    arena += key;
+    ++count;
+  }
+  slots[pos].value = std::move(value);
+}
+
+template <typename Value>
+void HashIndex<Value>::erase(const std::string& key) {
+  const size_t mask = slots.size() - 1;
+  size_t hole = probe(key, hash_of(key));
+  if (slots[hole].offset == EMPTY) return;
+  dead += stored_size(slots[hole].offset);
+  slots[hole] = Slot{0, EMPTY, Value()};
+  --count;
+
+  // Shift back later entries of the cluster that may no longer be reachable.
+  for (size_t pos = (hole + 1) & mask; slots[pos].offset != EMPTY;
+       pos = (pos + 1) & mask) {
+    const size_t home = slots[pos].hash & mask;
+    // Move the entry if its home does not lie cyclically in (hole, pos].
+    if (((pos - home) & mask) >= ((pos - hole) & mask)) {
+      slots[hole] = std::move(slots[pos]);
+      slots[pos] = Slot{0, EMPTY, Value()};
+      hole = pos;
+    }
+  }
+  if (dead * 2 > arena.size()) compact_keys();
+}
+
+template <typename Value>
+void HashIndex<Value>::clear() {
+  slots.assign(MIN_SLOTS, Slot{0, EMPTY, Value()});
+  std::string().swap(arena);
+  count = 0;
+  dead = 0;
+}
+
+template <typename Value>
+size_t HashIndex<Value>::size() const {
+  return count;
+}
+
+template <typename Value>
+size_t HashIndex<Value>::memory_usage() const {
+  return slots.capacity() * sizeof(Slot) + arena.capacity();
+}
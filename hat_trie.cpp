@@ -0,0 +1,514 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for HatTrie.
+*/
+#include "hat_trie.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <stdexcept>
+#include <utility>
+
+#include "successor.h"
+#include "varint.h"
+using std::hash;
+using std::initializer_list;
+using std::invalid_argument;
+using std::length_error;
+using std::make_unique;
+using std::string;
+using std::string_view;
+using std::unique_ptr;
+using std::vector;
+
+HatTrie::Bucket::Bucket() : slots(), order() {}
+
+size_t HatTrie::Bucket::slot_of(string_view suffix) const {
+  return hash<string_view>()(suffix) & (slots.size() - 1);
+}
+
+size_t HatTrie::Bucket::search(const string& slot, string_view suffix) {
+  size_t pos = 0;
+  while (pos < slot.size()) {
+    const size_t start = pos;
+    const size_t len = get_varint(slot.data(), pos);
+    if (len == suffix.length() && slot.compare(pos, len, suffix) == 0)
+      return start;
+    pos += len;
+  }
+  return string::npos;
+}
+
+string_view HatTrie::Bucket::entry(uint32_t pos) const {
+  const string& slot = slots[pos >> OFFSET_BITS];
+  size_t offset = pos & OFFSET_MASK;
+  const size_t len = get_varint(slot.data(), offset);
+  return string_view(slot.data() + offset, len);
+}
+
+uint32_t HatTrie::Bucket::head_of(string_view suffix) {
+  uint32_t head = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    const auto c = i < suffix.length() ? static_cast<uint8_t>(suffix[i]) : 0;
+    head = head << 8 | c;
+  }
+  return head;
+}
+
+bool HatTrie::Bucket::less(const Entry& e, string_view suffix,
+                           uint32_t head) const {
+  if (e.head != head) return e.head < head;
+  return entry(e.pos) < suffix;
+}
+
+uint32_t HatTrie::Bucket::append(vector<string>& out, string_view suffix) {
+  const size_t slot = hash<string_view>()(suffix) & (out.size() - 1);
+  string& dst = out[slot];
+  if (dst.size() >= (size_t{1} << OFFSET_BITS))
+    throw length_error("HatTrie bucket slot is full");
+  const auto pos = static_cast<uint32_t>(slot << OFFSET_BITS | dst.size());
+  put_varint(dst, suffix.length());
+  dst.append(suffix);
+  return pos;
+}
+
+void HatTrie::Bucket::relayout(size_t num_slots, size_t first, size_t last) {
+  vector<string> out(num_slots);
+  vector<Entry> kept;
+  kept.reserve(order.size() - (last - first));
+  // Suffixes are appended in order, so the new positions stay sorted.
+  for (size_t i = 0; i < order.size(); ++i) {
+    if (i >= first && i < last) continue;
+    kept.push_back(Entry{order[i].head, append(out, entry(order[i].pos))});
+  }
+  slots.swap(out);
+  order.swap(kept);
+}
+
+size_t HatTrie::Bucket::size() const { return order.size(); }
+
+bool HatTrie::Bucket::contains(const string& suffix) const {
+  if (slots.empty()) return false;
+  return search(slots[slot_of(suffix)], suffix) != string::npos;
+}
+
+bool HatTrie::Bucket::insert(const string& suffix) {
+  if (!slots.empty() &&
+      search(slots[slot_of(suffix)], suffix) != string::npos)
+    return false;
+  if (order.size() >= slots.size() * SLOT_ENTRIES &&
+      slots.size() < MAX_SLOTS)
+    relayout(std::max(slots.size() * 2, size_t{1}), 0, 0);
+  // Bursts insert in order, so check the end before searching.
+  const uint32_t head = head_of(suffix);
+  const size_t at = order.empty() || less(order.back(), suffix, head)
+                        ? order.size()
+                        : rank(suffix);
+  order.insert(order.begin() + static_cast<ptrdiff_t>(at),
+               Entry{head, append(slots, suffix)});
+  return true;
+}
+
+void HatTrie::Bucket::erase(const string& suffix) {
+  if (slots.empty()) return;
+  const size_t slot = slot_of(suffix);
+  string& dst = slots[slot];
+  const size_t start = search(dst, suffix);
+  if (start == string::npos) return;
+  order.erase(order.begin() + static_cast<ptrdiff_t>(rank(suffix)));
+  size_t pos = start;
+  const size_t len = get_varint(dst.data(), pos);
+  const size_t removed = pos - start + len;
+  dst.erase(start, removed);
+  // Later entries of the same slot moved down by the bytes removed.
+  for (Entry& e : order) {
+    if (e.pos >> OFFSET_BITS == slot && (e.pos & OFFSET_MASK) > start)
+      e.pos -= static_cast<uint32_t>(removed);
+  }
+}
+
+void HatTrie::Bucket::erase_prefix(const string& prf) {
+  string next = prf;
+  const size_t first = rank(prf);
+  const size_t last = prefix_successor(next) ? rank(next) : order.size();
+  if (first < last) relayout(slots.size(), first, last);
+}
+
+size_t HatTrie::Bucket::count_prefix(const string& prf) const {
+  string next = prf;
+  const size_t last = prefix_successor(next) ? rank(next) : order.size();
+  return last - rank(prf);
+}
+
+size_t HatTrie::Bucket::rank(string_view suffix) const {
+  const uint32_t head = head_of(suffix);
+  const auto found = std::lower_bound(
+      order.begin(), order.end(), suffix,
+      [this, head](const Entry& e, string_view s) { return less(e, s, head); });
+  return static_cast<size_t>(found - order.begin());
+}
+
+string_view HatTrie::Bucket::sorted(size_t i) const {
+  return entry(order[i].pos);
+}
+
+HatTrie::Node::Node() : is_end(false), children(), bucket(new Bucket) {}
+
+unique_ptr<HatTrie::Node> HatTrie::recursive_copy(const Node* other) {
+  assert(other);
+  auto node = make_unique<Node>();
+  node->is_end = other->is_end;
+  if (other->bucket) {
+    *node->bucket = *other->bucket;
+  } else {
+    node->bucket.reset();
+    for (const auto& str_ptr_pair : other->children) {
+      node->children.emplace(str_ptr_pair.first,
+                             recursive_copy(str_ptr_pair.second.get()));
+    }
+  }
+  return node;
+}
+
+void HatTrie::burst(Node* node) {
+  assert(node && node->bucket);
+  const auto old = std::move(node->bucket);
+  node->is_end = false;
+  // Redistribute each suffix to the child bucket for its leading character.
+  for (size_t i = 0; i < old->size(); ++i) {
+    const string_view suffix = old->sorted(i);
+    if (suffix.empty()) {
+      node->is_end = true;
+      continue;
+    }
+    auto& child = node->children[string(suffix.substr(0, 1))];
+    if (!child) child = make_unique<Node>();
+    child->bucket->insert(string(suffix.substr(1)));
+  }
+  for (auto& str_ptr_pair : node->children) {
+    if (str_ptr_pair.second->bucket->size() > burst_threshold)
+      burst(str_ptr_pair.second.get());
+  }
+}
+
+size_t HatTrie::key_counter(const Node* rt) {
+  assert(rt);
+  if (rt->bucket) return rt->bucket->size();
+  size_t acc = rt->is_end ? 1 : 0;
+  for (const auto& str_ptr_pair : rt->children) {
+    acc += key_counter(str_ptr_pair.second.get());
+  }
+  return acc;
+}
+
+void HatTrie::descend(const string& key, vector<Node*>& path,
+                      size_t& pos) const {
+  path.assign(1, root.get());
+  pos = 0;
+  while (!path.back()->bucket) {
+    bool descended = false;
+    for (const auto& str_ptr_pair : path.back()->children) {
+      const string& label = str_ptr_pair.first;
+      if (key.compare(pos, label.length(), label) == 0) {
+        pos += label.length();
+        path.push_back(str_ptr_pair.second.get());
+        descended = true;
+        break;
+      }
+    }
+    if (!descended) return;
+  }
+}
+
+void HatTrie::prune(const vector<Node*>& path) {
+  for (size_t i = path.size() - 1; i > 0; --i) {
+    Node* node = path[i];
+    const bool empty = node->bucket
+                           ? node->bucket->size() == 0
+                           : !node->is_end && node->children.empty();
+    if (!empty) break;
+    auto& siblings = path[i - 1]->children;
+    for (auto iter = siblings.begin(); iter != siblings.end(); ++iter) {
+      if (iter->second.get() == node) {
+        siblings.erase(iter);
+        break;
+      }
+    }
+  }
+  // An empty radix root goes back to being a single bucket.
+  if (!root->bucket && !root->is_end && root->children.empty()) {
+    root = make_unique<Node>();
+  }
+}
+
+bool HatTrie::add(const string& key) {
+  vector<Node*> path;
+  size_t pos = 0;
+  descend(key, path, pos);
+  Node* node = path.back();
+
+  if (node->bucket) {
+    const bool inserted = node->bucket->insert(key.substr(pos));
+    if (node->bucket->size() > burst_threshold) burst(node);
+    return inserted;
+  }
+  if (pos == key.length()) {
+    const bool inserted = !node->is_end;
+    node->is_end = true;
+    return inserted;
+  }
+  // Labels are single characters, so no child starts with key[pos].
+  auto child = make_unique<Node>();
+  child->bucket->insert(key.substr(pos + 1));
+  node->children.emplace(key.substr(pos, 1), std::move(child));
+  return true;
+}
+
+HatTrie::HatTrie(size_t threshold)
+    : root(make_unique<Node>()), burst_threshold(threshold) {
+  if (burst_threshold == 0)
+    throw invalid_argument("HatTrie burst threshold must be positive.");
+}
+
+HatTrie::HatTrie(const initializer_list<string>& key_list) : HatTrie() {
+  for (const auto& key : key_list) {
+    add(key);
+  }
+}
+
+HatTrie::HatTrie(const HatTrie& other)
+    : root(recursive_copy(other.root.get())),
+      burst_threshold(other.burst_threshold) {}
+
+HatTrie::HatTrie(HatTrie&& other)
+    : root(make_unique<Node>()), burst_threshold(other.burst_threshold) {
+  root.swap(other.root);
+}
+
+HatTrie& HatTrie::operator=(HatTrie other) {
+  root.swap(other.root);
+  std::swap(burst_threshold, other.burst_threshold);
+  return *this;
+}
+
+bool HatTrie::empty(string prefix) const {
+  vector<Node*> path;
+  size_t pos = 0;
+  descend(prefix, path, pos);
+  const Node* node = path.back();
+  if (node->bucket) return node->bucket->count_prefix(prefix.substr(pos)) == 0;
+  // Pruning guarantees that every radix node holds at least one key.
+  if (pos == prefix.length()) return !node->is_end && node->children.empty();
+  return true;
+}
+
+size_t HatTrie::size(string prefix) const {
+  vector<Node*> path;
+  size_t pos = 0;
+  descend(prefix, path, pos);
+  const Node* node = path.back();
+  if (node->bucket) return node->bucket->count_prefix(prefix.substr(pos));
+  if (pos == prefix.length()) return key_counter(node);
+  return 0;
+}
+
+HatTrie::iterator::iterator() : path(), key() {}
+
+bool HatTrie::iterator::enter(const Node* node, size_t depth) {
+  path.push_back(Frame{node, depth, node->children.begin(), 0});
+  if (!node->bucket) return node->is_end;
+  if (node->bucket->size() == 0) return false;
+  key.resize(depth);
+  key += node->bucket->sorted(0);
+  return true;
+}
+
+void HatTrie::iterator::advance() {
+  while (!path.empty()) {
+    Frame& f = path.back();
+    if (f.node->bucket) {
+      const Bucket& bucket = *f.node->bucket;
+      // Only now is the current suffix ranked in the bucket.
+      if (f.pos == UNRESOLVED)
+        f.pos = bucket.rank(string_view(key).substr(f.depth));
+      if (++f.pos < bucket.size()) {
+        key.resize(f.depth);
+        key += bucket.sorted(f.pos);
+        return;
+      }
+    } else if (f.next != f.node->children.end()) {
+      const auto& str_ptr_pair = *f.next;
+      ++f.next;
+      const size_t depth = f.depth + str_ptr_pair.first.length();
+      key.resize(f.depth);
+      key += str_ptr_pair.first;
+      if (enter(str_ptr_pair.second.get(), depth)) return;
+      continue;
+    }
+    path.pop_back();
+  }
+  key.clear();
+}
+
+HatTrie::iterator& HatTrie::iterator::operator++() {
+  advance();
+  return *this;
+}
+
+HatTrie::iterator HatTrie::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& HatTrie::iterator::operator*() const { return key; }
+
+HatTrie::iterator::operator bool() const { return !path.empty(); }
+
+HatTrie::iterator HatTrie::begin() const {
+  iterator iter;
+  if (!iter.enter(root.get(), 0)) iter.advance();
+  return iter;
+}
+
+HatTrie::iterator HatTrie::end() const { return iterator(); }
+
+HatTrie::iterator HatTrie::begin(string prefix) const {
+  return find(prefix, PREFIX_FLAG);
+}
+
+HatTrie::iterator HatTrie::end(string prefix) const {
+  return prefix_successor(prefix) ? lower_bound(prefix) : end();
+}
+
+HatTrie::iterator HatTrie::lower_bound(const string& key) const {
+  iterator iter;
+  const Node* node = root.get();
+  size_t depth = 0;
+  while (true) {
+    iter.path.push_back(
+        iterator::Frame{node, depth, node->children.begin(), 0});
+    iter.key.assign(key, 0, depth);
+
+    if (node->bucket) {
+      const Bucket& bucket = *node->bucket;
+      const size_t found = bucket.rank(string_view(key).substr(depth));
+      iter.path.back().pos = found;
+      if (found < bucket.size()) {
+        iter.key += bucket.sorted(found);
+        return iter;
+      }
+      // Everything in the bucket is smaller, so move on to the next subtree.
+      iter.advance();
+      return iter;
+    }
+
+    // Every key at or under node is at least key.
+    if (depth == key.length()) {
+      if (!node->is_end) iter.advance();
+      return iter;
+    }
+
+    // Find the child to descend into, or the first child greater than key.
+    iterator::Frame& f = iter.path.back();
+    f.next = node->children.end();
+    const Node* child = nullptr;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      const string& label = it->first;
+      if (key.compare(depth, label.length(), label) == 0) {
+        f.next = std::next(it);
+        child = it->second.get();
+        depth += label.length();
+        break;
+      }
+      if (key.compare(depth, string::npos, label) < 0) {
+        f.next = it;
+        break;
+      }
+    }
+    if (!child) {
+      iter.advance();
+      return iter;
+    }
+    node = child;
+  }
+}
+
+HatTrie::iterator HatTrie::find(string key, bool is_prefix) const {
+  if (is_prefix) {
+    auto iter = lower_bound(key);
+    if (iter && (*iter).compare(0, key.length(), key) == 0) return iter;
+    return end();
+  }
+
+  // Exact searches leave bucket positions unresolved to avoid sorting.
+  iterator iter;
+  const Node* node = root.get();
+  size_t depth = 0;
+  while (true) {
+    iter.path.push_back(iterator::Frame{node, depth, node->children.begin(),
+                                        iterator::UNRESOLVED});
+    if (node->bucket) {
+      if (!node->bucket->contains(key.substr(depth))) return end();
+      iter.key = key;
+      return iter;
+    }
+    if (depth == key.length()) {
+      if (!node->is_end) return end();
+      iter.key = key;
+      return iter;
+    }
+    iterator::Frame& f = iter.path.back();
+    const Node* child = nullptr;
+    for (auto it = node->children.begin(); it != node->children.end(); ++it) {
+      const string& label = it->first;
+      if (key.compare(depth, label.length(), label) == 0) {
+        f.next = std::next(it);
+        child = it->second.get();
+        depth += label.length();
+        break;
+      }
+    }
+    if (!child) return end();
+    node = child;
+  }
+}
+
+HatTrie::iterator HatTrie::insert(string key) {
+  add(key);
+  return find(key);
+}
+
+void HatTrie::erase(string key, bool is_prefix) {
+  vector<Node*> path;
+  size_t pos = 0;
+  descend(key, path, pos);
+  Node* node = path.back();
+
+  if (node->bucket) {
+    if (is_prefix) {
+      node->bucket->erase_prefix(key.substr(pos));
+    } else {
+      node->bucket->erase(key.substr(pos));
+    }
+  } else if (pos == key.length()) {
+    node->is_end = false;
+    // Every key at or under node has the prefix.
+    if (is_prefix) node->children.clear();
+  }
+  prune(path);
+}
+
+void HatTrie::clear() { root = make_unique<Node>(); }
+
+bool operator==(const HatTrie::iterator& lhs, const HatTrie::iterator& rhs) {
+  if (lhs.path.empty() || rhs.path.empty())
+    return lhs.path.empty() && rhs.path.empty();
+  return lhs.key == rhs.key;
+}
+
+bool operator!=(const HatTrie::iterator& lhs, const HatTrie::iterator& rhs) {
+  return !(lhs == rhs);
+}
@@ -0,0 +1,477 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for HatTrie.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief A burst trie (HAT-trie) with the same set API as Trie, for large sets
+ * of high entropy keys such as UUIDs or hashes. Small subtrees are stored as
+ * cache conscious array-hash buckets holding the remaining key suffixes. A
+ * bucket that grows past the burst threshold is split into a radix node with
+ * one child bucket per leading character.
+ *
+ * Every bucket also keeps the positions of its suffixes in alphabetical order,
+ * updated by each insert and erase, so ordered traversals never sort and const
+ * operations never write.
+ */
+class HatTrie {
+ private:
+  /**
+   * @brief An array-hash table of key suffixes. Each slot is a contiguous run
+   * of length prefixed suffixes, so a probe touches a single allocation. Slots
+   * are added as the bucket grows, so a small bucket takes one allocation.
+   */
+  class Bucket {
+   private:
+    static constexpr size_t MAX_SLOTS = 64;
+    // A bucket doubles its slots once it averages this many suffixes per slot.
+    static constexpr size_t SLOT_ENTRIES = 16;
+    // Positions hold the slot above OFFSET_BITS and the offset within it.
+    static constexpr uint32_t OFFSET_BITS = 26;
+    static constexpr uint32_t OFFSET_MASK = (uint32_t{1} << OFFSET_BITS) - 1;
+    std::vector<std::string> slots;
+
+    /**
+     * @brief The position of a suffix with its first four bytes, big endian
+     * and zero padded, which order most pairs of suffixes without reading the
+     * slots.
+     */
+    struct Entry {
+      uint32_t head;
+      uint32_t pos;
+    };
+    // Every suffix, in alphabetical order.
+    std::vector<Entry> order;
+
+    /**
+     * @brief Get the slot that suffix hashes to.
+     * @param suffix The suffix to hash.
+     * @return The slot index. There must be at least one slot.
+     */
+    size_t slot_of(std::string_view suffix) const;
+
+    /**
+     * @brief Find suffix in its slot.
+     * @param slot The slot to search.
+     * @param suffix The suffix to search for.
+     * @return The offset of the entry in the slot, or npos if missing.
+     */
+    static size_t search(const std::string& slot, std::string_view suffix);
+
+    /**
+     * @brief Get the first four bytes of a suffix as an Entry head.
+     * @param suffix The suffix.
+     * @return The head, which never decreases as the suffix increases.
+     */
+    static uint32_t head_of(std::string_view suffix);
+
+    /**
+     * @brief Compare a stored suffix to another.
+     * @param e The entry of the stored suffix.
+     * @param suffix The suffix to compare with.
+     * @param head The head of suffix.
+     * @return Whether or not the stored suffix is less than suffix.
+     */
+    bool less(const Entry& e, std::string_view suffix, uint32_t head) const;
+
+    /**
+     * @brief Get the suffix at a position.
+     * @param pos The position of an entry.
+     * @return The bytes of the suffix.
+     */
+    std::string_view entry(uint32_t pos) const;
+
+    /**
+     * @brief Append a suffix to a slot.
+     * @param out The slots to append to.
+     * @param suffix The suffix to append.
+     * @return The position of the new entry. Throws std::length_error if the
+     * slot outgrows the offset bits.
+     */
+    static uint32_t append(std::vector<std::string>& out,
+                           std::string_view suffix);
+
+    /**
+     * @brief Lay the suffixes out again over a number of slots, in order,
+     * leaving out those whose ranks are in [first, last).
+     * @param num_slots The new number of slots, a power of two.
+     * @param first The rank of the first suffix to drop.
+     * @param last The rank after the last suffix to drop.
+     */
+    void relayout(size_t num_slots, size_t first, size_t last);
+
+   public:
+    Bucket();
+
+    /**
+     * @brief Get the number of suffixes.
+     * @return The number of suffixes stored.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Check for a suffix.
+     * @param suffix The suffix to search for.
+     * @return Whether or not suffix is stored.
+     */
+    bool contains(const std::string& suffix) const;
+
+    /**
+     * @brief Insert a suffix. Idempotent.
+     * @param suffix The suffix to insert.
+     * @return Whether or not suffix was newly inserted.
+     */
+    bool insert(const std::string& suffix);
+
+    /**
+     * @brief Erase a suffix. Idempotent.
+     * @param suffix The suffix to erase.
+     */
+    void erase(const std::string& suffix);
+
+    /**
+     * @brief Erase every suffix that starts with prf.
+     * @param prf The prefix of the suffixes to erase.
+     */
+    void erase_prefix(const std::string& prf);
+
+    /**
+     * @brief Count the suffixes that start with prf, in O(log n) comparisons.
+     * @param prf The prefix to count.
+     * @return The number of matching suffixes.
+     */
+    size_t count_prefix(const std::string& prf) const;
+
+    /**
+     * @brief Rank a suffix, which need not be stored.
+     * @param suffix The suffix to rank.
+     * @return The number of stored suffixes less than suffix.
+     */
+    size_t rank(std::string_view suffix) const;
+
+    /**
+     * @brief Get a suffix by its rank.
+     * @param i The rank, less than size().
+     * @return The i-th suffix in alphabetical order.
+     */
+    std::string_view sorted(size_t i) const;
+  };
+
+  /**
+   * @brief A radix node if bucket is null. Otherwise, a bucket node that holds
+   * the suffixes of every key in its subtree, and has no children.
+   */
+  struct Node {
+    bool is_end;
+    std::map<std::string, std::unique_ptr<Node>> children;
+    std::unique_ptr<Bucket> bucket;
+    /**
+     * @brief Construct a new empty bucket node.
+     */
+    Node();
+  };
+
+  std::unique_ptr<Node> root;
+  size_t burst_threshold;
+
+  /**
+   * @brief Recursively copies other into a new node.
+   * @param other The non-null node to copy.
+   * @return The copy.
+   */
+  static std::unique_ptr<Node> recursive_copy(const Node* other);
+
+  /**
+   * @brief Split a bucket node into a radix node with a child bucket for each
+   * leading character, recursively bursting children that are still too big.
+   * @param node The bucket node to burst.
+   */
+  void burst(Node* node);
+
+  /**
+   * @brief Insert key without constructing an iterator.
+   * @param key The key to insert.
+   * @return Whether or not key was newly inserted.
+   */
+  bool add(const std::string& key);
+
+  /**
+   * @brief Counts the keys stored at or under rt.
+   * @param rt The non-null node at which to start counting.
+   * @return The number of keys.
+   */
+  static size_t key_counter(const Node* rt);
+
+  /**
+   * @brief Descend through radix nodes towards key.
+   * @param key The key to follow.
+   * @param path Set to the nodes visited, starting at the root.
+   * @param pos Set to the length of the prefix of key matched by the labels.
+   */
+  void descend(const std::string& key, std::vector<Node*>& path,
+               size_t& pos) const;
+
+  /**
+   * @brief Remove empty nodes at the bottom of path, never removing root.
+   * @param path The nodes visited from the root, as computed by descend.
+   */
+  void prune(const std::vector<Node*>& path);
+
+ public:
+  /**
+   * Used to mark a parameter as passing in a prefix and not a full key.
+   */
+  static constexpr bool PREFIX_FLAG = true;
+
+  /**
+   * Default number of suffixes a bucket may hold before it bursts.
+   */
+  static constexpr size_t DEFAULT_BURST_THRESHOLD = 1024;
+
+  /**
+   * @brief Default constructor initializes empty trie.
+   * @param threshold The number of suffixes a bucket may hold before it
+   * bursts. Must be positive.
+   */
+  explicit HatTrie(size_t threshold = DEFAULT_BURST_THRESHOLD);
+
+  /**
+   * @brief Initializer list constructor inserts strings in key_list into trie.
+   * Duplicates are ignored.
+   * @param key_list The items to initialize the trie with.
+   */
+  explicit HatTrie(const std::initializer_list<std::string>& key_list);
+
+  /**
+   * @brief Range constructor inserts strings contained in [first, last) into
+   * trie. Duplicates are ignored.
+   * @param first The starting iterator of the range.
+   * @param last The ending iterator (one past end) of the range.
+   */
+  template <typename InputIterator>
+  HatTrie(InputIterator first, InputIterator last);
+
+  /* --- DYNAMIC MEMORY: RULE OF 5 */
+
+  /**
+   * @brief Copy constructor.
+   * @param other The trie to copy into this.
+   */
+  HatTrie(const HatTrie& other);
+
+  /**
+   * @brief Move constructor.
+   * @param other The trie to move into this.
+   */
+  HatTrie(HatTrie&& other);
+
+  /**
+   * @brief Assignment operator.
+   * @param other The trie to assign to this.
+   */
+  HatTrie& operator=(HatTrie other);
+
+  /* --- CONTAINER SIZE --- */
+
+  /**
+   * @brief Check if the trie is empty.
+   * @param prefix The prefix on which to check for emptiness.
+   * @return Whether or not the trie is empty starting at given prefix.
+   */
+  bool empty(std::string prefix = "") const;
+
+  /**
+   * @brief Get the size of the trie under the prefix.
+   * @param prefix The prefix on which to check for size.
+   * @return The number of words stored in the trie with given prefix.
+   */
+  size_t size(std::string prefix = "") const;
+
+  /* --- ITERATION --- */
+
+  /**
+   * @brief Supports const forward iteration over the trie. The iterator
+   * carries its path from the root, and an exact find resolves the rank of its
+   * suffix in the bucket only when it is first incremented.
+   */
+  class iterator {
+    friend class HatTrie;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    static constexpr size_t UNRESOLVED = std::numeric_limits<size_t>::max();
+
+    /**
+     * @brief A node on the path with the length of its string representation.
+     * Radix frames hold the next child to visit. Bucket frames hold the rank
+     * of the current suffix, or UNRESOLVED until it is needed.
+     */
+    struct Frame {
+      const Node* node;
+      size_t depth;
+      std::map<std::string, std::unique_ptr<Node>>::const_iterator next;
+      size_t pos;
+    };
+
+    std::vector<Frame> path;
+    std::string key;
+
+    /**
+     * @brief Push a frame for node.
+     * @param node The node to push.
+     * @param depth The length of the string representation at node.
+     * @return Whether or not the iterator now points at a key in node itself.
+     */
+    bool enter(const Node* node, size_t depth);
+
+    /**
+     * @brief Move to the next key in alphabetical order.
+     */
+    void advance();
+
+   public:
+    /**
+     * @brief Constructor, the end iterator.
+     */
+    iterator();
+
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The string referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Implicit conversion to bool.
+     * @return Whether or not the iterator points at a key.
+     */
+    operator bool() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const HatTrie::iterator& lhs,
+                           const HatTrie::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const HatTrie::iterator& lhs,
+                           const HatTrie::iterator& rhs);
+  };
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the beginning of the trie.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the end of the trie.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the start of the range with given prefix.
+   */
+  iterator begin(std::string prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to one past the end of the range with given prefix.
+   */
+  iterator end(std::string prefix) const;
+
+  /**
+   * @brief Find the first key that is not less than key.
+   * @param key The bound to search for, which need not be stored.
+   * @return An iterator to the first key not less than key, or end().
+   */
+  iterator lower_bound(const std::string& key) const;
+
+  /* --- SEARCHING --- */
+
+  /**
+   * @brief Searches for key in trie. Exact searches do not sort any bucket.
+   * @param key The key used to search the trie.
+   * @param is_prefix Flags whether or not to treat the key as a prefix.
+   * @return An iterator to it if it exists. Otherwise, returns a null iterator.
+   * If is_prefix is true, returns an iterator to the first key that matches the
+   * prefix.
+   */
+  iterator find(std::string key, bool is_prefix = !PREFIX_FLAG) const;
+
+  /* --- INSERTION --- */
+
+  /**
+   * @brief Inserts key into trie. Idempotent if key already in trie.
+   * @param key The key to insert into the trie.
+   * @return An iterator to the key (whether inserted or not).
+   */
+  iterator insert(std::string key);
+
+  /* --- DELETION --- */
+
+  /**
+   * @brief Erases key from trie. If prefix flag is set, erases all keys that
+   * have the key as prefix from the trie. Idempotent if key (or prefix) is not
+   * in trie.
+   * @param key The key to erase from the trie.
+   * @param is_prefix Flag for treating key as a prefix.
+   */
+  void erase(std::string key, bool is_prefix = !PREFIX_FLAG);
+
+  /**
+   * @brief Erases all keys from trie. Idempotent on empty tries.
+   */
+  void clear();
+};
+
+// TEMPLATED IMPLEMENTATIONS
+
+template <typename InputIterator>
+HatTrie::HatTrie(InputIterator first, InputIterator last) : HatTrie() {
+  for (InputIterator iter = first; iter != last; ++iter) {
+    add(*iter);
+  }
+}
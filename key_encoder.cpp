@@ -0,0 +1,192 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for KeyEncoder.
+*/
+#include "key_encoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <set>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "successor.h"
+using std::invalid_argument;
+using std::pair;
+using std::set;
+using std::string;
+using std::string_view;
+using std::unordered_map;
+using std::vector;
+
+KeyEncoder::KeyEncoder(const vector<string>& sample, size_t max_grams)
+    : intervals(), first_level(), second_level(), by_byte() {
+  // Count every byte sequence of the sample.
+  unordered_map<string, size_t> counts;
+  for (const string& key : sample) {
+    for (size_t i = 0; i < key.length(); ++i) {
+      for (size_t len = 2; len <= MAX_GRAM_LENGTH && i + len <= key.length();
+           ++len) {
+        ++counts[key.substr(i, len)];
+      }
+    }
+  }
+
+  // Rank sequences by the number of bytes that replacing them would save.
+  using Ranked = pair<size_t, string>;
+  vector<Ranked> ranked;
+  for (const auto& gram_count : counts) {
+    if (gram_count.second < 2) continue;
+    ranked.emplace_back(gram_count.second * (gram_count.first.length() - 1),
+                        gram_count.first);
+  }
+  std::sort(ranked.begin(), ranked.end(),
+            [](const Ranked& lhs, const Ranked& rhs) {
+              return lhs.first != rhs.first ? lhs.first > rhs.first
+                                            : lhs.second < rhs.second;
+            });
+  if (ranked.size() > max_grams) ranked.resize(max_grams);
+  vector<string> grams;
+  for (auto& score_gram : ranked) {
+    grams.push_back(std::move(score_gram.second));
+  }
+
+  // Drop the least valuable sequences until every interval has a code. With
+  // no sequences at all, the 256 single byte intervals always fit.
+  while (!build(grams, sample)) {
+    grams.resize(grams.size() * 7 / 8);
+  }
+}
+
+bool KeyEncoder::build(const vector<string>& grams,
+                       const vector<string>& sample) {
+  set<string> bounds;
+  for (int c = 0; c < 256; ++c) {
+    bounds.emplace(1, static_cast<char>(c));
+  }
+  for (const string& gram : grams) {
+    bounds.insert(gram);
+    string next = gram;
+    if (prefix_successor(next)) bounds.insert(next);
+  }
+
+  // The symbol of [lower, upper) is its longest prefix p with every string
+  // having p as a prefix not less than upper.
+  intervals.clear();
+  for (auto iter = bounds.begin(); iter != bounds.end(); ++iter) {
+    const auto upper = std::next(iter);
+    Interval iv{*iter, "", 0, {0, 0}};
+    for (size_t len = iter->length(); len > 0; --len) {
+      string next = iter->substr(0, len);
+      const bool bounded = prefix_successor(next);
+      if (!bounded || (upper != bounds.end() && next >= *upper)) {
+        iv.symbol = iter->substr(0, len);
+        break;
+      }
+    }
+    assert(!iv.symbol.empty());
+    intervals.push_back(std::move(iv));
+  }
+  for (size_t i = intervals.size(); i-- > 0;) {
+    by_byte[static_cast<unsigned char>(intervals[i].lower[0])] =
+        static_cast<uint32_t>(i);
+  }
+  by_byte[256] = static_cast<uint32_t>(intervals.size());
+
+  // Intervals the sample actually reaches get one byte codes.
+  vector<size_t> hits(intervals.size(), 0);
+  for (const string& key : sample) {
+    for (size_t pos = 0; pos < key.length();) {
+      const size_t i = interval_of(key, pos);
+      ++hits[i];
+      pos += intervals[i].symbol.length();
+    }
+  }
+
+  // Assign codes in interval order. Runs of unused intervals share a prefix.
+  size_t next_byte = 0;
+  for (size_t i = 0; i < intervals.size();) {
+    if (next_byte > 0xFF) return false;
+    const auto byte = static_cast<unsigned char>(next_byte++);
+    if (hits[i] > 0) {
+      intervals[i].code_length = 1;
+      intervals[i].code = {byte, 0};
+      ++i;
+      continue;
+    }
+    for (size_t second = 0;
+         second <= 0xFF && i < intervals.size() && hits[i] == 0; ++second) {
+      intervals[i].code_length = 2;
+      intervals[i].code = {byte, static_cast<unsigned char>(second)};
+      ++i;
+    }
+  }
+
+  // Decoding tables. Negative entries below -1 name a second level table.
+  first_level.fill(-1);
+  second_level.clear();
+  for (size_t i = 0; i < intervals.size(); ++i) {
+    const Interval& iv = intervals[i];
+    if (iv.code_length == 1) {
+      first_level[iv.code[0]] = static_cast<int32_t>(i);
+      continue;
+    }
+    if (first_level[iv.code[0]] == -1) {
+      first_level[iv.code[0]] = -2 - static_cast<int32_t>(second_level.size());
+      second_level.emplace_back();
+      second_level.back().fill(-1);
+    }
+    const auto table = static_cast<size_t>(-2 - first_level[iv.code[0]]);
+    second_level[table][iv.code[1]] = static_cast<int32_t>(i);
+  }
+  return true;
+}
+
+size_t KeyEncoder::interval_of(const string& key, size_t pos) const {
+  const string_view rest = string_view(key).substr(pos);
+  // The last interval whose lower bound is not greater than rest. Every single
+  // byte is a lower bound, so it starts with the same byte as rest.
+  const auto byte = static_cast<unsigned char>(rest[0]);
+  if (by_byte[byte + 1] - by_byte[byte] == 1) return by_byte[byte];
+  const auto first = intervals.begin() + by_byte[byte];
+  const auto upper =
+      std::upper_bound(first, intervals.begin() + by_byte[byte + 1], rest,
+                       [](const string_view& val, const Interval& iv) {
+                         return val < iv.lower;
+                       });
+  assert(upper != first);
+  return static_cast<size_t>(upper - intervals.begin()) - 1;
+}
+
+string KeyEncoder::encode(const string& key) const {
+  string code;
+  code.reserve(key.length() * 2);
+  for (size_t pos = 0; pos < key.length();) {
+    const Interval& iv = intervals[interval_of(key, pos)];
+    assert(key.compare(pos, iv.symbol.length(), iv.symbol) == 0);
+    code.append(reinterpret_cast<const char*>(iv.code.data()), iv.code_length);
+    pos += iv.symbol.length();
+  }
+  return code;
+}
+
+string KeyEncoder::decode(const string& code) const {
+  string key;
+  for (size_t pos = 0; pos < code.length();) {
+    int32_t entry = first_level[static_cast<unsigned char>(code[pos++])];
+    if (entry < -1) {
+      if (pos == code.length())
+        throw invalid_argument("KeyEncoder::decode on truncated code.");
+      const auto table = static_cast<size_t>(-2 - entry);
+      entry = second_level[table][static_cast<unsigned char>(code[pos++])];
+    }
+    if (entry < 0) throw invalid_argument("KeyEncoder::decode on bad code.");
+    key += intervals[static_cast<size_t>(entry)].symbol;
+  }
+  return key;
+}
+
+size_t KeyEncoder::dictionary_size() const { return intervals.size(); }
@@ -0,0 +1,99 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for KeyEncoder.
+*/
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * @brief An order-preserving key compressor in the style of HOPE. The space of
+ * strings is partitioned into intervals whose boundaries are every single byte
+ * and every frequent byte sequence (and its successor) learnt from a sample.
+ * The symbol of an interval is the longest common prefix of all strings in it.
+ * A key is encoded by repeatedly finding the interval that contains the rest of
+ * the key, emitting the code of the interval, and consuming its symbol.
+ *
+ * Codes are one or two bytes, prefix free, and assigned in interval order, so
+ * a < b if and only if encode(a) < encode(b). Intervals that the sample never
+ * uses share two byte codes so that frequent intervals get one byte codes.
+ */
+class KeyEncoder {
+ private:
+  /**
+   * @brief A code of one or two bytes and the symbol it stands for.
+   */
+  struct Interval {
+    std::string lower;
+    std::string symbol;
+    uint8_t code_length;
+    std::array<unsigned char, 2> code;
+  };
+
+  // Sorted by lower bound, which is also code order.
+  std::vector<Interval> intervals;
+  // Decoding tables. A one byte code maps to its interval. The first byte of a
+  // two byte code maps to the index of its second level table.
+  std::array<int32_t, 256> first_level;
+  std::vector<std::array<int32_t, 256>> second_level;
+  // The intervals whose lower bound starts with byte c are [by_byte[c],
+  // by_byte[c + 1]), which narrows the search for an interval.
+  std::array<uint32_t, 257> by_byte;
+
+  /**
+   * @brief Find the interval containing the rest of key.
+   * @param key The key being encoded.
+   * @param pos The offset at which the rest of the key starts.
+   * @return The index of the interval.
+   */
+  size_t interval_of(const std::string& key, size_t pos) const;
+
+  /**
+   * @brief Build intervals from the given boundaries and assign codes.
+   * @param grams The multi-byte sequences to use as boundaries.
+   * @param sample The keys used to tell frequent intervals from rare ones.
+   * @return Whether or not every interval fit into the code space.
+   */
+  bool build(const std::vector<std::string>& grams,
+             const std::vector<std::string>& sample);
+
+ public:
+  /**
+   * Maximum length of a learnt byte sequence.
+   */
+  static constexpr size_t MAX_GRAM_LENGTH = 8;
+
+  /**
+   * @brief Learn a dictionary from a sample of keys.
+   * @param sample Keys representative of the keys that will be encoded. A few
+   * thousand keys suffice.
+   * @param max_grams Upper bound on the number of learnt byte sequences. Fewer
+   * are used if they do not fit into the code space.
+   */
+  explicit KeyEncoder(const std::vector<std::string>& sample,
+                      size_t max_grams = 128);
+
+  /**
+   * @brief Compress a key.
+   * @param key The key to compress.
+   * @return The compressed key, which compares like key.
+   */
+  std::string encode(const std::string& key) const;
+
+  /**
+   * @brief Decompress a key. Throws std::invalid_argument on malformed codes.
+   * @param code A string returned by encode.
+   * @return The original key.
+   */
+  std::string decode(const std::string& code) const;
+
+  /**
+   * @brief Get the number of intervals in the dictionary.
+   * @return The number of distinct codes.
+   */
+  size_t dictionary_size() const;
+};
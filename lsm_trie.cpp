@@ -0,0 +1,260 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for LsmTrie.
+*/
+#include "lsm_trie.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+using std::invalid_argument;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+LsmTrie::LsmTrie(size_t memtable_limit_in, size_t max_runs_in)
+    : mem_keys(),
+      mem_tombstones(),
+      mem_updates(0),
+      memtable_limit(memtable_limit_in),
+      max_runs(max_runs_in),
+      runs(),
+      num_compactions(0),
+      merger(),
+      merging(),
+      merged(),
+      merge_error(),
+      merge_done(false) {
+  if (memtable_limit == 0 || max_runs == 0)
+    throw invalid_argument("LsmTrie limits must be positive.");
+}
+
+LsmTrie::~LsmTrie() {
+  if (merger.joinable()) merger.join();
+}
+
+void LsmTrie::insert(const string& key) {
+  mem_keys.insert(key);
+  mem_tombstones.erase(key);
+  updated();
+}
+
+void LsmTrie::erase(const string& key) {
+  mem_keys.erase(key);
+  // Only older runs can hold the key, so no tombstone is needed without them.
+  if (!runs.empty()) mem_tombstones.insert(key);
+  updated();
+}
+
+bool LsmTrie::contains(const string& key) const {
+  if (mem_keys.find(key)) return true;
+  if (mem_tombstones.find(key)) return false;
+  for (const auto& run : runs) {
+    if (run->keys.contains(key)) return true;
+    if (run->tombstones.contains(key)) return false;
+  }
+  return false;
+}
+
+void LsmTrie::updated() {
+  finish_merge(false);
+  if (++mem_updates >= memtable_limit) flush();
+}
+
+void LsmTrie::flush() {
+  finish_merge(false);
+  if (mem_updates == 0) return;
+  auto run = std::make_shared<const Run>(
+      Run{TrieImage(mem_keys), TrieImage(mem_tombstones)});
+  runs.insert(runs.begin(), std::move(run));
+  mem_keys.clear();
+  mem_tombstones.clear();
+  mem_updates = 0;
+
+  // Writers wait rather than let reads slow down without bound.
+  if (runs.size() >= 2 * max_runs) finish_merge(true);
+  if (runs.size() <= max_runs || merger.joinable()) return;
+
+  // Merge the newest runs, and each older run no larger than them together.
+  size_t count = 2;
+  size_t total = entries(runs[0]) + entries(runs[1]);
+  while (count < runs.size() && entries(runs[count]) <= total) {
+    total += entries(runs[count++]);
+  }
+  merging.assign(runs.begin(), runs.begin() + static_cast<ptrdiff_t>(count));
+  const bool drop_tombstones = count == runs.size();
+  merge_done.store(false, std::memory_order_relaxed);
+  merger = std::thread([this, inputs = merging, drop_tombstones]() {
+    try {
+      merged = merge(inputs, drop_tombstones);
+    } catch (...) {
+      merge_error = std::current_exception();
+    }
+    merge_done.store(true, std::memory_order_release);
+  });
+}
+
+void LsmTrie::finish_merge(bool wait) {
+  if (!merger.joinable()) return;
+  if (!wait && !merge_done.load(std::memory_order_acquire)) return;
+  merger.join();
+  const auto inputs = std::move(merging);
+  merging.clear();
+  if (merge_error) {
+    auto error = merge_error;
+    merge_error = nullptr;
+    std::rethrow_exception(error);
+  }
+  // Runs flushed during the merge are newer than every merged run, so the
+  // merged block only moved back.
+  const auto first = std::find(runs.begin(), runs.end(), inputs.front());
+  assert(first != runs.end());
+  const auto last = runs.erase(
+      first, first + static_cast<ptrdiff_t>(inputs.size()));
+  if (entries(merged) > 0) runs.insert(last, std::move(merged));
+  merged.reset();
+  ++num_compactions;
+}
+
+shared_ptr<const LsmTrie::Run> LsmTrie::merge(
+    const vector<shared_ptr<const Run>>& inputs, bool drop_tombstones) {
+  // The merged entries come in order, so the images are built directly.
+  TrieImage::Builder keys;
+  TrieImage::Builder tombstones;
+  for (iterator iter(nullptr, nullptr, inputs, "", !drop_tombstones);
+       iter.valid; ++iter) {
+    (iter.at_tombstone ? tombstones : keys).add(iter.key);
+  }
+  return std::make_shared<const Run>(
+      Run{keys.finish(), tombstones.finish()});
+}
+
+size_t LsmTrie::entries(const shared_ptr<const Run>& run) {
+  return run->keys.size() + run->tombstones.size();
+}
+
+void LsmTrie::compact() {
+  flush();
+  finish_merge(true);
+  if (runs.empty() || (runs.size() == 1 && runs.front()->tombstones.empty()))
+    return;
+  // Nothing is older than every run, so tombstones have nothing left to hide.
+  auto result = merge(runs, true);
+  runs.clear();
+  if (entries(result) > 0) runs.push_back(std::move(result));
+  ++num_compactions;
+}
+
+LsmTrie::iterator LsmTrie::begin() const { return begin(""); }
+
+LsmTrie::iterator LsmTrie::begin(const string& prefix) const {
+  return iterator(&mem_keys, &mem_tombstones, runs, prefix, false);
+}
+
+LsmTrie::iterator LsmTrie::end() const { return iterator(); }
+
+size_t LsmTrie::num_runs() const { return runs.size(); }
+
+size_t LsmTrie::read_amplification() const { return 2 + 2 * runs.size(); }
+
+size_t LsmTrie::compactions() const { return num_compactions; }
+
+LsmTrie::iterator::iterator()
+    : pinned(),
+      mem_cursors(),
+      run_cursors(),
+      with_tombstones(false),
+      at_tombstone(false),
+      valid(false),
+      key() {}
+
+LsmTrie::iterator::iterator(const Trie* mem_keys, const Trie* mem_tombstones,
+                            const vector<shared_ptr<const Run>>& runs_in,
+                            const string& prefix, bool with_tombstones_in)
+    : iterator() {
+  pinned = runs_in;
+  with_tombstones = with_tombstones_in;
+  for (const Trie* tr : {mem_keys, mem_tombstones}) {
+    // The prefix range of a Trie is only valid if it is not empty.
+    if (!tr || tr->empty(prefix)) continue;
+    mem_cursors.push_back(
+        {tr->begin(prefix), tr->end(prefix), 0, tr == mem_tombstones, ""});
+    mem_cursors.back().key = *mem_cursors.back().pos;
+  }
+  for (size_t i = 0; i < pinned.size(); ++i) {
+    for (const TrieImage* image : {&pinned[i]->keys, &pinned[i]->tombstones}) {
+      if (image->empty(prefix)) continue;
+      run_cursors.push_back({image->begin(prefix), image->end(prefix), 1 + i,
+                             image == &pinned[i]->tombstones, ""});
+      run_cursors.back().key = *run_cursors.back().pos;
+    }
+  }
+  settle();
+}
+
+void LsmTrie::iterator::settle() {
+  for (;;) {
+    // The smallest key left, and whether its newest entry is a tombstone.
+    const string* least = nullptr;
+    size_t newest = std::numeric_limits<size_t>::max();
+    bool is_tombstone = false;
+    const auto find_least = [&](auto& cursors) {
+      for (const auto& cursor : cursors) {
+        if (cursor.pos == cursor.last) continue;
+        if (!least || cursor.key < *least ||
+            (cursor.key == *least && cursor.level < newest)) {
+          least = &cursor.key;
+          newest = cursor.level;
+          is_tombstone = cursor.is_tombstone;
+        }
+      }
+    };
+    find_least(mem_cursors);
+    find_least(run_cursors);
+    if (!least) {
+      valid = false;
+      key.clear();
+      return;
+    }
+
+    key = *least;
+    const auto advance = [this](auto& cursors) {
+      for (auto& cursor : cursors) {
+        if (cursor.pos == cursor.last || cursor.key != key) continue;
+        if (++cursor.pos != cursor.last) cursor.key = *cursor.pos;
+      }
+    };
+    advance(mem_cursors);
+    advance(run_cursors);
+    if (!is_tombstone || with_tombstones) {
+      valid = true;
+      at_tombstone = is_tombstone;
+      return;
+    }
+  }
+}
+
+LsmTrie::iterator& LsmTrie::iterator::operator++() {
+  settle();
+  return *this;
+}
+
+LsmTrie::iterator LsmTrie::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& LsmTrie::iterator::operator*() const { return key; }
+
+bool operator==(const LsmTrie::iterator& lhs, const LsmTrie::iterator& rhs) {
+  if (!lhs.valid || !rhs.valid) return lhs.valid == rhs.valid;
+  return lhs.key == rhs.key;
+}
+
+bool operator!=(const LsmTrie::iterator& lhs, const LsmTrie::iterator& rhs) {
+  return !(lhs == rhs);
+}
@@ -0,0 +1,297 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for LsmTrie.
+*/
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "trie.h"
+#include "trie_image.h"
+
+/**
+ * @brief A log structured merge trie for write heavy ingestion. Updates go to
+ * a small mutable Trie, the memtable, which holds inserted keys and tombstones
+ * for erased keys. Once it has taken memtable_limit updates, it is frozen
+ * into an immutable run of two TrieImages, one for keys and one for tombstones,
+ * and a fresh memtable takes further updates.
+ *
+ * Lookups check the memtable and then each run from newest to oldest, and the
+ * first one holding the key or a tombstone for it decides. Iteration merges
+ * the sorted keys of every level in one pass. Once there are more than
+ * max_runs runs, a background thread merges the newest ones into one while
+ * updates continue. Each older run joins the merge if it holds no more
+ * entries than the runs before it, so run sizes grow geometrically and every
+ * key is merged O(log n) times. Tombstones are dropped once the oldest run is
+ * merged. Should the runs reach twice max_runs first, updates wait for the
+ * merge. Read amplification, the number of tries a lookup may search, is
+ * thus at most 4 * max_runs + 2: the keys and tombstones of the memtable and
+ * of every run.
+ *
+ * Only exact keys can be erased. The background thread only reads frozen
+ * runs, so an LsmTrie may be used by one thread at a time like a Trie.
+ * Iterators hold the runs they read, but are invalidated by updates to the
+ * memtable.
+ */
+class LsmTrie {
+ public:
+  static constexpr size_t DEFAULT_MEMTABLE_LIMIT = 1 << 16;
+  static constexpr size_t DEFAULT_MAX_RUNS = 4;
+
+ private:
+  /**
+   * @brief A frozen memtable, or the result of merging runs.
+   */
+  struct Run {
+    TrieImage keys;
+    TrieImage tombstones;
+  };
+
+  Trie mem_keys;
+  Trie mem_tombstones;
+  size_t mem_updates;
+  size_t memtable_limit;
+  size_t max_runs;
+  // Newest first.
+  std::vector<std::shared_ptr<const Run>> runs;
+  size_t num_compactions;
+  // The background merge of a block of runs, if any. The thread sets
+  // merge_done after storing merged or merge_error.
+  std::thread merger;
+  std::vector<std::shared_ptr<const Run>> merging;
+  std::shared_ptr<const Run> merged;
+  std::exception_ptr merge_error;
+  std::atomic<bool> merge_done;
+
+  /**
+   * @brief Count an update, and freeze the memtable into a run once it
+   * reaches its limit.
+   */
+  void updated();
+
+  /**
+   * @brief Install a finished background merge, waiting for it if asked.
+   * Rethrows any exception thrown by the merge.
+   * @param wait Whether or not to wait for a merge in progress.
+   */
+  void finish_merge(bool wait);
+
+  /**
+   * @brief Merge consecutive runs into one, keeping the newest entry of each
+   * key. The merged entries are streamed into TrieImage builders in order,
+   * so this is linear in the total length of the entries.
+   * @param inputs The runs to merge, newest first.
+   * @param drop_tombstones Whether or not to drop tombstones, which is only
+   * correct if the oldest run is merged.
+   * @return The merged run.
+   */
+  static std::shared_ptr<const Run> merge(
+      const std::vector<std::shared_ptr<const Run>>& inputs,
+      bool drop_tombstones);
+
+  /**
+   * @brief Get the number of entries of a run.
+   * @param run The run.
+   * @return The number of keys and tombstones in the run.
+   */
+  static size_t entries(const std::shared_ptr<const Run>& run);
+
+ public:
+  /**
+   * @brief Supports const forward iteration in alphabetical order over the
+   * live keys of every level, or of those with a prefix.
+   */
+  class iterator {
+    friend class LsmTrie;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    /**
+     * @brief A sorted range of keys or tombstones of one level, and its
+     * current key.
+     */
+    template <typename Iter>
+    struct Cursor {
+      Iter pos;
+      Iter last;
+      // 0 for the memtable, and 1 + i for runs[i].
+      size_t level;
+      bool is_tombstone;
+      std::string key;
+    };
+
+    // Keeps the runs alive while they are read.
+    std::vector<std::shared_ptr<const Run>> pinned;
+    std::vector<Cursor<Trie::iterator>> mem_cursors;
+    std::vector<Cursor<TrieImage::iterator>> run_cursors;
+    // Whether keys whose newest entry is a tombstone are visited too, for
+    // merging runs, and whether the current one is such a key.
+    bool with_tombstones;
+    bool at_tombstone;
+    // False for the end iterator.
+    bool valid;
+    std::string key;
+
+    /**
+     * @brief Constructor, the end iterator.
+     */
+    iterator();
+
+    /**
+     * @brief Constructor, the first key with a prefix.
+     * @param mem_keys The keys of the memtable, or nullptr.
+     * @param mem_tombstones The tombstones of the memtable, or nullptr.
+     * @param runs_in The runs to read, newest first.
+     * @param prefix The prefix of every key to visit.
+     * @param with_tombstones_in Whether or not to visit erased keys too.
+     */
+    iterator(const Trie* mem_keys, const Trie* mem_tombstones,
+             const std::vector<std::shared_ptr<const Run>>& runs_in,
+             const std::string& prefix, bool with_tombstones_in);
+
+    /**
+     * @brief Move to the smallest key left whose newest entry is not a
+     * tombstone, unless with_tombstones is set, or to the end, advancing past
+     * every entry before it.
+     */
+    void settle();
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The key referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const LsmTrie::iterator& lhs,
+                           const LsmTrie::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const LsmTrie::iterator& lhs,
+                           const LsmTrie::iterator& rhs);
+  };
+
+  /**
+   * @brief Constructor, an empty LsmTrie. Throws std::invalid_argument if
+   * either parameter is 0.
+   * @param memtable_limit_in The number of updates that fill the memtable.
+   * @param max_runs_in The number of runs past which they are merged.
+   */
+  explicit LsmTrie(size_t memtable_limit_in = DEFAULT_MEMTABLE_LIMIT,
+                   size_t max_runs_in = DEFAULT_MAX_RUNS);
+
+  LsmTrie(const LsmTrie&) = delete;
+  LsmTrie& operator=(const LsmTrie&) = delete;
+
+  /**
+   * @brief Destructor, waits for a background merge.
+   */
+  ~LsmTrie();
+
+  /**
+   * @brief Inserts key. Idempotent if key is already stored.
+   * @param key The key to insert.
+   */
+  void insert(const std::string& key);
+
+  /**
+   * @brief Erases key by writing a tombstone. Idempotent if key is not
+   * stored.
+   * @param key The key to erase.
+   */
+  void erase(const std::string& key);
+
+  /**
+   * @brief Check for a key, from the newest level to the oldest.
+   * @param key The key to search for.
+   * @return Whether or not key is stored.
+   */
+  bool contains(const std::string& key) const;
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the smallest key.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to iterate over.
+   * @return Iterator to the first key with the given prefix. The range from it
+   * to end() holds exactly the keys with the prefix.
+   */
+  iterator begin(const std::string& prefix) const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the last key.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Freeze the memtable into a run, even if it is not full.
+   */
+  void flush();
+
+  /**
+   * @brief Flush the memtable and merge every run into one, waiting for the
+   * merge to finish.
+   */
+  void compact();
+
+  /**
+   * @brief Get the number of frozen runs.
+   * @return The number of runs.
+   */
+  size_t num_runs() const;
+
+  /**
+   * @brief Get the read amplification, the number of tries that a lookup of
+   * a missing key searches.
+   * @return Two for the keys and tombstones of the memtable, plus two for
+   * each run.
+   */
+  size_t read_amplification() const;
+
+  /**
+   * @brief Get the number of merges installed so far.
+   * @return The number of compactions.
+   */
+  size_t compactions() const;
+};
@@ -0,0 +1,750 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for PagedTrie.
+*/
+#include "paged_trie.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace {
+// The header page starts with the magic bytes, the version, the page size,
+// the number of pages, the location of the root, and the fill page.
+const char PAGED_MAGIC[8] = "TRIEPAG";
+constexpr size_t VERSION_POS = 8;
+constexpr size_t PAGE_SIZE_POS = 12;
+constexpr size_t PAGES_POS = 16;
+constexpr size_t ROOT_PAGE_POS = 20;
+constexpr size_t ROOT_SLOT_POS = 24;
+constexpr size_t FILL_PAGE_POS = 28;
+constexpr size_t HEADER_BYTES = 32;
+// A page starts with its number of slots and the start of its records, which
+// grow down from the end of the page. Each slot holds the offset and length
+// of a record, and a length of 0 marks a free slot.
+constexpr size_t LOW_POS = 2;
+constexpr size_t SLOTS_POS = 4;
+constexpr size_t SLOT_BYTES = 4;
+// A record holds the number of keys at or under the node, the length of its
+// label, its number of children, and its is_end flag. The first byte of the
+// label of each child follows, then the page and slot of each child, and then
+// the label of the node.
+constexpr size_t LABEL_LEN_POS = 8;
+constexpr size_t CHILDREN_POS = 10;
+constexpr size_t END_POS = 12;
+constexpr size_t FIRSTS_POS = 13;
+constexpr size_t REF_BYTES = 6;
+
+/**
+ * @brief Overwrite bytes of a buffer with a native integer.
+ * @param out The first byte of the buffer to write to.
+ * @param pos The offset to write at.
+ * @param val The value to write.
+ */
+template <typename T>
+void put(char* out, size_t pos, T val) {
+  std::memcpy(out + pos, &val, sizeof(T));
+}
+
+/**
+ * @brief Read a native integer.
+ * @param in The first byte of the buffer to read from.
+ * @param pos The offset to read at.
+ * @return The value read.
+ */
+template <typename T>
+T get(const char* in, size_t pos) {
+  T val;
+  std::memcpy(&val, in + pos, sizeof(T));
+  return val;
+}
+
+/**
+ * @brief Get the number of slots of a page, free or not.
+ * @param page The first byte of the page.
+ * @return The number of slots.
+ */
+size_t num_slots(const char* page) { return get<uint16_t>(page, 0); }
+
+/**
+ * @brief Get the offset of a slot within a page.
+ * @param slot The index of the slot.
+ * @return The offset of the slot.
+ */
+size_t slot_pos(size_t slot) { return SLOTS_POS + SLOT_BYTES * slot; }
+
+/**
+ * @brief Get the length of the record in a slot.
+ * @param page The first byte of the page.
+ * @param slot The index of the slot.
+ * @return The length of the record, or 0 for a free slot.
+ */
+size_t slot_length(const char* page, size_t slot) {
+  return get<uint16_t>(page, slot_pos(slot) + 2);
+}
+
+/**
+ * @brief Get the first free slot of a page.
+ * @param page The first byte of the page.
+ * @return The index of the first free slot, or the number of slots.
+ */
+size_t free_slot(const char* page) {
+  size_t slot = 0;
+  while (slot < num_slots(page) && slot_length(page, slot) != 0) ++slot;
+  return slot;
+}
+
+/**
+ * @brief Check whether a record fits in a slot of a page, if need be after
+ * compacting the page.
+ * @param page The first byte of the page.
+ * @param len The length of the record.
+ * @param slot A free slot, or the number of slots to add one.
+ * @param compact Set if the page must be compacted first.
+ * @return Whether or not the record fits.
+ */
+bool fits(const char* page, size_t len, size_t slot, bool& compact) {
+  const size_t dir_end = slot_pos(std::max(num_slots(page), slot + 1));
+  const size_t low = get<uint16_t>(page, LOW_POS);
+  compact = false;
+  if (dir_end <= low && len <= low - dir_end) return true;
+  size_t live = 0;
+  for (size_t i = 0; i < num_slots(page); ++i) live += slot_length(page, i);
+  compact = true;
+  return dir_end + live + len <= PagedTrie::PAGE_SIZE;
+}
+
+/**
+ * @brief Move every record of a page to its end, so that the free space
+ * between the slots and the records is contiguous. Slots keep their indices.
+ * @param page The first byte of the page.
+ */
+void compact(char* page) {
+  const vector<char> old(page, page + PagedTrie::PAGE_SIZE);
+  size_t low = PagedTrie::PAGE_SIZE;
+  for (size_t i = 0; i < num_slots(page); ++i) {
+    const size_t len = slot_length(page, i);
+    if (len == 0) continue;
+    low -= len;
+    std::memcpy(page + low, old.data() + get<uint16_t>(page, slot_pos(i)),
+                len);
+    put(page, slot_pos(i), static_cast<uint16_t>(low));
+  }
+  put(page, LOW_POS, static_cast<uint16_t>(low));
+}
+
+/**
+ * @brief Store a record in a page, which must have room for it.
+ * @param page The first byte of the page.
+ * @param rec The encoded record.
+ * @param slot A free slot, or the number of slots to add one.
+ * @param must_compact Whether the page must be compacted first, from fits.
+ */
+void store(char* page, const string& rec, size_t slot, bool must_compact) {
+  if (must_compact) compact(page);
+  if (slot >= num_slots(page)) put(page, 0, static_cast<uint16_t>(slot + 1));
+  const size_t low = get<uint16_t>(page, LOW_POS) - rec.length();
+  std::memcpy(page + low, rec.data(), rec.length());
+  put(page, LOW_POS, static_cast<uint16_t>(low));
+  put(page, slot_pos(slot), static_cast<uint16_t>(low));
+  put(page, slot_pos(slot) + 2, static_cast<uint16_t>(rec.length()));
+}
+
+/**
+ * @brief Get the number of children of a record.
+ * @param rec The first byte of the record.
+ * @return The number of children.
+ */
+size_t num_children(const char* rec) {
+  return get<uint16_t>(rec, CHILDREN_POS);
+}
+
+/**
+ * @brief Get the length of the label of a record.
+ * @param rec The first byte of the record.
+ * @return The length of the label.
+ */
+size_t label_length(const char* rec) {
+  return get<uint16_t>(rec, LABEL_LEN_POS);
+}
+
+/**
+ * @brief Get the label of a record.
+ * @param rec The first byte of the record.
+ * @return A pointer to the first byte of the label.
+ */
+const char* label(const char* rec) {
+  return rec + FIRSTS_POS + (1 + REF_BYTES) * num_children(rec);
+}
+
+/**
+ * @brief Check whether a record stores a key.
+ * @param rec The first byte of the record.
+ * @return The is_end flag of the record.
+ */
+bool is_end(const char* rec) { return rec[END_POS] != 0; }
+
+/**
+ * @brief Read from a file until every byte is read.
+ * @param fd The file descriptor.
+ * @param out The buffer to read into.
+ * @param len The number of bytes.
+ * @param pos The offset in the file.
+ * @return Whether or not every byte was read.
+ */
+bool read_all(int fd, char* out, size_t len, off_t pos) {
+  while (len > 0) {
+    const ssize_t n = pread(fd, out, len, pos);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    out += n;
+    len -= static_cast<size_t>(n);
+    pos += n;
+  }
+  return true;
+}
+
+/**
+ * @brief Write to a file until every byte is written.
+ * @param fd The file descriptor.
+ * @param in The bytes to write.
+ * @param len The number of bytes.
+ * @param pos The offset in the file.
+ * @return Whether or not every byte was written.
+ */
+bool write_all(int fd, const char* in, size_t len, off_t pos) {
+  while (len > 0) {
+    const ssize_t n = pwrite(fd, in, len, pos);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return false;
+    in += n;
+    len -= static_cast<size_t>(n);
+    pos += n;
+  }
+  return true;
+}
+
+}  // namespace
+
+PagedTrie::PagedTrie(const string& path_in, size_t memory_budget)
+    : path(path_in),
+      fd(-1),
+      num_pages(1),
+      root{0, 0},
+      fill_page(0),
+      capacity(std::max(MIN_FRAMES, memory_budget / PAGE_SIZE)),
+      frames(),
+      table(),
+      hand(0),
+      reads(0),
+      writes(0) {
+  fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0) throw runtime_error("Cannot open " + path + ".");
+  frames.reserve(capacity);
+  struct stat info;
+  if (fstat(fd, &info) != 0) {
+    close(fd);
+    throw runtime_error("Cannot read " + path + ".");
+  }
+
+  // A new file starts with an empty root.
+  if (info.st_size == 0) {
+    root = place(encode({0, false, "", "", {}}), 0);
+    write_header();
+    return;
+  }
+
+  char header[HEADER_BYTES];
+  if (!read_all(fd, header, HEADER_BYTES, 0) ||
+      std::memcmp(header, PAGED_MAGIC, sizeof(PAGED_MAGIC)) != 0) {
+    close(fd);
+    throw runtime_error("Not a paged trie.");
+  }
+  if (get<uint32_t>(header, VERSION_POS) != VERSION ||
+      get<uint32_t>(header, PAGE_SIZE_POS) != PAGE_SIZE) {
+    close(fd);
+    throw runtime_error("Unsupported paged trie version.");
+  }
+  num_pages = get<uint32_t>(header, PAGES_POS);
+  root = {get<uint32_t>(header, ROOT_PAGE_POS),
+          get<uint16_t>(header, ROOT_SLOT_POS)};
+  fill_page = get<uint32_t>(header, FILL_PAGE_POS);
+  if (root.page == 0 || root.page >= num_pages || fill_page >= num_pages ||
+      static_cast<uint64_t>(info.st_size) < uint64_t{num_pages} * PAGE_SIZE) {
+    close(fd);
+    throw runtime_error("Corrupt paged trie.");
+  }
+}
+
+PagedTrie::~PagedTrie() {
+  // Destructors must not throw.
+  try {
+    flush();
+  } catch (const runtime_error&) {
+  }
+  close(fd);
+}
+
+size_t PagedTrie::victim() const {
+  if (frames.size() < capacity) {
+    frames.push_back({0, false, false, std::make_unique<char[]>(PAGE_SIZE)});
+    return frames.size() - 1;
+  }
+  // Pages accessed since the hand last passed get a second chance.
+  for (;;) {
+    const size_t index = hand;
+    hand = (hand + 1) % frames.size();
+    Frame& frame = frames[index];
+    if (frame.referenced) {
+      frame.referenced = false;
+      continue;
+    }
+    if (frame.dirty) write_back(frame);
+    table.erase(frame.page);
+    return index;
+  }
+}
+
+char* PagedTrie::fetch(uint32_t page, bool dirty) const {
+  assert(page != 0 && page < num_pages);
+  const auto hit = table.find(page);
+  size_t index = 0;
+  if (hit != table.end()) {
+    index = hit->second;
+  } else {
+    index = victim();
+    if (!read_all(fd, frames[index].data.get(), PAGE_SIZE,
+                  static_cast<off_t>(uint64_t{page} * PAGE_SIZE)))
+      throw runtime_error("Cannot read " + path + ".");
+    ++reads;
+    frames[index].page = page;
+    frames[index].dirty = false;
+    table.emplace(page, index);
+  }
+  Frame& frame = frames[index];
+  frame.referenced = true;
+  frame.dirty = frame.dirty || dirty;
+  return frame.data.get();
+}
+
+void PagedTrie::write_back(Frame& frame) const {
+  if (!write_all(fd, frame.data.get(), PAGE_SIZE,
+                 static_cast<off_t>(uint64_t{frame.page} * PAGE_SIZE)))
+    throw runtime_error("Cannot write " + path + ".");
+  ++writes;
+  frame.dirty = false;
+}
+
+uint32_t PagedTrie::new_page() {
+  if (num_pages == UINT32_MAX) throw runtime_error("PagedTrie is too large.");
+  const uint32_t page = num_pages++;
+  // The page is dirty, so it is written before it can be read back.
+  const size_t index = victim();
+  Frame& frame = frames[index];
+  frame.page = page;
+  frame.dirty = true;
+  frame.referenced = true;
+  std::memset(frame.data.get(), 0, PAGE_SIZE);
+  put(frame.data.get(), LOW_POS, static_cast<uint16_t>(PAGE_SIZE));
+  table.emplace(page, index);
+  return page;
+}
+
+bool PagedTrie::place_in(uint32_t page, const string& rec, Ref& ref) {
+  const char* data = fetch(page, false);
+  const size_t slot = free_slot(data);
+  bool must_compact = false;
+  if (!fits(data, rec.length(), slot, must_compact)) return false;
+  store(fetch(page, true), rec, slot, must_compact);
+  ref = {page, static_cast<uint16_t>(slot)};
+  return true;
+}
+
+PagedTrie::Ref PagedTrie::place(const string& rec, uint32_t near) {
+  Ref ref{0, 0};
+  if (near != 0 && place_in(near, rec, ref)) return ref;
+  if (fill_page != 0 && fill_page != near && place_in(fill_page, rec, ref))
+    return ref;
+  // The new page takes the rest of the subtree that overflowed. Every record
+  // fits in an empty page.
+  fill_page = new_page();
+  place_in(fill_page, rec, ref);
+  assert(ref.page == fill_page);
+  return ref;
+}
+
+PagedTrie::Ref PagedTrie::rewrite(Ref ref, const string& rec) {
+  char* page = fetch(ref.page, true);
+  const size_t pos = slot_pos(ref.slot);
+  // A record that does not grow stays where it is. Slack is reclaimed by
+  // compaction.
+  if (rec.length() <= slot_length(page, ref.slot)) {
+    std::memcpy(page + get<uint16_t>(page, pos), rec.data(), rec.length());
+    put(page, pos + 2, static_cast<uint16_t>(rec.length()));
+    return ref;
+  }
+  put(page, pos + 2, uint16_t{0});
+  bool must_compact = false;
+  if (fits(page, rec.length(), ref.slot, must_compact)) {
+    store(page, rec, ref.slot, must_compact);
+    return ref;
+  }
+  return place(rec, fill_page);
+}
+
+const char* PagedTrie::record(Ref ref) const {
+  const char* page = fetch(ref.page, false);
+  return page + get<uint16_t>(page, slot_pos(ref.slot));
+}
+
+PagedTrie::Ref PagedTrie::child(const char* rec, size_t index) {
+  const size_t pos = FIRSTS_POS + num_children(rec) + REF_BYTES * index;
+  return {get<uint32_t>(rec, pos), get<uint16_t>(rec, pos + 4)};
+}
+
+size_t PagedTrie::search(const char* rec, char first) {
+  // Labels compare as unsigned bytes, like std::string.
+  const auto* firsts = reinterpret_cast<const unsigned char*>(rec + FIRSTS_POS);
+  const size_t n = num_children(rec);
+  return static_cast<size_t>(
+      std::lower_bound(firsts, firsts + n, static_cast<unsigned char>(first)) -
+      firsts);
+}
+
+PagedTrie::Record PagedTrie::read(Ref ref) const {
+  const char* rec = record(ref);
+  const size_t n = num_children(rec);
+  Record out{get<uint64_t>(rec, 0), is_end(rec),
+             string(label(rec), label_length(rec)),
+             string(rec + FIRSTS_POS, n), {}};
+  out.children.reserve(n);
+  for (size_t i = 0; i < n; ++i) out.children.push_back(child(rec, i));
+  return out;
+}
+
+string PagedTrie::encode(const Record& rec) {
+  const size_t n = rec.children.size();
+  assert(rec.firsts.length() == n && rec.label.length() <= MAX_LABEL);
+  string out(FIRSTS_POS + (1 + REF_BYTES) * n + rec.label.length(), '\0');
+  put(&out[0], 0, rec.num_keys);
+  put(&out[0], LABEL_LEN_POS, static_cast<uint16_t>(rec.label.length()));
+  put(&out[0], CHILDREN_POS, static_cast<uint16_t>(n));
+  out[END_POS] = rec.is_end;
+  out.replace(FIRSTS_POS, n, rec.firsts);
+  for (size_t i = 0; i < n; ++i) {
+    put(&out[0], FIRSTS_POS + n + REF_BYTES * i, rec.children[i].page);
+    put(&out[0], FIRSTS_POS + n + REF_BYTES * i + 4, rec.children[i].slot);
+  }
+  out.replace(FIRSTS_POS + (1 + REF_BYTES) * n, rec.label.length(), rec.label);
+  return out;
+}
+
+PagedTrie::Ref PagedTrie::chain(const string& suffix, uint32_t near) {
+  assert(!suffix.empty());
+  // The chain is built from its end, so each node knows its child.
+  size_t start = (suffix.length() - 1) / MAX_LABEL * MAX_LABEL;
+  Record rec{1, true, suffix.substr(start), "", {}};
+  Ref below = place(encode(rec), near);
+  while (start > 0) {
+    rec.is_end = false;
+    rec.firsts.assign(1, suffix[start]);
+    rec.children.assign(1, below);
+    start -= MAX_LABEL;
+    rec.label = suffix.substr(start, MAX_LABEL);
+    below = place(encode(rec), near);
+  }
+  return below;
+}
+
+void PagedTrie::update(const vector<Ref>& parents, Ref node,
+                       const Record& rec) {
+  const Ref moved = rewrite(node, encode(rec));
+  if (moved == node) return;
+  if (parents.empty()) {
+    root = moved;
+    return;
+  }
+  // The record of the parent keeps its size, so it is changed in place.
+  const Ref par = parents.back();
+  const char* par_rec = record(par);
+  const size_t n = num_children(par_rec);
+  size_t index = 0;
+  while (index < n && !(child(par_rec, index) == node)) ++index;
+  assert(index < n);
+  char* page = fetch(par.page, true);
+  const size_t pos = get<uint16_t>(page, slot_pos(par.slot)) + FIRSTS_POS +
+                     n + REF_BYTES * index;
+  put(page, pos, moved.page);
+  put(page, pos + 4, moved.slot);
+}
+
+void PagedTrie::write_header() const {
+  char header[HEADER_BYTES] = {};
+  std::memcpy(header, PAGED_MAGIC, sizeof(PAGED_MAGIC));
+  put(header, VERSION_POS, VERSION);
+  put(header, PAGE_SIZE_POS, static_cast<uint32_t>(PAGE_SIZE));
+  put(header, PAGES_POS, num_pages);
+  put(header, ROOT_PAGE_POS, root.page);
+  put(header, ROOT_SLOT_POS, root.slot);
+  put(header, FILL_PAGE_POS, fill_page);
+  if (!write_all(fd, header, HEADER_BYTES, 0))
+    throw runtime_error("Cannot write " + path + ".");
+}
+
+void PagedTrie::flush() {
+  for (Frame& frame : frames) {
+    if (frame.dirty) write_back(frame);
+  }
+  // The header goes last, so that it only names pages already written.
+  write_header();
+  if (fdatasync(fd) != 0) throw runtime_error("Cannot sync " + path + ".");
+}
+
+PagedTrie::Ref PagedTrie::match(const string& key, bool is_prefix,
+                                iterator* iter) const {
+  Ref node = root;
+  size_t depth = 0;
+  if (iter) iter->path.push_back({node, 0, 0});
+  for (;;) {
+    const char* rec = record(node);
+    // A node continues the key with its label. The root's label is empty.
+    const size_t len = label_length(rec);
+    const size_t cmp = std::min(len, key.length() - depth);
+    if ((!is_prefix && cmp < len) ||
+        std::memcmp(label(rec), key.data() + depth, cmp) != 0)
+      return {0, 0};
+    if (iter) iter->key.append(label(rec), len);
+    depth += len;
+    if (depth >= key.length()) return node;
+    const size_t index = search(rec, key[depth]);
+    if (index == num_children(rec)) return {0, 0};
+    node = child(rec, index);
+    if (iter) {
+      iter->path.back().index = index;
+      iter->path.push_back({node, 0, depth});
+    }
+  }
+}
+
+bool PagedTrie::empty(const string& prefix) const { return size(prefix) == 0; }
+
+size_t PagedTrie::size(const string& prefix) const {
+  const Ref node = match(prefix, true, nullptr);
+  if (node.page == 0) return 0;
+  return static_cast<size_t>(get<uint64_t>(record(node), 0));
+}
+
+bool PagedTrie::contains(const string& key) const {
+  const Ref node = match(key, false, nullptr);
+  return node.page != 0 && is_end(record(node));
+}
+
+PagedTrie::iterator PagedTrie::find(const string& key) const {
+  iterator iter(this);
+  const Ref node = match(key, false, &iter);
+  if (node.page == 0 || !is_end(record(node))) return end();
+  return iter;
+}
+
+bool PagedTrie::insert(const string& key) {
+  // Knowing that the key is new, every node on its path gains a key on the
+  // way down.
+  if (contains(key)) return false;
+  vector<Ref> parents;
+  Ref node = root;
+  size_t depth = 0;
+  for (;;) {
+    Record rec = read(node);
+    ++rec.num_keys;
+    if (depth == key.length()) {
+      rec.is_end = true;
+      update(parents, node, rec);
+      return true;
+    }
+
+    const size_t index = search(record(node), key[depth]);
+    if (index == rec.children.size() || rec.firsts[index] != key[depth]) {
+      // No label shares a first byte with the rest of the key.
+      const Ref leaf = chain(key.substr(depth), node.page);
+      rec.firsts.insert(index, 1, key[depth]);
+      rec.children.insert(rec.children.begin() + index, leaf);
+      update(parents, node, rec);
+      return true;
+    }
+
+    const Ref kid = rec.children[index];
+    Record sub = read(kid);
+    const size_t cmp = std::min(sub.label.length(), key.length() - depth);
+    const size_t common = static_cast<size_t>(
+        std::mismatch(sub.label.begin(), sub.label.begin() + cmp,
+                      key.begin() + depth)
+            .first -
+        sub.label.begin());
+    if (common == sub.label.length()) {
+      update(parents, node, rec);
+      parents.push_back(node);
+      node = kid;
+      depth += common;
+      continue;
+    }
+
+    // Split the label of the child with a junction holding the common part.
+    Record junction{sub.num_keys + 1, depth + common == key.length(),
+                    sub.label.substr(0, common),
+                    string(1, sub.label[common]),
+                    {kid}};
+    if (!junction.is_end) {
+      const bool before = static_cast<unsigned char>(key[depth + common]) <
+                          static_cast<unsigned char>(sub.label[common]);
+      const Ref leaf = chain(key.substr(depth + common), node.page);
+      junction.firsts.insert(before ? 0 : 1, 1, key[depth + common]);
+      junction.children.insert(
+          before ? junction.children.begin() : junction.children.end(), leaf);
+    }
+    // A shorter label never moves the child.
+    sub.label.erase(0, common);
+    rewrite(kid, encode(sub));
+    rec.children[index] = place(encode(junction), node.page);
+    update(parents, node, rec);
+    return true;
+  }
+}
+
+PagedTrie::iterator PagedTrie::lower_bound(const string& key) const {
+  iterator iter(this);
+  iter.path.push_back({root, 0, 0});
+  for (size_t depth = 0; depth < key.length();) {
+    const char* rec = record(iter.path.back().node);
+    const size_t index = search(rec, key[depth]);
+    // Every key under the node is less than key.
+    if (index == num_children(rec)) {
+      iter.skip();
+      return iter;
+    }
+    iter.push(index);
+    const size_t len = iter.key.length() - depth;
+    const size_t cmp = std::min(len, key.length() - depth);
+    const auto diff = std::mismatch(iter.key.begin() + depth,
+                                    iter.key.begin() + depth + cmp,
+                                    key.begin() + depth);
+    if (diff.first != iter.key.begin() + depth + cmp) {
+      // The label decides whether the whole subtree is below or above key.
+      if (static_cast<unsigned char>(*diff.first) <
+          static_cast<unsigned char>(*diff.second)) {
+        iter.skip();
+      } else {
+        iter.first_key();
+      }
+      return iter;
+    }
+    depth += len;
+  }
+  // Every key at or under the node is at least key.
+  iter.first_key();
+  return iter;
+}
+
+PagedTrie::iterator PagedTrie::begin() const { return lower_bound(""); }
+
+PagedTrie::iterator PagedTrie::end() const { return iterator(this); }
+
+PagedTrie::iterator PagedTrie::begin(const string& prefix) const {
+  // Keys with the prefix are the first keys not less than it.
+  return lower_bound(prefix);
+}
+
+PagedTrie::iterator PagedTrie::end(const string& prefix) const {
+  iterator iter(this);
+  if (match(prefix, true, &iter).page == 0) return lower_bound(prefix);
+  iter.skip();
+  return iter;
+}
+
+size_t PagedTrie::pages() const { return num_pages; }
+
+size_t PagedTrie::page_reads() const { return reads; }
+
+size_t PagedTrie::page_writes() const { return writes; }
+
+PagedTrie::iterator::iterator(const PagedTrie* t) : tree(t), path(), key() {}
+
+void PagedTrie::iterator::push(size_t index) {
+  const Ref node = path.back().node;
+  path.back().index = index;
+  const Ref kid = child(tree->record(node), index);
+  const char* rec = tree->record(kid);
+  const size_t depth = key.length();
+  key.append(label(rec), label_length(rec));
+  path.push_back({kid, 0, depth});
+}
+
+void PagedTrie::iterator::first_key() {
+  for (;;) {
+    const char* rec = tree->record(path.back().node);
+    if (is_end(rec)) return;
+    // Only the root of an empty trie has neither a key nor children.
+    if (num_children(rec) == 0) {
+      path.clear();
+      key.clear();
+      return;
+    }
+    push(0);
+  }
+}
+
+void PagedTrie::iterator::skip() {
+  while (path.size() > 1) {
+    key.resize(path.back().depth);
+    path.pop_back();
+    const Frame& par = path.back();
+    // Move to the next sibling if there is one.
+    if (par.index + 1 < num_children(tree->record(par.node))) {
+      push(par.index + 1);
+      first_key();
+      return;
+    }
+  }
+  path.clear();
+  key.clear();
+}
+
+PagedTrie::iterator& PagedTrie::iterator::operator++() {
+  if (num_children(tree->record(path.back().node)) == 0) {
+    skip();
+  } else {
+    push(0);
+    first_key();
+  }
+  return *this;
+}
+
+PagedTrie::iterator PagedTrie::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& PagedTrie::iterator::operator*() const { return key; }
+
+bool operator==(const PagedTrie::iterator& lhs,
+                const PagedTrie::iterator& rhs) {
+  // Every node is visited at most once, so the last nodes tell keys apart.
+  if (lhs.path.empty() || rhs.path.empty())
+    return lhs.path.empty() && rhs.path.empty();
+  return lhs.path.back().node == rhs.path.back().node;
+}
+
+bool operator!=(const PagedTrie::iterator& lhs,
+                const PagedTrie::iterator& rhs) {
+  return !(lhs == rhs);
+}
@@ -0,0 +1,426 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for PagedTrie.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A radix tree that lives in a file of fixed size pages, for key sets
+ * too large for the in memory Node layout. Only a bounded buffer pool of pages
+ * is held in memory, and the least recently used pages are approximated and
+ * evicted with the CLOCK algorithm, so the memory budget is fixed no matter
+ * how many keys are stored.
+ *
+ * Pages are slotted: a page holds a number of variable length node records,
+ * and a node is referred to by its page and slot. New nodes are placed in the
+ * page of their parent while it has room, so each page holds a connected
+ * fragment of the tree and most steps of a descent stay within one page. A
+ * node that outgrows its page moves to another one, and its parent is pointed
+ * at the new slot.
+ *
+ * Each node record holds the label of the edge into it, so that a parent only
+ * stores the first byte of each label, and the number of keys under it, so
+ * that size(prefix) takes O(|prefix|) page accesses. Labels longer than
+ * MAX_LABEL are split across a chain of nodes.
+ *
+ * Changes reach the file when pages are evicted or on flush, which the
+ * destructor calls. The file is not crash safe. Pages are in native byte
+ * order, and only the header is checked on opening, so files must come from a
+ * trusted source. Only one PagedTrie may use a file at a time. Iterators are
+ * invalidated by insert.
+ */
+class PagedTrie {
+ public:
+  static constexpr size_t PAGE_SIZE = 4096;
+  static constexpr size_t MAX_LABEL = 1024;
+  static constexpr size_t MIN_FRAMES = 4;
+  static constexpr size_t DEFAULT_BUDGET = size_t{64} << 20;
+  static constexpr uint32_t VERSION = 1;
+
+ private:
+  /**
+   * @brief The location of a node record. Page 0 holds the file header, so
+   * a reference to it is null.
+   */
+  struct Ref {
+    uint32_t page;
+    uint16_t slot;
+
+    bool operator==(const Ref& other) const {
+      return page == other.page && slot == other.slot;
+    }
+  };
+
+  /**
+   * @brief A decoded node record, for building and changing records.
+   */
+  struct Record {
+    uint64_t num_keys;
+    bool is_end;
+    std::string label;
+    std::string firsts;
+    std::vector<Ref> children;
+  };
+
+  /**
+   * @brief A page held in the buffer pool.
+   */
+  struct Frame {
+    uint32_t page;
+    bool dirty;
+    // Set on every access and cleared as the clock hand passes.
+    bool referenced;
+    std::unique_ptr<char[]> data;
+  };
+
+  std::string path;
+  int fd;
+  uint32_t num_pages;
+  Ref root;
+  // The page that new nodes go to when their parent's page is full.
+  uint32_t fill_page;
+  // The buffer pool. Lookups are const but still load and evict pages.
+  size_t capacity;
+  mutable std::vector<Frame> frames;
+  mutable std::unordered_map<uint32_t, size_t> table;
+  mutable size_t hand;
+  mutable size_t reads;
+  mutable size_t writes;
+
+  /**
+   * @brief Get a frame for another page, evicting one if the pool is full.
+   * @return The index of a frame that is not in the page table.
+   */
+  size_t victim() const;
+
+  /**
+   * @brief Get a page through the buffer pool, reading it on a miss. The
+   * pointer is valid until the next page is fetched.
+   * @param page The number of the page.
+   * @param dirty Whether or not the caller changes the page.
+   * @return The bytes of the page.
+   */
+  char* fetch(uint32_t page, bool dirty) const;
+
+  /**
+   * @brief Write a page back to the file.
+   * @param frame The frame holding the page.
+   */
+  void write_back(Frame& frame) const;
+
+  /**
+   * @brief Append an empty page to the file and hold it in the pool.
+   * @return The number of the new page.
+   */
+  uint32_t new_page();
+
+  /**
+   * @brief Store a record in a page if it has room.
+   * @param page The number of the page.
+   * @param rec The encoded record.
+   * @param ref Set to the location of the record on success.
+   * @return Whether or not the record was stored.
+   */
+  bool place_in(uint32_t page, const std::string& rec, Ref& ref);
+
+  /**
+   * @brief Store a new record, preferring the page of its parent.
+   * @param rec The encoded record.
+   * @param near The page of the parent of the node.
+   * @return The location of the record.
+   */
+  Ref place(const std::string& rec, uint32_t near);
+
+  /**
+   * @brief Replace a record, moving it to another page if it no longer fits.
+   * @param ref The location of the record.
+   * @param rec The new encoded record.
+   * @return The new location of the record.
+   */
+  Ref rewrite(Ref ref, const std::string& rec);
+
+  /**
+   * @brief Get a node record in place. The pointer is valid until the next
+   * page is fetched.
+   * @param ref The location of the record.
+   * @return The first byte of the record.
+   */
+  const char* record(Ref ref) const;
+
+  /**
+   * @brief Get a child of a node record.
+   * @param rec The first byte of the record.
+   * @param index The index of the child.
+   * @return The location of the child.
+   */
+  static Ref child(const char* rec, size_t index);
+
+  /**
+   * @brief Search the children of a node record.
+   * @param rec The first byte of the record.
+   * @param first The first byte of the label to search for.
+   * @return The index of the first child whose label does not start with a
+   * byte less than first, or the number of children if there is none.
+   */
+  static size_t search(const char* rec, char first);
+
+  /**
+   * @brief Decode a node record.
+   * @param ref The location of the record.
+   * @return The decoded record.
+   */
+  Record read(Ref ref) const;
+
+  /**
+   * @brief Encode a node record.
+   * @param rec The decoded record.
+   * @return The bytes of the record.
+   */
+  static std::string encode(const Record& rec);
+
+  /**
+   * @brief Store the nodes for the suffix of a new key as a chain of nodes
+   * whose labels are at most MAX_LABEL bytes long.
+   * @param suffix The rest of the key, which is not empty.
+   * @param near The page of the parent of the chain.
+   * @return The location of the first node of the chain.
+   */
+  Ref chain(const std::string& suffix, uint32_t near);
+
+  /**
+   * @brief Replace the record of a node on the insertion path, and point its
+   * parent at it if it moved.
+   * @param parents The path from the root to the parent of the node.
+   * @param node The location of the record.
+   * @param rec The new record.
+   */
+  void update(const std::vector<Ref>& parents, Ref node, const Record& rec);
+
+  /**
+   * @brief Write the file header.
+   */
+  void write_header() const;
+
+ public:
+  /**
+   * @brief Supports const forward iteration in alphabetical order. Holds the
+   * path from the root, so no parent references are stored in the pages.
+   */
+  class iterator {
+    friend class PagedTrie;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    /**
+     * @brief A node on the path, the child of it that the path follows, and
+     * the length of the key before the label of the node.
+     */
+    struct Frame {
+      Ref node;
+      size_t index;
+      size_t depth;
+    };
+
+    const PagedTrie* tree;
+    // Empty for the end iterator.
+    std::vector<Frame> path;
+    std::string key;
+
+    /**
+     * @brief Constructor, the end iterator.
+     * @param t The trie being iterated over.
+     */
+    explicit iterator(const PagedTrie* t);
+
+    /**
+     * @brief Extend the path to a child of the last node.
+     * @param index The index of the child.
+     */
+    void push(size_t index);
+
+    /**
+     * @brief Extend the path down to the first key at or under the last node.
+     */
+    void first_key();
+
+    /**
+     * @brief Move to the first key after every key under the last node, or to
+     * the end.
+     */
+    void skip();
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The key referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const PagedTrie::iterator& lhs,
+                           const PagedTrie::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const PagedTrie::iterator& lhs,
+                           const PagedTrie::iterator& rhs);
+  };
+
+ private:
+  /**
+   * @brief Descend from the root along key.
+   * @param key The key or prefix to match.
+   * @param is_prefix Whether key may end inside a label.
+   * @param iter If non-null, receives the path to the matched node.
+   * @return The node matching key, or a null reference if there is none.
+   */
+  Ref match(const std::string& key, bool is_prefix, iterator* iter) const;
+
+ public:
+  /**
+   * @brief Open or create a paged trie. Throws std::runtime_error if the file
+   * cannot be used or does not hold a paged trie.
+   * @param path_in The path of the file.
+   * @param memory_budget The bytes of pages to cache, at least MIN_FRAMES
+   * pages.
+   */
+  explicit PagedTrie(const std::string& path_in,
+                     size_t memory_budget = DEFAULT_BUDGET);
+
+  PagedTrie(const PagedTrie&) = delete;
+  PagedTrie& operator=(const PagedTrie&) = delete;
+
+  /**
+   * @brief Destructor, flushes every changed page.
+   */
+  ~PagedTrie();
+
+  /**
+   * @brief Write every changed page and the header to the file and sync it.
+   * Throws std::runtime_error on failure.
+   */
+  void flush();
+
+  /**
+   * @brief Check for keys with a prefix.
+   * @param prefix The prefix to check.
+   * @return Whether or not no key has the given prefix.
+   */
+  bool empty(const std::string& prefix = "") const;
+
+  /**
+   * @brief Count keys with a prefix in O(|prefix|).
+   * @param prefix The prefix to count.
+   * @return The number of keys with the given prefix.
+   */
+  size_t size(const std::string& prefix = "") const;
+
+  /**
+   * @brief Check for a key without building an iterator.
+   * @param key The key to search for.
+   * @return Whether or not key is stored.
+   */
+  bool contains(const std::string& key) const;
+
+  /**
+   * @brief Searches for key.
+   * @param key The key to search for.
+   * @return An iterator to key if it exists. Otherwise, end().
+   */
+  iterator find(const std::string& key) const;
+
+  /**
+   * @brief Inserts key. Idempotent if key is already stored.
+   * @param key The key to insert.
+   * @return Whether or not key was new.
+   */
+  bool insert(const std::string& key);
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the smallest key.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the largest key.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Find the first key that is not less than key.
+   * @param key The bound to search for, which need not be stored.
+   * @return An iterator to the first key not less than key, or end().
+   */
+  iterator lower_bound(const std::string& key) const;
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the first key with the given prefix, or end(prefix) if
+   * there is none, so the range is always valid.
+   */
+  iterator begin(const std::string& prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to the first key after every key with the given prefix.
+   */
+  iterator end(const std::string& prefix) const;
+
+  /**
+   * @brief Get the size of the file.
+   * @return The number of pages, including the header page.
+   */
+  size_t pages() const;
+
+  /**
+   * @brief Get the number of pages read from the file, which are the misses
+   * of the buffer pool.
+   * @return The number of page reads since opening.
+   */
+  size_t page_reads() const;
+
+  /**
+   * @brief Get the number of pages written to the file.
+   * @return The number of page writes since opening.
+   */
+  size_t page_writes() const;
+};
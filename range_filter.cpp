@@ -0,0 +1,461 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for RangeFilter.
+*/
+#include "range_filter.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <stdexcept>
+using std::invalid_argument;
+using std::queue;
+using std::string;
+using std::vector;
+
+RangeFilter::BitVector::BitVector()
+    : words(), ranks(), samples(), num_bits(0) {}
+
+void RangeFilter::BitVector::push_back(bool bit) {
+  if (num_bits % 64 == 0) words.push_back(0);
+  if (bit) words.back() |= uint64_t{1} << (num_bits % 64);
+  ++num_bits;
+}
+
+void RangeFilter::BitVector::build_ranks() {
+  ranks.clear();
+  samples.clear();
+  uint32_t count = 0;
+  for (size_t i = 0; i < words.size(); ++i) {
+    if (i % BLOCK_WORDS == 0) ranks.push_back(count);
+    count += static_cast<uint32_t>(__builtin_popcountll(words[i]));
+    while (samples.size() * SELECT_SAMPLE < count) {
+      samples.push_back(static_cast<uint32_t>(i / BLOCK_WORDS));
+    }
+  }
+  // The total closes the last block.
+  ranks.push_back(count);
+}
+
+void RangeFilter::BitVector::set(size_t pos) {
+  words[pos / 64] |= uint64_t{1} << (pos % 64);
+}
+
+bool RangeFilter::BitVector::operator[](size_t pos) const {
+  return (words[pos / 64] >> (pos % 64)) & 1;
+}
+
+size_t RangeFilter::BitVector::rank1(size_t pos) const {
+  const size_t word = pos / 64;
+  const size_t block = word / BLOCK_WORDS;
+  size_t count = ranks[block];
+  for (size_t i = block * BLOCK_WORDS; i < word; ++i) {
+    count += static_cast<size_t>(__builtin_popcountll(words[i]));
+  }
+  if (pos % 64 != 0) {
+    const uint64_t mask = (uint64_t{1} << (pos % 64)) - 1;
+    count += static_cast<size_t>(__builtin_popcountll(words[word] & mask));
+  }
+  return count;
+}
+
+size_t RangeFilter::BitVector::select1(size_t n) const {
+  if (n >= ranks.back()) return num_bits;
+  // The last block with at most n ones before it holds the answer. It lies
+  // between the blocks of the samples around n.
+  const size_t sample = n / SELECT_SAMPLE;
+  const auto first = ranks.begin() + samples[sample];
+  const auto last = sample + 1 < samples.size()
+                        ? ranks.begin() + samples[sample + 1] + 1
+                        : ranks.end();
+  const auto block = static_cast<size_t>(
+      std::upper_bound(first, last, n) - ranks.begin() - 1);
+  n -= ranks[block];
+  for (size_t i = block * BLOCK_WORDS;; ++i) {
+    const auto ones = static_cast<size_t>(__builtin_popcountll(words[i]));
+    if (n < ones) {
+      uint64_t word = words[i];
+      for (; n > 0; --n) word &= word - 1;
+      return i * 64 + static_cast<size_t>(__builtin_ctzll(word));
+    }
+    n -= ones;
+  }
+}
+
+size_t RangeFilter::BitVector::next1(size_t pos) const {
+  if (pos >= num_bits) return num_bits;
+  size_t i = pos / 64;
+  uint64_t word = words[i] & (~uint64_t{0} << (pos % 64));
+  while (word == 0) {
+    if (++i == words.size()) return num_bits;
+    word = words[i];
+  }
+  return i * 64 + static_cast<size_t>(__builtin_ctzll(word));
+}
+
+size_t RangeFilter::BitVector::size() const { return num_bits; }
+
+size_t RangeFilter::BitVector::memory_usage() const {
+  return words.size() * sizeof(uint64_t) +
+         (ranks.size() + samples.size()) * sizeof(uint32_t);
+}
+
+RangeFilter::RangeFilter(const Trie& tree, size_t real, size_t hash,
+                         size_t dense_ratio)
+    : dense_labels(),
+      dense_has_child(),
+      dense_prefix_key(),
+      dense_levels(0),
+      dense_nodes(0),
+      dense_children(0),
+      dense_leaves(0),
+      labels(),
+      has_child(),
+      louds(),
+      prefix_key(),
+      suffixes(),
+      real_bits(real),
+      hash_bits(hash),
+      suffix_bits(real + hash),
+      num_keys(0) {
+  if (real > MAX_SUFFIX_BITS || hash > MAX_SUFFIX_BITS - real)
+    throw invalid_argument("RangeFilter suffix bits out of range.");
+
+  const vector<string> keys(tree.begin(), tree.end());
+  num_keys = keys.size();
+
+  // Breadth first over the runs of keys that share a prefix of length depth.
+  // A run of one key is a leaf, which truncates the key after its label. Each
+  // node is passed to on_node with whether it is a key, and then each of its
+  // labels to on_label with the run of keys under it.
+  struct Run {
+    size_t first;
+    size_t last;
+    size_t depth;
+  };
+  const auto walk = [&keys](const auto& on_node, const auto& on_label) {
+    queue<Run> pending;
+    if (!keys.empty()) pending.push({0, keys.size(), 0});
+    while (!pending.empty()) {
+      const Run run = pending.front();
+      pending.pop();
+      // A key that ends at this node sorts before the keys that extend it.
+      const bool is_key = keys[run.first].length() == run.depth;
+      on_node(run.depth, is_key);
+      for (size_t i = run.first + is_key; i < run.last;) {
+        const char label = keys[i][run.depth];
+        size_t j = i + 1;
+        while (j < run.last && keys[j][run.depth] == label) ++j;
+        on_label(run.depth, label, i == run.first + is_key, i, j);
+        if (j - i > 1) pending.push({i, j, run.depth + 1});
+        i = j;
+      }
+    }
+  };
+
+  // Count the nodes and labels of each level, and make levels dense from the
+  // top while they stay small next to the sparse levels below them.
+  vector<size_t> level_nodes, level_labels;
+  walk(
+      [&](size_t depth, bool) {
+        if (depth == level_nodes.size()) {
+          level_nodes.push_back(0);
+          level_labels.push_back(0);
+        }
+        ++level_nodes[depth];
+      },
+      [&](size_t depth, char, bool, size_t, size_t) { ++level_labels[depth]; });
+  size_t sparse_bits = 0;
+  for (size_t d = 0; d < level_nodes.size(); ++d) {
+    sparse_bits += 10 * level_labels[d] + level_nodes[d];
+  }
+  size_t dense_bits = 0;
+  while (dense_levels < level_nodes.size()) {
+    const size_t nodes = level_nodes[dense_levels];
+    const size_t next_dense = dense_bits + 513 * nodes;
+    const size_t next_sparse =
+        sparse_bits - 10 * level_labels[dense_levels] - nodes;
+    if (next_dense * dense_ratio > next_sparse) break;
+    dense_bits = next_dense;
+    sparse_bits = next_sparse;
+    ++dense_levels;
+  }
+
+  size_t num_leaves = 0;
+  walk(
+      [&](size_t depth, bool is_key) {
+        if (depth >= dense_levels) {
+          prefix_key.push_back(is_key);
+          return;
+        }
+        dense_prefix_key.push_back(is_key);
+        for (size_t k = 0; k < 256; ++k) {
+          dense_labels.push_back(false);
+          dense_has_child.push_back(false);
+        }
+        ++dense_nodes;
+      },
+      [&](size_t depth, char label, bool is_first, size_t i, size_t j) {
+        if (depth < dense_levels) {
+          const size_t pos = 256 * (dense_nodes - 1) +
+                             static_cast<unsigned char>(label);
+          dense_labels.set(pos);
+          if (j - i > 1) {
+            dense_has_child.set(pos);
+            ++dense_children;
+          } else {
+            ++dense_leaves;
+          }
+        } else {
+          labels.push_back(label);
+          louds.push_back(is_first);
+          has_child.push_back(j - i > 1);
+        }
+        if (j - i > 1) return;
+        if (suffix_bits > 0) {
+          // Pack the suffix of the leaf, least significant word first.
+          const uint64_t suffix = suffix_entry(keys[i], depth + 1);
+          const size_t offset = num_leaves * suffix_bits;
+          suffixes.resize((offset + suffix_bits + 63) / 64, 0);
+          suffixes[offset / 64] |= suffix << (offset % 64);
+          if (offset % 64 + suffix_bits > 64) {
+            suffixes[offset / 64 + 1] |= suffix >> (64 - offset % 64);
+          }
+        }
+        ++num_leaves;
+      });
+  dense_labels.build_ranks();
+  dense_has_child.build_ranks();
+  dense_prefix_key.build_ranks();
+  has_child.build_ranks();
+  louds.build_ranks();
+  prefix_key.build_ranks();
+}
+
+uint64_t RangeFilter::suffix_of(const string& key, size_t pos, size_t bits) {
+  uint64_t suffix = 0;
+  for (size_t i = pos; bits > 0; ++i) {
+    const uint64_t byte =
+        i < key.length() ? static_cast<unsigned char>(key[i]) : 0;
+    if (bits >= 8) {
+      suffix = suffix << 8 | byte;
+      bits -= 8;
+    } else {
+      suffix = suffix << bits | byte >> (8 - bits);
+      bits = 0;
+    }
+  }
+  return suffix;
+}
+
+uint64_t RangeFilter::suffix_entry(const string& key, size_t pos) const {
+  uint64_t entry = suffix_of(key, pos, real_bits);
+  if (hash_bits == 0) return entry;
+  entry = hash_bits < 64 ? entry << hash_bits : 0;
+  const uint64_t hash = std::hash<string>()(key);
+  return entry | (hash_bits < 64 ? hash & ((uint64_t{1} << hash_bits) - 1)
+                                  : hash);
+}
+
+uint64_t RangeFilter::real_part(uint64_t entry) const {
+  return hash_bits < 64 ? entry >> hash_bits : 0;
+}
+
+uint64_t RangeFilter::leaf_suffix(size_t pos, size_t depth) const {
+  if (suffix_bits == 0) return 0;
+  // Dense leaves come first, in the same breadth first order as labels.
+  const size_t leaf =
+      depth < dense_levels
+          ? dense_labels.rank1(pos)
+          : dense_leaves + pos - has_child.rank1(pos);
+  const size_t offset = leaf * suffix_bits;
+  uint64_t suffix = suffixes[offset / 64] >> (offset % 64);
+  if (offset % 64 + suffix_bits > 64) {
+    suffix |= suffixes[offset / 64 + 1] << (64 - offset % 64);
+  }
+  if (suffix_bits < 64) suffix &= (uint64_t{1} << suffix_bits) - 1;
+  return suffix;
+}
+
+char RangeFilter::label_of(size_t pos, size_t depth) const {
+  return depth < dense_levels ? static_cast<char>(pos % 256) : labels[pos];
+}
+
+bool RangeFilter::leads_to_node(size_t pos, size_t depth) const {
+  return depth < dense_levels ? dense_has_child[pos] : has_child[pos];
+}
+
+size_t RangeFilter::child_of(size_t pos, size_t depth) const {
+  // The root is node 0 and every label with a child leads to the next node,
+  // with the dense labels before the sparse ones.
+  return depth < dense_levels ? dense_has_child.rank1(pos + 1)
+                              : dense_children + has_child.rank1(pos + 1);
+}
+
+bool RangeFilter::is_prefix_key(size_t node) const {
+  return node < dense_nodes ? dense_prefix_key[node]
+                            : prefix_key[node - dense_nodes];
+}
+
+size_t RangeFilter::first_label(size_t node, size_t depth) const {
+  if (depth < dense_levels) return dense_labels.next1(256 * node);
+  return louds.select1(node - dense_nodes);
+}
+
+size_t RangeFilter::next_label(size_t pos, size_t depth) const {
+  if (depth < dense_levels) {
+    const size_t next = dense_labels.next1(pos + 1);
+    return next / 256 == pos / 256 ? next : NONE;
+  }
+  return pos + 1 < labels.size() && !louds[pos + 1] ? pos + 1 : NONE;
+}
+
+size_t RangeFilter::label_bound(size_t node, size_t depth, char label) const {
+  const auto byte = static_cast<unsigned char>(label);
+  if (depth < dense_levels) {
+    const size_t next = dense_labels.next1(256 * node + byte);
+    return next / 256 == node ? next : NONE;
+  }
+  const size_t first = louds.select1(node - dense_nodes);
+  const size_t last = louds.next1(first + 1);
+  // Labels compare as unsigned bytes, like std::string.
+  const auto begin = labels.begin();
+  const auto found =
+      std::lower_bound(begin + static_cast<std::ptrdiff_t>(first),
+                       begin + static_cast<std::ptrdiff_t>(last), label,
+                       [](char lhs, char rhs) {
+                         return static_cast<unsigned char>(lhs) <
+                                static_cast<unsigned char>(rhs);
+                       });
+  const auto pos = static_cast<size_t>(found - begin);
+  return pos == last ? NONE : pos;
+}
+
+void RangeFilter::descend(Cursor& cur, size_t pos) const {
+  cur.at_prefix = false;
+  for (;;) {
+    const size_t depth = cur.path.size();
+    cur.path.push_back(pos);
+    if (!leads_to_node(pos, depth)) return;
+    const size_t node = child_of(pos, depth);
+    if (is_prefix_key(node)) {
+      cur.at_prefix = true;
+      return;
+    }
+    pos = first_label(node, depth + 1);
+  }
+}
+
+bool RangeFilter::skip(Cursor& cur) const {
+  while (!cur.path.empty()) {
+    const size_t pos = cur.path.back();
+    cur.path.pop_back();
+    // Move to the next sibling if the node has one.
+    const size_t next = next_label(pos, cur.path.size());
+    if (next != NONE) {
+      descend(cur, next);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool RangeFilter::seek(const string& bound, Cursor& cur) const {
+  cur.path.clear();
+  cur.at_prefix = false;
+  if (num_keys == 0) return false;
+
+  size_t node = 0;
+  for (size_t depth = 0;; ++depth) {
+    // Every key under this node has bound as a prefix.
+    if (depth == bound.length()) {
+      if (is_prefix_key(node)) {
+        cur.at_prefix = true;
+      } else {
+        descend(cur, first_label(node, depth));
+      }
+      return true;
+    }
+
+    const size_t pos = label_bound(node, depth, bound[depth]);
+    if (pos == NONE) return skip(cur);
+    if (label_of(pos, depth) != bound[depth]) {
+      descend(cur, pos);
+      return true;
+    }
+    cur.path.push_back(pos);
+    if (!leads_to_node(pos, depth)) {
+      // The leaf is less than bound only if its suffix says so.
+      if (real_part(leaf_suffix(pos, depth)) >=
+          suffix_of(bound, depth + 1, real_bits)) {
+        return true;
+      }
+      return skip(cur);
+    }
+    node = child_of(pos, depth);
+  }
+}
+
+string RangeFilter::key_floor(const Cursor& cur) const {
+  string key;
+  for (size_t i = 0; i < cur.path.size(); ++i) {
+    key.push_back(label_of(cur.path[i], i));
+  }
+  if (cur.at_prefix || real_bits == 0) return key;
+
+  // Append the real suffix bits, padding the last byte with zero bits.
+  const size_t num_bytes = (real_bits + 7) / 8;
+  const size_t depth = cur.path.size() - 1;
+  const uint64_t suffix = real_part(leaf_suffix(cur.path.back(), depth))
+                          << (num_bytes * 8 - real_bits);
+  for (size_t i = num_bytes; i-- > 0;) {
+    key.push_back(static_cast<char>(suffix >> (8 * i)));
+  }
+  // Zero bits may stand for the end of a shorter key.
+  while (key.length() > cur.path.size() && key.back() == '\0') key.pop_back();
+  return key;
+}
+
+bool RangeFilter::may_contain(const string& key) const {
+  if (num_keys == 0) return false;
+  size_t node = 0;
+  for (size_t depth = 0;; ++depth) {
+    if (depth == key.length()) return is_prefix_key(node);
+    const size_t pos = label_bound(node, depth, key[depth]);
+    if (pos == NONE || label_of(pos, depth) != key[depth]) return false;
+    if (!leads_to_node(pos, depth)) {
+      return leaf_suffix(pos, depth) == suffix_entry(key, depth + 1);
+    }
+    node = child_of(pos, depth);
+  }
+}
+
+bool RangeFilter::may_contain_range(const string& lo, const string& hi) const {
+  if (!(lo < hi)) return false;
+  Cursor cur;
+  if (!seek(lo, cur)) return false;
+  return key_floor(cur) < hi;
+}
+
+size_t RangeFilter::size() const { return num_keys; }
+
+size_t RangeFilter::memory_usage() const {
+  return dense_labels.memory_usage() + dense_has_child.memory_usage() +
+         dense_prefix_key.memory_usage() + labels.size() +
+         has_child.memory_usage() + louds.memory_usage() +
+         prefix_key.memory_usage() + suffixes.size() * sizeof(uint64_t);
+}
+
+size_t RangeFilter::num_dense_levels() const { return dense_levels; }
+
+double RangeFilter::bits_per_key() const {
+  return num_keys == 0 ? 0.0
+                       : static_cast<double>(memory_usage() * 8) /
+                             static_cast<double>(num_keys);
+}
+
+RangeFilter build_filter(const Trie& tree, size_t suffix_bits,
+                         size_t hash_bits, size_t dense_ratio) {
+  return RangeFilter(tree, suffix_bits, hash_bits, dense_ratio);
+}
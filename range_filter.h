@@ -0,0 +1,341 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for RangeFilter.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "trie.h"
+
+/**
+ * @brief An approximate membership filter for point and range queries in the
+ * style of SuRF, built from a Trie. Each key is truncated to the shortest
+ * prefix that tells it apart from its neighbours, and the truncated keys are
+ * stored as a byte-wise trie in LOUDS-DS form. The upper levels, which have
+ * few nodes and are visited by every query, are LOUDS-Dense: two 256 bit maps
+ * per node, of its labels and of those that lead to a node, so a step is a
+ * bit test and a rank. The lower levels are LOUDS-Sparse: one label byte and
+ * two bits per edge. Both mark each node that is a key with one more bit.
+ * Levels are dense from the top as long as the dense levels take at most
+ * 1 / dense_ratio of the space of the sparse ones, as in SuRF.
+ *
+ * Each truncated key keeps a suffix to cut false positives. Real suffix bits
+ * are the bits of the key following the truncated prefix, and serve both point
+ * and range queries. Hash suffix bits are bits of a hash of the whole key, and
+ * serve point queries only, but also reject absent keys that merely extend a
+ * stored key.
+ *
+ * Queries never return false negatives. The structure is frozen.
+ */
+class RangeFilter {
+ private:
+  /**
+   * @brief A bit vector with constant time rank and logarithmic select.
+   */
+  class BitVector {
+   private:
+    static constexpr size_t BLOCK_WORDS = 8;
+    static constexpr size_t SELECT_SAMPLE = 256;
+    std::vector<uint64_t> words;
+    // Number of ones before each block of BLOCK_WORDS words.
+    std::vector<uint32_t> ranks;
+    // Block holding every SELECT_SAMPLE-th one, to narrow select.
+    std::vector<uint32_t> samples;
+    size_t num_bits;
+
+   public:
+    BitVector();
+
+    /**
+     * @brief Append a bit. Invalidates ranks until build_ranks is called.
+     * @param bit The bit to append.
+     */
+    void push_back(bool bit);
+
+    /**
+     * @brief Set a bit that was pushed as zero.
+     * @param pos The position, which must be less than size().
+     */
+    void set(size_t pos);
+
+    /**
+     * @brief Precompute block ranks after the last push_back.
+     */
+    void build_ranks();
+
+    /**
+     * @brief Read a bit.
+     * @param pos The position, which must be less than size().
+     * @return The bit at pos.
+     */
+    bool operator[](size_t pos) const;
+
+    /**
+     * @brief Count ones.
+     * @param pos The end of the counted range, at most size().
+     * @return The number of ones in [0, pos).
+     */
+    size_t rank1(size_t pos) const;
+
+    /**
+     * @brief Find a one.
+     * @param n The number of ones before the one to find.
+     * @return The position of the one with rank n, or size() if there is none.
+     */
+    size_t select1(size_t n) const;
+
+    /**
+     * @brief Find the next one.
+     * @param pos The position at which to start searching.
+     * @return The position of the first one at or after pos, or size().
+     */
+    size_t next1(size_t pos) const;
+
+    /**
+     * @brief Get the number of bits.
+     * @return The number of bits pushed.
+     */
+    size_t size() const;
+
+    /**
+     * @brief Get the space used.
+     * @return The number of bytes used by bits and ranks.
+     */
+    size_t memory_usage() const;
+  };
+
+  /**
+   * @brief A position in key order. Either the leaf at the end of path, or the
+   * key that ends at the node under path when at_prefix is set. The label at
+   * path[i] is on level i.
+   */
+  struct Cursor {
+    std::vector<size_t> path;
+    bool at_prefix;
+  };
+
+  static constexpr size_t NONE = std::numeric_limits<size_t>::max();
+
+  // Nodes are numbered in breadth first order, from the root at 0, and the
+  // labels of a node are addressed by their position in the level's encoding.
+  // LOUDS-Dense: for each node, bit 256 * node + c is set if the node has
+  // label c, and in dense_has_child if that label leads to a node.
+  BitVector dense_labels;
+  BitVector dense_has_child;
+  BitVector dense_prefix_key;
+  size_t dense_levels;
+  size_t dense_nodes;
+  // The number of dense labels that lead to a node, and that are leaves.
+  size_t dense_children;
+  size_t dense_leaves;
+  // LOUDS-Sparse: labels in breadth first order, whether each label leads to
+  // a node, whether each label starts a node, and whether each node is a key.
+  std::string labels;
+  BitVector has_child;
+  BitVector louds;
+  BitVector prefix_key;
+  // Packed real bits followed by hash bits per leaf, in label order.
+  std::vector<uint64_t> suffixes;
+  size_t real_bits;
+  size_t hash_bits;
+  size_t suffix_bits;
+  size_t num_keys;
+
+  /**
+   * @brief Read the bits of key following pos, most significant first.
+   * @param key The key to read from. Missing bytes read as zero.
+   * @param pos The offset of the first byte to read.
+   * @param bits The number of bits to read, at most 64.
+   * @return The bits read.
+   */
+  static uint64_t suffix_of(const std::string& key, size_t pos, size_t bits);
+
+  /**
+   * @brief Compute the suffix stored for a key.
+   * @param key The key whose suffix to compute.
+   * @param pos The length of the truncated key.
+   * @return The real bits of key after pos followed by its hash bits.
+   */
+  uint64_t suffix_entry(const std::string& key, size_t pos) const;
+
+  /**
+   * @brief Drop the hash bits of a suffix.
+   * @param entry A suffix as computed by suffix_entry.
+   * @return The real bits of the suffix.
+   */
+  uint64_t real_part(uint64_t entry) const;
+
+  /**
+   * @brief Get the stored suffix of a leaf.
+   * @param pos The position of the leaf label.
+   * @param depth The level of the label.
+   * @return The suffix_bits bits stored for the leaf.
+   */
+  uint64_t leaf_suffix(size_t pos, size_t depth) const;
+
+  /**
+   * @brief Get the byte of a label.
+   * @param pos The position of the label.
+   * @param depth The level of the label.
+   * @return The label.
+   */
+  char label_of(size_t pos, size_t depth) const;
+
+  /**
+   * @brief Check whether a label leads to a node or is a leaf.
+   * @param pos The position of the label.
+   * @param depth The level of the label.
+   * @return Whether or not the label has a child.
+   */
+  bool leads_to_node(size_t pos, size_t depth) const;
+
+  /**
+   * @brief Get the node a label leads to.
+   * @param pos The position of a label with a child.
+   * @param depth The level of the label.
+   * @return The node number of the child.
+   */
+  size_t child_of(size_t pos, size_t depth) const;
+
+  /**
+   * @brief Check whether a key ends at a node.
+   * @param node The node number.
+   * @return Whether or not the node is a key.
+   */
+  bool is_prefix_key(size_t node) const;
+
+  /**
+   * @brief Get the first label of a node. Every node has one.
+   * @param node The node number.
+   * @param depth The level of the node.
+   * @return The position of the first label.
+   */
+  size_t first_label(size_t node, size_t depth) const;
+
+  /**
+   * @brief Get the next label of the same node.
+   * @param pos The position of a label.
+   * @param depth The level of the label.
+   * @return The position of the next label, or NONE if pos is the last.
+   */
+  size_t next_label(size_t pos, size_t depth) const;
+
+  /**
+   * @brief Search the labels of a node.
+   * @param node The node number.
+   * @param depth The level of the node.
+   * @param label The label to search for.
+   * @return The position of the first label not less than label, or NONE.
+   */
+  size_t label_bound(size_t node, size_t depth, char label) const;
+
+  /**
+   * @brief Move to the first key at or under the label at pos.
+   * @param cur The cursor whose path leads to the node holding pos.
+   * @param pos The label to descend from.
+   */
+  void descend(Cursor& cur, size_t pos) const;
+
+  /**
+   * @brief Move past every key under the end of the path.
+   * @param cur The cursor to advance.
+   * @return Whether or not there is a key after the path.
+   */
+  bool skip(Cursor& cur) const;
+
+  /**
+   * @brief Find the first stored key that may not be less than bound.
+   * @param bound The bound to search for.
+   * @param cur Set to the position of that key.
+   * @return Whether or not such a key exists.
+   */
+  bool seek(const std::string& bound, Cursor& cur) const;
+
+  /**
+   * @brief Get a string not greater than any key that cur may stand for.
+   * @param cur The position of a stored key.
+   * @return The truncated key followed by its known suffix bytes.
+   */
+  std::string key_floor(const Cursor& cur) const;
+
+ public:
+  /**
+   * Maximum number of suffix bits kept per key.
+   */
+  static constexpr size_t MAX_SUFFIX_BITS = 64;
+
+  /**
+   * Default least ratio of the size of the sparse levels to the dense levels.
+   */
+  static constexpr size_t DEFAULT_DENSE_RATIO = 64;
+
+  /**
+   * @brief Build a filter holding every key of tree. More suffix bits give
+   * fewer false positives. Throws std::invalid_argument if the suffix bits add
+   * up to more than MAX_SUFFIX_BITS.
+   * @param tree The trie to summarize.
+   * @param real The number of real suffix bits kept per key.
+   * @param hash The number of hash suffix bits kept per key.
+   * @param dense_ratio The least ratio of the size of the sparse levels to
+   * the dense levels. 0 makes every level dense.
+   */
+  RangeFilter(const Trie& tree, size_t real, size_t hash = 0,
+              size_t dense_ratio = DEFAULT_DENSE_RATIO);
+
+  /**
+   * @brief Check for a key.
+   * @param key The key to search for.
+   * @return False if key is definitely not stored. True if it may be stored.
+   */
+  bool may_contain(const std::string& key) const;
+
+  /**
+   * @brief Check for any key in the half open range [lo, hi).
+   * @param lo The inclusive lower bound.
+   * @param hi The exclusive upper bound.
+   * @return False if no key in the range is stored. True if one may be.
+   */
+  bool may_contain_range(const std::string& lo, const std::string& hi) const;
+
+  /**
+   * @brief Get the number of keys.
+   * @return The number of keys summarized.
+   */
+  size_t size() const;
+
+  /**
+   * @brief Get the space used.
+   * @return The number of bytes used by the encoded trie and suffixes.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Get the number of levels encoded with LOUDS-Dense.
+   * @return The number of dense levels.
+   */
+  size_t num_dense_levels() const;
+
+  /**
+   * @brief Get the space used per key.
+   * @return The number of bits used per key.
+   */
+  double bits_per_key() const;
+};
+
+/**
+ * @brief Build a range filter from a trie.
+ * @param tree The trie to summarize.
+ * @param suffix_bits The number of real suffix bits kept per key.
+ * @param hash_bits The number of hash suffix bits kept per key.
+ * @param dense_ratio The least ratio of the size of the sparse levels to the
+ * dense levels.
+ * @return The filter.
+ */
+RangeFilter build_filter(
+    const Trie& tree, size_t suffix_bits, size_t hash_bits = 0,
+    size_t dense_ratio = RangeFilter::DEFAULT_DENSE_RATIO);
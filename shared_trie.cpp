@@ -0,0 +1,204 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for SharedTrie.
+*/
+#include "shared_trie.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+using std::invalid_argument;
+using std::runtime_error;
+using std::string;
+
+namespace {
+/**
+ * @brief The contents of the control segment.
+ */
+struct Control {
+  char magic[8];
+  std::atomic<uint64_t> generation;
+};
+
+const char CONTROL_MAGIC[8] = "TRIESHM";
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "The generation must be shared without locks.");
+
+/**
+ * @brief Get the name of the segment of a generation.
+ * @param name The name of the publication.
+ * @param gen The generation.
+ * @return The segment name.
+ */
+string segment_name(const string& name, uint64_t gen) {
+  return name + "." + std::to_string(gen);
+}
+
+/**
+ * @brief Map a whole shared memory segment.
+ * @param fd The descriptor of the segment.
+ * @param prot The protection of the mapping.
+ * @param len Set to the length of the segment.
+ * @return The mapping, or nullptr on failure. Closes fd either way.
+ */
+void* map_segment(int fd, int prot, size_t& len) {
+  struct stat info;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0) {
+    len = static_cast<size_t>(info.st_size);
+    addr = mmap(nullptr, len, prot, MAP_SHARED, fd, 0);
+  }
+  close(fd);
+  return addr == MAP_FAILED ? nullptr : addr;
+}
+}  // namespace
+
+uint64_t SharedTrie::publish(const string& name, const Trie& tree) {
+  if (name.length() < 2 || name.front() != '/' ||
+      name.find('/', 1) != string::npos)
+    throw invalid_argument("Shared trie names must look like /name.");
+
+  // Create the control segment on the first publication.
+  int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+  if (fd < 0 || ftruncate(fd, sizeof(Control)) != 0) {
+    if (fd >= 0) close(fd);
+    throw runtime_error("Cannot create " + name + ".");
+  }
+  size_t len = 0;
+  auto* ctl = static_cast<Control*>(map_segment(fd, PROT_READ | PROT_WRITE,
+                                                len));
+  if (!ctl) throw runtime_error("Cannot map " + name + ".");
+  // A new segment is zero filled, so its generation starts at 0.
+  std::memcpy(ctl->magic, CONTROL_MAGIC, sizeof(CONTROL_MAGIC));
+  const uint64_t prev = ctl->generation.load(std::memory_order_acquire);
+  const uint64_t next = prev + 1;
+
+  // Fill the segment of the next generation before anyone can find it.
+  const TrieImage image(tree);
+  const string seg = segment_name(name, next);
+  shm_unlink(seg.c_str());
+  fd = shm_open(seg.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+  void* addr = nullptr;
+  if (fd >= 0 && ftruncate(fd, static_cast<off_t>(image.bytes())) == 0) {
+    addr = map_segment(fd, PROT_READ | PROT_WRITE, len);
+  } else if (fd >= 0) {
+    close(fd);
+  }
+  if (!addr) {
+    shm_unlink(seg.c_str());
+    munmap(ctl, sizeof(Control));
+    throw runtime_error("Cannot create " + seg + ".");
+  }
+  std::memcpy(addr, image.data(), image.bytes());
+  munmap(addr, len);
+
+  // Readers that load the new generation see the filled segment.
+  ctl->generation.store(next, std::memory_order_release);
+  munmap(ctl, sizeof(Control));
+  if (prev > 0) shm_unlink(segment_name(name, prev).c_str());
+  return next;
+}
+
+void SharedTrie::remove(const string& name) {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) return;
+  size_t len = 0;
+  const auto* ctl =
+      static_cast<const Control*>(map_segment(fd, PROT_READ, len));
+  if (ctl) {
+    const uint64_t gen = ctl->generation.load(std::memory_order_acquire);
+    if (gen > 0) shm_unlink(segment_name(name, gen).c_str());
+    munmap(const_cast<Control*>(ctl), len);
+  }
+  shm_unlink(name.c_str());
+}
+
+SharedTrie::SharedTrie(const string& name_in)
+    : name(name_in),
+      control(nullptr),
+      gen(0),
+      mapping(nullptr),
+      mapped(0),
+      img() {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) throw runtime_error("Nothing is published as " + name + ".");
+  size_t len = 0;
+  control = map_segment(fd, PROT_READ, len);
+  if (!control || len < sizeof(Control) ||
+      std::memcmp(static_cast<const Control*>(control)->magic, CONTROL_MAGIC,
+                  sizeof(CONTROL_MAGIC)) != 0) {
+    if (control) munmap(const_cast<void*>(control), len);
+    throw runtime_error("Nothing is published as " + name + ".");
+  }
+  try {
+    attach();
+  } catch (...) {
+    munmap(const_cast<void*>(control), sizeof(Control));
+    throw;
+  }
+}
+
+SharedTrie::~SharedTrie() {
+  detach();
+  munmap(const_cast<void*>(control), sizeof(Control));
+}
+
+void SharedTrie::attach() {
+  const auto* ctl = static_cast<const Control*>(control);
+  for (;;) {
+    const uint64_t next = ctl->generation.load(std::memory_order_acquire);
+    if (next == 0)
+      throw runtime_error("Nothing is published as " + name + ".");
+    const int fd = shm_open(segment_name(name, next).c_str(), O_RDONLY, 0);
+    // The writer unlinked the segment after publishing a newer one.
+    if (fd < 0 && errno == ENOENT &&
+        ctl->generation.load(std::memory_order_acquire) != next)
+      continue;
+    size_t len = 0;
+    void* addr = fd < 0 ? nullptr : map_segment(fd, PROT_READ, len);
+    if (!addr) throw runtime_error("Cannot map " + segment_name(name, next));
+
+    std::unique_ptr<TrieImage> next_img;
+    try {
+      next_img = std::make_unique<TrieImage>(static_cast<const char*>(addr),
+                                             len);
+    } catch (...) {
+      munmap(addr, len);
+      throw;
+    }
+    detach();
+    mapping = addr;
+    mapped = len;
+    gen = next;
+    img = std::move(next_img);
+    return;
+  }
+}
+
+void SharedTrie::detach() {
+  if (!mapping) return;
+  img.reset();
+  munmap(mapping, mapped);
+  mapping = nullptr;
+  mapped = 0;
+}
+
+uint64_t SharedTrie::generation() const { return gen; }
+
+bool SharedTrie::refresh() {
+  const auto* ctl = static_cast<const Control*>(control);
+  if (ctl->generation.load(std::memory_order_acquire) == gen) return false;
+  attach();
+  return true;
+}
+
+const TrieImage& SharedTrie::image() const { return *img; }
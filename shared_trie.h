@@ -0,0 +1,104 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for SharedTrie.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "trie.h"
+#include "trie_image.h"
+
+/**
+ * @brief A TrieImage published in POSIX shared memory by one writer process
+ * and queried in place by any number of reader processes.
+ *
+ * Every publication goes to a fresh segment named after the generation, such
+ * as "/words.3", and a small control segment named "/words" holds the current
+ * generation. The writer fills the new segment before bumping the generation,
+ * then unlinks the previous segment, whose pages live on until the last
+ * reader unmaps them. Readers therefore never see a partial image, and pick
+ * up a new one by calling refresh between queries.
+ *
+ * Readers map every segment read only. Lookups only read the image, so they
+ * perform no writes at all, and pages stay shared across fork().
+ */
+class SharedTrie {
+ private:
+  std::string name;
+  // The control segment, mapped read only.
+  const void* control;
+  uint64_t gen;
+  void* mapping;
+  size_t mapped;
+  // Borrows the mapped segment.
+  std::unique_ptr<TrieImage> img;
+
+  /**
+   * @brief Map the segment of the current generation, retrying if the writer
+   * replaces it in the meantime. Throws std::runtime_error if nothing has
+   * been published.
+   */
+  void attach();
+
+  /**
+   * @brief Unmap the image segment, if any.
+   */
+  void detach();
+
+ public:
+  /**
+   * @brief Publish a trie under a name, replacing the previous publication.
+   * Only one process may publish under a name at a time. Throws
+   * std::runtime_error if shared memory cannot be allocated, and
+   * std::invalid_argument if name is not of the form "/name".
+   * @param name The name of the publication.
+   * @param tree The trie to publish.
+   * @return The generation of the new publication, starting from 1.
+   */
+  static uint64_t publish(const std::string& name, const Trie& tree);
+
+  /**
+   * @brief Unlink every segment of a publication. Attached readers keep their
+   * current image. Idempotent.
+   * @param name The name of the publication.
+   */
+  static void remove(const std::string& name);
+
+  /**
+   * @brief Attach to the current generation of a publication. Throws
+   * std::runtime_error if nothing has been published under name.
+   * @param name_in The name of the publication.
+   */
+  explicit SharedTrie(const std::string& name_in);
+
+  SharedTrie(const SharedTrie&) = delete;
+  SharedTrie& operator=(const SharedTrie&) = delete;
+
+  /**
+   * @brief Destructor, unmaps every segment.
+   */
+  ~SharedTrie();
+
+  /**
+   * @brief Get the generation of the attached image.
+   * @return The generation that image() refers to.
+   */
+  uint64_t generation() const;
+
+  /**
+   * @brief Attach to the latest generation, if it changed. Invalidates
+   * iterators into image() when it returns true.
+   * @return Whether or not a new generation was attached.
+   */
+  bool refresh();
+
+  /**
+   * @brief Get the attached image, which answers every query.
+   * @return The image of the attached generation.
+   */
+  const TrieImage& image() const;
+};
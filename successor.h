@@ -0,0 +1,22 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Prefix successor shared by the ordered representations.
+*/
+#pragma once
+#include <string>
+
+/**
+ * @brief Replace s with the smallest string greater than every string that
+ * has s as a prefix, so that the strings with prefix s are exactly those in
+ * [s, successor).
+ * @param s The string to modify.
+ * @return Whether or not such a string exists. If not, s is left empty, since
+ * every string is below the bound.
+ */
+inline bool prefix_successor(std::string& s) {
+  while (!s.empty() && s.back() == static_cast<char>(0xFF)) s.pop_back();
+  if (s.empty()) return false;
+  s.back() = static_cast<char>(s.back() + 1);
+  return true;
+}
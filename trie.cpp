@@ -5,252 +5,355 @@ Implementation for Trie.
 */
 #include "trie.h"
 
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
 #include <algorithm>
-#include <map>
 #include <memory>
+#include <new>
 #include <stack>
-#include <unordered_set>
+#include <stdexcept>
 #include <utility>
+#include <vector>
+
+#include "varint.h"
 using std::initializer_list;
-using std::make_shared;
-using std::map;
+using std::istream;
 using std::move;
 using std::ostream;
 using std::runtime_error;
 using std::shared_ptr;
 using std::stack;
 using std::string;
-using std::swap;
-using std::unordered_set;
+using std::string_view;
+using std::vector;
+
+namespace {
+// Every saved trie starts with these bytes and the format version.
+const char SAVE_MAGIC[] = "TRIE";
+constexpr size_t SAVE_VERSION = 1;
+// Bytes buffered by save before each write to the stream.
+constexpr size_t SAVE_BUFFER = 1 << 16;
+// Labels are read in chunks, so a corrupt length cannot force a huge
+// allocation before the stream runs out.
+constexpr size_t LOAD_CHUNK = 4096;
+
+/**
+ * @brief Count an event on a filter counter that const lookups share.
+ * @param counter The counter to increment.
+ */
+void bump(std::atomic<size_t>& counter) {
+  counter.fetch_add(1, std::memory_order_relaxed);
+}
+}  // namespace
+
+Trie::Node::Node(std::pmr::memory_resource* mem) : tagged(0), children(mem) {}
+
+Trie::Filter::Filter(size_t bits_per_key_in, size_t prefix_length_in)
+    : bits_per_key(bits_per_key_in),
+      prefix_length(prefix_length_in),
+      capacity(0),
+      num_inserted(0),
+      num_erased(0),
+      keys(0, 1),
+      prefixes(0, 1),
+      lookups(0),
+      negatives(0),
+      false_positives(0),
+      rebuilds(0) {}
+
+Trie::Filter::Filter(const Filter& other)
+    : bits_per_key(other.bits_per_key),
+      prefix_length(other.prefix_length),
+      capacity(other.capacity),
+      num_inserted(other.num_inserted),
+      num_erased(other.num_erased),
+      keys(other.keys),
+      prefixes(other.prefixes),
+      lookups(other.lookups.load(std::memory_order_relaxed)),
+      negatives(other.negatives.load(std::memory_order_relaxed)),
+      false_positives(other.false_positives.load(std::memory_order_relaxed)),
+      rebuilds(other.rebuilds) {}
+
+Trie::Budget::Budget(std::pmr::memory_resource* upstream_in)
+    : upstream(upstream_in), in_use(0), limit(0), enforced(false) {}
+
+void* Trie::Budget::do_allocate(size_t bytes, size_t alignment) {
+  if (enforced && limit != 0 && bytes > limit - std::min(limit, in_use))
+    throw std::bad_alloc();
+  void* p = upstream->allocate(bytes, alignment);
+  in_use += bytes;
+  return p;
+}
 
-Trie::Node::Node(bool is_end_in, std::shared_ptr<Node> parent_in)
-    : is_end(is_end_in), parent(parent_in), children() {}
+void Trie::Budget::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  upstream->deallocate(p, bytes, alignment);
+  in_use -= bytes;
+}
 
-void Trie::recursive_copy(std::shared_ptr<Node> rt,
-                          const std::shared_ptr<Node> other) {
-  assert(rt && other);
-  // Make rt's is_end the same as other's is_end.
-  rt->is_end = other->is_end;
-  // Recursively copy children.
-  for (const auto& str_ptr_pair : other->children) {
-    const auto child = make_shared<Node>(false, rt);
-    rt->children.emplace(str_ptr_pair.first, std::move(child));
-    recursive_copy(child, str_ptr_pair.second);
+bool Trie::Budget::do_is_equal(
+    const std::pmr::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
+Trie::Pool::Pool(std::pmr::memory_resource* mem)
+    : resource(mem),
+      chunks(&resource),
+      next(0),
+      capacity(0),
+      num_live(0),
+      free_list(NIL) {}
+
+Trie::Pool::~Pool() {
+  for (size_t i = 0; i < chunks.size(); ++i) {
+    const size_t size = chunk_size(i);
+    std::destroy_n(chunks[i], size);
+    resource.deallocate(chunks[i], size * sizeof(Node), alignof(Node));
   }
 }
 
-bool Trie::is_prefix(const string& prf, const string& word) {
+void Trie::Pool::grow() {
+  const size_t size = chunk_size(chunks.size());
+  chunks.reserve(chunks.size() + 1);
+  auto chunk = static_cast<Node*>(
+      resource.allocate(size * sizeof(Node), alignof(Node)));
+  // Constructing a node allocates nothing, so this cannot throw.
+  for (size_t i = 0; i < size; ++i) new (chunk + i) Node(&resource);
+  chunks.push_back(chunk);
+  capacity += size;
+}
+
+void Trie::Pool::reserve(size_t num_nodes) {
+  // Freed nodes are reused first, then the rest of the chunks.
+  while (num_nodes > (next - num_live) + (capacity - next) &&
+         capacity < NIL) {
+    grow();
+  }
+}
+
+Trie::Ref Trie::Pool::allocate(bool is_end) {
+  Ref r = free_list;
+  if (r != NIL) {
+    free_list = static_cast<Ref>((*this)[r].tagged);
+  } else {
+    if (next == NIL) throw std::length_error("Trie has too many nodes.");
+    if (next == capacity) grow();
+    r = next++;
+  }
+  (*this)[r].tagged = is_end ? END_TAG : 0;
+  ++num_live;
+  return r;
+}
+
+void Trie::Pool::release(Ref r) {
+  Node& node = (*this)[r];
+  // Swapping frees the edges, which clear would keep.
+  std::pmr::vector<Edge>(&resource).swap(node.children);
+  node.tagged = free_list;
+  free_list = r;
+  --num_live;
+}
+
+shared_ptr<Trie::Pool> Trie::make_pool(std::pmr::memory_resource* mem) {
+  return std::allocate_shared<Pool>(std::pmr::polymorphic_allocator<Pool>(mem),
+                                    mem);
+}
+
+Trie::Ref Trie::copy_subtree(Pool& to, const Pool& from, Ref other,
+                             bool keep_saved) {
+  const Node& src = from[other];
+  const Ref rt = to.allocate(src.is_end());
+  if (keep_saved) to[rt].set_saved(src.saved());
+  // Recursively copy children, sized exactly.
+  to[rt].children.reserve(src.children.size());
+  for (const Edge& edge : src.children) {
+    const Ref child = copy_subtree(to, from, edge.child, keep_saved);
+    to[rt].children.emplace_back(edge.label, child);
+  }
+  return rt;
+}
+
+bool Trie::is_prefix(string_view prf, string_view word) {
   // The empty string is a prefix for every string.
   if (prf.empty()) return true;
   // Assuming non-emptiness of prf, it cannot be longer than word.
   if (prf.length() > word.length()) return false;
   // std::algorithm function that returns iterators to first mismatch.
-  auto res = mismatch(prf.begin(), prf.end(), word.begin());
+  auto res = std::mismatch(prf.begin(), prf.end(), word.begin());
 
   // If we reached the end of prf, it's a prefix.
   return res.first == prf.end();
 }
 
-std::shared_ptr<Trie::Node> Trie::approximate_match(
-    const std::shared_ptr<Node> rt, string& key) {
-  assert(rt);
-  // If the key is empty, return the root node.
-  if (key.empty()) return rt;
+std::pmr::vector<Trie::Edge>::iterator Trie::search(
+    std::pmr::vector<Edge>& children, char first) {
+  // Labels compare as unsigned bytes, like std::string.
+  return std::lower_bound(
+      children.begin(), children.end(), static_cast<unsigned char>(first),
+      [](const Edge& edge, unsigned char c) {
+        return static_cast<unsigned char>(edge.label.front()) < c;
+      });
+}
+
+std::pmr::vector<Trie::Edge>::const_iterator Trie::search(
+    const std::pmr::vector<Edge>& children, char first) {
+  return std::lower_bound(
+      children.begin(), children.end(), static_cast<unsigned char>(first),
+      [](const Edge& edge, unsigned char c) {
+        return static_cast<unsigned char>(edge.label.front()) < c;
+      });
+}
 
-  for (const auto& str_ptr_pair : rt->children) {
-    assert(str_ptr_pair.second);
-    // If one of the children is a prefix of key, recurse.
-    if (is_prefix(str_ptr_pair.first, key)) {
-      // Remove the child string off the front of key.
-      return approximate_match(str_ptr_pair.second,
-                               key.erase(0, str_ptr_pair.first.length()));
+Trie::Ref Trie::approximate_match(string& key, vector<Frame>* path) const {
+  Ref rt = root;
+  size_t depth = 0;
+  if (path) path->push_back(Frame{rt, 0, 0});
+  while (!key.empty()) {
+    // By invariant (2), only the child starting with key's first character
+    // can be a prefix of key. It is the first child not less than that
+    // character.
+    const auto& children = at(rt).children;
+    const auto child = search(children, key.front());
+    if (child == children.end() || !is_prefix(child->label, key)) break;
+    if (path) {
+      path->back().index = static_cast<size_t>(child - children.begin());
+      path->push_back(Frame{child->child, 0, depth});
     }
+    // Remove the child string off the front of key.
+    depth += child->label.length();
+    key.erase(0, child->label.length());
+    rt = child->child;
   }
 
-  // If none of the children form a prefix for key, simply return the root.
+  // If none of the children form a prefix for key, rt is the deepest match.
   return rt;
 }
 
-std::shared_ptr<Trie::Node> Trie::prefix_match(const std::shared_ptr<Node> rt,
-                                               string& prf) {
+Trie::Ref Trie::prefix_match(string& prf, vector<Frame>* path) const {
   // First compute the approximate root.
-  auto app_ptr = approximate_match(rt, prf);
-  assert(app_ptr);
+  const size_t length = prf.length();
+  const Ref app_ptr = approximate_match(prf, path);
+  assert(app_ptr != NIL);
   // If the given prf is empty, it's a perfect match.
   if (prf.empty()) return app_ptr;
 
   /*
-  If any of the returned node's children
-  have prf as prefix, return that child.
+  If the child starting with prf's first character
+  has prf as prefix, return that child.
   */
-  for (const auto& str_ptr_pair : app_ptr->children) {
-    assert(str_ptr_pair.second);
-    if (is_prefix(prf, str_ptr_pair.first)) {
-      prf.clear();
-      return str_ptr_pair.second;
+  const auto& children = at(app_ptr).children;
+  const auto child = search(children, prf.front());
+  if (child != children.end() && is_prefix(prf, child->label)) {
+    if (path) {
+      path->back().index = static_cast<size_t>(child - children.begin());
+      path->push_back(Frame{child->child, 0, length - prf.length()});
     }
+    prf.clear();
+    return child->child;
   }
 
   // No way to make prf a prefix. Return null.
-  return nullptr;
+  return NIL;
 }
 
-void Trie::key_counter(const std::shared_ptr<Node> rt, size_t& acc) {
-  assert(rt);
+void Trie::key_counter(Ref rt, size_t& acc) const {
+  assert(rt != NIL);
+  const Node& node = at(rt);
   // If root contains a word, increment the counter.
-  if (rt->is_end) ++acc;
+  if (node.is_end()) ++acc;
   // Recursively check for words in children
-  for (const auto& str_ptr_pair : rt->children) {
-    assert(str_ptr_pair.second);
-    key_counter(str_ptr_pair.second, acc);
+  for (const Edge& edge : node.children) {
+    key_counter(edge.child, acc);
   }
 }
 
-std::shared_ptr<Trie::Node> Trie::exact_match(const std::shared_ptr<Node> rt,
-                                              string word) {
+Trie::Ref Trie::exact_match(string word, vector<Frame>* path) const {
   // First compute the approximate root.
-  auto app_ptr = approximate_match(rt, word);
-  assert(app_ptr);
+  const Ref app_ptr = approximate_match(word, path);
+  assert(app_ptr != NIL);
   /*
   If the given word is empty, it's a perfect match.
   Otherwise, there is no match.
   */
-  return word.empty() ? app_ptr : nullptr;
+  return word.empty() ? app_ptr : NIL;
 }
 
-bool Trie::are_equal(const std::shared_ptr<Node> rt_1,
-                     const std::shared_ptr<Node> rt_2) {
-  assert(rt_1 && rt_2);
+bool Trie::are_equal(const Pool& pool_1, Ref rt_1, const Pool& pool_2,
+                     Ref rt_2) {
+  assert(rt_1 != NIL && rt_2 != NIL);
+  const Node& node_1 = pool_1[rt_1];
+  const Node& node_2 = pool_2[rt_2];
   // Check is_end parameters match.
-  if (rt_1->is_end != rt_2->is_end) return false;
-  // If neither have children, we're all good to go.
-  if (rt_1->children.empty() && rt_2->children.empty()) return true;
+  if (node_1.is_end() != node_2.is_end()) return false;
   // Check that number of children are the same.
-  if (rt_1->children.size() != rt_2->children.size()) return false;
+  if (node_1.children.size() != node_2.children.size()) return false;
   // Since the number of children match, we can iterate in parallel.
-  auto it_1 = rt_1->children.begin();
-  auto it_2 = rt_2->children.begin();
-  while (it_1 != rt_1->children.end()) {
+  for (size_t i = 0; i < node_1.children.size(); ++i) {
+    const Edge& edge_1 = node_1.children[i];
+    const Edge& edge_2 = node_2.children[i];
     // Check that the strings on the branches match.
-    if (it_1->first != it_2->first) return false;
+    if (edge_1.label != edge_2.label) return false;
     // Recursively check for equality.
-    if (!are_equal(it_1->second, it_2->second)) return false;
-    ++it_1;
-    ++it_2;
+    if (!are_equal(pool_1, edge_1.child, pool_2, edge_2.child)) return false;
   }
   return true;
 }
 
-std::shared_ptr<Trie::Node> Trie::first_key(std::shared_ptr<Node> rt) {
-  assert(rt);
-
-  // If rt has no children, nullptr.
-  if (rt->children.empty()) return nullptr;
-  rt = rt->children.begin()->second;
-  assert(rt);
-
-  // Keep moving down the tree along the left side until is_end.
-  while (!rt->is_end) {
-    // If rt is not an end, its children should not be empty.
-    assert(!rt->children.empty());
-    rt = rt->children.begin()->second;
-    assert(rt);
-  }
-  return rt;
-}
-
-std::shared_ptr<Trie::Node> Trie::next_node(std::shared_ptr<Node> ptr) {
-  assert(ptr);
-
-  // Go up once then keep going up until we can move right.
-  auto par = ptr->parent.lock();
-  // Note that par->children cannot be empty since its a parent.
-  assert(!par->children.empty());
-  while (par && par->children.rbegin()->second == ptr) {
-    // Move up.
-    ptr = par;
-    par = par->parent.lock();
-  }
-
-  // If par is null, there is nothing to the right. Return null
-  if (!par) return nullptr;
-
-  /*
-  If par is non-null, the only way we broke out of the while
-  loop is because ptr is not the right-most child.
-  Thus, we want to find the child to the right of ptr.
-  */
-  auto child_iter = value_find(par->children, ptr);
-  assert(child_iter != par->children.end());
-  assert(next(child_iter) != par->children.end());
-  ++child_iter;
-  auto rn = child_iter->second;
-  assert(rn);
-
-  // Return the smallest key rooted at rn.
-  if (rn->is_end) return rn;
-  assert(!rn->children.empty());
-  return first_key(rn);
-}
-
-string Trie::underlying_string(std::shared_ptr<Node> ptr) {
-  assert(ptr);
-
-  // As we move up, push string representations onto stack.
-  stack<string> history;
-  // Move up in trie until we get to root.
-  auto par = ptr->parent.lock();
-
-  while (par) {
-    // We must be able to find ptr in par->children.
-    auto iter = value_find(par->children, ptr);
-    assert(iter != par->children.end());
-
-    // Push the string representation onto the stack and go up.
-    history.push(iter->first);
-    ptr = par;
-    par = par->parent.lock();
-  }
-
-  // If par is null, then ptr must be root. Concatenate strings in reverse.
-  string str = "";
-  while (!history.empty()) {
-    str += history.top();
-    history.pop();
-  }
-
-  return str;
+string Trie::path_string(const vector<Frame>& path, const string& key) const {
+  // The root holds the empty string.
+  if (path.size() == 1) return "";
+  const Frame& par = path[path.size() - 2];
+  return key.substr(0, path.back().depth)
+      .append(at(par.node).children[par.index].label);
 }
 
-bool Trie::check_invariant(const shared_ptr<Node> root) {
+bool Trie::check_invariant(Ref rt) const {
   // Check that root is non-null.
-  if (!root) return false;
-  unordered_set<char> characters;
-
-  // Check validity of children.
-  for (const auto& str_ptr_pair : root->children) {
-    // No null nodes in children tree.
-    if (!str_ptr_pair.second) return false;
-    // Ensure that its parent is root.
-    if (str_ptr_pair.second->parent.lock() != root) return false;
-    // Make sure string is not empty.
-    if (str_ptr_pair.first.empty()) return false;
-    /*
-    Check that string does not share a prefix with other children.
-    We only really need to check first char.
-    */
-    if (characters.find(str_ptr_pair.first.front()) != characters.end())
-      return false;
-    characters.emplace(str_ptr_pair.first.front());
-    // Recursively check child node.
-    if (!check_invariant(str_ptr_pair.second)) return false;
+  if (rt == NIL) return false;
+  // Nodes are checked from an explicit stack, since tries may be deeper than
+  // the call stack allows.
+  stack<Ref> pending;
+  pending.push(rt);
+  while (!pending.empty()) {
+    const Node& node = at(pending.top());
+    pending.pop();
+
+    // Check validity of children.
+    for (size_t i = 0; i < node.children.size(); ++i) {
+      const Edge& edge = node.children[i];
+      // No null nodes in children.
+      if (edge.child == NIL) return false;
+      // Make sure string is not empty.
+      if (edge.label.empty()) return false;
+      /*
+      Check that string does not share a prefix with other children, and that
+      children are sorted. We only really need to check first char.
+      */
+      if (i > 0 && static_cast<unsigned char>(
+                       node.children[i - 1].label.front()) >=
+                       static_cast<unsigned char>(edge.label.front()))
+        return false;
+      // Check the child node later.
+      pending.push(edge.child);
+    }
   }
 
-  // If root passes every single check, the tree is valid.
+  // If every node passes every single check, the tree is valid.
   return true;
 }
 
-Trie::Trie() : root(make_shared<Node>(false, nullptr)) {
+Trie::Trie() : Trie(std::pmr::get_default_resource()) {}
+
+Trie::Trie(std::pmr::memory_resource* mem) : Trie(make_pool(mem)) {}
+
+Trie::Trie(shared_ptr<Pool> pool_in)
+    : pool(move(pool_in)),
+      root(pool->allocate(false)),
+      filter(),
+      index(),
+      garbage(),
+      foreign(false) {
   assert(check_invariant(root));
 }
 
@@ -261,35 +364,79 @@ Trie::Trie(const initializer_list<string>& key_list) : Trie() {
   assert(check_invariant(root));
 }
 
-Trie::Trie(const Trie& other) : Trie() {
-  assert(other.root);
-  recursive_copy(root, other.root);
+Trie::Trie(const Trie& other)
+    : Trie(other, std::pmr::get_default_resource()) {}
+
+Trie::Trie(const Trie& other, std::pmr::memory_resource* mem)
+    : pool(make_pool(mem)),
+      root(copy_subtree(*pool, *other.pool, other.root, false)),
+      filter(),
+      index(),
+      garbage(),
+      foreign(false) {
+  if (other.filter) filter = std::make_unique<Filter>(*other.filter);
+  if (other.index) enable_index();
   assert(check_invariant(root));
 }
 
-Trie::Trie(Trie&& other) : Trie() {
-  swap(*this, other);
+Trie::Trie(Trie&& other) : Trie(other.pool->memory()) {
+  // Swap members, since std::swap on tries is implemented with this.
+  pool.swap(other.pool);
+  std::swap(root, other.root);
+  filter.swap(other.filter);
+  index.swap(other.index);
+  garbage.swap(other.garbage);
+  std::swap(foreign, other.foreign);
   assert(check_invariant(root));
 }
 
 Trie& Trie::operator=(Trie other) {
-  swap(*this, other);
+  // Like std::pmr containers, the trie keeps its resource.
+  if (other.pool->memory() != pool->memory())
+    return *this = Trie(other, pool->memory());
+  pool.swap(other.pool);
+  std::swap(root, other.root);
+  filter.swap(other.filter);
+  index.swap(other.index);
+  garbage.swap(other.garbage);
+  std::swap(foreign, other.foreign);
   assert(check_invariant(root));
   return *this;
 }
 
+std::pmr::memory_resource* Trie::resource() const { return pool->memory(); }
+
+Trie::~Trie() {
+  // A pool of its own goes with the trie, nodes and all.
+  if (pool.use_count() > 1) {
+    garbage.push_back(root);
+    reclaim();
+  }
+}
+
 bool Trie::empty(string prefix) const {
-  const auto prf_rt = prefix_match(root, prefix);
+  bool filtered = false;
+  if (filter_rejects(prefix, PREFIX_FLAG, filtered)) return true;
+  const Ref prf_rt = prefix_match(prefix);
   // Check if prefix root is null
-  if (!prf_rt) return true;
+  if (prf_rt == NIL) {
+    if (filtered) bump(filter->false_positives);
+    return true;
+  }
   // It's empty if prf_rt is not a word and has no children.
   assert(check_invariant(root));
-  return !prf_rt->is_end && prf_rt->children.empty();
+  return !at(prf_rt).is_end() && at(prf_rt).children.empty();
 }
 
 size_t Trie::size(string prefix) const {
-  const auto prf_rt = prefix_match(root, prefix);
-  if (!prf_rt) return size_t(0);
+  if (index && prefix.empty()) return index->size();
+  bool filtered = false;
+  if (filter_rejects(prefix, PREFIX_FLAG, filtered)) return size_t(0);
+  const Ref prf_rt = prefix_match(prefix);
+  if (prf_rt == NIL) {
+    if (filtered) bump(filter->false_positives);
+    return size_t(0);
+  }
   size_t counter = 0;
   key_counter(prf_rt, counter);
 
@@ -299,129 +446,243 @@ size_t Trie::size(string prefix) const {
 
 Trie::iterator Trie::find(string key, bool is_prefix) const {
   // Check if we need an exact match.
+  bool filtered = false;
+  if (filter_rejects(key, is_prefix, filtered)) return iterator();
+  if (!is_prefix && index) {
+    const auto hit = index->find(key);
+    if (hit) return iterator(pool.get(), root, *hit, move(key));
+    if (filtered) bump(filter->false_positives);
+    return iterator();
+  }
   if (!is_prefix) {
-    // Elegantly handles both match and no match.
-    return iterator(exact_match(root, key));
+    // Nodes that only branch match the key without storing it.
+    const Ref match = exact_match(key);
+    if (match != NIL && at(match).is_end())
+      return iterator(pool.get(), root, match, move(key));
+    if (filtered) bump(filter->false_positives);
+    return iterator();
   }
 
   // In this case, we need only find a word that key is a prefix of.
-  const auto prf_rt = prefix_match(root, key);
+  iterator iter(pool.get(), root);
+  string prf = key;
+  const Ref prf_rt = prefix_match(prf, &iter.path);
   // If key is not a prefix of anything, there is no match.
-  if (!prf_rt) return iterator();
+  if (prf_rt == NIL) {
+    if (filtered) bump(filter->false_positives);
+    return iterator();
+  }
 
-  // Find the first child key rooted at prt_rt.
+  // Find the first key at or under prf_rt.
   assert(check_invariant(root));
-  // If key is empty and prf_rt is and end node, then it is the "first key".
-  return key.empty() && prf_rt->is_end ? iterator(prf_rt)
-                                       : iterator(first_key(prf_rt));
+  iter.key = path_string(iter.path, key);
+  iter.first_key();
+  return iter;
+}
+
+Trie::iterator Trie::lower_bound(string key) const {
+  iterator iter(pool.get(), root);
+  iter.path.push_back(Frame{root, 0, 0});
+  for (size_t depth = 0; depth < key.length();) {
+    const auto& children = at(iter.path.back().node).children;
+    const auto child = search(children, key[depth]);
+    // Every key under the node is less than key.
+    if (child == children.end()) {
+      iter.skip();
+      return iter;
+    }
+    iter.push(static_cast<size_t>(child - children.begin()));
+    const size_t len = iter.key.length() - depth;
+    const size_t cmp = std::min(len, key.length() - depth);
+    const auto diff = mismatch(iter.key.begin() + depth,
+                               iter.key.begin() + depth + cmp,
+                               key.begin() + depth);
+    if (diff.first != iter.key.begin() + depth + cmp) {
+      // The label decides whether the whole subtree is below or above key.
+      if (static_cast<unsigned char>(*diff.first) <
+          static_cast<unsigned char>(*diff.second)) {
+        iter.skip();
+      } else {
+        iter.first_key();
+      }
+      return iter;
+    }
+    depth += len;
+  }
+  // Every key at or under the node is at least key.
+  iter.first_key();
+  return iter;
 }
 
 Trie::iterator Trie::insert(string key) {
+  if (!garbage.empty()) reclaim(RECLAIM_STEP);
+  Ref node = NIL;
+  if (index) {
+    // Keys already in the index need not touch the tree.
+    const auto hit = index->find(key);
+    if (hit) node = *hit;
+  }
+  if (node == NIL) {
+    Budget& budget = pool->budget();
+    // Only inserts are held to the limit, so that erases can always join
+    // labels.
+    budget.enforced = true;
+    try {
+      node = place(key);
+    } catch (const std::bad_alloc&) {
+      budget.enforced = false;
+      if (budget.limit == 0) throw;
+      return iterator();
+    } catch (...) {
+      budget.enforced = false;
+      throw;
+    }
+    budget.enforced = false;
+    if (index) index->insert(key, node);
+  }
+  if (filter) {
+    // Keys already in the trie are counted too, which only rebuilds sooner.
+    filter->keys.insert(key);
+    if (filter->prefix_length > 0 && key.length() >= filter->prefix_length) {
+      filter->prefixes.insert(key.substr(0, filter->prefix_length));
+    }
+    if (++filter->num_inserted > filter->capacity) rebuild_filter();
+  }
+  return iterator(pool.get(), root, node, move(key));
+}
+
+Trie::Ref Trie::place(const string& word) {
   /*
   Note: inserting key at root, is the same
   as inserting reduced key at loc.
   The problem space has been reduced.
   */
-  auto loc = approximate_match(root, key);
-  assert(loc);
+  string key = word;
+  const Ref loc = approximate_match(key);
+  assert(loc != NIL);
+  // Every change is to loc, unless the key is already there. Ancestors of
+  // changed nodes are changed, so the path is only needed if loc is saved.
+  if ((!key.empty() || !at(loc).is_end()) && at(loc).saved() != 0) {
+    string rest = word;
+    vector<Frame> path;
+    approximate_match(rest, &path);
+    touch(path);
+  }
   /* INSERT KEY AT LOC */
 
   // If the key is now empty, simply set is_end to true.
   if (key.empty()) {
-    loc->is_end = true;
+    at(loc).set_end(true);
     assert(check_invariant(root));
-    return iterator(loc);
+    return loc;
   }
 
+  // Nodes never move, so this stays valid as nodes are allocated.
+  auto& children = at(loc).children;
+  // Only the child with the same first letter can share a prefix with key.
+  const auto child = search(children, key.front());
+  if (child == children.end() || child->label.front() != key.front()) {
+    // If there are no shared prefixes, then simply create a node under loc.
+    const Ref key_node = pool->allocate(true);
+    try {
+      children.emplace(child, key, key_node);
+    } catch (...) {
+      // Inserts refused by a memory limit leave the trie unchanged.
+      pool->release(key_node);
+      throw;
+    }
+    assert(check_invariant(root));
+    return key_node;
+  }
+
+  // Use mismatch to compute the spot where the prefix fails.
+  const auto common = static_cast<size_t>(
+      mismatch(key.begin(), key.end(), child->label.begin()).first -
+      key.begin());
+  // The unique postfixes of key and child.
+  const string_view post_key = string_view(key).substr(common);
+  const string_view post_child = string_view(child->label).substr(common);
   /*
-  At this point, the key is non-empty.
-  If loc has no children, then just make a child.
+  If remaining key's prefix can match a child,
+  then approximate_match failed.
   */
-  if (loc->children.empty()) {
-    auto child = make_shared<Node>(true, loc);
-    loc->children.emplace(key, child);
-    assert(check_invariant(root));
-    return iterator(child);
-  }
-
-  // Check children of loc for shared prefixes.
-  for (const auto& str_ptr_pair : loc->children) {
-    const string& child_str = str_ptr_pair.first;
-    assert(!child_str.empty());
-
-    // Keep iterating until a first letter match is found.
-    if (child_str.front() != key.front()) continue;
-
-    // Use mismatch to compute the spot where the prefix fails.
-    auto iter_pair = mismatch(key.begin(), key.end(), child_str.begin());
-    // Extract the common prefix and unique postfixes of key and child.
-    string common(key.begin(), iter_pair.first);
-    string post_key(iter_pair.first, key.end());
-    string post_child(iter_pair.second, child_str.end());
-    /*
-    If remaining key's prefix can match a child,
-    then approximate_match failed.
-    */
-    assert(!post_child.empty());
-
-    // This node will be moved under junction.
-    auto old_child = str_ptr_pair.second;
-    // Create a child for the common part. junction's parent is set.
-    auto junction = make_shared<Node>(post_key.empty(), loc);
-    // Add junction to loc under common.
-    loc->children.emplace(common, junction);
-    // loc child is added to junction's children map.
-    junction->children.emplace(post_child, old_child);
-    // The original child's parent pointer is set to junction.
-    old_child->parent = junction;
-    // Remove child_str from loc child map.
-    loc->children.erase(child_str);
-
-    if (!post_key.empty()) {
-      // Add an additional node for the split.
-      auto key_node = make_shared<Node>(true, junction);
-      junction->children.emplace(post_key, key_node);
-
-      assert(check_invariant(root));
-      return iterator(key_node);
+  assert(!post_child.empty());
+
+  // The child will be moved under junction, a node for the common part.
+  const Ref old_child = child->child;
+  const Ref junction = pool->allocate(post_key.empty());
+  auto& junction_children = at(junction).children;
+  Ref key_node = junction;
+  try {
+    if (post_key.empty()) {
+      junction_children.emplace_back(post_child, old_child);
     } else {
-      assert(check_invariant(root));
-      return iterator(junction);
+      // Add an additional node for the split, in order with the child.
+      key_node = pool->allocate(true);
+      junction_children.reserve(2);
+      const bool key_first = static_cast<unsigned char>(post_key.front()) <
+                             static_cast<unsigned char>(post_child.front());
+      if (key_first) junction_children.emplace_back(post_key, key_node);
+      junction_children.emplace_back(post_child, old_child);
+      if (!key_first) junction_children.emplace_back(post_key, key_node);
     }
+  } catch (...) {
+    // Nothing points at the new nodes yet, so freeing them undoes the insert.
+    if (key_node != junction) pool->release(key_node);
+    pool->release(junction);
+    throw;
   }
-
-  // If there are no shared prefixes, then simply create a node under loc.
-  auto key_node = make_shared<Node>(true, loc);
-  loc->children.emplace(key, key_node);
+  // junction takes the place of the child, and shares its first letter.
+  child->label.resize(common);
+  child->child = junction;
   assert(check_invariant(root));
-  return iterator(key_node);
+  return key_node;
 }
 
 void Trie::erase(string key, bool is_prefix) {
+  if (!garbage.empty()) reclaim(RECLAIM_STEP);
+  vector<Frame> path;
   /*
   If is_prefix flag is set, wipe everything
   at and under the prefix_match.
   */
   if (is_prefix) {
-    auto prf_ptr = prefix_match(root, key);
-    if (!prf_ptr) return;
+    string prf = key;
+    const Ref prf_ptr = prefix_match(prf, &path);
+    if (prf_ptr == NIL) return;
+    if (index) {
+      string removed = path_string(path, key);
+      index_keys(prf_ptr, removed, false);
+    }
     if (prf_ptr == root) {
       clear();
     } else {
-      auto par = prf_ptr->parent.lock();
-      assert(par);
-      par->children.erase(value_find(par->children, prf_ptr));
+      // The subtree is freed later, so erasing it is O(|prefix|).
+      path.pop_back();
+      touch(path);
+      const Frame& par = path.back();
+      auto& siblings = at(par.node).children;
+      siblings.erase(siblings.begin() + static_cast<std::ptrdiff_t>(par.index));
+      garbage.push_back(prf_ptr);
+      join(path);
+      // Any number of keys went, so the filter is rebuilt.
+      if (filter) rebuild_filter();
     }
     assert(check_invariant(root));
     return;
   }
 
   // Must remove exact key.
-  auto match = exact_match(root, key);
+  if (index) index->erase(key);
+  const Ref match = exact_match(key, &path);
   // If the key was not in the tree, just return.
-  if (!match) return;
-  // No matter what happens, setting is_end to false is correct.
-  match->is_end = false;
+  if (match == NIL || !at(match).is_end()) return;
+  // Only match and its ancestors change.
+  touch(path);
+  at(match).set_end(false);
+  // The filter keeps erased keys until enough of them pile up. Joining nodes
+  // below changes no key, so it can be rebuilt now.
+  if (filter && ++filter->num_erased * 4 > filter->capacity) rebuild_filter();
 
   // If match is the root node, it won't have a parent to deal with.
   if (match == root) {
@@ -431,60 +692,911 @@ void Trie::erase(string key, bool is_prefix) {
     return;
   }
 
-  if (match->children.empty()) {
-    auto par = match->parent.lock();
-    auto match_iter = value_find(par->children, match);
-    par->children.erase(match_iter);
+  if (at(match).children.empty()) {
+    // The edge to match is the one the path took from its parent.
+    path.pop_back();
+    const Frame& par = path.back();
+    auto& siblings = at(par.node).children;
+    siblings.erase(siblings.begin() + static_cast<std::ptrdiff_t>(par.index));
+    pool->release(match);
+  }
+  // Check for possible joining of match, or of its parent with the grand
+  // parent. If match has multiple children, nothing can be joined.
+  join(path);
+  assert(check_invariant(root));
+}
 
-    // Check for possible joining with grand parent.
-    if (par->children.size() == 1 && par != root && !par->is_end) {
-      auto grand_par = par->parent.lock();
-      assert(grand_par);
-      auto par_iter = value_find(grand_par->children, par);
-      assert(par_iter != grand_par->children.end());
+void Trie::erase_range(const string& lo, const string& hi) {
+  if (!garbage.empty()) reclaim(RECLAIM_STEP);
+  if (hi <= lo) return;
+  vector<Frame> path{Frame{root, 0, 0}};
+  string str;
+  if (erase_between(path, str, lo, hi) && filter) rebuild_filter();
+  assert(check_invariant(root));
+}
+
+bool Trie::erase_between(vector<Frame>& path, string& str, const string& lo,
+                         const string& hi) {
+  const Ref rt = path.back().node;
+  bool erased = false;
+  if (at(rt).is_end() && lo <= str && str < hi) {
+    touch(path);
+    at(rt).set_end(false);
+    if (index) index->erase(str);
+    erased = true;
+  }
+  auto& children = at(rt).children;
+  // Removing a child leaves the next one at the same position.
+  for (size_t i = 0; i < children.size();) {
+    const Ref child = children[i].child;
+    const auto pos = children.begin() + static_cast<std::ptrdiff_t>(i);
+    const size_t depth = str.length();
+    str += children[i].label;
+    // Every key under child starts with str.
+    if (str >= hi) {
+      // Later children hold even greater keys.
+      str.resize(depth);
+      break;
+    }
+    if (str < lo && !is_prefix(str, lo)) {
+      // Every key under child is less than lo.
+      ++i;
+    } else if (lo <= str && !is_prefix(str, hi)) {
+      // Every key under child is in the range.
+      if (index) index_keys(child, str, false);
+      touch(path);
+      garbage.push_back(child);
+      children.erase(pos);
+      erased = true;
+    } else {
+      // str is a prefix of lo or hi, and child may need compressing.
+      path.back().index = i;
+      path.push_back(Frame{child, 0, depth});
+      const bool below = erase_between(path, str, lo, hi);
+      if (below && !at(child).is_end() && at(child).children.empty()) {
+        path.pop_back();
+        children.erase(pos);
+        pool->release(child);
+      } else {
+        if (below) join(path);
+        path.pop_back();
+        ++i;
+      }
+      erased = erased || below;
+    }
+    str.resize(depth);
+  }
+  return erased;
+}
 
-      // Join keys on par_iter and the only child of par.
-      string mod_key = par_iter->first + par->children.begin()->first;
-      auto child = par->children.begin()->second;
+void Trie::clear() {
+  // Clear everything under root, leaving the nodes to reclaim.
+  for (const Edge& edge : at(root).children) {
+    garbage.push_back(edge.child);
+  }
+  at(root).children.clear();
+  at(root).set_end(false);
+  // The root has no ancestors to mark.
+  at(root).set_saved(0);
+  if (index) index->clear();
+  if (filter) {
+    filter->keys.clear();
+    filter->prefixes.clear();
+    filter->num_inserted = 0;
+    filter->num_erased = 0;
+  }
+  assert(check_invariant(root));
+}
 
-      grand_par->children.emplace(mod_key, child);
-      child->parent = grand_par;
-      grand_par->children.erase(par_iter);
+size_t Trie::reclaim(size_t max_nodes) {
+  size_t freed = 0;
+  while (freed < max_nodes && !garbage.empty()) {
+    const Ref node = garbage.back();
+    garbage.pop_back();
+    // Taking the children first keeps each free O(1) instead of recursive.
+    for (const Edge& edge : at(node).children) {
+      garbage.push_back(edge.child);
     }
-  } else if (match->children.size() == 1) {
-    // Extract child and parent string to form joined key.
-    auto only_child = match->children.begin();
-    auto par = match->parent.lock();
-    assert(par);
-    auto match_iter = value_find(par->children, match);
-    string joined_key = match_iter->first + only_child->first;
+    pool->release(node);
+    ++freed;
+  }
+  return freed;
+}
 
-    only_child->second->parent = par;
-    par->children.emplace(joined_key, only_child->second);
-    par->children.erase(match_iter);
+size_t Trie::pending_reclaim() const { return garbage.size(); }
+
+size_t Trie::compact() {
+  const size_t before = heap_in_use();
+  reclaim();
+  // Copying in pre-order places each subtree in consecutive slots.
+  auto fresh = make_pool(pool->memory());
+  const Ref fresh_root = copy_subtree(*fresh, *pool, root, true);
+  adopt(move(fresh), fresh_root);
+  if (index) {
+    index.reset();
+    enable_index();
+  }
+  assert(check_invariant(root));
+#ifdef __GLIBC__
+  // Return the freed chunks and labels to the system.
+  malloc_trim(0);
+#endif
+  const size_t after = heap_in_use();
+  return before > after ? before - after : 0;
+}
+
+void Trie::adopt(shared_ptr<Pool> fresh, Ref fresh_root) {
+  if (pool.use_count() > 1) {
+    garbage.push_back(root);
+    reclaim();
+  }
+  garbage.clear();
+  // The limit belongs to the trie rather than to its nodes.
+  fresh->budget().limit = pool->budget().limit;
+  pool = move(fresh);
+  root = fresh_root;
+}
+
+size_t Trie::heap_in_use() {
+#ifdef __GLIBC__
+  const struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+Trie Trie::extract_prefix(const string& prefix) {
+  string prf = prefix;
+  vector<Frame> path;
+  const Ref prf_ptr = prefix_match(prf, &path);
+  if (prf_ptr == NIL) return Trie(pool->memory());
+  // The extracted nodes stay in this pool.
+  Trie out(pool);
+  out.foreign = true;
+  if (prf_ptr == root) {
+    // Every key moves, so the trees are swapped and this trie is reset.
+    std::swap(root, out.root);
+    clear();
+    return out;
   }
 
+  string label = path_string(path, prefix);
+  if (index) {
+    string removed = label;
+    index_keys(prf_ptr, removed, false);
+  }
+  path.pop_back();
+  touch(path);
+  const Frame& par = path.back();
+  auto& siblings = at(par.node).children;
+  siblings.erase(siblings.begin() + static_cast<std::ptrdiff_t>(par.index));
+  join(path);
+  if (filter) rebuild_filter();
+  // The subtree is re-rooted under its whole string.
+  vector<Frame> out_path{Frame{out.root, 0, 0}};
+  out.graft(out_path, move(label), prf_ptr);
   assert(check_invariant(root));
-  // If match has multiple children, nothing can be joined.
+  assert(out.check_invariant(out.root));
+  return out;
 }
 
-void Trie::clear() {
-  // Clear everything under root.
-  root->children.clear();
-  root->is_end = false;
-  assert(!root->parent.lock());
+void Trie::merge_disjoint(Trie&& other) {
+  if (&other == this) return;
+  // Leaves other as an empty trie.
+  Trie taken(move(other));
+  if (!taken.at(taken.root).is_end() && taken.at(taken.root).children.empty())
+    return;
+  vector<Frame> path{Frame{root, 0, 0}};
+  if (taken.pool == pool) {
+    // The nodes move, and taken keeps an empty root to free.
+    const Ref sub = taken.root;
+    taken.root = pool->allocate(false);
+    graft(path, "", sub);
+  } else {
+    // Nodes cannot leave their pool, so those of other are copied.
+    graft(path, "", copy_subtree(*pool, *taken.pool, taken.root, false));
+  }
+  foreign = true;
+  if (index) {
+    index.reset();
+    enable_index();
+  }
+  if (filter) rebuild_filter();
+  assert(check_invariant(root));
+}
+
+Trie Trie::split_at(const string& key) {
+  // Subtrees whose keys are all at least key, and their strings.
+  vector<std::pair<string, Ref>> moved;
+  // The nodes on the path of key, which may lose children.
+  vector<Frame> path{Frame{root, 0, 0}};
+  string str;
+  while (true) {
+    Node& node = at(path.back().node);
+    if (str.length() == key.length()) {
+      // The node holds key, so it and every key under it move.
+      if (node.is_end() || !node.children.empty()) {
+        const Ref top = pool->allocate(node.is_end());
+        at(top).children.swap(node.children);
+        node.set_end(false);
+        moved.emplace_back(str, top);
+      }
+      break;
+    }
+
+    // Children after the one on the path of key hold greater keys.
+    auto& children = node.children;
+    const char next = key[str.length()];
+    auto child = search(children, next);
+    const bool has_path =
+        child != children.end() && child->label.front() == next;
+    const size_t on_path = static_cast<size_t>(child - children.begin());
+    if (has_path) ++child;
+    for (auto iter = child; iter != children.end(); ++iter) {
+      moved.emplace_back(str + string(iter->label), iter->child);
+    }
+    children.erase(child, children.end());
+    if (!has_path) break;
+
+    const string_view label = children[on_path].label;
+    const string rest = key.substr(str.length());
+    const auto res = mismatch(label.begin(), label.end(), rest.begin(),
+                              rest.end());
+    if (res.first == label.end()) {
+      // The label is a prefix of the rest of key, so the path goes on.
+      path.back().index = on_path;
+      path.push_back(Frame{children[on_path].child, 0, str.length()});
+      str += label;
+      continue;
+    }
+    // Otherwise the whole child is on one side of key.
+    if (res.second == rest.end() ||
+        static_cast<unsigned char>(*res.first) >
+            static_cast<unsigned char>(*res.second)) {
+      moved.emplace_back(str + string(label), children[on_path].child);
+      children.pop_back();
+    }
+    break;
+  }
+
+  if (moved.empty()) return Trie(pool->memory());
+  // The moved nodes stay in this pool.
+  Trie out(pool);
+  out.foreign = true;
+  if (index) {
+    for (auto& str_ref_pair : moved) {
+      index_keys(str_ref_pair.second, str_ref_pair.first, false);
+    }
+  }
+  touch(path);
+  // Restore compression along the path, from the bottom up. Only the edge
+  // below each node changes, so the edges named by the path stay valid.
+  for (; !path.empty(); path.pop_back()) {
+    const Ref node = path.back().node;
+    if (path.size() > 1 && !at(node).is_end() && at(node).children.empty()) {
+      const Frame& par = path[path.size() - 2];
+      auto& siblings = at(par.node).children;
+      siblings.erase(siblings.begin() + static_cast<std::ptrdiff_t>(par.index));
+      pool->release(node);
+    } else {
+      join(path);
+    }
+  }
+  if (filter) rebuild_filter();
+  vector<Frame> out_path{Frame{out.root, 0, 0}};
+  for (auto& str_ref_pair : moved) {
+    out.graft(out_path, move(str_ref_pair.first), str_ref_pair.second);
+  }
+  assert(check_invariant(root));
+  assert(out.check_invariant(out.root));
+  return out;
+}
+
+class Trie::Reader {
+ private:
+  std::streambuf* buf;
+
+ public:
+  explicit Reader(istream& is) : buf(is.rdbuf()) {
+    if (!buf) throw runtime_error("Trie stream has no buffer.");
+  }
+
+  /**
+   * @brief Read a byte.
+   * @return The byte read. Throws std::runtime_error at the end of input.
+   */
+  unsigned char byte() {
+    const auto c = buf->sbumpc();
+    if (c == std::char_traits<char>::eof())
+      throw runtime_error("Truncated trie stream.");
+    return static_cast<unsigned char>(c);
+  }
+
+  /**
+   * @brief Read a variable length (LEB128) integer, as written by put_varint.
+   * @return The value read. Throws std::runtime_error if it overflows.
+   */
+  size_t varint() {
+    size_t val = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+      const unsigned char c = byte();
+      val |= static_cast<size_t>(c & 0x7F) << shift;
+      if (!(c & 0x80)) return val;
+    }
+    throw runtime_error("Malformed trie stream.");
+  }
+
+  /**
+   * @brief Read a run of bytes.
+   * @param out Set to the bytes read.
+   * @param len The number of bytes to read.
+   */
+  void bytes(string& out, size_t len) {
+    out.clear();
+    while (out.length() < len) {
+      const size_t start = out.length();
+      const size_t count = std::min(len - start, LOAD_CHUNK);
+      out.resize(start + count);
+      if (buf->sgetn(&out[start], static_cast<std::streamsize>(count)) !=
+          static_cast<std::streamsize>(count))
+        throw runtime_error("Truncated trie stream.");
+    }
+  }
+};
+
+void Trie::save_node(Ref rt, string& buf, ostream& os) const {
+  assert(rt != NIL);
+  const Node& node = at(rt);
+  put_varint(buf, node.children.size() << 1 | node.is_end());
+  for (const Edge& edge : node.children) {
+    put_varint(buf, edge.label.length());
+    buf += edge.label;
+    if (buf.length() >= SAVE_BUFFER) {
+      os.write(buf.data(), static_cast<std::streamsize>(buf.length()));
+      buf.clear();
+    }
+    save_node(edge.child, buf, os);
+  }
+}
+
+Trie::Ref Trie::load_tree(Pool& nodes, Reader& in) {
+  // A decoded node, and the number of its children still to decode.
+  struct Pending {
+    Ref node;
+    size_t remaining;
+  };
+  // Allocates the node whose header is next, and notes how many children
+  // follow it.
+  vector<Pending> pending;
+  const auto decode = [&nodes, &in, &pending](bool is_root) {
+    const size_t header = in.varint();
+    const bool is_end = header & 1;
+    const size_t num_children = header >> 1;
+    // Invariants 4 and 5 hold for every node but the root, and by invariant 6
+    // there is at most one child per character.
+    if (num_children > 256 || (!is_root && !is_end && num_children < 2))
+      throw runtime_error("Malformed trie stream.");
+    const Ref rt = nodes.allocate(is_end);
+    nodes[rt].children.reserve(num_children);
+    pending.push_back(Pending{rt, num_children});
+    return rt;
+  };
+
+  // Nodes were saved in pre-order, so the children of the node on top of the
+  // stack come next. The stack, not the call stack, grows with the depth.
+  const Ref rt = decode(true);
+  string label;
+  while (!pending.empty()) {
+    if (pending.back().remaining == 0) {
+      pending.pop_back();
+      continue;
+    }
+    --pending.back().remaining;
+    const Ref parent = pending.back().node;
+    const size_t len = in.varint();
+    if (len == 0) throw runtime_error("Malformed trie stream.");
+    in.bytes(label, len);
+    // Children were saved in order, and by invariant 1 with distinct first
+    // characters, so each goes at the end.
+    const auto& children = nodes[parent].children;
+    if (!children.empty() &&
+        static_cast<unsigned char>(children.back().label.front()) >=
+            static_cast<unsigned char>(label.front()))
+      throw runtime_error("Malformed trie stream.");
+    const Ref child = decode(false);
+    nodes[parent].children.emplace_back(label, child);
+  }
+  return rt;
+}
+
+void Trie::save(ostream& os) const {
+  string buf(SAVE_MAGIC);
+  put_varint(buf, SAVE_VERSION);
+  save_node(root, buf, os);
+  os.write(buf.data(), static_cast<std::streamsize>(buf.length()));
+}
+
+void Trie::load(istream& is) {
+  Reader in(is);
+  string magic;
+  in.bytes(magic, sizeof(SAVE_MAGIC) - 1);
+  if (magic != SAVE_MAGIC) throw runtime_error("Not a saved trie.");
+  if (in.varint() != SAVE_VERSION)
+    throw runtime_error("Unsupported trie format version.");
+  // Decode fully into a fresh pool, so errors leave the trie unchanged.
+  auto fresh = make_pool(pool->memory());
+  const Ref loaded = load_tree(*fresh, in);
+  adopt(move(fresh), loaded);
+  foreign = false;
+  if (index) {
+    index.reset();
+    enable_index();
+  }
+  if (filter) rebuild_filter();
+  assert(check_invariant(root));
+}
+
+void Trie::touch(const vector<Frame>& path) {
+  // Ancestors of a changed node are already marked.
+  for (auto iter = path.rbegin();
+       iter != path.rend() && at(iter->node).saved() != 0; ++iter) {
+    at(iter->node).set_saved(0);
+  }
+}
+
+void Trie::join(const vector<Frame>& path) {
+  assert(!path.empty());
+  const Ref ptr = path.back().node;
+  Node& node = at(ptr);
+  if (ptr == root || node.is_end() || node.children.size() != 1) return;
+  touch(path);
+  const Frame& par = path[path.size() - 2];
+  Edge& edge = at(par.node).children[par.index];
+  assert(edge.child == ptr);
+
+  // Join the label of ptr and that of its only child, keeping the position.
+  const Edge& only = node.children.front();
+  edge.label += only.label;
+  edge.child = only.child;
+  pool->release(ptr);
+}
+
+void Trie::graft(vector<Frame>& path, string label, Ref sub) {
+  const Ref rt = path.back().node;
+  assert(sub != NIL);
+  Node& sub_node = at(sub);
+  if (label.empty()) {
+    // rt and sub hold the same string, so their keys are merged.
+    if (sub_node.is_end() && !at(rt).is_end()) {
+      touch(path);
+      at(rt).set_end(true);
+    }
+    std::pmr::vector<Edge> children(pool->memory());
+    children.swap(sub_node.children);
+    pool->release(sub);
+    for (const Edge& edge : children) {
+      graft(path, string(edge.label), edge.child);
+    }
+    return;
+  }
+  // A node that is not compressed is replaced by its only child.
+  if (!sub_node.is_end() && sub_node.children.size() <= 1) {
+    if (sub_node.children.empty()) {
+      pool->release(sub);
+      return;
+    }
+    const Ref only = sub_node.children.front().child;
+    label += sub_node.children.front().label;
+    pool->release(sub);
+    graft(path, move(label), only);
+    return;
+  }
+
+  // By invariant (2), at most one child shares a first character with label.
+  auto& children = at(rt).children;
+  const auto child = search(children, label.front());
+  if (child == children.end() || child->label.front() != label.front()) {
+    touch(path);
+    children.emplace(child, label, sub);
+    return;
+  }
+  const string child_str(child->label);
+  const Ref old_child = child->child;
+  const size_t common = static_cast<size_t>(
+      mismatch(label.begin(), label.end(), child_str.begin(), child_str.end())
+          .first -
+      label.begin());
+  // Grafting only needs the nodes and edges of the path, not its depths.
+  path.back().index = static_cast<size_t>(child - children.begin());
+
+  if (common == child_str.length()) {
+    // The child holds a prefix of label, so sub goes under it.
+    path.push_back(Frame{old_child, 0, 0});
+    graft(path, label.substr(common), sub);
+    path.pop_back();
+    return;
+  }
+  touch(path);
+  if (common == label.length()) {
+    // sub holds a prefix of the child, which goes under sub instead.
+    child->label = move(label);
+    child->child = sub;
+    path.push_back(Frame{sub, 0, 0});
+    graft(path, child_str.substr(common), old_child);
+    path.pop_back();
+    return;
+  }
+  // Neither holds a prefix of the other, so they branch at a new node.
+  const Ref junction = pool->allocate(false);
+  child->label.resize(common);
+  child->child = junction;
+  const string_view post_child = string_view(child_str).substr(common);
+  const string_view post_label = string_view(label).substr(common);
+  auto& junction_children = at(junction).children;
+  junction_children.reserve(2);
+  const bool label_first = static_cast<unsigned char>(post_label.front()) <
+                           static_cast<unsigned char>(post_child.front());
+  if (label_first) junction_children.emplace_back(post_label, sub);
+  junction_children.emplace_back(post_child, old_child);
+  if (!label_first) junction_children.emplace_back(post_label, sub);
+}
+
+uint64_t Trie::save_changed(Ref rt, string& buf, ostream& os,
+                            uint64_t& offset) {
+  assert(rt != NIL);
+  if (at(rt).saved() != 0) return at(rt).saved();
+  // Children are saved first, so that their offsets are known.
+  vector<uint64_t> kids;
+  kids.reserve(at(rt).children.size());
+  for (const Edge& edge : at(rt).children) {
+    kids.push_back(save_changed(edge.child, buf, os, offset));
+  }
+
+  const Node& node = at(rt);
+  const size_t start = buf.length();
+  put_varint(buf, node.children.size() << 1 | node.is_end());
+  size_t i = 0;
+  for (const Edge& edge : node.children) {
+    put_varint(buf, edge.label.length());
+    buf += edge.label;
+    put_varint(buf, kids[i++]);
+  }
+  at(rt).set_saved(offset);
+  offset += buf.length() - start;
+  if (buf.length() >= SAVE_BUFFER) {
+    os.write(buf.data(), static_cast<std::streamsize>(buf.length()));
+    buf.clear();
+  }
+  return at(rt).saved();
+}
+
+Trie::Ref Trie::load_records(Pool& nodes, const string& data, uint64_t rt) {
+  // Reads a varint without running past the end of data.
+  const auto varint = [&data](size_t& pos) {
+    size_t val = 0;
+    for (unsigned shift = 0; shift < 64 && pos < data.length(); shift += 7) {
+      const auto byte = static_cast<unsigned char>(data[pos++]);
+      val |= static_cast<size_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return val;
+    }
+    throw runtime_error("Malformed trie checkpoint.");
+  };
+
+  // A node whose record is still to decode, and the offset of the record.
+  struct Pending {
+    Ref node;
+    size_t offset;
+  };
+  vector<Pending> pending;
+  // The offsets reached so far. A tree reaches each record once, and a
+  // record reached twice could make the tree exponentially larger than data.
+  vector<bool> seen(data.length());
+  // Allocates the node of the record at an offset from its header.
+  const auto decode = [&nodes, &data, &varint, &pending, &seen](
+                          uint64_t offset, bool is_root) {
+    if (offset == 0 || offset >= data.length() ||
+        seen[static_cast<size_t>(offset)])
+      throw runtime_error("Malformed trie checkpoint.");
+    seen[static_cast<size_t>(offset)] = true;
+    size_t pos = static_cast<size_t>(offset);
+    const size_t header = varint(pos);
+    const bool is_end = header & 1;
+    const size_t num_children = header >> 1;
+    // The same invariants as load.
+    if (num_children > 256 || (!is_root && !is_end && num_children < 2))
+      throw runtime_error("Malformed trie checkpoint.");
+    const Ref node = nodes.allocate(is_end);
+    nodes[node].set_saved(offset);
+    nodes[node].children.reserve(num_children);
+    pending.push_back(Pending{node, static_cast<size_t>(offset)});
+    return node;
+  };
+
+  // The stack, not the call stack, grows with the depth. Children precede
+  // their parents, so every path through the file ends.
+  const Ref loaded = decode(rt, true);
+  while (!pending.empty()) {
+    const Pending top = pending.back();
+    pending.pop_back();
+    size_t pos = top.offset;
+    const size_t num_children = varint(pos) >> 1;
+    for (size_t i = 0; i < num_children; ++i) {
+      const size_t len = varint(pos);
+      if (len == 0 || len > data.length() - pos)
+        throw runtime_error("Malformed trie checkpoint.");
+      const string_view label = string_view(data).substr(pos, len);
+      pos += len;
+      const size_t kid = varint(pos);
+      const auto& children = nodes[top.node].children;
+      if (kid >= top.offset ||
+          (!children.empty() &&
+           static_cast<unsigned char>(children.back().label.front()) >=
+               static_cast<unsigned char>(label.front())))
+        throw runtime_error("Malformed trie checkpoint.");
+      const Ref child = decode(kid, false);
+      nodes[top.node].children.emplace_back(label, child);
+    }
+  }
+  return loaded;
+}
+
+uint64_t Trie::save_changes(ostream& os, uint64_t& offset) {
+  assert(offset != 0);
+  // Offsets into the file of another trie are meaningless here.
+  if (foreign) forget_checkpoint();
+  string buf;
+  const uint64_t rt = save_changed(root, buf, os, offset);
+  os.write(buf.data(), static_cast<std::streamsize>(buf.length()));
+  return rt;
+}
+
+void Trie::load_checkpoint(const string& data, uint64_t rt) {
+  // Decode fully into a fresh pool, so errors leave the trie unchanged.
+  auto fresh = make_pool(pool->memory());
+  const Ref loaded = load_records(*fresh, data, rt);
+  adopt(move(fresh), loaded);
+  foreign = false;
+  if (index) {
+    index.reset();
+    enable_index();
+  }
+  if (filter) rebuild_filter();
   assert(check_invariant(root));
 }
 
-Trie::iterator::iterator(const std::shared_ptr<Node> p) : ptr(p) {}
+void Trie::forget_checkpoint() {
+  foreign = false;
+  stack<Ref> pending;
+  pending.push(root);
+  while (!pending.empty()) {
+    const Ref rt = pending.top();
+    pending.pop();
+    at(rt).set_saved(0);
+    for (const Edge& edge : at(rt).children) {
+      pending.push(edge.child);
+    }
+  }
+}
+
+void Trie::filter_keys(Ref rt, string& key, Filter& f) const {
+  assert(rt != NIL);
+  if (at(rt).is_end()) f.keys.insert(key);
+  // Each prefix of prefix_length is added once, at the depth it completes.
+  for (const Edge& edge : at(rt).children) {
+    const size_t depth = key.length();
+    key += edge.label;
+    if (f.prefix_length > 0 && depth < f.prefix_length &&
+        key.length() >= f.prefix_length) {
+      f.prefixes.insert(key.substr(0, f.prefix_length));
+    }
+    filter_keys(edge.child, key, f);
+    key.resize(depth);
+  }
+}
+
+void Trie::index_keys(Ref rt, string& key, bool add) {
+  assert(rt != NIL && index);
+  if (at(rt).is_end()) {
+    if (add) {
+      index->insert(key, rt);
+    } else {
+      index->erase(key);
+    }
+  }
+  for (const Edge& edge : at(rt).children) {
+    const size_t depth = key.length();
+    key += edge.label;
+    index_keys(edge.child, key, add);
+    key.resize(depth);
+  }
+}
+
+void Trie::enable_index() {
+  if (index) return;
+  index = std::make_unique<HashIndex<Ref>>();
+  string key;
+  index_keys(root, key, true);
+}
+
+void Trie::disable_index() { index.reset(); }
+
+bool Trie::has_index() const { return static_cast<bool>(index); }
+
+size_t Trie::index_memory_usage() const {
+  return index ? index->memory_usage() : 0;
+}
+
+bool Trie::reserve(size_t expected_keys, size_t expected_total_bytes) {
+  const size_t num_nodes = 2 * expected_keys;
+  const Budget& budget = pool->budget();
+  if (budget.limit != 0) {
+    // Each new node is also the child of an edge.
+    const size_t bytes = num_nodes * (sizeof(Node) + sizeof(Edge)) +
+                         expected_total_bytes;
+    if (budget.in_use > budget.limit || bytes > budget.limit - budget.in_use)
+      return false;
+  }
+  pool->reserve(num_nodes);
+  return true;
+}
+
+Trie::MemoryUsage Trie::memory_usage() const {
+  MemoryUsage usage{0, 0, 0, 0, pool->budget().in_use};
+  // Labels that fit in the edge allocate nothing.
+  const size_t inline_capacity = std::pmr::string().capacity();
+  vector<Ref> pending(garbage);
+  pending.push_back(root);
+  while (!pending.empty()) {
+    const Node& node = at(pending.back());
+    pending.pop_back();
+    usage.nodes += sizeof(Node);
+    usage.children += node.children.capacity() * sizeof(Edge);
+    for (const Edge& edge : node.children) {
+      // The buffer holds a terminating null.
+      if (edge.label.capacity() > inline_capacity)
+        usage.labels += edge.label.capacity() + 1;
+      pending.push_back(edge.child);
+    }
+  }
+  usage.overhead = usage.total - usage.nodes - usage.children - usage.labels;
+  return usage;
+}
+
+void Trie::set_memory_limit(size_t bytes) { pool->budget().limit = bytes; }
+
+size_t Trie::memory_limit() const { return pool->budget().limit; }
+
+void Trie::rebuild_filter() {
+  assert(filter);
+  // Leave room to grow by half before the next rebuild.
+  const size_t num_keys = size();
+  Filter& f = *filter;
+  f.capacity = std::max<size_t>(num_keys + num_keys / 2, MIN_FILTER_CAPACITY);
+  f.keys = BloomFilter(f.capacity, f.bits_per_key);
+  f.prefixes = BloomFilter(f.prefix_length > 0 ? f.capacity : 0,
+                           f.bits_per_key);
+  string key;
+  filter_keys(root, key, f);
+  f.num_inserted = num_keys;
+  f.num_erased = 0;
+  ++f.rebuilds;
+}
+
+bool Trie::filter_rejects(const string& key, bool is_prefix,
+                          bool& consulted) const {
+  consulted = false;
+  if (!filter) return false;
+  // Short prefixes cannot be checked against the prefix filter.
+  if (is_prefix &&
+      (filter->prefix_length == 0 || key.length() < filter->prefix_length)) {
+    return false;
+  }
+  consulted = true;
+
+  bump(filter->lookups);
+  const bool rejected =
+      is_prefix ? !filter->prefixes.may_contain(
+                      key.substr(0, filter->prefix_length))
+                : !filter->keys.may_contain(key);
+  if (rejected) bump(filter->negatives);
+  return rejected;
+}
+
+void Trie::enable_filter(size_t bits_per_key, size_t prefix_length) {
+  assert(bits_per_key > 0);
+  filter = std::make_unique<Filter>(bits_per_key, prefix_length);
+  rebuild_filter();
+  filter->rebuilds = 0;
+}
+
+void Trie::disable_filter() { filter.reset(); }
+
+bool Trie::has_filter() const { return static_cast<bool>(filter); }
+
+Trie::FilterStats Trie::filter_stats() const {
+  if (!filter) return FilterStats{0, 0, 0, 0};
+  return FilterStats{filter->lookups.load(std::memory_order_relaxed),
+                     filter->negatives.load(std::memory_order_relaxed),
+                     filter->false_positives.load(std::memory_order_relaxed),
+                     filter->rebuilds};
+}
+
+Trie::iterator::iterator(const Pool* n, Ref rt)
+    : nodes(n), root(rt), ptr(NIL), path(), key() {}
+
+Trie::iterator::iterator(const Pool* n, Ref rt, Ref node, string k)
+    : nodes(n), root(rt), ptr(node), path(), key(move(k)) {}
+
+void Trie::iterator::push(size_t index) {
+  path.back().index = index;
+  const Edge& edge = (*nodes)[path.back().node].children[index];
+  const size_t depth = key.length();
+  key += edge.label;
+  path.push_back(Frame{edge.child, 0, depth});
+}
+
+void Trie::iterator::first_key() {
+  for (;;) {
+    const Node& node = (*nodes)[path.back().node];
+    if (node.is_end()) {
+      ptr = path.back().node;
+      return;
+    }
+    // Only the root of an empty trie has neither a key nor children.
+    if (node.children.empty()) {
+      ptr = NIL;
+      path.clear();
+      key.clear();
+      return;
+    }
+    push(0);
+  }
+}
+
+void Trie::iterator::skip() {
+  while (path.size() > 1) {
+    key.resize(path.back().depth);
+    path.pop_back();
+    const Frame& par = path.back();
+    // Move to the next sibling if there is one.
+    if (par.index + 1 < (*nodes)[par.node].children.size()) {
+      push(par.index + 1);
+      first_key();
+      return;
+    }
+  }
+  ptr = NIL;
+  path.clear();
+  key.clear();
+}
+
+void Trie::iterator::locate() {
+  if (!path.empty()) return;
+  // The key is in the trie, so each step follows the child with its next byte.
+  string target;
+  target.swap(key);
+  path.push_back(Frame{root, 0, 0});
+  while (key.length() < target.length()) {
+    const auto& children = (*nodes)[path.back().node].children;
+    const auto child = search(children, target[key.length()]);
+    push(static_cast<size_t>(child - children.begin()));
+  }
+  assert(path.back().node == ptr);
+}
 
 Trie::iterator& Trie::iterator::operator++() {
+  locate();
   /*
-  If the ptr has children, return the first child.
-  Otherwise, return the next node that isn't a child.
-  Elegantly handles the case when the returned value is nullptr.
+  If the node has children, the next key is the first one under them.
+  Otherwise, it is the first key after the node.
   */
-  ptr = ptr->children.empty() ? next_node(ptr) : first_key(ptr);
+  if ((*nodes)[path.back().node].children.empty()) {
+    skip();
+  } else {
+    push(0);
+    first_key();
+  }
   return *this;
 }
 
@@ -494,15 +1606,18 @@ Trie::iterator Trie::iterator::operator++(int) {
   return temp;
 }
 
-string Trie::iterator::operator*() { return underlying_string(ptr); }
+const string& Trie::iterator::operator*() const { return key; }
 
-Trie::iterator::operator bool() const { return ptr != nullptr; }
+Trie::iterator::operator bool() const { return ptr != NIL; }
 
 Trie::iterator Trie::begin() const {
-  return root->is_end ? iterator(root) : iterator(first_key(root));
+  iterator iter(pool.get(), root);
+  iter.path.push_back(Frame{root, 0, 0});
+  iter.first_key();
+  return iter;
 }
 
-Trie::iterator Trie::end() const { return iterator(nullptr); }
+Trie::iterator Trie::end() const { return iterator(); }
 
 Trie::iterator Trie::begin(string prefix) const {
   // Find the first key that matches the given prefix.
@@ -510,32 +1625,14 @@ Trie::iterator Trie::begin(string prefix) const {
 }
 
 Trie::iterator Trie::end(string prefix) const {
-  // Perform an approximate match.
-  auto app_ptr = approximate_match(root, prefix);
-  assert(app_ptr);
-
-  /*
-  If prefix is empty, app_ptr is a prefix match and
-  none of its children work. If all children of app_ptr
-  are less than prefix, nothing under app_ptr works.
-  */
-  if (prefix.empty() || app_ptr->children.empty() ||
-      app_ptr->children.rbegin()->first < prefix)
-    return iterator(next_node(app_ptr));
-
-  // Find the first child that is greater than prefix
-  for (auto& str_ptr_pair : app_ptr->children) {
-    // If equality, then approximate_match failed.
-    assert(str_ptr_pair.first != prefix);
-    if (str_ptr_pair.first.front() > prefix.front()) {
-      return str_ptr_pair.second->is_end
-                 ? iterator(str_ptr_pair.second)
-                 : iterator(first_key(str_ptr_pair.second));
-    }
-  }
-
-  // If we've gotten down to here, something has gone wrong.
-  throw runtime_error("Unexpected bug in Trie::end(std::string)");
+  iterator iter(pool.get(), root);
+  string prf = prefix;
+  // Without keys with the prefix, the first key after them is the first
+  // one not less than it.
+  if (prefix_match(prf, &iter.path) == NIL) return lower_bound(prefix);
+  iter.key = path_string(iter.path, prefix);
+  iter.skip();
+  return iter;
 }
 
 Trie& Trie::operator+=(const Trie& rhs) {
@@ -561,14 +1658,14 @@ Trie& Trie::operator-=(const Trie& rhs) {
 Trie operator-(Trie lhs, const Trie& rhs) { return lhs -= rhs; }
 
 bool operator==(const Trie& lhs, const Trie& rhs) {
-  return Trie::are_equal(lhs.root, rhs.root);
+  return Trie::are_equal(*lhs.pool, lhs.root, *rhs.pool, rhs.root);
 }
 
 bool operator!=(const Trie& lhs, const Trie& rhs) { return !(lhs == rhs); }
 
 bool operator<(const Trie& lhs, const Trie& rhs) {
   if (lhs.size() >= rhs.size()) return false;
-  return includes(rhs.begin(), rhs.end(), lhs.begin(), lhs.end());
+  return std::includes(rhs.begin(), rhs.end(), lhs.begin(), lhs.end());
 }
 
 bool operator>(const Trie& lhs, const Trie& rhs) { return rhs < lhs; }
@@ -577,6 +1674,26 @@ bool operator<=(const Trie& lhs, const Trie& rhs) { return !(rhs < lhs); }
 
 bool operator>=(const Trie& lhs, const Trie& rhs) { return !(lhs < rhs); }
 
+ostream& operator<<(ostream& os, const Trie::FilterStats& stats) {
+  // Every lookup the filter passed was either a hit or a false positive.
+  const size_t misses = stats.negatives + stats.false_positives;
+  os << "Filter lookups: " << stats.lookups << ", rejected: " << stats.negatives
+     << ", passed: " << stats.lookups - stats.negatives << '\n';
+  os << "False positives: " << stats.false_positives << " ("
+     << (misses == 0 ? 0.0
+                     : static_cast<double>(stats.false_positives) /
+                           static_cast<double>(misses))
+     << " of misses), rebuilds: " << stats.rebuilds << '\n';
+  return os;
+}
+
+ostream& operator<<(ostream& os, const Trie::MemoryUsage& usage) {
+  os << "Nodes: " << usage.nodes << ", children: " << usage.children
+     << ", labels: " << usage.labels << ", overhead: " << usage.overhead
+     << ", total: " << usage.total << '\n';
+  return os;
+}
+
 ostream& operator<<(std::ostream& os, const Trie& tree) {
   for (const auto& str : tree) {
     os << str << '\n';
@@ -585,11 +1702,10 @@ ostream& operator<<(std::ostream& os, const Trie& tree) {
 }
 
 bool operator==(const Trie::iterator& lhs, const Trie::iterator& rhs) {
-  // Performs element by element.
-  return lhs.ptr == rhs.ptr;
+  // Indices are only comparable within one pool.
+  return lhs.ptr == rhs.ptr && (!lhs || lhs.nodes == rhs.nodes);
 }
 
 bool operator!=(const Trie::iterator& lhs, const Trie::iterator& rhs) {
-  // Performs element by element.
-  return lhs.ptr != rhs.ptr;
+  return !(lhs == rhs);
 }
@@ -1,446 +1,1235 @@
-/*
-Copyright 2020. Siwei Wang.
-
-Interface for Trie.
-*/
-#pragma once
-#include <cassert>
-#include <exception>
-#include <initializer_list>
-#include <iostream>
-#include <iterator>
-#include <map>
-#include <memory>
-#include <string>
-
-/**
- * @brief A compact prefix tree with keys as std::basic_string. The empty string
- * is always contained in the trie.
- *
- * Radix tree invariants.
- * 1. Given a node N, children of N do not share any common non-empty prefixes.
- *     Otherwise, the common prefix would have been compressed.
- * 2. As a corollary of (1), for any non-empty prefix P and node N, at most 1
- *     child node of N has P as a prefix.
- * 3. The empty string is never in a children map. Suppose N contains the empty
- *     string in its children map. This would be equivalent to N being is_end.
- * 4. All leaf nodes have true is_end. If a leaf node N was not the end of a
- * key, must have non-empty children map, which it can't have because it's a
- * leaf.
- * 5. If node N has false is_end, it must have at least 2 children node.
- *     Otherwise, it would be compressed with its only child.
- * 6. As another corollary of (1), a children map can have at most |char| items.
- *     Therefore, we can treat searching std::map as constant.
- * 7. approximate_match, prefix_match, and exact_match can be composed due
- *     to the recursive structure of the trie.
- * 8. root is never null. The empty trie consists of a root node with false
- * is_end, an empty children map, and nullptr as parent.
- */
-class Trie {
- private:
-  /**
-   * @brief Defines a singular node in the Trie data structure.
-   */
-  struct Node {
-    bool is_end;
-    std::weak_ptr<Node> parent;
-    std::map<std::string, std::shared_ptr<Node>> children;
-    /**
-     * @brief Construct a new node with no children.
-     * @param is_end_in The is_end value.
-     * @param parent_in The parent pointer.
-     */
-    Node(bool is_end_in, std::shared_ptr<Node> const parent_in);
-  };
-
-  std::shared_ptr<Node> root;
-
-  /* --- HELPER FUNCTIONS --- */
-
-  /**
-   * @brief Recursively copies other into rt.
-   */
-  static void recursive_copy(std::shared_ptr<Node> const rt,
-                             const std::shared_ptr<Node> other);
-
-  /**
-   * @brief Check for prefixes of words.
-   * @param prf The string to match with the beginning of word.
-   * @param word The full prefix to test.
-   * @return whether or not prf is a prefix of word.
-   */
-  static bool is_prefix(const std::string& prf, const std::string& word);
-
-  /**
-   * @brief Depth traversing search for the deepest node N such that a prefix of
-   * key matches the string representation at N.
-   * @param rt The non-null node at which to start searching.
-   * @param key The key on which to make an approximate match. Modifies key
-   * such that the string representation at N is removed.
-   * @return The node N described above. Since the root node is equivalent to
-   * the empty string, N is never null.
-   */
-  static std::shared_ptr<Node> approximate_match(const std::shared_ptr<Node> rt,
-                                                 std::string& key);
-
-  /**
-   * @brief Depth traversing search for the node that serves as a root for prf.
-   * @param rt The non-null node at which to start searching.
-   * @param prf The prefix which the return node should be a root of. Modifies
-   * so that the string at prefix_match is removed from prf. Note that if prf is
-   * not a prefix, the modified prf reflects as far as it got.
-   * @return The deepest node N such that N and all of N's children have prf as
-   * prefix. If prf is not a prefix, returns a nullptr.
-   */
-  static std::shared_ptr<Node> prefix_match(const std::shared_ptr<Node> rt,
-                                            std::string& prf);
-
-  /**
-   * @brief Depth traversing search for the node that matches word.
-   * @param rt The non-null root node from which to search.
-   * @param word The string we are trying to match.
-   * @return The first node that exactly matches the given word. If no match is
-   * found, returns a nullptr.
-   */
-  static std::shared_ptr<Node> exact_match(const std::shared_ptr<Node> rt,
-                                           std::string word);
-
-  /**
-   * @brief Counts the number of keys stored at or as children of rt added to
-   * acc. Equivalent to counting the number of true is_end's accessible from rt.
-   * @param rt The non-null root node at which to start counting.
-   * @param acc The value at which to start counting.
-   */
-  static void key_counter(const std::shared_ptr<Node> rt, size_t& acc);
-
-  /**
-   * @brief Deep equality check.
-   * @param rt_1: The non-null root of the first trie.
-   * @param rt_2: The non-null root of the second trie.
-   * @return Whether or not the tries rooted at rt_1 and rt_2 are equivalent.
-   */
-  static bool are_equal(const std::shared_ptr<Node> rt_1,
-                        const std::shared_ptr<Node> rt_2);
-
-  /**
-   * @brief Searches for the the given value in a map.
-   * @param m The map on which to search.
-   * @param val The value we are searching for in the map.
-   * @return An iterator to the position which matches val. This is the end
-   * iterator if val is not in the map.
-   */
-  template <typename K, typename V>
-  static typename std::map<K, std::shared_ptr<V>>::const_iterator value_find(
-      const std::map<K, std::shared_ptr<V>>& m, const std::shared_ptr<V> val);
-
-  /**
-   * @brief Find the first child key.
-   * @param rt The non-null root node at which to start.
-   * @return The first key that's a child of rt or nullptr if empty.
-   */
-  static std::shared_ptr<Node> first_key(std::shared_ptr<Node> rt);
-
-  /**
-   * @brief Get the next need for in-order traversal.
-   * @param ptr The non-null starting node position.
-   * @return The first key AFTER ptr that is not a child of ptr. If there isn't
-   * such a key, returns nullptr.
-   */
-  static std::shared_ptr<Node> next_node(const std::shared_ptr<Node> ptr);
-
-  /**
-   * @brief Reconstruct string from node.
-   * @param ptr The node for which we are trying to construct a string.
-   * @return The string representation at ptr.
-   */
-  static std::string underlying_string(std::shared_ptr<Node> ptr);
-
-  /**
-   * @brief This function is only used for testing!
-   * @param root The root of the tree to check.
-   * @return Whether or not the tree at root is valid (satisfies invariants).
-   */
-  static bool check_invariant(const std::shared_ptr<Node> root);
-
- public:
-  /**
-   * Used to mark a parameter as passing in a prefix and not a full key.
-   */
-  static constexpr bool PREFIX_FLAG = true;
-
-  /**
-   * @brief Default constructor initializes empty trie.
-   */
-  Trie();
-
-  /**
-   * @brief Initializer list constructor inserts strings in key_list into trie.
-   * Duplicates are ignored.
-   * @param key_list The items to initialize the trie with.
-   */
-  explicit Trie(const std::initializer_list<std::string>& key_list);
-
-  /**
-   * @brief Range constructor inserts strings contained in [first, last) into
-   * trie. Duplicates are ignored.
-   * @param first The starting iterator of the range.
-   * @param last The ending iterator (one past end) of the range.
-   */
-  template <typename InputIterator>
-  Trie(InputIterator first, InputIterator last);
-
-  /* --- DYNAMIC MEMORY: RULE OF 5 */
-
-  /**
-   * @brief Copy constructor.
-   * @param other The trie to copy into this.
-   */
-  Trie(const Trie& other);
-
-  /**
-   * @brief Move constructor.
-   * @param other The trie to move into this.
-   */
-  Trie(Trie&& other);
-
-  /**
-   * @brief Assignment operator.
-   * @param other The trie to assign to this.
-   */
-  Trie& operator=(Trie other);
-
-  /* --- CONTAINER SIZE --- */
-
-  /**
-   * @brief Check if the trie is empty.
-   * @param prefix The prefix on which to check for emptiness.
-   * @return Whether or not the trie is empty starting at given prefix.
-   * Prefix defaults to empty string, corresponding to entire trie.
-   */
-  bool empty(std::string prefix = "") const;
-
-  /**
-   * @brief Get the size of the trie under the prefix.
-   * @param prefix The prefix on which to check for size.
-   * @return The number of words stored in the trie with given prefix.
-   * Default prefix is empty, which means the full trie size is returned.
-   */
-  size_t size(std::string prefix = "") const;
-
-  /* --- ITERATION --- */
-
-  /**
-   * @brief Supports const forward iteration over the trie.
-   */
-  class iterator
-      : public std::iterator<std::forward_iterator_tag,  // iterator category
-                             std::string,                // value_type
-                             std::ptrdiff_t,             // difference_type
-                             const std::string*,         // pointer
-                             const std::string&          // reference
-                             > {
-    friend class Trie;
-
-   private:
-    std::shared_ptr<Node> ptr;
-
-    /**
-     * @brief Constructor, Node ptr is null by default.
-     * @param t The trie reference to assign to tree.
-     * @param p The Node that the iterator is currently pointing at.
-     */
-    explicit iterator(const std::shared_ptr<Node> p = nullptr);
-
-   public:
-    /**
-     * @brief Prefix increment.
-     * @return The next iterator.
-     */
-    iterator& operator++();
-
-    /**
-     * @brief Postfix increment.
-     * @return The current iterator.
-     */
-    iterator operator++(int);
-
-    /**
-     * @brief Dereference operator.
-     * @return The string referred to by this.
-     */
-    std::string operator*();
-
-    /**
-     * @brief Implicit conversion to bool.
-     * @return Whether or not the underlying pointer is null.
-     */
-    operator bool() const;
-
-    /* Comparison between iterators performs element-wise comparison. */
-
-    /**
-     * @brief Check if two iterators are equal.
-     * @param lhs The left iterator.
-     * @param rhs The right iterator.
-     * @return Equality between lhs and rhs.
-     */
-    friend bool operator==(const Trie::iterator& lhs,
-                           const Trie::iterator& rhs);
-
-    /**
-     * @brief Check if two iterators are unequal.
-     * @param lhs The left iterator.
-     * @param rhs The right iterator.
-     * @return Inequality between lhs and rhs.
-     */
-    friend bool operator!=(const Trie::iterator& lhs,
-                           const Trie::iterator& rhs);
-  };
-
-  /**
-   * @brief Standard begin iterator getter.
-   * @return Iterator to the beginning of the trie.
-   */
-  iterator begin() const;
-
-  /**
-   * @brief Standard end iterator getter.
-   * @return Iterator to one past the end of the trie.
-   */
-  iterator end() const;
-
-  /*
-  Prefix traversal by iterator. Returns begin and end iterators to the range of
-  items which has prefix given by the parameter. Note that they constitute an
-  alphabetically ordered range like regular traversal by iterator.
-  If none of the keys have the given prefix, returns a null iterator.
-  begin("") and end("") have the same behavior as begin() and end()
-  since every key has empty string as prefix.
-  */
-
-  /**
-   * @brief Prefix ranged begin iterator.
-   * @param prefix The prefix to obtain a begin iterator for.
-   * @return Iterator to the start of the range with given prefix.
-   */
-  iterator begin(std::string prefix) const;
-
-  /**
-   * @brief Prefix ranged end iterator.
-   * @param prefix The prefix to obtain an end iterator fpr.
-   * @return Iterator to one past the end of the range with given prefix.
-   */
-  iterator end(std::string prefix) const;
-
-  /* --- SEARCHING --- */
-
-  /**
-   * @brief Searches for key in trie.
-   * @param key The key used to search the trie.
-   * @param is_prefix Flags whether or not to treat the key as a prefix.
-   * @return An iterator to it if it exists. Otherwise, returns a null iterator.
-   * If is_prefix is true, returns an iterator to the first key that matches the
-   * prefix.
-   */
-  iterator find(std::string key, bool is_prefix = !PREFIX_FLAG) const;
-
-  /* --- INSERTION --- */
-
-  /**
-   * @brief Inserts key (or key pointed to by iterator) into trie. Idempotent if
-   * key already in trie.
-   * @param key The key to insert into the trie.
-   * @return An iterator to the key (whether inserted or not).
-   */
-  iterator insert(std::string key);
-
-  /* --- DELETION --- */
-
-  /**
-   * @brief Erases key from trie. If prefix flag is set, erases all keys that
-   * have the key as prefix from the trie. Idempotent if key (or prefix) is not
-   * in trie.
-   * @param key The key to erase from the trie.
-   * @param is_prefix Flag for treating key as a prefix.
-   */
-  void erase(std::string key, bool is_prefix = !PREFIX_FLAG);
-
-  /**
-   * @brief Erases all keys from trie. Idempotent on empty tries.
-   */
-  void clear();
-
-  /* --- ASYMMETRIC BINARY OPERATIONS --- */
-
-  /*
-  A + B inserts all of B's keys into A.
-  A - B erases all of B's keys from A.
-  */
-
-  /**
-   * @brief Inserts all of rhs's keys into this. Requires that this and rhs are
-   * not the same trie.
-   * @param rhs The trie to union with this.
-   */
-  Trie& operator+=(const Trie& rhs);
-
-  /**
-   * @brief Removes all of rhs's keys from this. Requires that this and rhs are
-   * not the same trie.
-   * @param rhs The trie to set subtract from this.
-   */
-  Trie& operator-=(const Trie& rhs);
-
-  // Private access for == operator to allow efficient deep equality check. See
-  // COMPARISON OF TRIES.
-  friend bool operator==(const Trie& lhs, const Trie& rhs);
-};
-
-/* --- SYMMETRIC BINARY OPERATIONS --- */
-
-/*
-COMPARISON OF TRIES.
-We say that A == B if A and B have equivalent keys.
-Define A < B as a proper subset relation.
-Note: operator== is a friend to take advantage of
-the more efficient Trie::are_equal function.
-*/
-
-bool operator<(const Trie& lhs, const Trie& rhs);
-bool operator!=(const Trie& lhs, const Trie& rhs);
-bool operator>(const Trie& lhs, const Trie& rhs);
-bool operator<=(const Trie& lhs, const Trie& rhs);
-bool operator>=(const Trie& lhs, const Trie& rhs);
-
-// Arithmetic operators, uses += and -=.
-
-Trie operator+(Trie lhs, const Trie& rhs);
-Trie operator-(Trie lhs, const Trie& rhs);
-
-/**
- * @brief Outputs each entry in tree to os. Each entry is given its own line.
- *
- * @param os The output stream.
- * @param tree The tree to write.
- * @return std::ostream& os
- */
-std::ostream& operator<<(std::ostream& os, const Trie& tree);
-
-// TEMPLATED IMPLEMENTATIONS
-
-template <typename InputIterator>
-Trie::Trie(InputIterator first, InputIterator last) : Trie() {
-  for (InputIterator iter = first; iter != last; ++iter) {
-    insert(*iter);
-  }
-  assert(check_invariant(root));
-}
-
-template <typename K, typename V>
-typename std::map<K, std::shared_ptr<V>>::const_iterator Trie::value_find(
-    const std::map<K, std::shared_ptr<V>>& m, const std::shared_ptr<V> val) {
-  for (auto it = m.begin(); it != m.end(); ++it) {
-    if (it->second == val) return it;
-  }
-  return m.end();
-}
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for Trie.
+*/
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <initializer_list>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bloom_filter.h"
+#include "hash_index.h"
+
+/**
+ * @brief A compact prefix tree with keys as std::basic_string. The empty string
+ * is always contained in the trie.
+ *
+ * Radix tree invariants.
+ * 1. Given a node N, children of N do not share any common non-empty prefixes.
+ *     Otherwise, the common prefix would have been compressed.
+ * 2. As a corollary of (1), for any non-empty prefix P and node N, at most 1
+ *     child node of N has P as a prefix.
+ * 3. The empty string is never in a children map. Suppose N contains the empty
+ *     string in its children map. This would be equivalent to N being is_end.
+ * 4. All leaf nodes have true is_end. If a leaf node N was not the end of a
+ * key, must have non-empty children map, which it can't have because it's a
+ * leaf.
+ * 5. If node N has false is_end, it must have at least 2 children node.
+ *     Otherwise, it would be compressed with its only child.
+ * 6. As another corollary of (1), a children map can have at most |char| items.
+ *     Therefore, we can treat searching the children as constant.
+ * 7. approximate_match, prefix_match, and exact_match can be composed due
+ *     to the recursive structure of the trie.
+ * 8. root is never null. The empty trie consists of a root node with false
+ * is_end and no children.
+ *
+ * Nodes live in a pool and refer to each other by 32 bit indices. They hold
+ * no parent references: iterators and updates carry the path they descended
+ * instead, so a node only changes when its own edges or key do. The tries
+ * returned by extract_prefix and split_at share the pool of the trie they came
+ * from, so that subtrees move between them without copying, and must be used
+ * by one thread at a time like a single trie until copied.
+ *
+ * Nodes, child vectors, and labels are allocated from a memory resource,
+ * which defaults to std::pmr::get_default_resource(). A resource such as a
+ * std::pmr::monotonic_buffer_resource over a stack buffer serves a short lived
+ * trie without touching the global heap. The resource must outlive the trie
+ * and every trie sharing its pool. Like std::pmr containers, copies take the
+ * default resource unless one is given, and assignment and merge_disjoint
+ * copy the nodes of a trie from another resource.
+ */
+class Trie {
+ private:
+  /**
+   * @brief The index of a node in its pool.
+   */
+  using Ref = uint32_t;
+  static constexpr Ref NIL = std::numeric_limits<Ref>::max();
+  // Checkpoint offsets never reach the top bit, so it holds is_end.
+  static constexpr uint64_t END_TAG = uint64_t{1} << 63;
+
+  /**
+   * @brief The edge from a node to one of its children. The label takes the
+   * resource of the vector it is constructed in.
+   */
+  struct Edge {
+    using allocator_type = std::pmr::polymorphic_allocator<char>;
+
+    std::pmr::string label;
+    Ref child;
+
+    Edge(std::string_view label_in, Ref child_in,
+         const allocator_type& alloc = {})
+        : label(label_in, alloc), child(child_in) {}
+    Edge(const Edge& other, const allocator_type& alloc)
+        : label(other.label, alloc), child(other.child) {}
+    Edge(Edge&& other, const allocator_type& alloc)
+        : label(std::move(other.label), alloc), child(other.child) {}
+    Edge(const Edge&) = default;
+    Edge(Edge&&) = default;
+    Edge& operator=(const Edge&) = default;
+    Edge& operator=(Edge&&) = default;
+  };
+
+  /**
+   * @brief Defines a singular node in the Trie data structure.
+   */
+  struct Node {
+    // Offset of the record of the node in the checkpoint file, or 0 if the
+    // node changed since it was saved, tagged with END_TAG if the node is the
+    // end of a key. Ancestors of changed nodes are changed. Free nodes hold
+    // the next free node instead.
+    uint64_t tagged;
+    // Sorted by the first byte of each label, which by invariant 1 orders
+    // them like std::string.
+    std::pmr::vector<Edge> children;
+
+    /**
+     * @brief Construct a free node with no children.
+     * @param mem The resource of the children and their labels.
+     */
+    explicit Node(std::pmr::memory_resource* mem);
+
+    bool is_end() const { return (tagged & END_TAG) != 0; }
+
+    void set_end(bool end) {
+      tagged = end ? tagged | END_TAG : tagged & ~END_TAG;
+    }
+
+    uint64_t saved() const { return tagged & ~END_TAG; }
+
+    void set_saved(uint64_t offset) { tagged = (tagged & END_TAG) | offset; }
+  };
+
+  /**
+   * @brief A node on a path from the root, the index of the edge that the
+   * path follows from it, and the length of the string before the label of the
+   * edge into it.
+   */
+  struct Frame {
+    Ref node;
+    size_t index;
+    size_t depth;
+  };
+
+  /**
+   * @brief Passes allocations on to another resource, counting the bytes in
+   * use, and refuses those past a limit while it is enforced.
+   */
+  class Budget : public std::pmr::memory_resource {
+   public:
+    std::pmr::memory_resource* upstream;
+    size_t in_use;
+    // 0 for no limit.
+    size_t limit;
+    bool enforced;
+
+    /**
+     * @brief Constructor, with no bytes in use and no limit.
+     * @param upstream_in The resource to allocate from.
+     */
+    explicit Budget(std::pmr::memory_resource* upstream_in);
+
+   private:
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+    bool do_is_equal(
+        const std::pmr::memory_resource& other) const noexcept override;
+  };
+
+  /**
+   * @brief Storage for nodes, named by their indices. Chunks double in size
+   * up to 2^CHUNK_BITS nodes and never move, so references to nodes stay
+   * valid as the pool grows. Freed nodes are chained through their tagged
+   * words and reused first. Chunks, and the edges and labels of their nodes,
+   * are allocated through the budget of the pool.
+   */
+  class Pool {
+   private:
+    static constexpr uint32_t FIRST_BITS = 4;
+    static constexpr uint32_t CHUNK_BITS = 16;
+    Budget resource;
+    std::pmr::vector<Node*> chunks;
+    // The number of nodes handed out, the number that fit in chunks, and the
+    // number handed out and not freed.
+    Ref next;
+    size_t capacity;
+    size_t num_live;
+    // The most recently freed node, or NIL.
+    Ref free_list;
+
+    /**
+     * @brief Add a chunk of nodes.
+     */
+    void grow();
+
+    /**
+     * @brief Get the number of nodes in a chunk.
+     * @param i The index of the chunk.
+     * @return The number of nodes in chunks[i].
+     */
+    static size_t chunk_size(size_t i) {
+      return size_t{1} << std::min<size_t>(FIRST_BITS + i, CHUNK_BITS);
+    }
+
+   public:
+    /**
+     * @brief Constructor, an empty pool.
+     * @param mem The resource to allocate from.
+     */
+    explicit Pool(std::pmr::memory_resource* mem);
+
+    Pool(const Pool&) = delete;
+    Pool& operator=(const Pool&) = delete;
+
+    /**
+     * @brief Destructor, returns every chunk to the resource.
+     */
+    ~Pool();
+
+    /**
+     * @brief Get the resource that nodes, edges, and labels come from.
+     * @return The resource of the pool.
+     */
+    std::pmr::memory_resource* memory() const { return resource.upstream; }
+
+    /**
+     * @brief Get the budget that every allocation of the pool goes through.
+     * @return The budget of the pool.
+     */
+    Budget& budget() { return resource; }
+    const Budget& budget() const { return resource; }
+
+    /**
+     * @brief Get the number of nodes in use.
+     * @return The number of nodes handed out and not freed.
+     */
+    size_t live() const { return num_live; }
+
+    /**
+     * @brief Add chunks until a number of nodes can be handed out without
+     * allocating.
+     * @param num_nodes The number of nodes.
+     */
+    void reserve(size_t num_nodes);
+
+    /**
+     * @brief Hand out a free node. Throws std::length_error once NIL nodes
+     * are in use.
+     * @param is_end The is_end value of the node.
+     * @return The index of the node, which has no children.
+     */
+    Ref allocate(bool is_end);
+
+    /**
+     * @brief Free a node, dropping its edges but not its children.
+     * @param r The index of the node.
+     */
+    void release(Ref r);
+
+    /**
+     * @brief Get a node.
+     * @param r The index of a node handed out by allocate.
+     * @return The node.
+     */
+    Node& operator[](Ref r) const {
+      // The first chunk starts at 2^FIRST_BITS, and each chunk at a power of
+      // two until they stop growing. The sum is taken in 64 bits, since it
+      // passes 2^32 for the last indices.
+      const uint64_t pos = uint64_t{r} + (uint64_t{1} << FIRST_BITS);
+      if (pos >> CHUNK_BITS) {
+        return chunks[(pos >> CHUNK_BITS) + CHUNK_BITS - FIRST_BITS - 1]
+                     [pos & ((uint64_t{1} << CHUNK_BITS) - 1)];
+      }
+      const auto log = static_cast<uint32_t>(63 - __builtin_clzll(pos));
+      return chunks[log - FIRST_BITS][pos - (uint64_t{1} << log)];
+    }
+  };
+
+  /**
+   * @brief An optional Bloom filter over the keys, and over their prefixes of
+   * prefix_length, that rejects most misses before any node is visited. It is
+   * updated on insert, and rebuilt by the update that degrades it, so const
+   * lookups only read it.
+   */
+  struct Filter {
+    size_t bits_per_key;
+    size_t prefix_length;
+    // Number of keys the filters were sized for.
+    size_t capacity;
+    // Number of inserts and erases since the last rebuild.
+    size_t num_inserted;
+    size_t num_erased;
+    BloomFilter keys;
+    BloomFilter prefixes;
+    // Counters for filter_stats. Concurrent const lookups bump them, so they
+    // are atomic, and relaxed since nothing is ordered by them.
+    std::atomic<size_t> lookups;
+    std::atomic<size_t> negatives;
+    std::atomic<size_t> false_positives;
+    size_t rebuilds;
+
+    /**
+     * @brief Constructor, empty filters with zero counters.
+     * @param bits_per_key_in The number of filter bits per key.
+     * @param prefix_length_in The length of the prefixes to filter, or 0.
+     */
+    Filter(size_t bits_per_key_in, size_t prefix_length_in);
+
+    /**
+     * @brief Copy constructor, which copies the counters too.
+     * @param other The filter to copy.
+     */
+    Filter(const Filter& other);
+  };
+
+  // Shared with the tries that extract_prefix and split_at move nodes into.
+  std::shared_ptr<Pool> pool;
+  Ref root;
+  // Const lookups only read the filter and bump its atomic counters.
+  std::unique_ptr<Filter> filter;
+  // Optional side index from every key to its node, for single probe finds.
+  std::unique_ptr<HashIndex<Ref>> index;
+  // Subtrees detached by prefix erases and clear, freed a few nodes at a time
+  // by later updates instead of by the erase itself.
+  std::vector<Ref> garbage;
+  // Whether nodes moved in from another trie may hold offsets into its
+  // checkpoint file, so that the next save_changes must write every node.
+  bool foreign;
+
+  // Frozen representations are built directly from the node structure.
+  friend class Dawg;
+  friend class TrieImage;
+
+  /* --- HELPER FUNCTIONS --- */
+
+  /**
+   * @brief Get a node of this trie.
+   * @param r The index of the node.
+   * @return The node.
+   */
+  Node& at(Ref r) const { return (*pool)[r]; }
+
+  /**
+   * @brief Create an empty pool whose bookkeeping also comes from a resource.
+   * @param mem The resource to allocate from.
+   * @return The pool.
+   */
+  static std::shared_ptr<Pool> make_pool(std::pmr::memory_resource* mem);
+
+  /**
+   * @brief Recursively copies a subtree into a pool.
+   * @param to The pool to copy into.
+   * @param from The pool holding the subtree.
+   * @param other The non-null root of the subtree.
+   * @param keep_saved Whether or not to keep the checkpoint offsets.
+   * @return The root of the copy.
+   */
+  static Ref copy_subtree(Pool& to, const Pool& from, Ref other,
+                          bool keep_saved);
+
+  /**
+   * @brief Check for prefixes of words.
+   * @param prf The string to match with the beginning of word.
+   * @param word The full prefix to test.
+   * @return whether or not prf is a prefix of word.
+   */
+  static bool is_prefix(std::string_view prf, std::string_view word);
+
+  /**
+   * @brief Search the children of a node.
+   * @param children The children of a node.
+   * @param first The first byte of the label to search for.
+   * @return The first child whose label does not start with a byte less than
+   * first, or the end of children if there is none.
+   */
+  static std::pmr::vector<Edge>::iterator search(
+      std::pmr::vector<Edge>& children, char first);
+  static std::pmr::vector<Edge>::const_iterator search(
+      const std::pmr::vector<Edge>& children, char first);
+
+  /**
+   * @brief Depth traversing search for the deepest node N such that a prefix of
+   * key matches the string representation at N.
+   * @param key The key on which to make an approximate match. Modifies key
+   * such that the string representation at N is removed.
+   * @param path If non-null, receives the path from the root to N.
+   * @return The node N described above. Since the root node is equivalent to
+   * the empty string, N is never null.
+   */
+  Ref approximate_match(std::string& key,
+                        std::vector<Frame>* path = nullptr) const;
+
+  /**
+   * @brief Depth traversing search for the node that serves as a root for prf.
+   * @param prf The prefix which the return node should be a root of. Modifies
+   * so that the string at prefix_match is removed from prf. Note that if prf is
+   * not a prefix, the modified prf reflects as far as it got.
+   * @param path If non-null, receives the path from the root to the node.
+   * @return The deepest node N such that N and all of N's children have prf as
+   * prefix. If prf is not a prefix, returns NIL.
+   */
+  Ref prefix_match(std::string& prf, std::vector<Frame>* path = nullptr) const;
+
+  /**
+   * @brief Depth traversing search for the node that matches word.
+   * @param word The string we are trying to match.
+   * @param path If non-null, receives the path from the root to the node.
+   * @return The first node that exactly matches the given word. If no match is
+   * found, returns NIL.
+   */
+  Ref exact_match(std::string word, std::vector<Frame>* path = nullptr) const;
+
+  /**
+   * @brief Counts the number of keys stored at or as children of rt added to
+   * acc. Equivalent to counting the number of true is_end's accessible from rt.
+   * @param rt The non-null root node at which to start counting.
+   * @param acc The value at which to start counting.
+   */
+  void key_counter(Ref rt, size_t& acc) const;
+
+  /**
+   * @brief Deep equality check.
+   * @param pool_1: The pool of the first trie.
+   * @param rt_1: The non-null root of the first trie.
+   * @param pool_2: The pool of the second trie.
+   * @param rt_2: The non-null root of the second trie.
+   * @return Whether or not the tries rooted at rt_1 and rt_2 are equivalent.
+   */
+  static bool are_equal(const Pool& pool_1, Ref rt_1, const Pool& pool_2,
+                        Ref rt_2);
+
+  /**
+   * @brief Reconstruct the string at the end of a path.
+   * @param path The path from the root to a node.
+   * @param key A string with the string at the parent of the node as prefix.
+   * @return The string representation at the node.
+   */
+  std::string path_string(const std::vector<Frame>& path,
+                          const std::string& key) const;
+
+  /**
+   * @brief Adds every key at or under rt to the filter.
+   * @param rt The non-null root node at which to start.
+   * @param key The string representation at rt. Restored before returning.
+   * @param f The filter to add to.
+   */
+  void filter_keys(Ref rt, std::string& key, Filter& f) const;
+
+  /**
+   * @brief Adds every key at or under rt to the index, or erases them.
+   * @param rt The non-null root node at which to start.
+   * @param key The string representation at rt. Restored before returning.
+   * @param add Whether to add the keys or to erase them.
+   */
+  void index_keys(Ref rt, std::string& key, bool add);
+
+  /**
+   * @brief Inserts key into the tree, without updating the index.
+   * @param word The key to insert into the tree.
+   * @return The node of the key.
+   */
+  Ref place(const std::string& word);
+
+  /**
+   * @brief Replaces the tree with one in another pool. The nodes of the old
+   * tree are freed if its pool is shared, and dropped with it otherwise.
+   * @param fresh The pool of the new tree.
+   * @param fresh_root The root of the new tree.
+   */
+  void adopt(std::shared_ptr<Pool> fresh, Ref fresh_root);
+
+  /**
+   * @brief Buffered reader over the stream given to load.
+   */
+  class Reader;
+
+  /**
+   * @brief Appends the pre-order encoding of rt to buf, flushing full buffers
+   * to os.
+   * @param rt The non-null root node at which to start.
+   * @param buf The buffer of bytes not yet written.
+   * @param os The output stream.
+   */
+  void save_node(Ref rt, std::string& buf, std::ostream& os) const;
+
+  /**
+   * @brief Decodes a tree saved in pre-order, keeping the path to the node
+   * being decoded on an explicit stack, so deep chains cannot overflow the
+   * call stack.
+   * @param nodes The pool to decode into.
+   * @param in The reader positioned at the root.
+   * @return The decoded root. Throws std::runtime_error if the bytes do not
+   * encode a valid tree.
+   */
+  static Ref load_tree(Pool& nodes, Reader& in);
+
+  /**
+   * @brief Marks the nodes of a path as changed since the last checkpoint.
+   * @param path The path from the root to the node that changed.
+   */
+  void touch(const std::vector<Frame>& path);
+
+  /**
+   * @brief Joins the last node of a path with its only child if it is not the
+   * end of a key (invariant 5), and frees it. Does nothing to any other node.
+   * @param path The path from the root to the node to check, whose frames
+   * name the edges followed.
+   */
+  void join(const std::vector<Frame>& path);
+
+  /**
+   * @brief Adds the keys at or under sub to the subtree of the last node of a
+   * path, reusing the nodes of sub. Nodes of both that hold the same string are
+   * merged, so the work is proportional to the overlap of the two subtrees.
+   * @param path The path from the root to the node of this trie to add under.
+   * Restored before returning.
+   * @param label The string of sub relative to that node.
+   * @param sub The non-null root of the nodes to add, which are in the pool of
+   * this trie but in no trie.
+   */
+  void graft(std::vector<Frame>& path, std::string label, Ref sub);
+
+  /**
+   * @brief Erases the keys in [lo, hi) at or under the last node of a path.
+   * Subtrees that lie wholly inside the range are detached, so only nodes
+   * whose strings are prefixes of lo or hi are descended into.
+   * @param path The path from the root to the node at which to start.
+   * Restored before returning, but for the edge indices.
+   * @param str The string representation at the node. Restored before
+   * returning.
+   * @param lo The smallest key to erase.
+   * @param hi The bound past the keys to erase.
+   * @return Whether or not any key was erased.
+   */
+  bool erase_between(std::vector<Frame>& path, std::string& str,
+                     const std::string& lo, const std::string& hi);
+
+  /**
+   * @brief Get the number of heap bytes in use, where the allocator reports
+   * it.
+   * @return The bytes in use, or 0 if unknown.
+   */
+  static size_t heap_in_use();
+
+  /**
+   * @brief Appends the records of the changed nodes at or under rt to buf in
+   * post-order, flushing full buffers to os.
+   * @param rt The non-null root node at which to start.
+   * @param buf The buffer of bytes not yet written.
+   * @param os The output stream.
+   * @param offset The file offset of the end of buf, advanced as it grows.
+   * @return The offset of the record of rt.
+   */
+  uint64_t save_changed(Ref rt, std::string& buf, std::ostream& os,
+                        uint64_t& offset);
+
+  /**
+   * @brief Decodes the record at an offset of a checkpoint file, and the
+   * records it refers to, keeping the nodes whose records are still to decode
+   * on an explicit stack.
+   * @param nodes The pool to decode into.
+   * @param data The bytes of the checkpoint file.
+   * @param rt The offset of the record of the root.
+   * @return The decoded root. Throws std::runtime_error if the bytes do not
+   * encode a valid tree, including if a record is reached more than once.
+   */
+  static Ref load_records(Pool& nodes, const std::string& data, uint64_t rt);
+
+  /**
+   * @brief Rebuild the filter from the keys in the trie, sized for growth.
+   * Every update that leaves the filter degraded or missing keys calls this
+   * before returning.
+   */
+  void rebuild_filter();
+
+  /**
+   * @brief Consult the filter before searching the tree.
+   * @param key The key or prefix that is about to be searched for.
+   * @param is_prefix Whether or not key is a prefix.
+   * @param consulted Set to whether or not the filter applied to key, so that
+   * a miss in the tree can be counted as a false positive.
+   * @return True if the filter proves that the search will miss.
+   */
+  bool filter_rejects(const std::string& key, bool is_prefix,
+                      bool& consulted) const;
+
+  /**
+   * @brief This function is only used for testing!
+   * @param rt The root of the tree to check.
+   * @return Whether or not the tree at rt is valid (satisfies invariants).
+   */
+  bool check_invariant(Ref rt) const;
+
+  /**
+   * @brief Constructor, an empty trie whose nodes go in a given pool.
+   * @param pool_in The pool to share.
+   */
+  explicit Trie(std::shared_ptr<Pool> pool_in);
+
+ public:
+  /**
+   * Used to mark a parameter as passing in a prefix and not a full key.
+   */
+  static constexpr bool PREFIX_FLAG = true;
+
+  /**
+   * Smallest number of keys a filter is sized for.
+   */
+  static constexpr size_t MIN_FILTER_CAPACITY = 1024;
+
+  /**
+   * Number of detached nodes that each insert and erase frees.
+   */
+  static constexpr size_t RECLAIM_STEP = 16;
+
+  /**
+   * @brief Default constructor initializes empty trie.
+   */
+  Trie();
+
+  /**
+   * @brief Constructor, an empty trie whose nodes, child vectors, and labels
+   * are allocated from a memory resource.
+   * @param mem The resource, which must outlive the trie.
+   */
+  explicit Trie(std::pmr::memory_resource* mem);
+
+  /**
+   * @brief Initializer list constructor inserts strings in key_list into trie.
+   * Duplicates are ignored.
+   * @param key_list The items to initialize the trie with.
+   */
+  explicit Trie(const std::initializer_list<std::string>& key_list);
+
+  /**
+   * @brief Range constructor inserts strings contained in [first, last) into
+   * trie. Duplicates are ignored.
+   * @param first The starting iterator of the range.
+   * @param last The ending iterator (one past end) of the range.
+   */
+  template <typename InputIterator>
+  Trie(InputIterator first, InputIterator last);
+
+  /* --- DYNAMIC MEMORY: RULE OF 5 */
+
+  /**
+   * @brief Copy constructor, allocates from the default resource.
+   * @param other The trie to copy into this.
+   */
+  Trie(const Trie& other);
+
+  /**
+   * @brief Copy constructor with a memory resource.
+   * @param other The trie to copy into this.
+   * @param mem The resource to allocate the copy from.
+   */
+  Trie(const Trie& other, std::pmr::memory_resource* mem);
+
+  /**
+   * @brief Move constructor, leaves other empty on the same resource.
+   * @param other The trie to move into this.
+   */
+  Trie(Trie&& other);
+
+  /**
+   * @brief Assignment operator. Keeps the resource of this trie, copying the
+   * nodes of other if it allocates from another one.
+   * @param other The trie to assign to this.
+   */
+  Trie& operator=(Trie other);
+
+  /**
+   * @brief Destructor, frees the nodes into a pool shared with another trie.
+   */
+  ~Trie();
+
+  /**
+   * @brief Get the memory resource of the trie.
+   * @return The resource that nodes, child vectors, and labels come from.
+   */
+  std::pmr::memory_resource* resource() const;
+
+  /* --- CONTAINER SIZE --- */
+
+  /**
+   * @brief Check if the trie is empty.
+   * @param prefix The prefix on which to check for emptiness.
+   * @return Whether or not the trie is empty starting at given prefix.
+   * Prefix defaults to empty string, corresponding to entire trie.
+   */
+  bool empty(std::string prefix = "") const;
+
+  /**
+   * @brief Get the size of the trie under the prefix.
+   * @param prefix The prefix on which to check for size.
+   * @return The number of words stored in the trie with given prefix.
+   * Default prefix is empty, which means the full trie size is returned.
+   */
+  size_t size(std::string prefix = "") const;
+
+  /* --- ITERATION --- */
+
+  /**
+   * @brief Supports const forward iteration over the trie.
+   */
+  class iterator {
+    friend class Trie;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    // The pool outlives moves of the trie, so iterators do too.
+    const Pool* nodes;
+    Ref root;
+    // The node of the key, or NIL for the null iterator.
+    Ref ptr;
+    // The path from the root to ptr. Keys found by exact match hold only their
+    // node until the path is needed.
+    std::vector<Frame> path;
+    std::string key;
+
+    /**
+     * @brief Constructor, the null iterator by default.
+     * @param n The pool of the trie.
+     * @param rt The root of the trie.
+     */
+    explicit iterator(const Pool* n = nullptr, Ref rt = NIL);
+
+    /**
+     * @brief Constructor, a key whose path is found when first needed.
+     * @param n The pool of the trie.
+     * @param rt The root of the trie.
+     * @param node The node of the key.
+     * @param k The key.
+     */
+    iterator(const Pool* n, Ref rt, Ref node, std::string k);
+
+    /**
+     * @brief Extend the path to a child of the last node.
+     * @param index The index of the child.
+     */
+    void push(size_t index);
+
+    /**
+     * @brief Extend the path down to the first key at or under the last node,
+     * and move to it.
+     */
+    void first_key();
+
+    /**
+     * @brief Move to the first key after every key under the last node, or to
+     * the null iterator.
+     */
+    void skip();
+
+    /**
+     * @brief Find the path to ptr from the root, if it is not known yet.
+     */
+    void locate();
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The string referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Implicit conversion to bool.
+     * @return Whether or not the iterator refers to a key.
+     */
+    operator bool() const;
+
+    /* Comparison between iterators performs element-wise comparison. */
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const Trie::iterator& lhs,
+                           const Trie::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const Trie::iterator& lhs,
+                           const Trie::iterator& rhs);
+  };
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the beginning of the trie.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the end of the trie.
+   */
+  iterator end() const;
+
+  /*
+  Prefix traversal by iterator. Returns begin and end iterators to the range of
+  items which has prefix given by the parameter. Note that they constitute an
+  alphabetically ordered range like regular traversal by iterator.
+  If none of the keys have the given prefix, returns a null iterator.
+  begin("") and end("") have the same behavior as begin() and end()
+  since every key has empty string as prefix.
+  */
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the start of the range with given prefix.
+   */
+  iterator begin(std::string prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to one past the end of the range with given prefix: the
+   * first key greater than every string with the prefix, whether or not any
+   * key has it, or the end iterator if there is no such key.
+   */
+  iterator end(std::string prefix) const;
+
+  /* --- SEARCHING --- */
+
+  /**
+   * @brief Searches for key in trie.
+   * @param key The key used to search the trie.
+   * @param is_prefix Flags whether or not to treat the key as a prefix.
+   * @return An iterator to it if it exists. Otherwise, returns a null iterator,
+   * also when key is only the string at a node where other keys branch. If
+   * is_prefix is true, returns an iterator to the first key that matches the
+   * prefix.
+   */
+  iterator find(std::string key, bool is_prefix = !PREFIX_FLAG) const;
+
+  /**
+   * @brief Searches for the first key that is not less than key.
+   * @param key The bound to search for, which need not be in the trie.
+   * @return An iterator to the first key not less than key. If every key is
+   * less than key, returns a null iterator.
+   */
+  iterator lower_bound(std::string key) const;
+
+  /* --- INSERTION --- */
+
+  /**
+   * @brief Inserts key (or key pointed to by iterator) into trie. Idempotent if
+   * key already in trie.
+   * @param key The key to insert into the trie.
+   * @return An iterator to the key (whether inserted or not), or the null
+   * iterator if a memory limit is set and the key does not fit under it, in
+   * which case the trie is unchanged.
+   */
+  iterator insert(std::string key);
+
+  /* --- DELETION --- */
+
+  /**
+   * @brief Erases key from trie. If prefix flag is set, erases all keys that
+   * have the key as prefix from the trie. Idempotent if key (or prefix) is not
+   * in trie. A prefix erase detaches the subtree in O(|prefix|) and leaves its
+   * nodes to reclaim, unless the index is enabled and must drop every key.
+   * @param key The key to erase from the trie.
+   * @param is_prefix Flag for treating key as a prefix.
+   */
+  void erase(std::string key, bool is_prefix = !PREFIX_FLAG);
+
+  /**
+   * @brief Erases every key in [lo, hi). Only the paths of lo and hi are
+   * descended into, and the subtrees between them are detached whole and left
+   * to reclaim. Idempotent if no key is in the range, such as if hi <= lo.
+   * @param lo The smallest key to erase, which need not be stored.
+   * @param hi The bound past the keys to erase, which need not be stored.
+   */
+  void erase_range(const std::string& lo, const std::string& hi);
+
+  /**
+   * @brief Erases all keys from trie. Idempotent on empty tries. The nodes are
+   * left to reclaim.
+   */
+  void clear();
+
+  /**
+   * @brief Frees nodes detached by prefix erases and clear. Each insert and
+   * erase frees RECLAIM_STEP of them, so that no single call pays for a large
+   * subtree.
+   * @param max_nodes The most nodes to free.
+   * @return The number of nodes freed.
+   */
+  size_t reclaim(size_t max_nodes = std::numeric_limits<size_t>::max());
+
+  /**
+   * @brief Check for detached nodes that are not freed yet.
+   * @return The number of detached subtrees waiting for reclaim.
+   */
+  size_t pending_reclaim() const;
+
+  /**
+   * @brief Rebuilds the tree into a fresh pool in depth first order, so that
+   * descents and iteration touch nearby memory after long runs of inserts and
+   * erases have scattered the nodes over reused slots. The old pool is freed
+   * afterwards, unless another trie shares it. Checkpoint offsets are kept.
+   * Iterators are invalidated. If memory runs out while rebuilding, the
+   * exception propagates and the trie is unchanged.
+   * @return The number of heap bytes freed, as reported by the allocator, or
+   * 0 where it does not report them.
+   */
+  size_t compact();
+
+  /* --- SPLITTING AND MERGING --- */
+
+  /*
+  These move whole subtrees between tries instead of copying keys, so their
+  cost depends on the length of the prefix or key rather than on the number of
+  keys moved. An enabled filter is rebuilt, in O(n). Keys moved out of a trie
+  with an index are dropped from it one by one, and a trie with an index
+  rebuilds it after a merge. The other trie has neither. A trie that takes
+  nodes from another writes every node on its next save_changes.
+  */
+
+  /**
+   * @brief Moves every key with a prefix into a new trie in O(|prefix|).
+   * @param prefix The prefix of the keys to move.
+   * @return A trie holding exactly the keys with the prefix.
+   */
+  Trie extract_prefix(const std::string& prefix);
+
+  /**
+   * @brief Moves every key of other into this trie, leaving other empty. Only
+   * the nodes where the two tries overlap are visited, so merging back a trie
+   * from extract_prefix or split_at takes O(|prefix|) or O(|key|). Keys in
+   * both tries are kept once.
+   * @param other The trie to take the keys of.
+   */
+  void merge_disjoint(Trie&& other);
+
+  /**
+   * @brief Moves every key not less than key into a new trie, detaching only
+   * the subtrees to the right of the path of key.
+   * @param key The smallest key to move, which need not be stored.
+   * @return A trie holding exactly the keys not less than key.
+   */
+  Trie split_at(const std::string& key);
+
+  /* --- SERIALIZATION --- */
+
+  /*
+  The binary format is a header followed by the nodes in pre-order. Each node
+  is a varint holding its number of children and its is_end bit, followed by
+  each child as a varint label length, the label bytes, and the child node.
+  Loading rebuilds the tree node for node, without searching or splitting.
+  */
+
+  /**
+   * @brief Writes the trie to os in the binary format.
+   * @param os The output stream, which should be opened in binary mode.
+   */
+  void save(std::ostream& os) const;
+
+  /**
+   * @brief Replaces the keys of the trie with those written by save. Throws
+   * std::runtime_error if the input is truncated or malformed, in which case
+   * the trie is unchanged. An enabled filter or index is rebuilt.
+   * @param is The input stream, positioned at the start of the saved trie.
+   */
+  void load(std::istream& is);
+
+  /* --- INCREMENTAL CHECKPOINTS --- */
+
+  /*
+  A checkpoint file is a sequence of node records, each a varint holding the
+  number of children and the is_end bit, followed by each child as a varint
+  label length, the label bytes, and the varint file offset of the record of
+  the child. Children precede their parents. Every node remembers where its
+  record was last saved until it changes, so later checkpoints only append the
+  records of changed nodes and refer to the rest by offset.
+  */
+
+  /**
+   * @brief Appends the records of every node changed since the last
+   * save_changes or load_checkpoint to a checkpoint file.
+   * @param os The output stream, positioned at the end of the file.
+   * @param offset The file offset of the end of the file, which must not be 0.
+   * Advanced past the written records.
+   * @return The offset of the record of the root, which identifies the
+   * checkpoint.
+   */
+  uint64_t save_changes(std::ostream& os, uint64_t& offset);
+
+  /**
+   * @brief Replaces the keys of the trie with those of a checkpoint, so that
+   * the next save_changes can extend the same file. Throws std::runtime_error
+   * if the checkpoint is malformed, in which case the trie is unchanged. A
+   * record that is the child of more than one node is malformed, since the
+   * records of a checkpoint form a tree. An enabled filter or index is
+   * rebuilt.
+   * @param data The bytes of the checkpoint file.
+   * @param root The offset of the record of the root.
+   */
+  void load_checkpoint(const std::string& data, uint64_t root);
+
+  /**
+   * @brief Marks every node as changed, so that the next save_changes writes
+   * the whole trie, such as into a new file.
+   */
+  void forget_checkpoint();
+
+  /* --- NEGATIVE LOOKUP FILTER --- */
+
+  /**
+   * @brief Counters of filter activity since the filter was enabled.
+   */
+  struct FilterStats {
+    // Searches that consulted the filter.
+    size_t lookups;
+    // Searches rejected by the filter without visiting the tree.
+    size_t negatives;
+    // Searches that passed the filter but missed in the tree.
+    size_t false_positives;
+    // Number of times the filter was rebuilt.
+    size_t rebuilds;
+  };
+
+  /**
+   * @brief Put a Bloom filter in front of exact find, and optionally in front
+   * of find, empty, and size with prefixes at least prefix_length long.
+   * Replaces any existing filter.
+   * @param bits_per_key The number of filter bits per key. Must be positive.
+   * @param prefix_length The length of the prefixes to filter, or 0 to only
+   * filter exact searches.
+   */
+  void enable_filter(size_t bits_per_key = 10, size_t prefix_length = 0);
+
+  /**
+   * @brief Remove the filter. Idempotent.
+   */
+  void disable_filter();
+
+  /**
+   * @brief Check for a filter.
+   * @return Whether or not a filter is enabled.
+   */
+  bool has_filter() const;
+
+  /**
+   * @brief Get the filter counters.
+   * @return The counters, all zero if there is no filter.
+   */
+  FilterStats filter_stats() const;
+
+  /* --- EXACT MATCH INDEX --- */
+
+  /**
+   * @brief Maintain a hash index from every key to its node alongside the
+   * tree, so that exact find and size() take a single probe. Prefix searches
+   * and iteration keep using the tree. Idempotent.
+   */
+  void enable_index();
+
+  /**
+   * @brief Remove the index. Idempotent.
+   */
+  void disable_index();
+
+  /**
+   * @brief Check for an index.
+   * @return Whether or not an index is enabled.
+   */
+  bool has_index() const;
+
+  /**
+   * @brief Get the space used by the index.
+   * @return The approximate number of bytes used, or 0 if there is no index.
+   */
+  size_t index_memory_usage() const;
+
+  /* --- MEMORY BUDGET --- */
+
+  /*
+  Every byte that the nodes, child vectors, and labels take from the memory
+  resource is counted, so memory_usage is exact rather than estimated from
+  the heap. Tries from extract_prefix and split_at share the count, and the
+  limit, of the pool they came from. The filter, the index, and the fixed
+  size bookkeeping of the pool are not counted.
+  */
+
+  /**
+   * @brief Bytes allocated for the trie, broken down by what holds them.
+   */
+  struct MemoryUsage {
+    // The node slots of the keys and branches of the trie.
+    size_t nodes;
+    // The edge arrays of their child vectors, including spare capacity.
+    size_t children;
+    // The buffers of labels too long to be stored in their edges.
+    size_t labels;
+    // The rest: free and unused node slots, the chunk table, and the nodes
+    // of other tries sharing the pool.
+    size_t overhead;
+    // Every byte allocated from the resource for the pool.
+    size_t total;
+  };
+
+  /**
+   * @brief Allocates node slots for the keys about to be inserted, so that
+   * inserting them does not grow the pool. Labels up to 15 bytes are stored
+   * inline in their edges, and longer ones are allocated with them, so the
+   * key bytes only count against the limit.
+   * @param expected_keys The number of keys to make room for. Each new key
+   * takes at most two nodes.
+   * @param expected_total_bytes The total length of those keys.
+   * @return False, with nothing allocated, if a limit is set and the slots,
+   * an edge for each, and the key bytes would not fit under it.
+   */
+  bool reserve(size_t expected_keys, size_t expected_total_bytes = 0);
+
+  /**
+   * @brief Get the exact memory usage of the trie, in O(number of nodes).
+   * @return The bytes allocated for the trie, by category.
+   */
+  MemoryUsage memory_usage() const;
+
+  /**
+   * @brief Refuse inserts that would take the total of memory_usage past a
+   * limit. Only insert is refused, so erases and merges may still exceed it,
+   * and copies do not inherit it.
+   * @param bytes The most bytes to allocate, or 0 for no limit.
+   */
+  void set_memory_limit(size_t bytes);
+
+  /**
+   * @brief Get the memory limit.
+   * @return The most bytes to allocate, or 0 if there is no limit.
+   */
+  size_t memory_limit() const;
+
+  /* --- ASYMMETRIC BINARY OPERATIONS --- */
+
+  /*
+  A + B inserts all of B's keys into A.
+  A - B erases all of B's keys from A.
+  */
+
+  /**
+   * @brief Inserts all of rhs's keys into this. Requires that this and rhs are
+   * not the same trie.
+   * @param rhs The trie to union with this.
+   */
+  Trie& operator+=(const Trie& rhs);
+
+  /**
+   * @brief Removes all of rhs's keys from this. Requires that this and rhs are
+   * not the same trie.
+   * @param rhs The trie to set subtract from this.
+   */
+  Trie& operator-=(const Trie& rhs);
+
+  // Private access for == operator to allow efficient deep equality check. See
+  // COMPARISON OF TRIES.
+  friend bool operator==(const Trie& lhs, const Trie& rhs);
+};
+
+/* --- SYMMETRIC BINARY OPERATIONS --- */
+
+/*
+COMPARISON OF TRIES.
+We say that A == B if A and B have equivalent keys.
+Define A < B as a proper subset relation.
+Note: operator== is a friend to take advantage of
+the more efficient Trie::are_equal function.
+*/
+
+bool operator<(const Trie& lhs, const Trie& rhs);
+bool operator!=(const Trie& lhs, const Trie& rhs);
+bool operator>(const Trie& lhs, const Trie& rhs);
+bool operator<=(const Trie& lhs, const Trie& rhs);
+bool operator>=(const Trie& lhs, const Trie& rhs);
+
+// Arithmetic operators, uses += and -=.
+
+Trie operator+(Trie lhs, const Trie& rhs);
+Trie operator-(Trie lhs, const Trie& rhs);
+
+/**
+ * @brief Outputs the hit, miss, and false positive rates of a filter.
+ * @param os The output stream.
+ * @param stats The counters to write.
+ * @return std::ostream& os
+ */
+std::ostream& operator<<(std::ostream& os, const Trie::FilterStats& stats);
+
+/**
+ * @brief Outputs a memory breakdown, with the bytes of each category.
+ * @param os The output stream.
+ * @param usage The breakdown to write.
+ * @return std::ostream& os
+ */
+std::ostream& operator<<(std::ostream& os, const Trie::MemoryUsage& usage);
+
+/**
+ * @brief Outputs each entry in tree to os. Each entry is given its own line.
+ *
+ * @param os The output stream.
+ * @param tree The tree to write.
+ * @return std::ostream& os
+ */
+std::ostream& operator<<(std::ostream& os, const Trie& tree);
+
+// TEMPLATED IMPLEMENTATIONS
+
+template <typename InputIterator>
+Trie::Trie(InputIterator first, InputIterator last) : Trie() {
+  for (InputIterator iter = first; iter != last; ++iter) {
+    insert(*iter);
+  }
+  assert(check_invariant(root));
+}
@@ -0,0 +1,178 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for TrieHandle.
+*/
+#include "trie_handle.h"
+
+#include <algorithm>
+#include <cassert>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+using std::invalid_argument;
+using std::lock_guard;
+using std::memory_order_release;
+using std::mutex;
+using std::runtime_error;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+TrieHandle::TrieHandle(unique_ptr<Trie> tree)
+    : current(nullptr),
+      global_epoch(1),
+      slots(new Slot[MAX_READERS]),
+      retired_lock(),
+      retired_cv(),
+      retired(),
+      num_reclaimed(0),
+      stopping(false),
+      reclaimer(),
+      builder(),
+      build_error() {
+  if (!tree) throw invalid_argument("TrieHandle needs a tree.");
+  current.store(tree.release());
+  reclaimer = std::thread([this]() { reclaim(); });
+}
+
+TrieHandle::~TrieHandle() {
+  if (builder.joinable()) builder.join();
+  {
+    lock_guard<mutex> lock(retired_lock);
+    stopping = true;
+  }
+  retired_cv.notify_one();
+  reclaimer.join();
+  delete current.load();
+}
+
+void TrieHandle::publish(unique_ptr<Trie> tree) {
+  if (!tree) throw invalid_argument("TrieHandle needs a tree.");
+  {
+    lock_guard<mutex> lock(retired_lock);
+    unique_ptr<const Trie> old(current.exchange(tree.release()));
+    // Readers that pin after the epoch moves on load the new tree, so only
+    // those pinned at this epoch or before may hold the old one.
+    const uint64_t epoch = global_epoch.fetch_add(1);
+    retired.push_back(Retired{std::move(old), epoch});
+  }
+  retired_cv.notify_one();
+}
+
+void TrieHandle::rebuild(const string& path) {
+  wait();
+  builder = std::thread([this, path]() {
+    try {
+      std::ifstream fin(path, std::ios::binary);
+      if (!fin) throw runtime_error("Cannot open " + path + ".");
+      auto tree = std::make_unique<Trie>();
+      tree->load(fin);
+      publish(std::move(tree));
+    } catch (...) {
+      build_error = std::current_exception();
+    }
+  });
+}
+
+void TrieHandle::wait() {
+  if (!builder.joinable()) return;
+  builder.join();
+  if (build_error) {
+    auto error = build_error;
+    build_error = nullptr;
+    std::rethrow_exception(error);
+  }
+}
+
+uint64_t TrieHandle::version() const { return global_epoch.load() - 1; }
+
+size_t TrieHandle::pending() const {
+  lock_guard<mutex> lock(retired_lock);
+  return retired.size();
+}
+
+size_t TrieHandle::reclaimed() const {
+  lock_guard<mutex> lock(retired_lock);
+  return num_reclaimed;
+}
+
+uint64_t TrieHandle::oldest_pinned() const {
+  uint64_t oldest = std::numeric_limits<uint64_t>::max();
+  for (size_t i = 0; i < MAX_READERS; ++i) {
+    const uint64_t epoch = slots[i].epoch.load();
+    if (epoch != 0) oldest = std::min(oldest, epoch);
+  }
+  return oldest;
+}
+
+void TrieHandle::reclaim() {
+  unique_lock<mutex> lock(retired_lock);
+  vector<unique_ptr<const Trie>> freeing;
+  while (true) {
+    if (retired.empty()) {
+      if (stopping) return;
+      retired_cv.wait(lock);
+      continue;
+    }
+    // Trees are retired in epoch order, so the safe ones come first.
+    const uint64_t oldest = oldest_pinned();
+    while (!retired.empty() && retired.front().epoch < oldest) {
+      freeing.push_back(std::move(retired.front().tree));
+      retired.pop_front();
+    }
+    if (freeing.empty()) {
+      // Readers unpin without signalling, so check on them periodically.
+      retired_cv.wait_for(lock, RECLAIM_POLL);
+      continue;
+    }
+    const size_t count = freeing.size();
+    lock.unlock();
+    freeing.clear();
+    lock.lock();
+    num_reclaimed += count;
+  }
+}
+
+TrieHandle::Reader::Reader(TrieHandle& handle_in)
+    : handle(&handle_in), slot(nullptr), depth(0) {
+  for (size_t i = 0; i < MAX_READERS && !slot; ++i) {
+    bool expected = false;
+    if (handle->slots[i].claimed.compare_exchange_strong(expected, true))
+      slot = &handle->slots[i];
+  }
+  if (!slot) throw runtime_error("TrieHandle has too many readers.");
+}
+
+TrieHandle::Reader::~Reader() {
+  assert(depth == 0);
+  slot->claimed.store(false, memory_order_release);
+}
+
+TrieHandle::Guard TrieHandle::Reader::pin() {
+  // The epoch is published before the tree is read, so the reclaimer either
+  // sees the pin or the tree read is newer than any it is about to free.
+  if (depth++ == 0) slot->epoch.store(handle->global_epoch.load());
+  return Guard(this, handle->current.load());
+}
+
+TrieHandle::Guard::Guard(Reader* reader_in, const Trie* tree_in)
+    : reader(reader_in), tree(tree_in) {}
+
+TrieHandle::Guard::Guard(Guard&& other) noexcept
+    : reader(other.reader), tree(other.tree) {
+  other.reader = nullptr;
+  other.tree = nullptr;
+}
+
+TrieHandle::Guard::~Guard() {
+  if (reader && --reader->depth == 0)
+    reader->slot->epoch.store(0, memory_order_release);
+}
+
+const Trie& TrieHandle::Guard::operator*() const { return *tree; }
+
+const Trie* TrieHandle::Guard::operator->() const { return tree; }
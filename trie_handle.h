@@ -0,0 +1,221 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for TrieHandle.
+*/
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "trie.h"
+
+/**
+ * @brief Serves one Trie to many reader threads while a rebuilt one replaces
+ * it. publish swaps in the new tree with a single atomic exchange, and rebuild
+ * loads one from a file written by Trie::save on a builder thread and then
+ * publishes it, so queries never wait for a rebuild.
+ *
+ * The replaced tree is retired, and is freed by a reclaimer thread once every
+ * reader that may still use it has finished, so its destruction never runs on
+ * a request path. Readers are tracked with epochs: each thread registers a
+ * Reader, which owns a slot on its own cache line, and pinning only stores the
+ * current epoch into that slot. Pins thus never write to memory shared with
+ * other readers, unlike a shared reference count. Each publish advances the
+ * epoch, and a tree retired at epoch E is freed once no slot is pinned at an
+ * epoch E or older.
+ *
+ * Published trees must not be changed, and must not have a filter (see
+ * Trie::enable_filter), since filtered lookups update it. A Reader is used by
+ * one thread at a time, and every Reader must be destroyed before its handle.
+ */
+class TrieHandle {
+ public:
+  static constexpr size_t MAX_READERS = 64;
+  static constexpr std::chrono::milliseconds RECLAIM_POLL{1};
+
+ private:
+  /**
+   * @brief The epoch of a reader, on its own cache line.
+   */
+  struct alignas(64) Slot {
+    // The epoch the reader pinned at, or 0 if it is not pinned.
+    std::atomic<uint64_t> epoch{0};
+    std::atomic<bool> claimed{false};
+  };
+
+  /**
+   * @brief A replaced tree and the last epoch at which readers may see it.
+   */
+  struct Retired {
+    std::unique_ptr<const Trie> tree;
+    uint64_t epoch;
+  };
+
+  // Owned, and only replaced by publish.
+  std::atomic<const Trie*> current;
+  std::atomic<uint64_t> global_epoch;
+  std::unique_ptr<Slot[]> slots;
+  // Guards retired, num_reclaimed, and stopping, and orders publishes.
+  mutable std::mutex retired_lock;
+  std::condition_variable retired_cv;
+  std::deque<Retired> retired;
+  size_t num_reclaimed;
+  bool stopping;
+  std::thread reclaimer;
+  // The rebuild in progress, if any.
+  std::thread builder;
+  std::exception_ptr build_error;
+
+  /**
+   * @brief Free retired trees once no reader can use them, until stopped.
+   */
+  void reclaim();
+
+  /**
+   * @brief Get the oldest epoch any reader is pinned at.
+   * @return The oldest pinned epoch, or UINT64_MAX if no reader is pinned.
+   */
+  uint64_t oldest_pinned() const;
+
+ public:
+  class Reader;
+
+  /**
+   * @brief Keeps the tree that was current when it was pinned alive until it
+   * is destroyed.
+   */
+  class Guard {
+    friend class Reader;
+
+   private:
+    Reader* reader;
+    const Trie* tree;
+
+    /**
+     * @brief Constructor.
+     * @param reader_in The pinned reader.
+     * @param tree_in The tree it read.
+     */
+    Guard(Reader* reader_in, const Trie* tree_in);
+
+   public:
+    Guard(Guard&& other) noexcept;
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    Guard& operator=(Guard&&) = delete;
+
+    /**
+     * @brief Destructor, unpins the reader unless an outer guard remains.
+     */
+    ~Guard();
+
+    /**
+     * @brief Dereference operator.
+     * @return The pinned tree.
+     */
+    const Trie& operator*() const;
+
+    /**
+     * @brief Member access operator.
+     * @return The pinned tree.
+     */
+    const Trie* operator->() const;
+  };
+
+  /**
+   * @brief The registration of a reader thread with its slot.
+   */
+  class Reader {
+    friend class Guard;
+
+   private:
+    TrieHandle* handle;
+    Slot* slot;
+    // The number of live guards, which only the owning thread changes.
+    size_t depth;
+
+   public:
+    /**
+     * @brief Constructor, claims a free slot. Throws std::runtime_error if
+     * MAX_READERS readers are registered already.
+     * @param handle_in The handle to read from.
+     */
+    explicit Reader(TrieHandle& handle_in);
+
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    /**
+     * @brief Destructor, releases the slot. No guard may outlive it.
+     */
+    ~Reader();
+
+    /**
+     * @brief Pin the current tree. Guards may nest, and an inner guard may
+     * see a newer tree than an outer one.
+     * @return A guard for the current tree.
+     */
+    Guard pin();
+  };
+
+  /**
+   * @brief Constructor, serves tree until another one is published.
+   * @param tree The initial tree. Throws std::invalid_argument if null.
+   */
+  explicit TrieHandle(std::unique_ptr<Trie> tree = std::make_unique<Trie>());
+
+  TrieHandle(const TrieHandle&) = delete;
+  TrieHandle& operator=(const TrieHandle&) = delete;
+
+  /**
+   * @brief Destructor, waits for a rebuild and frees every tree.
+   */
+  ~TrieHandle();
+
+  /**
+   * @brief Make tree current and retire the previous one. Readers pinned
+   * before keep the previous tree until they unpin.
+   * @param tree The new tree. Throws std::invalid_argument if null.
+   */
+  void publish(std::unique_ptr<Trie> tree);
+
+  /**
+   * @brief Load a tree saved by Trie::save on a builder thread, and publish it.
+   * Waits for the previous rebuild first, rethrowing any exception from it.
+   * @param path The path of the saved tree.
+   */
+  void rebuild(const std::string& path);
+
+  /**
+   * @brief Wait for the rebuild in progress, if any. Rethrows any exception
+   * thrown by the rebuild, in which case nothing was published.
+   */
+  void wait();
+
+  /**
+   * @brief Get the number of publishes so far.
+   * @return The current epoch less one.
+   */
+  uint64_t version() const;
+
+  /**
+   * @brief Get the number of retired trees that are not freed yet.
+   * @return The number of trees waiting for readers to unpin.
+   */
+  size_t pending() const;
+
+  /**
+   * @brief Get the number of retired trees freed so far.
+   * @return The number of reclaimed trees.
+   */
+  size_t reclaimed() const;
+};
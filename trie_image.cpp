@@ -0,0 +1,572 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Implementation for TrieImage.
+*/
+#include "trie_image.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+using std::invalid_argument;
+using std::numeric_limits;
+using std::runtime_error;
+using std::string;
+using std::vector;
+
+namespace {
+// The header holds the magic bytes, the version, the offset of the root, the
+// length of the image, and the number of nodes.
+const char IMAGE_MAGIC[8] = "TRIEIMG";
+constexpr size_t VERSION_POS = 8;
+constexpr size_t ROOT_POS = 12;
+constexpr size_t LENGTH_POS = 16;
+constexpr size_t NODES_POS = 24;
+// Offsets within a node record.
+constexpr size_t CHILDREN_POS = 4;
+constexpr size_t END_POS = 6;
+constexpr size_t FIRSTS_POS = 8;
+
+/**
+ * @brief Round up to a multiple of 4.
+ * @param pos The value to round.
+ * @return The smallest multiple of 4 not less than pos.
+ */
+size_t align(size_t pos) { return (pos + 3) & ~size_t{3}; }
+
+/**
+ * @brief Overwrite bytes of a buffer with a native integer.
+ * @param out The buffer to write to.
+ * @param pos The offset to write at.
+ * @param val The value to write.
+ */
+template <typename T>
+void put(std::vector<char>& out, size_t pos, T val) {
+  std::memcpy(out.data() + pos, &val, sizeof(T));
+}
+
+/**
+ * @brief Read a native integer.
+ * @param in The first byte of the buffer to read from.
+ * @param pos The offset to read at.
+ * @return The value read.
+ */
+template <typename T>
+T get(const char* in, size_t pos) {
+  T val;
+  std::memcpy(&val, in + pos, sizeof(T));
+  return val;
+}
+}  // namespace
+
+TrieImage::TrieImage() : owned(), base(nullptr), length(0), mapping(nullptr) {}
+
+TrieImage::TrieImage(const Trie& tree, Layout layout) : TrieImage() {
+  owned.assign(HEADER_SIZE, '\0');
+  vector<Shape> shapes;
+  flatten(tree, tree.root, shapes);
+  vector<size_t> order;
+  order.reserve(shapes.size());
+  if (layout == VAN_EMDE_BOAS) {
+    veb_order(shapes, 0, shapes.front().height, order);
+  } else {
+    order.resize(shapes.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+  }
+  seal(emit(shapes, order), shapes.size());
+}
+
+void TrieImage::seal(uint32_t rt, size_t num_nodes) {
+  std::memcpy(owned.data(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+  put(owned, VERSION_POS, VERSION);
+  put(owned, ROOT_POS, rt);
+  put(owned, LENGTH_POS, static_cast<uint64_t>(owned.size()));
+  put(owned, NODES_POS, static_cast<uint64_t>(num_nodes));
+  owned.shrink_to_fit();
+  base = owned.data();
+  length = owned.size();
+}
+
+TrieImage::Builder::Builder()
+    : out(HEADER_SIZE, '\0'),
+      path{Open{0, false, {}}},
+      last(),
+      num_keys(0),
+      num_nodes(0) {}
+
+void TrieImage::Builder::add(const string& key) {
+  if (num_keys > 0 && key <= last)
+    throw invalid_argument("TrieImage::Builder keys must increase.");
+  const size_t limit = std::min(key.length(), last.length());
+  size_t common = 0;
+  while (common < limit && key[common] == last[common]) ++common;
+  fold(common);
+  // Only the empty key, added first, ends at the root.
+  if (key.length() == common) {
+    path.back().is_end = true;
+  } else {
+    path.push_back(Open{key.length(), true, {}});
+  }
+  last = key;
+  ++num_keys;
+}
+
+void TrieImage::Builder::fold(size_t depth) {
+  while (path.back().depth > depth) {
+    const size_t child_depth = path.back().depth;
+    Child child = close();
+    if (path.back().depth < depth) path.push_back(Open{depth, false, {}});
+    const size_t parent_depth = path.back().depth;
+    child.label = last.substr(parent_depth, child_depth - parent_depth);
+    path.back().children.push_back(std::move(child));
+  }
+}
+
+TrieImage::Builder::Child TrieImage::Builder::close() {
+  const Open node = std::move(path.back());
+  path.pop_back();
+  const size_t n = node.children.size();
+  size_t label_bytes = 0;
+  uint32_t keys = node.is_end;
+  for (const auto& kid : node.children) {
+    label_bytes += kid.label.length();
+    keys += kid.keys;
+  }
+  const size_t pos = out.size();
+  const size_t children = pos + align(FIRSTS_POS + n);
+  const size_t labels = children + 8 * n;
+  if (labels + align(label_bytes) > numeric_limits<uint32_t>::max())
+    throw runtime_error("TrieImage is too large.");
+  out.resize(labels + align(label_bytes), '\0');
+
+  put(out, pos, keys);
+  put(out, pos + CHILDREN_POS, static_cast<uint16_t>(n));
+  out[pos + END_POS] = node.is_end;
+  size_t end = 0;
+  for (size_t k = 0; k < n; ++k) {
+    const auto& str = node.children[k].label;
+    out[pos + FIRSTS_POS + k] = str.front();
+    std::copy(str.begin(), str.end(), out.begin() + labels + end);
+    end += str.length();
+    put(out, children + 4 * k, node.children[k].offset);
+    put(out, children + 4 * (n + k), static_cast<uint32_t>(end));
+  }
+  ++num_nodes;
+  return Child{string(), static_cast<uint32_t>(pos), keys};
+}
+
+TrieImage TrieImage::Builder::finish() {
+  fold(0);
+  const uint32_t rt = close().offset;
+  TrieImage image;
+  image.owned = std::move(out);
+  image.seal(rt, num_nodes);
+  return image;
+}
+
+size_t TrieImage::flatten(const Trie& tree, Trie::Ref rt,
+                          vector<Shape>& out) {
+  const Trie::Node* node = &tree.at(rt);
+  const size_t i = out.size();
+  out.push_back({node, 1, 1, node->is_end()});
+  // Appending may move the shapes, so out[i] is looked up each time.
+  for (const auto& edge : node->children) {
+    const size_t kid = flatten(tree, edge.child, out);
+    out[i].size += out[kid].size;
+    out[i].height = std::max(out[i].height, out[kid].height + 1);
+    out[i].keys += out[kid].keys;
+  }
+  return i;
+}
+
+void TrieImage::veb_order(const vector<Shape>& shapes, size_t rt,
+                          size_t levels, vector<size_t>& order) {
+  levels = std::min(levels, shapes[rt].height);
+  if (levels == 1) {
+    order.push_back(rt);
+    return;
+  }
+  const size_t top = levels / 2;
+  veb_order(shapes, rt, top, order);
+  // Find the roots of the subtrees hanging below the top levels, left to
+  // right. Shallower branches were laid out whole with the top levels.
+  vector<size_t> below;
+  vector<std::pair<size_t, size_t>> pending{{rt, 0}};
+  while (!pending.empty()) {
+    const auto node_depth = pending.back();
+    pending.pop_back();
+    if (node_depth.second == top) {
+      below.push_back(node_depth.first);
+      continue;
+    }
+    const size_t n = shapes[node_depth.first].node->children.size();
+    vector<size_t> kids(n);
+    for (size_t k = 0, kid = node_depth.first + 1; k < n; ++k) {
+      kids[k] = kid;
+      kid += shapes[kid].size;
+    }
+    for (auto kid = kids.rbegin(); kid != kids.rend(); ++kid) {
+      pending.emplace_back(*kid, node_depth.second + 1);
+    }
+  }
+  for (const size_t sub : below) {
+    veb_order(shapes, sub, levels - top, order);
+  }
+}
+
+uint32_t TrieImage::emit(const vector<Shape>& shapes,
+                         const vector<size_t>& order) {
+  // Place every record first, so that each one can refer to its children.
+  vector<uint32_t> offsets(shapes.size());
+  size_t pos = owned.size();
+  for (const size_t i : order) {
+    const Trie::Node* rt = shapes[i].node;
+    const size_t n = rt->children.size();
+    size_t label_bytes = 0;
+    for (const auto& edge : rt->children) {
+      label_bytes += edge.label.length();
+    }
+    offsets[i] = static_cast<uint32_t>(pos);
+    pos += align(FIRSTS_POS + n) + 8 * n + align(label_bytes);
+    if (pos > numeric_limits<uint32_t>::max())
+      throw runtime_error("TrieImage is too large.");
+  }
+  owned.resize(pos, '\0');
+
+  for (const size_t i : order) {
+    const Trie::Node* rt = shapes[i].node;
+    const size_t n = rt->children.size();
+    const size_t node = offsets[i];
+    const size_t children = align(node + FIRSTS_POS + n);
+    const size_t labels = children + 8 * n;
+    put(owned, node, shapes[i].keys);
+    put(owned, node + CHILDREN_POS, static_cast<uint16_t>(n));
+    owned[node + END_POS] = rt->is_end();
+    size_t k = 0, end = 0, kid = i + 1;
+    for (const auto& edge : rt->children) {
+      const auto& str = edge.label;
+      owned[node + FIRSTS_POS + k] = str.front();
+      std::copy(str.begin(), str.end(), owned.begin() + labels + end);
+      end += str.length();
+      put(owned, children + 4 * k, offsets[kid]);
+      put(owned, children + 4 * (n + k), static_cast<uint32_t>(end));
+      kid += shapes[kid].size;
+      ++k;
+    }
+  }
+  return offsets.front();
+}
+
+TrieImage::TrieImage(const char* data, size_t len) : TrieImage() {
+  base = data;
+  length = len;
+  check_header();
+}
+
+TrieImage TrieImage::open(const string& path) {
+  const int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) throw runtime_error("Cannot open " + path + ".");
+  struct stat info;
+  if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+    close(fd);
+    throw runtime_error("Cannot read " + path + ".");
+  }
+  const auto len = static_cast<size_t>(info.st_size);
+  void* addr = mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  if (addr == MAP_FAILED) throw runtime_error("Cannot map " + path + ".");
+
+  TrieImage image;
+  image.mapping = addr;
+  image.base = static_cast<const char*>(addr);
+  image.length = len;
+  // On failure, the destructor of image unmaps the file.
+  image.check_header();
+  return image;
+}
+
+void TrieImage::write(const string& path) const {
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(base, static_cast<std::streamsize>(length));
+  if (!out.flush()) throw runtime_error("Cannot write " + path + ".");
+}
+
+TrieImage::TrieImage(TrieImage&& other) : TrieImage() {
+  *this = std::move(other);
+}
+
+TrieImage& TrieImage::operator=(TrieImage&& other) {
+  if (this == &other) return *this;
+  if (mapping) munmap(mapping, length);
+  // Moving a vector keeps its buffer, so base stays valid for owned images.
+  owned = std::move(other.owned);
+  base = other.base;
+  length = other.length;
+  mapping = other.mapping;
+  other.owned.clear();
+  other.base = nullptr;
+  other.length = 0;
+  other.mapping = nullptr;
+  return *this;
+}
+
+TrieImage::~TrieImage() {
+  if (mapping) munmap(mapping, length);
+}
+
+void TrieImage::check_header() const {
+  if (length < HEADER_SIZE ||
+      std::memcmp(base, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0)
+    throw runtime_error("Not a trie image.");
+  // An image written with the other byte order fails this check too.
+  if (word(VERSION_POS) != VERSION)
+    throw runtime_error("Unsupported trie image version.");
+  // Every node record takes at least FIRSTS_POS bytes, which bounds the
+  // depth of the tree.
+  if (get<uint64_t>(base, LENGTH_POS) != length ||
+      get<uint64_t>(base, NODES_POS) > length / FIRSTS_POS)
+    throw runtime_error("Corrupt trie image.");
+  checked(word(ROOT_POS));
+}
+
+uint32_t TrieImage::checked(uint32_t node) const {
+  if (node % 4 != 0 || node < HEADER_SIZE || node > length - FIRSTS_POS)
+    throw runtime_error("Corrupt trie image.");
+  const size_t n = num_children(node);
+  const size_t ends = align(node + FIRSTS_POS + n) + 4 * n;
+  if (ends + 4 * n > length ||
+      (n != 0 && word(ends + 4 * (n - 1)) > length - ends - 4 * n))
+    throw runtime_error("Corrupt trie image.");
+  return node;
+}
+
+uint32_t TrieImage::word(size_t pos) const {
+  assert(pos + 4 <= length);
+  return get<uint32_t>(base, pos);
+}
+
+uint32_t TrieImage::root() const { return word(ROOT_POS); }
+
+size_t TrieImage::num_nodes() const {
+  return static_cast<size_t>(get<uint64_t>(base, NODES_POS));
+}
+
+size_t TrieImage::num_keys(uint32_t node) const { return word(node); }
+
+size_t TrieImage::num_children(uint32_t node) const {
+  return get<uint16_t>(base, node + CHILDREN_POS);
+}
+
+bool TrieImage::is_end(uint32_t node) const {
+  return base[node + END_POS] != 0;
+}
+
+uint32_t TrieImage::child(uint32_t node, size_t index) const {
+  const size_t n = num_children(node);
+  assert(index < n);
+  return checked(word(align(node + FIRSTS_POS + n) + 4 * index));
+}
+
+const char* TrieImage::label(uint32_t node, size_t index, size_t& len) const {
+  const size_t n = num_children(node);
+  assert(index < n);
+  const size_t ends = align(node + FIRSTS_POS + n) + 4 * n;
+  const size_t first = index == 0 ? 0 : word(ends + 4 * (index - 1));
+  const size_t last = word(ends + 4 * index);
+  // Labels are not empty, which also bounds every descent by the key.
+  if (first >= last || last > length - ends - 4 * n)
+    throw runtime_error("Corrupt trie image.");
+  len = last - first;
+  return base + ends + 4 * n + first;
+}
+
+size_t TrieImage::search(uint32_t node, char first) const {
+  // Labels compare as unsigned bytes, like std::string.
+  const auto* firsts =
+      reinterpret_cast<const unsigned char*>(base + node + FIRSTS_POS);
+  const size_t n = num_children(node);
+  return static_cast<size_t>(
+      std::lower_bound(firsts, firsts + n, static_cast<unsigned char>(first)) -
+      firsts);
+}
+
+uint32_t TrieImage::match(const string& key, bool is_prefix,
+                          iterator* path) const {
+  uint32_t node = root();
+  if (path) path->path.push_back({node, 0});
+  for (size_t depth = 0; depth < key.length();) {
+    const size_t index = search(node, key[depth]);
+    if (index == num_children(node)) return 0;
+    size_t len = 0;
+    const char* str = label(node, index, len);
+    // A prefix may end inside the label. A key must match all of it.
+    const size_t cmp = std::min(len, key.length() - depth);
+    if ((!is_prefix && cmp < len) ||
+        std::memcmp(str, key.data() + depth, cmp) != 0)
+      return 0;
+    if (path) path->push(index);
+    node = child(node, index);
+    depth += len;
+  }
+  return node;
+}
+
+const char* TrieImage::data() const { return base; }
+
+size_t TrieImage::bytes() const { return length; }
+
+bool TrieImage::empty(const string& prefix) const {
+  return size(prefix) == 0;
+}
+
+size_t TrieImage::size(const string& prefix) const {
+  const uint32_t node = match(prefix, Trie::PREFIX_FLAG, nullptr);
+  return node == 0 ? 0 : num_keys(node);
+}
+
+bool TrieImage::contains(const string& key) const {
+  const uint32_t node = match(key, !Trie::PREFIX_FLAG, nullptr);
+  return node != 0 && is_end(node);
+}
+
+TrieImage::iterator TrieImage::find(const string& key) const {
+  iterator iter(this);
+  const uint32_t node = match(key, !Trie::PREFIX_FLAG, &iter);
+  if (node == 0 || !is_end(node)) return end();
+  return iter;
+}
+
+TrieImage::iterator TrieImage::lower_bound(const string& key) const {
+  iterator iter(this);
+  uint32_t node = root();
+  iter.path.push_back({node, 0});
+  for (size_t depth = 0; depth < key.length();) {
+    const size_t index = search(node, key[depth]);
+    // Every key under node is less than key.
+    if (index == num_children(node)) {
+      iter.skip();
+      return iter;
+    }
+    iter.push(index);
+    size_t len = 0;
+    const char* str = label(node, index, len);
+    const size_t cmp = std::min(len, key.length() - depth);
+    const auto diff = std::mismatch(str, str + cmp, key.data() + depth);
+    if (diff.first != str + cmp) {
+      // The label decides whether the whole subtree is below or above key.
+      if (static_cast<unsigned char>(*diff.first) <
+          static_cast<unsigned char>(*diff.second)) {
+        iter.skip();
+      } else {
+        iter.first_key();
+      }
+      return iter;
+    }
+    node = child(node, index);
+    depth += len;
+  }
+  // Every key at or under node is at least key.
+  iter.first_key();
+  return iter;
+}
+
+TrieImage::iterator TrieImage::begin() const { return lower_bound(""); }
+
+TrieImage::iterator TrieImage::end() const { return iterator(this); }
+
+TrieImage::iterator TrieImage::begin(const string& prefix) const {
+  // Keys with the prefix are the first keys not less than it.
+  return lower_bound(prefix);
+}
+
+TrieImage::iterator TrieImage::end(const string& prefix) const {
+  iterator iter(this);
+  if (match(prefix, Trie::PREFIX_FLAG, &iter) == 0) return lower_bound(prefix);
+  iter.skip();
+  return iter;
+}
+
+TrieImage::iterator::iterator(const TrieImage* i) : image(i), path(), key() {}
+
+void TrieImage::iterator::push(size_t index) {
+  const uint32_t node = path.back().node;
+  path.back().index = static_cast<uint32_t>(index);
+  size_t len = 0;
+  const char* str = image->label(node, index, len);
+  key.append(str, len);
+  // Only a cycle of offsets makes a path longer than the tree has nodes.
+  if (path.size() > image->num_nodes())
+    throw runtime_error("Corrupt trie image.");
+  path.push_back({image->child(node, index), 0});
+}
+
+void TrieImage::iterator::first_key() {
+  // Only the root of an empty image has neither a key nor children.
+  while (!image->is_end(path.back().node)) {
+    if (image->num_children(path.back().node) == 0) {
+      path.clear();
+      key.clear();
+      return;
+    }
+    push(0);
+  }
+}
+
+void TrieImage::iterator::skip() {
+  while (path.size() > 1) {
+    path.pop_back();
+    const Frame& par = path.back();
+    size_t len = 0;
+    image->label(par.node, par.index, len);
+    key.resize(key.length() - len);
+    // Move to the next sibling if there is one.
+    if (par.index + 1 < image->num_children(par.node)) {
+      push(par.index + 1);
+      first_key();
+      return;
+    }
+  }
+  path.clear();
+  key.clear();
+}
+
+TrieImage::iterator& TrieImage::iterator::operator++() {
+  if (image->num_children(path.back().node) == 0) {
+    skip();
+  } else {
+    push(0);
+    first_key();
+  }
+  return *this;
+}
+
+TrieImage::iterator TrieImage::iterator::operator++(int) {
+  auto temp(*this);
+  ++(*this);
+  return temp;
+}
+
+const string& TrieImage::iterator::operator*() const { return key; }
+
+bool operator==(const TrieImage::iterator& lhs,
+                const TrieImage::iterator& rhs) {
+  // Every node is visited at most once, so the last nodes tell keys apart.
+  if (lhs.path.empty() || rhs.path.empty())
+    return lhs.path.empty() && rhs.path.empty();
+  return lhs.path.back().node == rhs.path.back().node;
+}
+
+bool operator!=(const TrieImage::iterator& lhs,
+                const TrieImage::iterator& rhs) {
+  return !(lhs == rhs);
+}
@@ -0,0 +1,498 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Interface for TrieImage.
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "trie.h"
+
+/**
+ * @brief A frozen radix tree stored as one position independent block of
+ * bytes, which can be written to a file and memory mapped back to be queried
+ * in place, with no deserialization. Opening an image takes constant time and
+ * processes that map the same file share its pages.
+ *
+ * The image is a header followed by node records. Every reference is a 32 bit
+ * offset from the start of the image, so images are at most 4 GiB. A node is
+ * laid out as follows, padded to a multiple of 4 bytes.
+ *
+ * uint32_t num_keys: the number of keys at or under the node.
+ * uint16_t num_children, uint8_t is_end, and one unused byte.
+ * uint8_t firsts[num_children]: the first byte of each label, in order.
+ * uint32_t children[num_children]: the offset of each child.
+ * uint32_t ends[num_children]: the end of each label within labels.
+ * char labels[]: the labels of every child, back to back.
+ *
+ * Records are in pre-order by default, so a subtree is one contiguous run
+ * and iteration reads the image front to back. For images larger than the
+ * last level cache, VAN_EMDE_BOAS places them in van Emde Boas order instead:
+ * the top half of the levels of the tree is laid out first, recursively, and
+ * then each subtree hanging below it, recursively. A descent then touches
+ * O(log_B n) blocks of B bytes for every B at once, so it needs no tuning to
+ * the cache or page size. Readers only follow offsets, so they handle either
+ * order and nothing in the image records which one was used. A Builder lays
+ * records out in post-order.
+ *
+ * Integers are in native byte order. Opening checks only the header, and
+ * every record is checked to lie inside the image as an offset to it is
+ * followed, so a corrupt image throws std::runtime_error from the query that
+ * reaches the damage instead of reading past its end.
+ */
+class TrieImage {
+ public:
+  static constexpr size_t HEADER_SIZE = 32;
+  static constexpr uint32_t VERSION = 1;
+
+  /**
+   * @brief The order of the node records within an image.
+   */
+  enum Layout { PREORDER, VAN_EMDE_BOAS };
+
+ private:
+  /**
+   * @brief A node of the tree being frozen, in pre-order, so that the first
+   * child of the node at i is at i + 1 and each next sibling follows the
+   * subtree of the previous one.
+   */
+  struct Shape {
+    const Trie::Node* node;
+    // The number of nodes at or under the node.
+    size_t size;
+    // The number of levels at or under the node.
+    size_t height;
+    uint32_t keys;
+  };
+
+  // Bytes of an image built in memory. Empty for mapped or borrowed images.
+  std::vector<char> owned;
+  const char* base;
+  size_t length;
+  // The mapping to release on destruction, or nullptr.
+  void* mapping;
+
+  /**
+   * @brief Constructs an empty image for open and move.
+   */
+  TrieImage();
+
+  /**
+   * @brief Appends the shapes of rt and the nodes under it in pre-order.
+   * @param tree The trie that rt belongs to.
+   * @param rt The root node at which to start.
+   * @param out The shapes to append to.
+   * @return The index of the shape of rt.
+   */
+  static size_t flatten(const Trie& tree, Trie::Ref rt,
+                        std::vector<Shape>& out);
+
+  /**
+   * @brief Appends the nodes of the top levels of a subtree in van Emde Boas
+   * order, in O(n log height) for n nodes.
+   * @param shapes The shapes of the tree.
+   * @param rt The index of the root of the subtree.
+   * @param levels The number of levels of the subtree to lay out.
+   * @param order The indices to append to.
+   */
+  static void veb_order(const std::vector<Shape>& shapes, size_t rt,
+                        size_t levels, std::vector<size_t>& order);
+
+  /**
+   * @brief Appends the record of every node after the header.
+   * @param shapes The shapes of the tree.
+   * @param order The indices of the nodes in the order of their records.
+   * @return The offset of the record of the root.
+   */
+  uint32_t emit(const std::vector<Shape>& shapes,
+                const std::vector<size_t>& order);
+
+  /**
+   * @brief Write the header in front of the records in owned, and take owned
+   * as the image.
+   * @param rt The offset of the record of the root.
+   * @param num_nodes The number of records.
+   */
+  void seal(uint32_t rt, size_t num_nodes);
+
+  /**
+   * @brief Check the header against the bytes at base. Throws
+   * std::runtime_error if they do not start a valid image of length bytes.
+   */
+  void check_header() const;
+
+  /**
+   * @brief Check that a node record, with its arrays and labels, lies inside
+   * the image. Throws std::runtime_error if it does not.
+   * @param node The offset of a node, as read from the image.
+   * @return node.
+   */
+  uint32_t checked(uint32_t node) const;
+
+  /**
+   * @brief Read a native 32 bit integer.
+   * @param pos The offset of the integer.
+   * @return The integer at pos.
+   */
+  uint32_t word(size_t pos) const;
+
+  /**
+   * @brief Get the offset of the root record.
+   * @return The offset of the root.
+   */
+  uint32_t root() const;
+
+  /**
+   * @brief Get the number of node records.
+   * @return The number of nodes in the header.
+   */
+  size_t num_nodes() const;
+
+  /**
+   * @brief Get the number of keys at or under a node.
+   * @param node The offset of a node.
+   * @return The number of keys.
+   */
+  size_t num_keys(uint32_t node) const;
+
+  /**
+   * @brief Get the number of children of a node.
+   * @param node The offset of a node.
+   * @return The number of children.
+   */
+  size_t num_children(uint32_t node) const;
+
+  /**
+   * @brief Check whether a node stores a key.
+   * @param node The offset of a node.
+   * @return The is_end flag of the node.
+   */
+  bool is_end(uint32_t node) const;
+
+  /**
+   * @brief Get a child of a node.
+   * @param node The offset of a node.
+   * @param index The index of the child, less than num_children(node).
+   * @return The offset of the child.
+   */
+  uint32_t child(uint32_t node, size_t index) const;
+
+  /**
+   * @brief Get the label of a child of a node.
+   * @param node The offset of a node.
+   * @param index The index of the child, less than num_children(node).
+   * @param len Set to the length of the label.
+   * @return A pointer to the first byte of the label.
+   */
+  const char* label(uint32_t node, size_t index, size_t& len) const;
+
+  /**
+   * @brief Search the children of a node.
+   * @param node The offset of a node.
+   * @param first The first byte of the label to search for.
+   * @return The index of the first child whose label does not start with a
+   * byte less than first, or num_children(node) if there is none.
+   */
+  size_t search(uint32_t node, char first) const;
+
+ public:
+  /**
+   * @brief Supports const forward iteration in alphabetical order. Holds the
+   * path from the root, so no parent offsets are stored in the image.
+   */
+  class iterator {
+    friend class TrieImage;
+
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string*;
+    using reference = const std::string&;
+
+   private:
+    /**
+     * @brief A node on the path, and the child of it that the path follows.
+     */
+    struct Frame {
+      uint32_t node;
+      uint32_t index;
+    };
+
+    const TrieImage* image;
+    // Empty for the end iterator.
+    std::vector<Frame> path;
+    std::string key;
+
+    /**
+     * @brief Constructor, the end iterator.
+     * @param i The image being iterated over.
+     */
+    explicit iterator(const TrieImage* i);
+
+    /**
+     * @brief Extend the path to a child of the last node.
+     * @param index The index of the child.
+     */
+    void push(size_t index);
+
+    /**
+     * @brief Extend the path down to the first key at or under the last node.
+     */
+    void first_key();
+
+    /**
+     * @brief Move to the first key after every key under the last node, or to
+     * the end.
+     */
+    void skip();
+
+   public:
+    /**
+     * @brief Prefix increment.
+     * @return The next iterator.
+     */
+    iterator& operator++();
+
+    /**
+     * @brief Postfix increment.
+     * @return The current iterator.
+     */
+    iterator operator++(int);
+
+    /**
+     * @brief Dereference operator.
+     * @return The key referred to by this.
+     */
+    const std::string& operator*() const;
+
+    /**
+     * @brief Check if two iterators are equal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Equality between lhs and rhs.
+     */
+    friend bool operator==(const TrieImage::iterator& lhs,
+                           const TrieImage::iterator& rhs);
+
+    /**
+     * @brief Check if two iterators are unequal.
+     * @param lhs The left iterator.
+     * @param rhs The right iterator.
+     * @return Inequality between lhs and rhs.
+     */
+    friend bool operator!=(const TrieImage::iterator& lhs,
+                           const TrieImage::iterator& rhs);
+  };
+
+ private:
+  /**
+   * @brief Descend from the root along key.
+   * @param key The key or prefix to match.
+   * @param is_prefix Whether key may end inside a label.
+   * @param path If non-null, receives the path to the matched node.
+   * @return The offset of the node matching key, or 0 if there is none.
+   */
+  uint32_t match(const std::string& key, bool is_prefix,
+                 iterator* path) const;
+
+ public:
+  /**
+   * @brief Builds an image from keys in increasing order, in time linear in
+   * their total length and without building a Trie first. Records are laid
+   * out in post-order, so every subtree is still contiguous.
+   */
+  class Builder {
+   private:
+    /**
+     * @brief A finished child of an open node.
+     */
+    struct Child {
+      std::string label;
+      uint32_t offset;
+      uint32_t keys;
+    };
+
+    /**
+     * @brief A node on the path to the last key, whose subtree may still grow.
+     */
+    struct Open {
+      // The length of the string that the node represents.
+      size_t depth;
+      bool is_end;
+      std::vector<Child> children;
+    };
+
+    // The header and the records of every closed node.
+    std::vector<char> out;
+    // Open nodes from the root down.
+    std::vector<Open> path;
+    std::string last;
+    size_t num_keys;
+    size_t num_nodes;
+
+    /**
+     * @brief Append the record of the deepest open node and close it.
+     * @return The node as a child, with an empty label.
+     */
+    Child close();
+
+    /**
+     * @brief Close every open node deeper than depth and attach each to its
+     * parent, opening a node at depth if no open node is there.
+     * @param depth The depth that the deepest open node is left at.
+     */
+    void fold(size_t depth);
+
+   public:
+    /**
+     * @brief Constructor, an empty image.
+     */
+    Builder();
+
+    /**
+     * @brief Add a key. Throws std::invalid_argument unless key is greater
+     * than every key added before.
+     * @param key The key to add.
+     */
+    void add(const std::string& key);
+
+    /**
+     * @brief Finish the image. The builder may not be used afterwards.
+     * Throws std::runtime_error if the image would exceed 4 GiB.
+     * @return The image of every key added.
+     */
+    TrieImage finish();
+  };
+
+  /**
+   * @brief Build an image in memory from a trie, in linear time for PREORDER
+   * and O(n log height) for VAN_EMDE_BOAS. Throws std::runtime_error if the
+   * image would exceed 4 GiB.
+   * @param tree The trie to freeze. It is not modified.
+   * @param layout The order of the node records.
+   */
+  explicit TrieImage(const Trie& tree, Layout layout = PREORDER);
+
+  /**
+   * @brief Borrow an image from memory owned by the caller, such as a shared
+   * memory segment. Throws std::runtime_error if the header is invalid.
+   * @param data The first byte of the image, which must outlive this.
+   * @param len The number of bytes available at data.
+   */
+  TrieImage(const char* data, size_t len);
+
+  /**
+   * @brief Memory map an image file read only. Throws std::runtime_error if
+   * the file cannot be mapped or does not hold an image.
+   * @param path The path of a file written by write.
+   * @return The mapped image.
+   */
+  static TrieImage open(const std::string& path);
+
+  /**
+   * @brief Write the image to a file. Throws std::runtime_error on failure.
+   * @param path The path of the file to create or replace.
+   */
+  void write(const std::string& path) const;
+
+  TrieImage(const TrieImage&) = delete;
+  TrieImage& operator=(const TrieImage&) = delete;
+
+  /**
+   * @brief Move constructor.
+   * @param other The image to move into this.
+   */
+  TrieImage(TrieImage&& other);
+
+  /**
+   * @brief Move assignment operator.
+   * @param other The image to move into this.
+   * @return This image.
+   */
+  TrieImage& operator=(TrieImage&& other);
+
+  /**
+   * @brief Destructor, unmaps a mapped image.
+   */
+  ~TrieImage();
+
+  /**
+   * @brief Get the bytes of the image.
+   * @return A pointer to the first byte of the image.
+   */
+  const char* data() const;
+
+  /**
+   * @brief Get the length of the image.
+   * @return The number of bytes in the image.
+   */
+  size_t bytes() const;
+
+  /**
+   * @brief Check for keys with a prefix.
+   * @param prefix The prefix to check.
+   * @return Whether or not no key has the given prefix.
+   */
+  bool empty(const std::string& prefix = "") const;
+
+  /**
+   * @brief Count keys with a prefix in O(|prefix|).
+   * @param prefix The prefix to count.
+   * @return The number of keys with the given prefix.
+   */
+  size_t size(const std::string& prefix = "") const;
+
+  /**
+   * @brief Check for a key without building an iterator.
+   * @param key The key to search for.
+   * @return Whether or not key is stored.
+   */
+  bool contains(const std::string& key) const;
+
+  /**
+   * @brief Searches for key.
+   * @param key The key to search for.
+   * @return An iterator to key if it exists. Otherwise, end().
+   */
+  iterator find(const std::string& key) const;
+
+  /**
+   * @brief Standard begin iterator getter.
+   * @return Iterator to the smallest key.
+   */
+  iterator begin() const;
+
+  /**
+   * @brief Standard end iterator getter.
+   * @return Iterator to one past the largest key.
+   */
+  iterator end() const;
+
+  /**
+   * @brief Find the first key that is not less than key.
+   * @param key The bound to search for, which need not be stored.
+   * @return An iterator to the first key not less than key, or end().
+   */
+  iterator lower_bound(const std::string& key) const;
+
+  /**
+   * @brief Prefix ranged begin iterator.
+   * @param prefix The prefix to obtain a begin iterator for.
+   * @return Iterator to the first key with the given prefix, or end(prefix) if
+   * there is none, so the range is always valid.
+   */
+  iterator begin(const std::string& prefix) const;
+
+  /**
+   * @brief Prefix ranged end iterator.
+   * @param prefix The prefix to obtain an end iterator for.
+   * @return Iterator to the first key after every key with the given prefix.
+   */
+  iterator end(const std::string& prefix) const;
+};
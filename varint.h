@@ -0,0 +1,36 @@
+/*
+Copyright 2020. Siwei Wang.
+
+Variable length integer encoding shared by the compact representations.
+*/
+#pragma once
+#include <cstddef>
+#include <string>
+
+/**
+ * @brief Append a variable length (LEB128) integer.
+ * @param out The string to append to.
+ * @param val The value to append.
+ */
+inline void put_varint(std::string& out, size_t val) {
+  while (val >= 0x80) {
+    out.push_back(static_cast<char>((val & 0x7F) | 0x80));
+    val >>= 7;
+  }
+  out.push_back(static_cast<char>(val));
+}
+
+/**
+ * @brief Read a variable length (LEB128) integer.
+ * @param in The bytes to read from.
+ * @param pos The offset to read at, advanced past the integer.
+ * @return The value read.
+ */
+inline size_t get_varint(const char* in, size_t& pos) {
+  size_t val = 0;
+  for (int shift = 0;; shift += 7) {
+    const auto byte = static_cast<unsigned char>(in[pos++]);
+    val |= static_cast<size_t>(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) return val;
+  }
+}